@@ -73,12 +73,40 @@ if [ "$OS_NAME" == "GNU/Linux" ] || \
     -pg $CommonLinkerFlags
     clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines $CommonLinkerFlags -o linux/test_zhc_renderer_x64 $srcDir/zhc_renderer_test.cpp \
     -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/test_linux_net_api_x64 $srcDir/linux_net_api_test.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/test_zhc_compress_x64 $srcDir/zhc_compress_test.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/test_linux_uring_api_x64 $srcDir/linux_uring_api_test.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/test_sim_net_api_x64 $srcDir/sim_net_api_test.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/test_linux_net_capture_x64 $srcDir/linux_net_capture_test.cpp \
+    -pg $CommonLinkerFlags
 
     echo "Testing:"
     ./linux/test_sdl2_api_x64
     ./linux/test_zhc_net_x64
     ./linux/test_zhc_asset_x64
     ./linux/test_zhc_renderer_x64
+    ./linux/test_linux_net_api_x64
+    ./linux/test_zhc_compress_x64
+    ./linux/test_linux_uring_api_x64
+    ./linux/test_sim_net_api_x64
+    ./linux/test_linux_net_capture_x64
+
+    # NOTE(dgl): benchmarks are not run automatically. Run ./build/linux/bench_zhc_net_x64
+    # ./build/linux/bench_linux_net_api_x64, ./build/linux/bench_zhc_net_load_x64 and
+    # ./build/linux/bench_zhc_net_replay_x64 <capture> (record one with server_main_x64 --capture <file>)
+    echo "Building benchmarks"
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/bench_zhc_net_x64 $srcDir/zhc_net_bench.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/bench_linux_net_api_x64 $srcDir/linux_net_api_bench.cpp \
+    -pg $CommonLinkerFlags
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/bench_zhc_net_load_x64 $srcDir/zhc_net_load.cpp \
+    -pg $CommonLinkerFlags -lpthread
+    clang++ $CommonIncludeFlags $CommonCompilerFlags $CommonDefines -o linux/bench_zhc_net_replay_x64 $srcDir/zhc_net_replay.cpp \
+    -pg $CommonLinkerFlags
 
     # PIC = Position Independent Code
     # -lm -> we have to link the math library...
@@ -23,10 +23,22 @@
 // not in Microsoft Visual C++.
 #include <dirent.h> /* opendir, readdir */
 #include <errno.h>
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <netinet/in.h>
+#ifndef __ANDROID__
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#endif
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "sdl2_api.cpp"
+#include "linux_net_api.cpp"
 
 global bool32 global_running;
+global SDL_mutex *global_log_mutex;
 
 internal int64
 get_time_in_ms()
@@ -38,9 +50,18 @@ get_time_in_ms()
     return(result);
 }
 
+// NOTE(dgl): the net layer logs from its own thread
+internal void
+log_lock(bool32 lock)
+{
+    if(lock) { SDL_LockMutex(global_log_mutex); }
+    else { SDL_UnlockMutex(global_log_mutex); }
+}
+
 int main(int argc, char *argv[])
 {
-    dgl_log_init(get_time_in_ms);
+    global_log_mutex = SDL_CreateMutex();
+    dgl_log_init_threadsafe(get_time_in_ms, global_log_mutex ? log_lock : 0);
 
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
         SDL_Log("Unable to initialize SDL: %s", SDL_GetError());
@@ -66,7 +87,7 @@ int main(int argc, char *argv[])
     void *base_address = 0;
 #endif
 
-    usize permanent_memory_size = megabytes(48);
+    usize permanent_memory_size = megabytes(64);
     usize transient_memory_size = megabytes(16);
 
     usize total_size = permanent_memory_size + transient_memory_size;
@@ -97,10 +118,34 @@ int main(int argc, char *argv[])
         memory.api.file_size = sdl_file_size;
         memory.api.get_data_base_path = sdl_internal_storage_path;
         memory.api.get_user_data_base_path = sdl_external_storage_path;
+        memory.api.get_time_in_ms = sdl_get_time_in_ms;
+#if __ANDROID__
+        // NOTE(dgl): sendmmsg and recvmmsg are only available since android api 21 (APP_PLATFORM is
+        // android-16). The SDL_net functions send and receive one datagram per call, the net layer
+        // falls back to them without the batch functions. We cannot poll the SDL_net socket,
+        // so the net context is updated once per frame (no wait_for_data).
         memory.api.open_socket = sdl_net_open_socket;
         memory.api.close_socket = sdl_net_close_socket;
         memory.api.send_data = sdl_net_send_data;
         memory.api.receive_data = sdl_net_receive_data;
+#else
+        // NOTE(dgl): the native sockets move the datagrams in batches (see linux_net_api_bench.cpp).
+        // The SDL_net functions (sdl_net_open_socket...) send and receive one datagram per call.
+        memory.api.open_socket = linux_open_socket;
+        memory.api.close_socket = linux_close_socket;
+        memory.api.send_data = linux_send_data;
+        memory.api.receive_data = linux_receive_data;
+        memory.api.send_data_batch = linux_send_data_batch;
+        memory.api.receive_data_batch = linux_receive_data_batch;
+        memory.api.receive_multicast_data_batch = linux_receive_data_batch;
+        memory.api.send_multicast_data_batch = linux_send_data_batch;
+        memory.api.wait_for_data = linux_wait_for_data;
+#endif
+        memory.api.open_multicast_socket = linux_open_multicast_socket;
+        memory.api.close_multicast_socket = linux_close_socket;
+        memory.api.receive_multicast_data = linux_receive_data;
+        memory.api.send_multicast_data = linux_send_data;
+        memory.api.start_thread = sdl_start_thread;
 
         Zhc_Offscreen_Buffer back_buffer = {};
         Zhc_Input input = {};
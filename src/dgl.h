@@ -226,6 +226,35 @@ dgl_atomic_compare_exchange_uintptr(uintptr volatile *value, uintptr new_val, ui
     uintptr result = __sync_val_compare_and_swap(value, expected, new_val);
     return(result);
 }
+// NOTE(dgl): loads see all writes before the matching store (acquire/release)
+DGL_DEF inline usize
+dgl_atomic_load_usize(usize volatile *value)
+{
+    usize result = __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    return(result);
+}
+DGL_DEF inline void
+dgl_atomic_store_usize(usize volatile *value, usize new_val)
+{
+    __atomic_store_n(value, new_val, __ATOMIC_RELEASE);
+}
+// NOTE(dgl): no load or store is moved across the fence (e.g. for sequence locks)
+DGL_DEF inline void
+dgl_atomic_fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+// NOTE(dgl): hint for the cpu in spin loops. The other hyperthread of the core can run
+// and the loop does not flood the memory bus.
+DGL_DEF inline void
+dgl_atomic_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
 
 // TODO(dgl): not tested
 #elif COMPILER_MSVC
@@ -248,6 +277,30 @@ dgl_atomic_compare_exchange_uintptr(uintptr volatile *value, uintptr new_val, ui
     uintptr result = _InterlockedCompareExchange(value, new_val, expected);
     return(result);
 }
+DGL_DEF inline usize
+dgl_atomic_load_usize(usize volatile *value)
+{
+    usize result = *value;
+    _ReadWriteBarrier();
+    return(result);
+}
+DGL_DEF inline void
+dgl_atomic_store_usize(usize volatile *value, usize new_val)
+{
+    _ReadWriteBarrier();
+    *value = new_val;
+}
+DGL_DEF inline void
+dgl_atomic_fence()
+{
+    _ReadWriteBarrier();
+    _mm_mfence();
+}
+DGL_DEF inline void
+dgl_atomic_pause()
+{
+    _mm_pause();
+}
 #else
 // TODO(dgl): support other compilers
 #endif
@@ -353,7 +406,7 @@ DGL_DEF void dgl_mem_pool_init_align(DGL_Mem_Pool *arena, uint8 *base, DGL_Mem_I
 DGL_DEF void dgl_mem_pool_free_all(DGL_Mem_Pool *arena);
 #define dgl_mem_pool_push(arena, type) (type *)dgl__mem_pool_alloc_internal(arena)
 DGL_DEF void * dgl__mem_pool_alloc_internal(DGL_Mem_Pool *arena);
-#define dgl_mem_pool_release(arena, ptr) dgl__mem_pool_free_internal(arena)
+#define dgl_mem_pool_release(arena, ptr) dgl__mem_pool_free_internal(arena, ptr)
 DGL_DEF void dgl__mem_pool_free_internal(DGL_Mem_Pool *arena, void *ptr);
 #define dgl_mem_pool_push_threadsafe(arena, type) (type *)dgl__mem_pool_alloc_threadsafe_internal(arena)
 DGL_DEF void * dgl__mem_pool_alloc_threadsafe_internal(DGL_Mem_Pool *arena);
@@ -633,6 +686,7 @@ DGL_DEF void
 dgl_mem_pool_free_all(DGL_Mem_Pool *arena)
 {
     DGL_Mem_Index chunk_count = arena->size / arena->chunk_size;
+    arena->head = 0;
 
     for(DGL_Mem_Index index = 0; index < chunk_count; ++index)
     {
@@ -674,13 +728,13 @@ dgl__mem_pool_alloc_internal(DGL_Mem_Pool *arena)
 
     if(node) {
         result = node;
-        arena->head->next = arena->head->next;
+        arena->head = node->next;
         dgl_memset(result, 0, arena->chunk_size);
     }
     else
     {
         // TODO(dgl): logging
-        dgl_assert(!node, "No free node in memory pool");
+        dgl_assert(node, "No free node in memory pool");
     }
 
     return(result);
@@ -0,0 +1,429 @@
+// NOTE(dgl): Native socket implementations for linux (and android) of the platform api.
+// SDL_net does not expose the socket options we need (e.g. multicast groups).
+// DO NOT INCLUDE THIS FILE INTO THE PLATFORM INDEPENDENT CODE!
+
+internal int32
+linux_socket_fd(Zhc_Net_Socket *socket)
+{
+    int32 result = cast(int32)cast(intptr_t)socket->handle.platform;
+    return(result);
+}
+
+internal sockaddr_in
+linux_sockaddr(Zhc_Net_Address *address)
+{
+    sockaddr_in result = {};
+    result.sin_family = AF_INET;
+    // NOTE(dgl): the host is already stored in network byte order (same as SDL_net)
+    result.sin_addr.s_addr = address->host;
+    result.sin_port = htons(address->port);
+
+    return(result);
+}
+
+// NOTE(dgl): sendmmsg and recvmmsg are only available since android api 21. The android client
+// uses the single datagram functions (see client_main.cpp).
+#ifndef __ANDROID__
+// NOTE(dgl): UDP generic segmentation offload sends consecutive datagrams of the same size to the
+// same address as one message. The kernel splits the message into the datagrams. If the kernel
+// or the interface does not support it, the first send fails and we stop using it.
+#define LINUX_BATCH_SIZE 64
+#define LINUX_MAX_SEGMENT_COUNT 64
+#define LINUX_MAX_UDP_PAYLOAD 65507
+
+global bool32 linux_segmentation_disabled;
+
+struct Linux_Send_Batch
+{
+    int32 count;
+    mmsghdr messages[LINUX_BATCH_SIZE];
+    sockaddr_in targets[LINUX_BATCH_SIZE];
+    iovec vectors[LINUX_BATCH_SIZE];
+    union
+    {
+        usize align; /* NOTE(dgl): alignment of cmsghdr */
+        uint8 data[CMSG_SPACE(sizeof(uint16))];
+    } controls[LINUX_BATCH_SIZE];
+};
+#endif
+
+// NOTE(dgl): If join is set, the socket is bound to the group port and joins the group on the
+// interface in socket->address (0 = default interface). Otherwise the socket is bound to a random
+// port and only used to send to the group. Multicast loop is enabled, so peers on the same host
+// (and the loopback interface) receive the datagrams as well.
+ZHC_OPEN_MULTICAST_SOCKET(linux_open_multicast_socket)
+{
+    int32 fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd >= 0)
+    {
+        bool32 success = true;
+
+        int32 reuse = 1;
+        success &= (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0);
+
+        uint8 loop = 1;
+        uint8 ttl = 1;
+        success &= (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == 0);
+        success &= (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == 0);
+
+        in_addr interface_address = {};
+        interface_address.s_addr = socket->address.host;
+        if(interface_address.s_addr)
+        {
+            success &= (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) == 0);
+        }
+
+        sockaddr_in bind_address = {};
+        bind_address.sin_family = AF_INET;
+        bind_address.sin_addr.s_addr = htonl(INADDR_ANY);
+        bind_address.sin_port = join ? htons(group->port) : 0;
+        success &= (bind(fd, cast(sockaddr *)&bind_address, sizeof(bind_address)) == 0);
+
+        if(join)
+        {
+            ip_mreq request = {};
+            request.imr_multiaddr.s_addr = group->host;
+            request.imr_interface = interface_address;
+            success &= (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == 0);
+        }
+
+        success &= (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0);
+
+        if(success)
+        {
+            socket->handle.platform = cast(void *)cast(intptr_t)fd;
+            socket->handle.no_error = true;
+        }
+        else
+        {
+            LOG("Failed opening multicast socket for %u.%u.%u.%u:%u: %s", group->ip[0], group->ip[1], group->ip[2], group->ip[3], group->port, strerror(errno));
+            close(fd);
+        }
+    }
+    else
+    {
+        LOG("Failed creating socket: %s", strerror(errno));
+    }
+}
+
+// NOTE(dgl): native unicast socket. It is bound to the port of the socket address (0 binds a random
+// port, which is written back into the socket address). Broadcasts are allowed for the server discovery.
+ZHC_OPEN_SOCKET(linux_open_socket)
+{
+    int32 fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd >= 0)
+    {
+        bool32 success = true;
+
+        int32 broadcast = 1;
+        success &= (setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) == 0);
+
+        // NOTE(dgl): a window of slices arrives as a burst. The default buffer drops a part of it
+        // before we drain the socket in the next frame.
+        int32 buffer_size = megabytes(1);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+        if(socket->reuse_port_count > 0)
+        {
+            int32 reuse_port = 1;
+            success &= (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) == 0);
+        }
+
+        sockaddr_in bind_address = {};
+        bind_address.sin_family = AF_INET;
+        bind_address.sin_addr.s_addr = htonl(INADDR_ANY);
+        bind_address.sin_port = htons(socket->address.port);
+        success &= (bind(fd, cast(sockaddr *)&bind_address, sizeof(bind_address)) == 0);
+
+        // NOTE(dgl): Without a program the kernel picks the socket by a hash of the addresses, which we
+        // cannot compute. The program selects the socket by the source port of the UDP header, which
+        // is in front of the payload (assuming an ip header without options). Only the server uses
+        // several sockets, the android client does not need it.
+#ifndef __ANDROID__
+        if(success && socket->reuse_port_count > 0)
+        {
+            sock_filter code[] =
+            {
+                {BPF_LD | BPF_H | BPF_ABS, 0, 0, cast(uint32)(SKF_NET_OFF + 20)},
+                {BPF_ALU | BPF_MOD | BPF_K, 0, 0, cast(uint32)socket->reuse_port_count},
+                {BPF_RET | BPF_A, 0, 0, 0},
+            };
+            sock_fprog program = {};
+            program.len = array_count(code);
+            program.filter = code;
+            if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0)
+            {
+                LOG("Failed to select the socket by the peer port: %s. The peers may reach the wrong socket", strerror(errno));
+            }
+        }
+#endif
+
+        socklen_t bound_size = sizeof(bind_address);
+        success &= (getsockname(fd, cast(sockaddr *)&bind_address, &bound_size) == 0);
+
+        success &= (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0);
+
+        if(success)
+        {
+            socket->address.port = ntohs(bind_address.sin_port);
+            socket->handle.platform = cast(void *)cast(intptr_t)fd;
+            socket->handle.no_error = true;
+        }
+        else
+        {
+            LOG("Failed opening socket on port %u: %s", socket->address.port, strerror(errno));
+            close(fd);
+        }
+    }
+    else
+    {
+        LOG("Failed creating socket: %s", strerror(errno));
+    }
+}
+
+ZHC_CLOSE_SOCKET(linux_close_socket)
+{
+    if(socket->handle.no_error)
+    {
+        close(linux_socket_fd(socket));
+        socket->handle.platform = 0;
+        socket->handle.no_error = false;
+    }
+}
+
+ZHC_SEND_DATA(linux_send_data)
+{
+    if(socket->handle.no_error)
+    {
+        sockaddr_in target = linux_sockaddr(target_address);
+        ssize_t sent = sendto(linux_socket_fd(socket), buffer, buffer_size, 0, cast(sockaddr *)&target, sizeof(target));
+        if(sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG("Failed sending udp package: %s", strerror(errno));
+            socket->handle.no_error = false;
+        }
+    }
+}
+
+ZHC_RECEIVE_DATA(linux_receive_data)
+{
+    usize result = 0;
+    if(socket->handle.no_error)
+    {
+        sockaddr_in peer = {};
+        socklen_t peer_size = sizeof(peer);
+        ssize_t received = recvfrom(linux_socket_fd(socket), buffer, buffer_size, 0, cast(sockaddr *)&peer, &peer_size);
+        if(received > 0)
+        {
+            result = cast(usize)received;
+            peer_address->host = peer.sin_addr.s_addr;
+            peer_address->port = ntohs(peer.sin_port);
+        }
+        else if(received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG("Failed receiving udp package: %s", strerror(errno));
+            socket->handle.no_error = false;
+        }
+    }
+
+    return(result);
+}
+
+#ifndef __ANDROID__
+// NOTE(dgl): Returns the number of datagrams which are sent as the next message. The datagrams
+// of a run go to the same address and have the same size, only the last one can be smaller.
+internal int32
+linux_segment_count(Zhc_Net_Datagram *datagrams, int32 count, bool32 segment)
+{
+    int32 result = 0;
+    Zhc_Net_Datagram *first = datagrams;
+    usize message_size = 0;
+    while(result < count)
+    {
+        Zhc_Net_Datagram *datagram = datagrams + result;
+        bool32 fits = (result == 0 ||
+                       (segment &&
+                        result < LINUX_MAX_SEGMENT_COUNT &&
+                        datagram->address.host == first->address.host &&
+                        datagram->address.port == first->address.port &&
+                        datagram->size <= first->size &&
+                        datagram->size > 0 &&
+                        message_size + datagram->size <= LINUX_MAX_UDP_PAYLOAD));
+        if(!fits) { break; }
+
+        message_size += datagram->size;
+        result++;
+
+        // NOTE(dgl): a smaller datagram ends the run
+        if(datagram->size < first->size) { break; }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): control must hold CMSG_SPACE(sizeof(uint16)) bytes
+internal void
+linux_set_segment_size(msghdr *header, uint8 *control_data, usize segment_size)
+{
+#if defined(UDP_SEGMENT)
+    header->msg_control = control_data;
+    header->msg_controllen = CMSG_SPACE(sizeof(uint16));
+    cmsghdr *control = CMSG_FIRSTHDR(header);
+    control->cmsg_level = IPPROTO_UDP;
+    control->cmsg_type = UDP_SEGMENT;
+    control->cmsg_len = CMSG_LEN(sizeof(uint16));
+    uint16 gso_size = cast(uint16)segment_size;
+    dgl_memcpy(CMSG_DATA(control), &gso_size, sizeof(gso_size));
+#endif
+}
+
+// NOTE(dgl): builds one message per run of datagrams (see linux_segment_count).
+// Returns the number of datagrams in the batch.
+internal int32
+linux_build_send_batch(Linux_Send_Batch *batch, Zhc_Net_Datagram *datagrams, int32 count, bool32 segment)
+{
+    int32 result = 0;
+    batch->count = 0;
+    while(result < count && batch->count < LINUX_BATCH_SIZE)
+    {
+        Zhc_Net_Datagram *first = datagrams + result;
+        int32 segment_count = linux_segment_count(first, count - result, segment);
+
+        int32 message_index = batch->count++;
+        mmsghdr *message = batch->messages + message_index;
+        *message = {};
+        batch->targets[message_index] = linux_sockaddr(&first->address);
+        message->msg_hdr.msg_name = batch->targets + message_index;
+        message->msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        message->msg_hdr.msg_iov = batch->vectors + result;
+        message->msg_hdr.msg_iovlen = cast(usize)segment_count;
+        for(int32 index = 0; index < segment_count; ++index)
+        {
+            iovec *vector = batch->vectors + result + index;
+            vector->iov_base = first[index].data;
+            vector->iov_len = first[index].size;
+        }
+
+        if(segment_count > 1)
+        {
+            linux_set_segment_size(&message->msg_hdr, batch->controls[message_index].data, first->size);
+        }
+        result += segment_count;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): datagrams which do not fit into the socket buffer are dropped, like in linux_send_data.
+ZHC_SEND_DATA_BATCH(linux_send_data_batch)
+{
+    Linux_Send_Batch batch;
+    int32 offset = 0;
+    while(socket->handle.no_error && offset < count)
+    {
+#if defined(UDP_SEGMENT)
+        bool32 segment = !linux_segmentation_disabled;
+#else
+        bool32 segment = false;
+#endif
+        int32 batch_count = linux_build_send_batch(&batch, datagrams + offset, count - offset, segment);
+
+        int32 sent = 0;
+        while(sent < batch.count)
+        {
+            int32 result = sendmmsg(linux_socket_fd(socket), batch.messages + sent, cast(uint32)(batch.count - sent), 0);
+            if(result > 0)
+            {
+                sent += result;
+            }
+            else if(segment && sent == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT))
+            {
+                LOG("UDP segmentation offload is not supported (%s). Sending the datagrams one by one", strerror(errno));
+                linux_segmentation_disabled = true;
+                batch_count = 0;
+                break;
+            }
+            else
+            {
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    LOG("Failed sending udp packages: %s", strerror(errno));
+                    socket->handle.no_error = false;
+                }
+                break;
+            }
+        }
+        offset += batch_count;
+
+        // NOTE(dgl): the socket buffer is full. The remaining datagrams are dropped.
+        if(sent < batch.count && batch_count > 0) { break; }
+    }
+}
+
+ZHC_RECEIVE_DATA_BATCH(linux_receive_data_batch)
+{
+    int32 result = 0;
+    if(socket->handle.no_error)
+    {
+        mmsghdr messages[LINUX_BATCH_SIZE];
+        sockaddr_in peers[LINUX_BATCH_SIZE];
+        iovec vectors[LINUX_BATCH_SIZE];
+
+        int32 batch_count = dgl_min(count, LINUX_BATCH_SIZE);
+        for(int32 index = 0; index < batch_count; ++index)
+        {
+            messages[index] = {};
+            vectors[index].iov_base = datagrams[index].data;
+            vectors[index].iov_len = datagrams[index].capacity;
+            messages[index].msg_hdr.msg_name = peers + index;
+            messages[index].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[index].msg_hdr.msg_iov = vectors + index;
+            messages[index].msg_hdr.msg_iovlen = 1;
+        }
+
+        int32 received = recvmmsg(linux_socket_fd(socket), messages, cast(uint32)batch_count, MSG_DONTWAIT, 0);
+        if(received > 0)
+        {
+            for(int32 index = 0; index < received; ++index)
+            {
+                Zhc_Net_Datagram *datagram = datagrams + index;
+                datagram->size = messages[index].msg_len;
+                datagram->address.host = peers[index].sin_addr.s_addr;
+                datagram->address.port = ntohs(peers[index].sin_port);
+            }
+            result = received;
+        }
+        else if(received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG("Failed receiving udp packages: %s", strerror(errno));
+            socket->handle.no_error = false;
+        }
+    }
+
+    return(result);
+}
+#endif
+
+// NOTE(dgl): waits until one of the sockets is readable or the timeout expires
+ZHC_WAIT_FOR_DATA(linux_wait_for_data)
+{
+    pollfd fds[2] = {};
+    nfds_t fd_count = 0;
+    if(socket && socket->handle.no_error)
+    {
+        fds[fd_count].fd = linux_socket_fd(socket);
+        fds[fd_count++].events = POLLIN;
+    }
+    if(multicast_socket && multicast_socket->handle.no_error)
+    {
+        fds[fd_count].fd = linux_socket_fd(multicast_socket);
+        fds[fd_count++].events = POLLIN;
+    }
+
+    int32 timeout = cast(int32)(timeout_ms + 0.5);
+    if(poll(fds, fd_count, timeout) < 0 && errno != EINTR)
+    {
+        LOG("Failed waiting for udp packages: %s", strerror(errno));
+    }
+}
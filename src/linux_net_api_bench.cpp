@@ -0,0 +1,197 @@
+#include <string.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_net.h>
+#include <sys/mman.h> /* mmap */
+
+#include "zhc_platform.h"
+#include <dirent.h> /* opendir, readdir */
+#include <errno.h>
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sdl2_api.cpp"
+#include "linux_net_api.cpp"
+#include "linux_uring_api.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+// NOTE(dgl): Loopback throughput of the socket paths of the platform api. The server sends the
+// slices of a song switch to each client as bursts of a flushed packet ring. Each client drains its
+// socket after the burst, like net_recv_message does each frame.
+
+#define BENCH_CLIENT_COUNT 4
+#define BENCH_BURST_SIZE 32 /* NOTE(dgl): NET_PACKET_RING_SIZE */
+#define BENCH_DATAGRAM_SIZE 1200 /* NOTE(dgl): NET_MTU_SIZE */
+#define BENCH_RECEIVE_SIZE 1500
+#define BENCH_BASE_PORT 19300
+
+struct Bench_Socket_Path
+{
+    char *name;
+    Zhc_Open_Socket *open_socket;
+    Zhc_Close_Socket *close_socket;
+    Zhc_Send_Data *send_data;
+    Zhc_Receive_Data *receive_data;
+    Zhc_Send_Data_Batch *send_data_batch; /* NOTE(dgl): 0 sends the datagrams one by one */
+    Zhc_Receive_Data_Batch *receive_data_batch;
+    bool32 segmentation;
+};
+
+internal real64
+bench_time_in_ms(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    real64 result = cast(real64)now.tv_sec * 1000.0 + cast(real64)now.tv_nsec * 1e-6;
+    return(result);
+}
+
+internal Zhc_Net_Address
+bench_loopback_address(uint16 port)
+{
+    Zhc_Net_Address result = {};
+    result.ip[0] = 127;
+    result.ip[3] = 1;
+    result.port = port;
+    return(result);
+}
+
+internal void
+bench_socket_throughput(Bench_Socket_Path *path, uint8 *memory, usize total_bytes)
+{
+    Zhc_Net_Socket server = {};
+    Zhc_Net_Socket clients[BENCH_CLIENT_COUNT] = {};
+    path->open_socket(0, &server);
+    for(int32 index = 0; index < BENCH_CLIENT_COUNT; ++index)
+    {
+        clients[index].address.port = cast(uint16)(BENCH_BASE_PORT + index);
+        path->open_socket(0, clients + index);
+    }
+    linux_segmentation_disabled = !path->segmentation;
+
+    // NOTE(dgl): the burst is sent from memory, the clients receive into the memory after it
+    Zhc_Net_Datagram burst[BENCH_BURST_SIZE] = {};
+    Zhc_Net_Datagram received[BENCH_BURST_SIZE] = {};
+    for(int32 index = 0; index < BENCH_BURST_SIZE; ++index)
+    {
+        burst[index].data = memory + index*BENCH_DATAGRAM_SIZE;
+        burst[index].size = BENCH_DATAGRAM_SIZE;
+        received[index].data = memory + (BENCH_BURST_SIZE + index)*BENCH_RECEIVE_SIZE;
+        received[index].capacity = BENCH_RECEIVE_SIZE;
+    }
+
+    int32 datagram_count = dgl_safe_size_to_int32(total_bytes / BENCH_DATAGRAM_SIZE);
+    int32 sent_count = 0;
+    int32 received_count = 0;
+    int32 send_calls = 0;
+    int32 receive_calls = 0;
+    real64 start_ms = bench_time_in_ms();
+    real64 start_cpu_ms = bench_time_in_ms(CLOCK_PROCESS_CPUTIME_ID);
+    for(int32 burst_index = 0; sent_count < datagram_count; ++burst_index)
+    {
+        Zhc_Net_Socket *client = clients + (burst_index % BENCH_CLIENT_COUNT);
+        int32 burst_count = dgl_min(BENCH_BURST_SIZE, datagram_count - sent_count);
+        for(int32 index = 0; index < burst_count; ++index)
+        {
+            burst[index].address = bench_loopback_address(client->address.port);
+        }
+
+        if(path->send_data_batch)
+        {
+            path->send_data_batch(&server, burst, burst_count);
+            send_calls++;
+        }
+        else
+        {
+            for(int32 index = 0; index < burst_count; ++index)
+            {
+                path->send_data(&server, &burst[index].address, burst[index].data, burst[index].size);
+                send_calls++;
+            }
+        }
+        sent_count += burst_count;
+
+        int32 count = 0;
+        do
+        {
+            if(path->receive_data_batch)
+            {
+                count = path->receive_data_batch(client, received, BENCH_BURST_SIZE);
+            }
+            else
+            {
+                Zhc_Net_Datagram *datagram = received;
+                count = (path->receive_data(client, &datagram->address, datagram->data, datagram->capacity) > 0) ? 1 : 0;
+            }
+            received_count += count;
+            receive_calls++;
+        } while(count > 0);
+    }
+    real64 elapsed_ms = bench_time_in_ms() - start_ms;
+    real64 cpu_ms = bench_time_in_ms(CLOCK_PROCESS_CPUTIME_ID) - start_cpu_ms;
+
+    printf("%16s %10.1f %12.1f %12.0f %12.3f %12.1f %12d %12d\n", path->name, elapsed_ms,
+           cast(real64)received_count*BENCH_DATAGRAM_SIZE / (elapsed_ms * 1000.0),
+           cast(real64)received_count / (elapsed_ms / 1000.0),
+           cpu_ms / (cast(real64)received_count*BENCH_DATAGRAM_SIZE / cast(real64)megabytes(1)),
+           100.0 * cast(real64)received_count / cast(real64)datagram_count, send_calls, receive_calls);
+
+    for(int32 index = 0; index < BENCH_CLIENT_COUNT; ++index)
+    {
+        path->close_socket(clients + index);
+    }
+    path->close_socket(&server);
+}
+
+int
+main(int argc, char **argv)
+{
+    if(SDLNet_Init() != 0)
+    {
+        LOG("Unable to initialize SDLNet: %s", SDLNet_GetError());
+        return(1);
+    }
+
+    usize memory_size = megabytes(1);
+    uint8 *memory = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    Bench_Socket_Path paths[] =
+    {
+        {"sdl_net", sdl_net_open_socket, sdl_net_close_socket, sdl_net_send_data, sdl_net_receive_data, 0, 0, false},
+        {"native", linux_open_socket, linux_close_socket, linux_send_data, linux_receive_data, 0, 0, false},
+        {"native batched", linux_open_socket, linux_close_socket, linux_send_data, linux_receive_data, linux_send_data_batch, linux_receive_data_batch, false},
+        {"native gso", linux_open_socket, linux_close_socket, linux_send_data, linux_receive_data, linux_send_data_batch, linux_receive_data_batch, true},
+        {"io_uring", linux_uring_open_socket, linux_uring_close_socket, linux_uring_send_data, linux_uring_receive_data, linux_uring_send_data_batch, linux_uring_receive_data_batch, true},
+    };
+
+    // NOTE(dgl): the io_uring path is skipped, if the kernel does not support it
+    int32 path_count = array_count(paths);
+    if(!linux_uring_init())
+    {
+        LOG("io_uring is not supported. Skipping the io_uring path");
+        path_count--;
+    }
+
+    // NOTE(dgl): a 1 MB song switch to 128 clients
+    usize total_bytes = 128*megabytes(1);
+    printf("Loopback throughput of %zu MB in bursts of %d datagrams to %d clients\n", total_bytes / megabytes(1), BENCH_BURST_SIZE, BENCH_CLIENT_COUNT);
+    printf("%16s %10s %12s %12s %12s %12s %12s %12s\n", "path", "ms", "MB/s", "packets/s", "cpu ms/MB", "received %", "send calls", "recv calls");
+    for(int32 index = 0; index < path_count; ++index)
+    {
+        bench_socket_throughput(paths + index, memory, total_bytes);
+    }
+
+    SDLNet_Quit();
+    return(0);
+}
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <netinet/in.h>
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "zhc_platform.h"
+#include "linux_net_api.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "dgl_test_helpers.h"
+
+internal Zhc_Net_Address
+test_address(uint8 a, uint8 b, uint8 c, uint8 d, uint16 port)
+{
+    Zhc_Net_Address result = {};
+    result.ip[0] = a;
+    result.ip[1] = b;
+    result.ip[2] = c;
+    result.ip[3] = d;
+    result.port = port;
+
+    return(result);
+}
+
+internal usize
+receive_with_retry(Zhc_Net_Socket *socket, Zhc_Net_Address *peer, uint8 *buffer, usize buffer_size)
+{
+    usize result = 0;
+    for(int32 retry = 0; retry < 100 && result == 0; ++retry)
+    {
+        result = linux_receive_data(socket, peer, buffer, buffer_size);
+        if(result == 0) { usleep(1000); }
+    }
+
+    return(result);
+}
+
+int
+main(int argc, char **argv)
+{
+    DGL_BEGIN_TEST("Multicast datagrams are looped back to group members on the loopback interface");
+    {
+        Zhc_Net_Address group = test_address(239, 192, 0, 88, 18889);
+
+        Zhc_Net_Socket receiver = {};
+        receiver.address = test_address(127, 0, 0, 1, 0);
+        linux_open_multicast_socket(&receiver, &group, true);
+        DGL_EXPECT_bool32(receiver.handle.no_error, ==, true);
+
+        Zhc_Net_Socket sender = {};
+        sender.address = test_address(127, 0, 0, 1, 0);
+        linux_open_multicast_socket(&sender, &group, false);
+        DGL_EXPECT_bool32(sender.handle.no_error, ==, true);
+
+        uint8 data[4] = {1, 2, 3, 4};
+        linux_send_data(&sender, &group, data, array_count(data));
+
+        uint8 buffer[16] = {};
+        Zhc_Net_Address peer = {};
+        usize received = receive_with_retry(&receiver, &peer, buffer, array_count(buffer));
+        DGL_EXPECT_usize(received, ==, array_count(data));
+        DGL_EXPECT_uint8(buffer[3], ==, 4);
+        DGL_EXPECT_uint32(peer.host, ==, test_address(127, 0, 0, 1, 0).host);
+
+        linux_close_socket(&sender);
+        linux_close_socket(&receiver);
+        DGL_EXPECT_bool32(receiver.handle.no_error, ==, false);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Receiving from an empty socket does not block");
+    {
+        Zhc_Net_Address group = test_address(239, 192, 0, 88, 18890);
+        Zhc_Net_Socket receiver = {};
+        linux_open_multicast_socket(&receiver, &group, true);
+
+        uint8 buffer[16] = {};
+        Zhc_Net_Address peer = {};
+        DGL_EXPECT_usize(linux_receive_data(&receiver, &peer, buffer, array_count(buffer)), ==, 0);
+        DGL_EXPECT_bool32(receiver.handle.no_error, ==, true);
+
+        linux_close_socket(&receiver);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Batched datagrams are received in order and keep their size");
+    {
+        Zhc_Net_Socket receiver = {};
+        linux_open_socket(0, &receiver);
+        DGL_EXPECT_bool32(receiver.handle.no_error, ==, true);
+        DGL_EXPECT_uint16(receiver.address.port, !=, 0);
+
+        Zhc_Net_Socket sender = {};
+        linux_open_socket(0, &sender);
+        DGL_EXPECT_bool32(sender.handle.no_error, ==, true);
+
+        // NOTE(dgl): the datagrams of the same size are one message, if segmentation is supported.
+        // The smaller datagram ends the message.
+        uint8 data[40][1200] = {};
+        Zhc_Net_Datagram datagrams[40] = {};
+        for(int32 index = 0; index < 40; ++index)
+        {
+            Zhc_Net_Datagram *datagram = datagrams + index;
+            datagram->address = test_address(127, 0, 0, 1, receiver.address.port);
+            datagram->data = data[index];
+            datagram->size = (index == 20) ? 100 : array_count(data[index]);
+            dgl_memset(datagram->data, index, datagram->size);
+        }
+        linux_send_data_batch(&sender, datagrams, array_count(datagrams));
+        DGL_EXPECT_bool32(sender.handle.no_error, ==, true);
+
+        uint8 buffer[16][1500] = {};
+        Zhc_Net_Datagram received[16] = {};
+        int32 received_count = 0;
+        bool32 in_order = true;
+        for(int32 retry = 0; retry < 100 && received_count < 40; ++retry)
+        {
+            for(int32 index = 0; index < array_count(received); ++index)
+            {
+                received[index].data = buffer[index];
+                received[index].capacity = array_count(buffer[index]);
+            }
+
+            int32 count = linux_receive_data_batch(&receiver, received, array_count(received));
+            for(int32 index = 0; index < count; ++index)
+            {
+                usize expected_size = (received_count == 20) ? 100 : 1200;
+                in_order &= (received[index].size == expected_size);
+                in_order &= (received[index].data[expected_size - 1] == received_count);
+                in_order &= (received[index].address.port == sender.address.port);
+                received_count++;
+            }
+            if(count == 0) { usleep(1000); }
+        }
+        DGL_EXPECT_int32(received_count, ==, 40);
+        DGL_EXPECT_bool32(in_order, ==, true);
+
+        linux_close_socket(&sender);
+        linux_close_socket(&receiver);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Sockets sharing a port receive the datagrams of a peer by the port of the peer");
+    {
+        Zhc_Net_Socket shards[3] = {};
+        for(int32 index = 0; index < array_count(shards); ++index)
+        {
+            shards[index].address = test_address(0, 0, 0, 0, 18890);
+            shards[index].reuse_port_count = array_count(shards);
+            linux_open_socket(0, shards + index);
+            DGL_EXPECT_bool32(shards[index].handle.no_error, ==, true);
+        }
+
+        bool32 steered = true;
+        for(int32 index = 0; index < 6; ++index)
+        {
+            Zhc_Net_Socket peer = {};
+            peer.address = test_address(0, 0, 0, 0, cast(uint16)(18900 + index));
+            linux_open_socket(0, &peer);
+
+            uint8 data[4] = {1, 2, 3, cast(uint8)index};
+            Zhc_Net_Address target = test_address(127, 0, 0, 1, 18890);
+            linux_send_data(&peer, &target, data, array_count(data));
+
+            uint8 buffer[16] = {};
+            Zhc_Net_Address from = {};
+            Zhc_Net_Socket *shard = shards + (peer.address.port % array_count(shards));
+            steered &= (receive_with_retry(shard, &from, buffer, array_count(buffer)) == array_count(data));
+            steered &= (from.port == peer.address.port);
+            linux_close_socket(&peer);
+        }
+        DGL_EXPECT_bool32(steered, ==, true);
+
+        for(int32 index = 0; index < array_count(shards); ++index)
+        {
+            linux_close_socket(shards + index);
+        }
+    }
+    DGL_END_TEST();
+
+    if(dgl_test_result()) { return(0); }
+    else { return(1); }
+}
@@ -0,0 +1,613 @@
+// NOTE(dgl): Capture of the datagrams passing the socket functions of the platform api and a replay
+// of captures into net_recv_message. The capture wraps the functions of an api after the backend
+// was chosen. It writes every datagram with its time, the peer and the local port to a file.
+// The replay hands the received datagrams of a capture to a new net context as fast as possible.
+// This measures parsing and dispatching (serialize_packet, the connection lookup, copying the slices)
+// with the traffic of a real venue. The replay needs zhc_net.cpp.
+// DO NOT INCLUDE THIS FILE INTO THE PLATFORM INDEPENDENT CODE!
+//
+// File format (little endian):
+//   header: magic "ZHCP" (u32), version (u16), flags (u16), start time in ms (u64)
+//   record: time since the previous record in us (u32), flags (u8), peer ip (4 x u8), peer port (u16),
+//           local port (u16), size (u16), data
+
+#define NET_CAPTURE_MAGIC 0x5043485A
+#define NET_CAPTURE_VERSION 1
+#define NET_CAPTURE_HEADER_SIZE 16
+#define NET_CAPTURE_RECORD_SIZE 15
+#define NET_CAPTURE_BUFFER_SIZE megabytes(1)
+
+enum Net_Capture_Flag
+{
+    Net_Capture_Flag_Received = (1 << 0), /* NOTE(dgl): otherwise the datagram was sent */
+    Net_Capture_Flag_Group = (1 << 1), /* NOTE(dgl): the datagram passed the multicast socket */
+};
+
+enum Net_Capture_File_Flag
+{
+    Net_Capture_File_Flag_Server = (1 << 0),
+};
+
+internal uint8 *
+net_capture_write_uint16(uint8 *dest, uint16 value)
+{
+    dest[0] = cast(uint8)(value & 0xFF);
+    dest[1] = cast(uint8)(value >> 8);
+    return(dest + 2);
+}
+
+internal uint8 *
+net_capture_write_uint32(uint8 *dest, uint32 value)
+{
+    dest = net_capture_write_uint16(dest, cast(uint16)(value & 0xFFFF));
+    dest = net_capture_write_uint16(dest, cast(uint16)(value >> 16));
+    return(dest);
+}
+
+internal uint16
+net_capture_read_uint16(uint8 *source)
+{
+    uint16 result = cast(uint16)(source[0] | (source[1] << 8));
+    return(result);
+}
+
+internal uint32
+net_capture_read_uint32(uint8 *source)
+{
+    uint32 result = net_capture_read_uint16(source) | (cast(uint32)net_capture_read_uint16(source + 2) << 16);
+    return(result);
+}
+
+//
+// NOTE(dgl): Capture
+//
+
+struct Linux_Capture
+{
+    bool32 active;
+    int32 fd;
+    uint32 volatile lock; /* NOTE(dgl): the net threads of the server shards capture at the same time */
+    real64 start_ms;
+    uint64 last_us;
+    uint64 datagram_count;
+    Zhc_Platform_Api api; /* NOTE(dgl): the captured functions */
+    usize used;
+    uint8 buffer[NET_CAPTURE_BUFFER_SIZE];
+};
+
+global Linux_Capture linux_capture;
+
+// NOTE(dgl): the lock must be held
+internal void
+linux_capture_flush(void)
+{
+    uint8 *data = linux_capture.buffer;
+    usize size = linux_capture.used;
+    while(linux_capture.active && size > 0)
+    {
+        ssize_t written = write(linux_capture.fd, data, size);
+        if(written > 0)
+        {
+            data += written;
+            size -= cast(usize)written;
+        }
+        else if(written < 0 && errno != EINTR)
+        {
+            LOG("Failed writing the capture: %s. The capture is stopped", strerror(errno));
+            linux_capture.active = false;
+        }
+    }
+    linux_capture.used = 0;
+}
+
+internal void
+linux_capture_record(uint8 flags, Zhc_Net_Socket *socket, Zhc_Net_Address address, uint8 *data, usize size)
+{
+    assert(size <= 0xFFFF, "Datagram is too big for the capture");
+    if(size > 0)
+    {
+        while(dgl_atomic_compare_exchange_uint32(&linux_capture.lock, 1, 0) != 0) {}
+
+        if(linux_capture.active)
+        {
+            if(linux_capture.used + NET_CAPTURE_RECORD_SIZE + size > NET_CAPTURE_BUFFER_SIZE)
+            {
+                linux_capture_flush();
+            }
+
+            // NOTE(dgl): the time is taken under the lock, so the records of all threads are in order
+            real64 elapsed_ms = dgl_max(linux_capture.api.get_time_in_ms() - linux_capture.start_ms, 0.0);
+            uint64 now_us = dgl_max(cast(uint64)(elapsed_ms*1000.0), linux_capture.last_us);
+            uint64 delta_us = dgl_min(now_us - linux_capture.last_us, cast(uint64)0xFFFFFFFF);
+            linux_capture.last_us = now_us;
+
+            uint8 *dest = linux_capture.buffer + linux_capture.used;
+            dest = net_capture_write_uint32(dest, cast(uint32)delta_us);
+            *dest++ = flags;
+            for(int32 index = 0; index < array_count(address.ip); ++index) { *dest++ = address.ip[index]; }
+            dest = net_capture_write_uint16(dest, address.port);
+            dest = net_capture_write_uint16(dest, socket->address.port);
+            dest = net_capture_write_uint16(dest, cast(uint16)size);
+            dgl_memcpy(dest, data, size);
+            linux_capture.used += NET_CAPTURE_RECORD_SIZE + size;
+            linux_capture.datagram_count++;
+        }
+
+        dgl_atomic_fence();
+        linux_capture.lock = 0;
+    }
+}
+
+internal void
+linux_capture_record_batch(uint8 flags, Zhc_Net_Socket *socket, Zhc_Net_Datagram *datagrams, int32 count)
+{
+    for(int32 index = 0; index < count; ++index)
+    {
+        Zhc_Net_Datagram *datagram = datagrams + index;
+        linux_capture_record(flags, socket, datagram->address, datagram->data, datagram->size);
+    }
+}
+
+ZHC_SEND_DATA(linux_capture_send_data)
+{
+    linux_capture.api.send_data(socket, target_address, buffer, buffer_size);
+    linux_capture_record(0, socket, *target_address, buffer, buffer_size);
+}
+
+ZHC_SEND_DATA(linux_capture_send_multicast_data)
+{
+    linux_capture.api.send_multicast_data(socket, target_address, buffer, buffer_size);
+    linux_capture_record(Net_Capture_Flag_Group, socket, *target_address, buffer, buffer_size);
+}
+
+ZHC_RECEIVE_DATA(linux_capture_receive_data)
+{
+    usize result = linux_capture.api.receive_data(socket, peer_address, buffer, buffer_size);
+    linux_capture_record(Net_Capture_Flag_Received, socket, *peer_address, buffer, result);
+    return(result);
+}
+
+ZHC_RECEIVE_DATA(linux_capture_receive_multicast_data)
+{
+    usize result = linux_capture.api.receive_multicast_data(socket, peer_address, buffer, buffer_size);
+    linux_capture_record(Net_Capture_Flag_Received|Net_Capture_Flag_Group, socket, *peer_address, buffer, result);
+    return(result);
+}
+
+ZHC_SEND_DATA_BATCH(linux_capture_send_data_batch)
+{
+    linux_capture.api.send_data_batch(socket, datagrams, count);
+    linux_capture_record_batch(0, socket, datagrams, count);
+}
+
+ZHC_SEND_DATA_BATCH(linux_capture_send_multicast_data_batch)
+{
+    linux_capture.api.send_multicast_data_batch(socket, datagrams, count);
+    linux_capture_record_batch(Net_Capture_Flag_Group, socket, datagrams, count);
+}
+
+ZHC_RECEIVE_DATA_BATCH(linux_capture_receive_data_batch)
+{
+    int32 result = linux_capture.api.receive_data_batch(socket, datagrams, count);
+    linux_capture_record_batch(Net_Capture_Flag_Received, socket, datagrams, result);
+    return(result);
+}
+
+ZHC_RECEIVE_DATA_BATCH(linux_capture_receive_multicast_data_batch)
+{
+    int32 result = linux_capture.api.receive_multicast_data_batch(socket, datagrams, count);
+    linux_capture_record_batch(Net_Capture_Flag_Received|Net_Capture_Flag_Group, socket, datagrams, result);
+    return(result);
+}
+
+// NOTE(dgl): replaces the send and receive functions of the api with functions capturing the
+// datagrams into the file at path. Must be called before the net layer uses the api.
+internal bool32
+linux_capture_begin(Zhc_Platform_Api *api, char *path, bool32 server)
+{
+    assert(!linux_capture.active, "Only one capture can be active");
+    assert(api->get_time_in_ms, "The capture needs the time of the platform");
+    bool32 result = false;
+    int32 fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0)
+    {
+        linux_capture.fd = fd;
+        linux_capture.api = *api;
+        linux_capture.start_ms = api->get_time_in_ms();
+        linux_capture.last_us = 0;
+        linux_capture.datagram_count = 0;
+        linux_capture.lock = 0;
+
+        uint8 *dest = linux_capture.buffer;
+        dest = net_capture_write_uint32(dest, NET_CAPTURE_MAGIC);
+        dest = net_capture_write_uint16(dest, NET_CAPTURE_VERSION);
+        dest = net_capture_write_uint16(dest, server ? Net_Capture_File_Flag_Server : 0);
+        uint64 start_ms = cast(uint64)linux_capture.start_ms;
+        dest = net_capture_write_uint32(dest, cast(uint32)(start_ms & 0xFFFFFFFF));
+        dest = net_capture_write_uint32(dest, cast(uint32)(start_ms >> 32));
+        linux_capture.used = NET_CAPTURE_HEADER_SIZE;
+        linux_capture.active = true;
+
+        if(api->send_data) { api->send_data = linux_capture_send_data; }
+        if(api->receive_data) { api->receive_data = linux_capture_receive_data; }
+        if(api->send_multicast_data) { api->send_multicast_data = linux_capture_send_multicast_data; }
+        if(api->receive_multicast_data) { api->receive_multicast_data = linux_capture_receive_multicast_data; }
+        if(api->send_data_batch) { api->send_data_batch = linux_capture_send_data_batch; }
+        if(api->receive_data_batch) { api->receive_data_batch = linux_capture_receive_data_batch; }
+        if(api->send_multicast_data_batch) { api->send_multicast_data_batch = linux_capture_send_multicast_data_batch; }
+        if(api->receive_multicast_data_batch) { api->receive_multicast_data_batch = linux_capture_receive_multicast_data_batch; }
+
+        LOG("Capturing the datagrams into %s", path);
+        result = true;
+    }
+    else
+    {
+        LOG("Failed opening the capture %s: %s", path, strerror(errno));
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): writes the remaining datagrams. The wrapped functions stay in the api, but do not
+// capture anymore.
+internal void
+linux_capture_end(void)
+{
+    while(dgl_atomic_compare_exchange_uint32(&linux_capture.lock, 1, 0) != 0) {}
+    if(linux_capture.active)
+    {
+        linux_capture_flush();
+        close(linux_capture.fd);
+        linux_capture.active = false;
+        LOG("Captured %llu datagrams", linux_capture.datagram_count);
+    }
+    dgl_atomic_fence();
+    linux_capture.lock = 0;
+}
+
+//
+// NOTE(dgl): Reading a capture
+//
+
+struct Net_Capture_Record
+{
+    real64 time_ms; /* NOTE(dgl): since the start of the capture */
+    uint8 flags;
+    Zhc_Net_Address peer;
+    uint16 local_port;
+    usize size;
+    uint8 *data; /* NOTE(dgl): points into the capture */
+
+    // NOTE(dgl): set by net_replay_prepare
+    bool32 ends_batch;
+    bool32 sync_salt;
+    uint64 salt;
+};
+
+struct Net_Capture
+{
+    uint16 flags;
+    real64 start_ms;
+    int32 record_count;
+    Net_Capture_Record *records;
+};
+
+// NOTE(dgl): the records point into the data, it must stay valid while the capture is used.
+// A truncated last record (e.g. the server was killed) is ignored.
+internal bool32
+net_capture_parse(DGL_Mem_Arena *arena, uint8 *data, usize size, Net_Capture *capture)
+{
+    bool32 result = false;
+    *capture = {};
+    if(size >= NET_CAPTURE_HEADER_SIZE &&
+       net_capture_read_uint32(data) == NET_CAPTURE_MAGIC &&
+       net_capture_read_uint16(data + 4) == NET_CAPTURE_VERSION)
+    {
+        capture->flags = net_capture_read_uint16(data + 6);
+        uint64 start_ms = net_capture_read_uint32(data + 8) | (cast(uint64)net_capture_read_uint32(data + 12) << 32);
+        capture->start_ms = cast(real64)start_ms;
+
+        // NOTE(dgl): the first pass counts the records
+        int32 count = 0;
+        usize offset = NET_CAPTURE_HEADER_SIZE;
+        while(offset + NET_CAPTURE_RECORD_SIZE <= size)
+        {
+            usize record_size = NET_CAPTURE_RECORD_SIZE + net_capture_read_uint16(data + offset + 13);
+            if(offset + record_size > size) { break; }
+            offset += record_size;
+            count++;
+        }
+
+        capture->record_count = count;
+        capture->records = dgl_mem_arena_push_array(arena, Net_Capture_Record, cast(usize)count);
+
+        uint64 time_us = 0;
+        offset = NET_CAPTURE_HEADER_SIZE;
+        for(int32 index = 0; index < count; ++index)
+        {
+            uint8 *source = data + offset;
+            Net_Capture_Record *record = capture->records + index;
+            *record = {};
+            time_us += net_capture_read_uint32(source);
+            record->time_ms = cast(real64)time_us / 1000.0;
+            record->flags = source[4];
+            for(int32 ip_index = 0; ip_index < array_count(record->peer.ip); ++ip_index)
+            {
+                record->peer.ip[ip_index] = source[5 + ip_index];
+            }
+            record->peer.port = net_capture_read_uint16(source + 9);
+            record->local_port = net_capture_read_uint16(source + 11);
+            record->size = net_capture_read_uint16(source + 13);
+            record->data = source + NET_CAPTURE_RECORD_SIZE;
+            offset += NET_CAPTURE_RECORD_SIZE + record->size;
+        }
+
+        result = true;
+    }
+    else
+    {
+        LOG("The data is no capture of version %d", NET_CAPTURE_VERSION);
+    }
+
+    return(result);
+}
+
+//
+// NOTE(dgl): Replay
+//
+
+struct Net_Replay_Stats
+{
+    uint64 datagrams;
+    uint64 bytes;
+    uint64 messages; /* NOTE(dgl): returned by net_recv_message */
+    uint64 datagrams_sent; /* NOTE(dgl): replies of the context, they are dropped */
+    uint64 skipped; /* NOTE(dgl): group datagrams before the client joined the group */
+    real64 elapsed_ms;
+};
+
+struct Net_Replay
+{
+    bool32 server;
+    int32 max_clients;
+    int32 count;
+    Net_Capture_Record *records; /* NOTE(dgl): the received datagrams of the replayed context */
+
+    // NOTE(dgl): state of the current run
+    Net_Context *ctx;
+    int32 next;
+    real64 now_ms;
+};
+
+global Net_Replay net_replay;
+
+struct Net_Replay_Peer
+{
+    bool32 used;
+    bool32 needs_sync;
+    Zhc_Net_Address address;
+};
+
+// NOTE(dgl): Selects the received datagrams of one context from the capture. The server receives
+// on its port, a client on its own port and the group (port 0 takes all unicast datagrams).
+// The salts of the connections are random, the replayed context does not get the salts of the
+// captured one. Therefore the first datagram of a peer after its handshake (or the first one of
+// the capture) sets the salt of the connection to the captured salt. The handshake datagrams
+// end a receive batch, so the connection exists before the following datagrams are received.
+internal void
+net_replay_prepare(DGL_Mem_Arena *arena, Net_Capture *capture, bool32 server, uint16 port, int32 max_clients)
+{
+    net_replay = {};
+    net_replay.server = server;
+    net_replay.max_clients = max_clients;
+    net_replay.records = dgl_mem_arena_push_array(arena, Net_Capture_Record, cast(usize)capture->record_count);
+
+    uint32 peer_capacity = 16;
+    while(peer_capacity < 2*cast(uint32)capture->record_count) { peer_capacity <<= 1; }
+    DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+    Net_Replay_Peer *peers = dgl_mem_arena_push_array(temp.arena, Net_Replay_Peer, peer_capacity);
+
+    for(int32 index = 0; index < capture->record_count; ++index)
+    {
+        Net_Capture_Record *source = capture->records + index;
+        bool32 group = (source->flags & Net_Capture_Flag_Group);
+        if((source->flags & Net_Capture_Flag_Received) &&
+           (group ? !server : (port == 0 || source->local_port == port)))
+        {
+            Net_Capture_Record *record = net_replay.records + net_replay.count++;
+            *record = *source;
+
+            // NOTE(dgl): connected datagrams only carry the session. A salt of the session
+            // has the same session (see net_session).
+            Packet packet = {};
+            packet.type = serialized_packet_type(record->data, record->size);
+            if(packet.type < Packet_Type_Max)
+            {
+                Bitstream reader = stream_reader_init(record->data, record->size);
+                serialize_packet(&reader, &packet);
+            }
+            record->salt = (packet.type < _Packet_Type_Connected) ? packet.salt : packet.session;
+            record->ends_batch = (packet.type <= Packet_Type_Challenge_Resp);
+
+            if(!group)
+            {
+                uint32 slot = address_hash(record->peer) & (peer_capacity - 1);
+                while(peers[slot].used && !address_compare(peers[slot].address, record->peer))
+                {
+                    slot = (slot + 1) & (peer_capacity - 1);
+                }
+                Net_Replay_Peer *peer = peers + slot;
+                if(!peer->used)
+                {
+                    peer->used = true;
+                    peer->needs_sync = true;
+                    peer->address = record->peer;
+                }
+
+                if(packet.type < Packet_Type_Challenge_Resp)
+                {
+                    peer->needs_sync = true;
+                }
+                else if(packet.type == Packet_Type_Challenge_Resp || peer->needs_sync)
+                {
+                    record->sync_salt = true;
+                    peer->needs_sync = false;
+                }
+            }
+        }
+    }
+    dgl_mem_arena_end_temp(temp);
+}
+
+// NOTE(dgl): a peer without connection connected before the capture started. It gets a connection,
+// which is connected by the datagram.
+internal void
+net_replay_sync_salt(Net_Capture_Record *record)
+{
+    Connection_List *conns = net_replay.ctx->conns;
+    Net_Conn_ID index = get_connection(conns, record->peer);
+    if(index < 0 && !record->ends_batch)
+    {
+        index = push_connection(conns, record->peer, record->salt);
+    }
+    if(index >= 0) { conns->salt[index] = record->salt; }
+}
+
+// NOTE(dgl): the datagrams are copied into the receive buffers, like the kernel does
+internal int32
+net_replay_receive(Zhc_Net_Datagram *datagrams, int32 count, bool32 group)
+{
+    int32 result = 0;
+    while(result < count && net_replay.next < net_replay.count)
+    {
+        Net_Capture_Record *record = net_replay.records + net_replay.next;
+        if(((record->flags & Net_Capture_Flag_Group) != 0) != group) { break; }
+
+        net_replay.next++;
+        net_replay.now_ms = record->time_ms;
+        if(record->sync_salt) { net_replay_sync_salt(record); }
+
+        Zhc_Net_Datagram *datagram = datagrams + result++;
+        datagram->address = record->peer;
+        datagram->size = dgl_min(record->size, datagram->capacity);
+        dgl_memcpy(datagram->data, record->data, datagram->size);
+        if(record->ends_batch) { break; }
+    }
+
+    return(result);
+}
+
+ZHC_GET_TIME_IN_MS(net_replay_get_time_in_ms)
+{
+    return(net_replay.now_ms);
+}
+
+ZHC_RECEIVE_DATA_BATCH(net_replay_receive_data_batch)
+{
+    return(net_replay_receive(datagrams, count, false));
+}
+
+ZHC_RECEIVE_DATA_BATCH(net_replay_receive_multicast_data_batch)
+{
+    return(net_replay_receive(datagrams, count, true));
+}
+
+ZHC_RECEIVE_DATA(net_replay_receive_data)
+{
+    Zhc_Net_Datagram datagram = {};
+    datagram.data = buffer;
+    datagram.capacity = buffer_size;
+    int32 count = net_replay_receive(&datagram, 1, socket == &net_replay.ctx->multicast.socket);
+    *peer_address = datagram.address;
+    return(count > 0 ? datagram.size : 0);
+}
+
+ZHC_SEND_DATA(net_replay_send_data) {}
+ZHC_SEND_DATA_BATCH(net_replay_send_data_batch) {}
+
+ZHC_OPEN_MULTICAST_SOCKET(net_replay_open_multicast_socket)
+{
+    socket->address.port = join ? group->port : 0;
+    socket->handle.no_error = true;
+}
+
+ZHC_CLOSE_SOCKET(net_replay_close_socket)
+{
+    socket->handle.no_error = false;
+}
+
+internal real64
+net_replay_clock_ms(void)
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    real64 result = cast(real64)now.tv_sec*1000.0 + cast(real64)now.tv_nsec/1000000.0;
+    return(result);
+}
+
+// NOTE(dgl): Feeds the prepared datagrams into a new context, without running the timers. The
+// types of the returned messages are written into message_types (optional). The replies of the
+// context are dropped.
+internal Net_Replay_Stats
+net_replay_run(DGL_Mem_Arena *arena, Net_Message_Type *message_types, int32 message_type_capacity)
+{
+    Net_Replay_Stats result = {};
+    Zhc_Platform_Api saved_platform = platform;
+    platform = {};
+    platform.get_time_in_ms = net_replay_get_time_in_ms;
+    platform.receive_data = net_replay_receive_data;
+    platform.receive_multicast_data = net_replay_receive_data;
+    platform.receive_data_batch = net_replay_receive_data_batch;
+    platform.receive_multicast_data_batch = net_replay_receive_multicast_data_batch;
+    platform.send_data = net_replay_send_data;
+    platform.send_multicast_data = net_replay_send_data;
+    platform.send_data_batch = net_replay_send_data_batch;
+    platform.send_multicast_data_batch = net_replay_send_data_batch;
+    platform.open_multicast_socket = net_replay_open_multicast_socket;
+    platform.close_multicast_socket = net_replay_close_socket;
+
+    DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+    net_replay.next = 0;
+    net_replay.now_ms = (net_replay.count > 0) ? net_replay.records[0].time_ms : 0.0;
+    Net_Context *ctx = net_replay.server ? net_init_server(temp.arena, net_replay.max_clients) : net_init_client(temp.arena, ZHC_MAX_FILESIZE);
+    ctx->socket.handle.no_error = true;
+    net_replay.ctx = ctx;
+
+    real64 start_ms = net_replay_clock_ms();
+    // NOTE(dgl): datagrams put back into the receive batch (see net_recv_message) are returned
+    // by the next call, even after the last record.
+    Net_Receive_Batch *batch = &ctx->receive_batch;
+    while(net_replay.next < net_replay.count || batch->next < batch->count)
+    {
+        int32 next = net_replay.next;
+        uint64 received = ctx->stats.datagrams_received;
+
+        DGL_Mem_Temp_Arena frame = dgl_mem_arena_begin_temp(temp.arena);
+        Net_Message message = {};
+        while(net_recv_message(frame.arena, ctx, &message) >= 0)
+        {
+            if(message_types && result.messages < cast(uint64)message_type_capacity)
+            {
+                message_types[result.messages] = message.type;
+            }
+            result.messages++;
+        }
+        dgl_mem_arena_end_temp(frame);
+
+        // NOTE(dgl): the next datagram is for the group, which the client did not join (yet)
+        if(net_replay.next == next && ctx->stats.datagrams_received == received)
+        {
+            net_replay.next++;
+            result.skipped++;
+        }
+    }
+    result.elapsed_ms = net_replay_clock_ms() - start_ms;
+
+    result.datagrams = ctx->stats.datagrams_received;
+    result.bytes = ctx->stats.bytes_received;
+    result.datagrams_sent = ctx->stats.datagrams_sent;
+    dgl_mem_arena_end_temp(temp);
+    platform = saved_platform;
+
+    return(result);
+}
@@ -0,0 +1,292 @@
+#include "zhc_lib.h"
+#include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
+#include "zhc_net.cpp"
+
+#include <string.h>
+#include <stdlib.h> /* mkstemp */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h> /* mmap */
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "sim_net_api.cpp"
+#include "linux_net_capture.cpp"
+
+#include "dgl_test_helpers.h"
+
+#define TEST_MAX_MESSAGES 256
+
+internal uint8 *
+test_read_file(DGL_Mem_Arena *arena, char *path, usize *size)
+{
+    uint8 *result = 0;
+    *size = 0;
+    int32 fd = open(path, O_RDONLY);
+    if(fd >= 0)
+    {
+        off_t file_size = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        result = dgl_mem_arena_push_array(arena, uint8, cast(usize)file_size);
+        while(*size < cast(usize)file_size)
+        {
+            ssize_t count = read(fd, result + *size, cast(usize)file_size - *size);
+            if(count <= 0) { break; }
+            *size += cast(usize)count;
+        }
+        close(fd);
+    }
+
+    return(result);
+}
+
+struct Test_Messages
+{
+    int32 count;
+    Net_Message_Type types[TEST_MAX_MESSAGES];
+};
+
+internal void
+test_push_message(Test_Messages *messages, Net_Message_Type type)
+{
+    if(messages->count < TEST_MAX_MESSAGES) { messages->types[messages->count] = type; }
+    messages->count++;
+}
+
+struct Test_Transfer
+{
+    bool32 complete;
+    uint16 client_port;
+    uint64 server_received;
+    Test_Messages server;
+    Test_Messages client;
+};
+
+// NOTE(dgl): a client receives a file from the server through a lossy simulated network. The
+// capture starts at the beginning or after the client connected. Only the messages returned while
+// capturing are recorded.
+internal Test_Transfer
+test_captured_transfer(DGL_Mem_Arena *arena, char *path, bool32 capture_after_connect)
+{
+    Test_Transfer result = {};
+    DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+
+    Sim_Link link = {};
+    link.delay_ms = 20.0;
+    link.jitter_ms = 5.0;
+    link.loss = 0.05f;
+    link.duplicate = 0.02f;
+    sim_init(temp.arena, 4096, 99, link);
+    sim_platform_api(&platform);
+    bool32 capturing = false;
+    if(!capture_after_connect) { capturing = linux_capture_begin(&platform, path, true); }
+
+    usize payload_size = kilobytes(32);
+    uint8 *payload = dgl_mem_arena_push_array(temp.arena, uint8, payload_size);
+    for(usize index = 0; index < payload_size; ++index) { payload[index] = cast(uint8)(index*13 + (index >> 8)); }
+    Net_Message file = {};
+    file.type = Net_Message_Data_Res;
+    file.payload = payload;
+    file.payload_size = payload_size;
+
+    Net_Context *server = net_init_server(temp.arena, 8);
+    net_open_socket(server);
+    Net_Context *client = net_init_client(temp.arena, payload_size);
+    Net_Thread *thread = net_thread_init(temp.arena, client, kilobytes(4), 2*payload_size);
+    net_thread_start(thread);
+
+    bool32 requested = false;
+    while(!result.complete && sim_get_time_in_ms() < 30000.0)
+    {
+        if(!capturing && client->conns->state[0] == Net_Conn_State_Connected)
+        {
+            // NOTE(dgl): the net functions of the contexts are taken from the platform on each call
+            capturing = linux_capture_begin(&platform, path, true);
+        }
+
+        DGL_Mem_Temp_Arena frame = dgl_mem_arena_begin_temp(temp.arena);
+        Net_Message message = {};
+        Net_Conn_ID id = 0;
+        while((id = net_recv_message(frame.arena, server, &message)) >= 0)
+        {
+            if(capturing) { test_push_message(&result.server, message.type); }
+            if(message.type == Net_Message_Data_Req) { net_send_message(server, id, file); }
+        }
+        net_process_timers(server);
+        dgl_mem_arena_end_temp(frame);
+
+        Net_Queue_Entry *event = 0;
+        while((event = net_queue_peek(&thread->events)) != 0)
+        {
+            if(capturing) { test_push_message(&result.client, event->message.type); }
+            result.complete = (event->message.type == Net_Message_Data_Res);
+            net_queue_pop(&thread->events, event);
+        }
+
+        if(capturing && !requested && client->conns->state[0] == Net_Conn_State_Connected)
+        {
+            Net_Message request = {};
+            request.type = Net_Message_Data_Req;
+            net_thread_send_message(thread, 0, request);
+            requested = true;
+        }
+        net_thread_step(thread);
+
+        sim_advance(1.0);
+    }
+
+    // NOTE(dgl): the datagrams still in the receive batch were captured, but not returned
+    result.server_received = server->stats.datagrams_received;
+    result.client_port = client->socket.address.port;
+    linux_capture_end();
+    dgl_mem_arena_end_temp(temp);
+
+    return(result);
+}
+
+int
+main(int argc, char **argv)
+{
+    usize memory_size = megabytes(256);
+    uint8 *memory_block = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
+    char path[] = "/tmp/zhc_capture_test_XXXXXX";
+    int32 fd = mkstemp(path);
+    if(fd >= 0) { close(fd); }
+
+    DGL_BEGIN_TEST("A capture records the direction, peers, ports and times of the datagrams");
+    {
+        Sim_Link link = {};
+        link.delay_ms = 5.0;
+        sim_init(&arena, 64, 1, link);
+        Zhc_Platform_Api api = {};
+        sim_platform_api(&api);
+        DGL_EXPECT_bool32(linux_capture_begin(&api, path, true), ==, true);
+
+        Zhc_Net_Socket server = {};
+        server.address.port = ZHC_SERVER_PORT;
+        Zhc_Net_Socket client = {};
+        api.open_socket(0, &server);
+        api.open_socket(0, &client);
+        Zhc_Net_Address server_address = sim_socket_address(&server);
+
+        uint8 data[3] = {1, 2, 3};
+        sim_advance(2.0);
+        api.send_data(&client, &server_address, data, sizeof(data));
+        sim_advance(5.0);
+
+        uint8 buffer[64] = {};
+        Zhc_Net_Datagram datagram = {};
+        datagram.data = buffer;
+        datagram.capacity = sizeof(buffer);
+        DGL_EXPECT_int32(api.receive_data_batch(&server, &datagram, 1), ==, 1);
+        api.send_data(&server, &datagram.address, data, 2);
+        sim_advance(5.5);
+        Zhc_Net_Address peer = {};
+        DGL_EXPECT_usize(api.receive_data(&client, &peer, buffer, sizeof(buffer)), ==, 2);
+        linux_capture_end();
+
+        usize size = 0;
+        uint8 *file = test_read_file(&arena, path, &size);
+        Net_Capture capture = {};
+        DGL_EXPECT_bool32(net_capture_parse(&arena, file, size, &capture), ==, true);
+        DGL_EXPECT_uint32(capture.flags, ==, Net_Capture_File_Flag_Server);
+        DGL_EXPECT_int32(capture.record_count, ==, 4);
+        DGL_EXPECT_usize(size, ==, NET_CAPTURE_HEADER_SIZE + 4*NET_CAPTURE_RECORD_SIZE + 3 + 3 + 2 + 2);
+
+        Net_Capture_Record *records = capture.records;
+        DGL_EXPECT_uint32(records[0].flags, ==, 0);
+        DGL_EXPECT_real64(records[0].time_ms, ==, 2.0);
+        DGL_EXPECT_bool32(address_compare(records[0].peer, server_address), ==, true);
+        DGL_EXPECT_uint32(records[0].local_port, ==, client.address.port);
+        DGL_EXPECT_usize(records[0].size, ==, 3);
+        DGL_EXPECT_int32(memcmp(records[0].data, data, 3), ==, 0);
+
+        DGL_EXPECT_uint32(records[1].flags, ==, Net_Capture_Flag_Received);
+        DGL_EXPECT_real64(records[1].time_ms, ==, 7.0);
+        DGL_EXPECT_bool32(address_compare(records[1].peer, sim_socket_address(&client)), ==, true);
+        DGL_EXPECT_uint32(records[1].local_port, ==, ZHC_SERVER_PORT);
+
+        DGL_EXPECT_uint32(records[2].flags, ==, 0);
+        DGL_EXPECT_real64(records[2].time_ms, ==, 7.0);
+        DGL_EXPECT_uint32(records[3].flags, ==, Net_Capture_Flag_Received);
+        DGL_EXPECT_real64(records[3].time_ms, ==, 12.5);
+        DGL_EXPECT_usize(records[3].size, ==, 2);
+
+        // NOTE(dgl): a truncated record is ignored
+        DGL_EXPECT_bool32(net_capture_parse(&arena, file, size - 1, &capture), ==, true);
+        DGL_EXPECT_int32(capture.record_count, ==, 3);
+        file[0] = 'X';
+        DGL_EXPECT_bool32(net_capture_parse(&arena, file, size, &capture), ==, false);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("A replay of a captured transfer returns the captured messages");
+    {
+        Test_Transfer transfer = test_captured_transfer(&arena, path, false);
+        DGL_EXPECT_bool32(transfer.complete, ==, true);
+
+        usize size = 0;
+        uint8 *file = test_read_file(&arena, path, &size);
+        Net_Capture capture = {};
+        DGL_EXPECT_bool32(net_capture_parse(&arena, file, size, &capture), ==, true);
+
+        Test_Messages replayed = {};
+        net_replay_prepare(&arena, &capture, true, ZHC_SERVER_PORT, 8);
+        Net_Replay_Stats stats = net_replay_run(&arena, replayed.types, TEST_MAX_MESSAGES);
+        DGL_EXPECT_uint64(stats.datagrams, ==, transfer.server_received);
+        DGL_EXPECT_int32(cast(int32)stats.messages, ==, transfer.server.count);
+        DGL_EXPECT_int32(memcmp(replayed.types, transfer.server.types, sizeof(Net_Message_Type)*cast(usize)transfer.server.count), ==, 0);
+
+        replayed = {};
+        net_replay_prepare(&arena, &capture, false, transfer.client_port, 8);
+        stats = net_replay_run(&arena, replayed.types, TEST_MAX_MESSAGES);
+        DGL_EXPECT_int32(cast(int32)stats.messages, ==, transfer.client.count);
+        DGL_EXPECT_int32(memcmp(replayed.types, transfer.client.types, sizeof(Net_Message_Type)*cast(usize)transfer.client.count), ==, 0);
+        DGL_EXPECT_uint32(replayed.types[transfer.client.count - 1], ==, Net_Message_Data_Res);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("A capture started after the handshake is replayed with the captured salts");
+    {
+        Test_Transfer transfer = test_captured_transfer(&arena, path, true);
+        DGL_EXPECT_bool32(transfer.complete, ==, true);
+
+        usize size = 0;
+        uint8 *file = test_read_file(&arena, path, &size);
+        Net_Capture capture = {};
+        DGL_EXPECT_bool32(net_capture_parse(&arena, file, size, &capture), ==, true);
+
+        Test_Messages replayed = {};
+        net_replay_prepare(&arena, &capture, true, ZHC_SERVER_PORT, 8);
+        Net_Replay_Stats stats = net_replay_run(&arena, replayed.types, TEST_MAX_MESSAGES);
+        DGL_EXPECT_int32(cast(int32)stats.messages, ==, transfer.server.count);
+        DGL_EXPECT_int32(memcmp(replayed.types, transfer.server.types, sizeof(Net_Message_Type)*cast(usize)transfer.server.count), ==, 0);
+
+        replayed = {};
+        net_replay_prepare(&arena, &capture, false, transfer.client_port, 8);
+        stats = net_replay_run(&arena, replayed.types, TEST_MAX_MESSAGES);
+        DGL_EXPECT_int32(cast(int32)stats.messages, ==, transfer.client.count);
+        DGL_EXPECT_uint32(replayed.types[transfer.client.count - 1], ==, Net_Message_Data_Res);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    unlink(path);
+
+    if(dgl_test_result()) { return(0); }
+    else { return(1); }
+}
@@ -0,0 +1,708 @@
+// NOTE(dgl): io_uring backend of the socket and file functions for linux. It is selected at startup
+// (see server_main.cpp) and falls back to the native sockets, if the kernel does not support it.
+// We do not depend on liburing. The rings are mapped and driven with the raw system calls.
+// Requires linux_net_api.cpp and sdl2_api.cpp.
+// DO NOT INCLUDE THIS FILE INTO THE PLATFORM INDEPENDENT CODE!
+//
+// Each socket has its own ring. A multishot receive stays posted on the socket. The kernel picks a
+// buffer of the provided buffer ring for each datagram and posts a completion. Receiving a batch
+// only reads the completion ring and does not need a system call. Sends are copied into the send
+// slots of the socket and submitted with one system call per batch. Runs of datagrams to the same
+// address are one message with UDP segmentation offload, like in linux_send_data_batch.
+
+#define LINUX_URING_ENTRIES 256
+#define LINUX_URING_RECEIVE_BUFFERS 256 /* NOTE(dgl): power of two */
+#define LINUX_URING_RECEIVE_BUFFER_SIZE 2048
+#define LINUX_URING_SEND_SLOTS 1024
+#define LINUX_URING_SEND_SLOT_SIZE 1536
+#define LINUX_URING_SEND_MESSAGES 256
+#define LINUX_URING_READ_SIZE kilobytes(256)
+
+enum Linux_Uring_Op
+{
+    Linux_Uring_Op_Receive,
+    Linux_Uring_Op_Send,
+    Linux_Uring_Op_Read,
+};
+
+struct Linux_Uring
+{
+    int32 fd;
+
+    uint32 *sq_head;
+    uint32 *sq_tail;
+    uint32 *sq_array;
+    uint32 sq_mask;
+    uint32 sq_entries;
+    uint32 sq_local_tail;
+    uint32 sq_submitted;
+    io_uring_sqe *sqes;
+
+    uint32 *cq_head;
+    uint32 *cq_tail;
+    uint32 cq_mask;
+    io_uring_cqe *cqes;
+
+    void *ring_memory;
+    usize ring_memory_size;
+    usize sqe_memory_size;
+};
+
+struct Linux_Uring_Message
+{
+    msghdr header;
+    sockaddr_in target;
+    iovec vectors[LINUX_MAX_SEGMENT_COUNT];
+    union
+    {
+        usize control_align; /* NOTE(dgl): alignment of cmsghdr */
+        uint8 control[CMSG_SPACE(sizeof(uint16))];
+    };
+    int32 slot_count;
+    uint16 slots[LINUX_MAX_SEGMENT_COUNT];
+};
+
+// NOTE(dgl): completions of the multishot receive, which were reaped while sending
+struct Linux_Uring_Received
+{
+    int32 size;
+    uint16 buffer_id;
+};
+
+struct Linux_Uring_Socket
+{
+    int32 fd;
+    Linux_Uring ring;
+
+    bool32 receive_armed;
+    msghdr receive_header;
+    io_uring_buf_ring *buffer_ring;
+    uint16 buffer_tail;
+    uint8 *receive_memory;
+
+    uint32 received_first;
+    uint32 received_count;
+    Linux_Uring_Received received[LINUX_URING_RECEIVE_BUFFERS];
+
+    uint8 *send_memory;
+    int32 free_slot_count;
+    uint16 free_slots[LINUX_URING_SEND_SLOTS];
+    int32 free_message_count;
+    uint16 free_messages[LINUX_URING_SEND_MESSAGES];
+    Linux_Uring_Message messages[LINUX_URING_SEND_MESSAGES];
+
+    usize memory_size;
+};
+
+global Linux_Uring linux_file_ring;
+
+internal uint64
+linux_uring_user_data(Linux_Uring_Op op, uint32 index)
+{
+    uint64 result = (cast(uint64)op << 32) | index;
+    return(result);
+}
+
+internal bool32
+linux_uring_setup(Linux_Uring *ring, uint32 entries)
+{
+    bool32 result = false;
+
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4*entries;
+    int32 fd = cast(int32)syscall(__NR_io_uring_setup, entries, &params);
+    if(fd >= 0)
+    {
+        // NOTE(dgl): We need the single mmap of both rings and the kernel must not drop completions
+        // if the completion ring overflows (5.5+).
+        uint32 required_features = IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP;
+        usize sq_size = params.sq_off.array + params.sq_entries*sizeof(uint32);
+        usize cq_size = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+        ring->ring_memory_size = dgl_max(sq_size, cq_size);
+        ring->sqe_memory_size = params.sq_entries*sizeof(io_uring_sqe);
+
+        void *ring_memory = MAP_FAILED;
+        void *sqe_memory = MAP_FAILED;
+        if((params.features & required_features) == required_features)
+        {
+            ring_memory = mmap(0, ring->ring_memory_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            sqe_memory = mmap(0, ring->sqe_memory_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+        }
+
+        if(ring_memory != MAP_FAILED && sqe_memory != MAP_FAILED)
+        {
+            uint8 *base = cast(uint8 *)ring_memory;
+            ring->fd = fd;
+            ring->ring_memory = ring_memory;
+            ring->sq_head = cast(uint32 *)(base + params.sq_off.head);
+            ring->sq_tail = cast(uint32 *)(base + params.sq_off.tail);
+            ring->sq_array = cast(uint32 *)(base + params.sq_off.array);
+            ring->sq_mask = *cast(uint32 *)(base + params.sq_off.ring_mask);
+            ring->sq_entries = params.sq_entries;
+            ring->sq_local_tail = *ring->sq_tail;
+            ring->sq_submitted = ring->sq_local_tail;
+            ring->sqes = cast(io_uring_sqe *)sqe_memory;
+            ring->cq_head = cast(uint32 *)(base + params.cq_off.head);
+            ring->cq_tail = cast(uint32 *)(base + params.cq_off.tail);
+            ring->cq_mask = *cast(uint32 *)(base + params.cq_off.ring_mask);
+            ring->cqes = cast(io_uring_cqe *)(base + params.cq_off.cqes);
+            result = true;
+        }
+        else
+        {
+            LOG("Failed mapping the io_uring (features %x)", params.features);
+            if(ring_memory != MAP_FAILED) { munmap(ring_memory, ring->ring_memory_size); }
+            if(sqe_memory != MAP_FAILED) { munmap(sqe_memory, ring->sqe_memory_size); }
+            close(fd);
+        }
+    }
+    else
+    {
+        LOG("Failed creating io_uring: %s", strerror(errno));
+    }
+
+    return(result);
+}
+
+internal void
+linux_uring_close(Linux_Uring *ring)
+{
+    if(ring->ring_memory)
+    {
+        munmap(ring->sqes, ring->sqe_memory_size);
+        munmap(ring->ring_memory, ring->ring_memory_size);
+        close(ring->fd);
+        *ring = {};
+    }
+}
+
+// NOTE(dgl): submits the queued entries and waits for wait_count completions
+internal bool32
+linux_uring_submit(Linux_Uring *ring, uint32 wait_count)
+{
+    uint32 submit_count = ring->sq_local_tail - ring->sq_submitted;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    bool32 result = true;
+    if(submit_count > 0 || wait_count > 0)
+    {
+        uint32 flags = (wait_count > 0) ? IORING_ENTER_GETEVENTS : 0;
+        int32 submitted = cast(int32)syscall(__NR_io_uring_enter, ring->fd, submit_count, wait_count, flags, 0, 0);
+        if(submitted >= 0)
+        {
+            ring->sq_submitted += cast(uint32)submitted;
+        }
+        else if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            LOG("Failed submitting to io_uring: %s", strerror(errno));
+            result = false;
+        }
+    }
+
+    return(result);
+}
+
+internal io_uring_sqe *
+linux_uring_get_sqe(Linux_Uring *ring)
+{
+    // NOTE(dgl): the kernel consumes the submitted entries in io_uring_enter
+    if(ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+    {
+        linux_uring_submit(ring, 0);
+    }
+
+    io_uring_sqe *result = 0;
+    if(ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) < ring->sq_entries)
+    {
+        uint32 index = ring->sq_local_tail++ & ring->sq_mask;
+        result = ring->sqes + index;
+        *result = {};
+        ring->sq_array[index] = index;
+    }
+
+    return(result);
+}
+
+internal io_uring_cqe *
+linux_uring_peek_cqe(Linux_Uring *ring)
+{
+    io_uring_cqe *result = 0;
+    uint32 head = *ring->cq_head;
+    if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        result = ring->cqes + (head & ring->cq_mask);
+    }
+
+    return(result);
+}
+
+internal void
+linux_uring_advance_cq(Linux_Uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+//
+// NOTE(dgl): Sockets
+//
+
+internal Linux_Uring_Socket *
+linux_uring_socket(Zhc_Net_Socket *socket)
+{
+    Linux_Uring_Socket *result = cast(Linux_Uring_Socket *)socket->handle.platform;
+    return(result);
+}
+
+internal void
+linux_uring_provide_buffer(Linux_Uring_Socket *uring_socket, uint16 buffer_id)
+{
+    // NOTE(dgl): the buffers start at the ring. The flexible array of io_uring_buf_ring has an offset in c++.
+    io_uring_buf *buffer = cast(io_uring_buf *)uring_socket->buffer_ring + (uring_socket->buffer_tail & (LINUX_URING_RECEIVE_BUFFERS - 1));
+    buffer->addr = cast(uint64)cast(uintptr_t)(uring_socket->receive_memory + cast(usize)buffer_id*LINUX_URING_RECEIVE_BUFFER_SIZE);
+    buffer->len = LINUX_URING_RECEIVE_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+    uring_socket->buffer_tail++;
+    __atomic_store_n(&uring_socket->buffer_ring->tail, uring_socket->buffer_tail, __ATOMIC_RELEASE);
+}
+
+internal void
+linux_uring_arm_receive(Linux_Uring_Socket *uring_socket)
+{
+    io_uring_sqe *sqe = linux_uring_get_sqe(&uring_socket->ring);
+    if(sqe)
+    {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = uring_socket->fd;
+        sqe->addr = cast(uint64)cast(uintptr_t)&uring_socket->receive_header;
+        sqe->len = 1;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = linux_uring_user_data(Linux_Uring_Op_Receive, 0);
+        uring_socket->receive_armed = true;
+    }
+}
+
+internal void
+linux_uring_release_message(Linux_Uring_Socket *uring_socket, uint32 message_index)
+{
+    Linux_Uring_Message *message = uring_socket->messages + message_index;
+    for(int32 index = 0; index < message->slot_count; ++index)
+    {
+        uring_socket->free_slots[uring_socket->free_slot_count++] = message->slots[index];
+    }
+    message->slot_count = 0;
+    uring_socket->free_messages[uring_socket->free_message_count++] = cast(uint16)message_index;
+}
+
+// NOTE(dgl): Releases the completed sends. Received datagrams are queued until they are received.
+// If the multishot receive stopped (e.g. all buffers were in use), it is posted again.
+internal void
+linux_uring_reap(Zhc_Net_Socket *socket)
+{
+    Linux_Uring_Socket *uring_socket = linux_uring_socket(socket);
+    io_uring_cqe *cqe = 0;
+    while((cqe = linux_uring_peek_cqe(&uring_socket->ring)) != 0)
+    {
+        Linux_Uring_Op op = cast(Linux_Uring_Op)(cqe->user_data >> 32);
+        uint32 index = cast(uint32)(cqe->user_data & 0xFFFFFFFF);
+        if(op == Linux_Uring_Op_Receive)
+        {
+            if(cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                assert(uring_socket->received_count < LINUX_URING_RECEIVE_BUFFERS, "More received datagrams than buffers");
+                Linux_Uring_Received *received = uring_socket->received + ((uring_socket->received_first + uring_socket->received_count++) % LINUX_URING_RECEIVE_BUFFERS);
+                received->size = cqe->res;
+                received->buffer_id = cast(uint16)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+            else if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+            {
+                LOG("Failed receiving udp packages: %s", strerror(-cqe->res));
+                socket->handle.no_error = false;
+            }
+
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+            {
+                uring_socket->receive_armed = false;
+            }
+        }
+        else if(op == Linux_Uring_Op_Send)
+        {
+            if(cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -ENOBUFS)
+            {
+                Linux_Uring_Message *message = uring_socket->messages + index;
+                if(message->header.msg_controllen > 0 && (cqe->res == -EIO || cqe->res == -EINVAL))
+                {
+                    LOG("UDP segmentation offload is not supported (%s). Sending the datagrams one by one", strerror(-cqe->res));
+                    linux_segmentation_disabled = true;
+                }
+                else
+                {
+                    LOG("Failed sending udp packages: %s", strerror(-cqe->res));
+                    socket->handle.no_error = false;
+                }
+            }
+            linux_uring_release_message(uring_socket, index);
+        }
+        linux_uring_advance_cq(&uring_socket->ring);
+    }
+
+    // NOTE(dgl): the receive is posted with the next submit. If all buffers are in use, we wait
+    // until the received datagrams are handled.
+    if(!uring_socket->receive_armed &&
+       socket->handle.no_error &&
+       uring_socket->received_count < LINUX_URING_RECEIVE_BUFFERS)
+    {
+        linux_uring_arm_receive(uring_socket);
+    }
+}
+
+// NOTE(dgl): the socket is opened with linux_open_socket. The ring and the buffers are allocated
+// with the socket and released in linux_uring_close_socket.
+ZHC_OPEN_SOCKET(linux_uring_open_socket)
+{
+    linux_open_socket(arena, socket);
+    if(socket->handle.no_error)
+    {
+        int32 fd = linux_socket_fd(socket);
+        socket->handle.no_error = false;
+
+        // NOTE(dgl): the buffer ring must be page aligned. It is at the start of the memory.
+        usize buffer_ring_size = LINUX_URING_RECEIVE_BUFFERS*sizeof(io_uring_buf);
+        usize memory_size = buffer_ring_size +
+                            LINUX_URING_RECEIVE_BUFFERS*LINUX_URING_RECEIVE_BUFFER_SIZE +
+                            LINUX_URING_SEND_SLOTS*LINUX_URING_SEND_SLOT_SIZE +
+                            sizeof(Linux_Uring_Socket);
+        uint8 *memory = cast(uint8 *)mmap(0, memory_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(memory != MAP_FAILED)
+        {
+            Linux_Uring_Socket *uring_socket = cast(Linux_Uring_Socket *)(memory + memory_size - sizeof(Linux_Uring_Socket));
+            uring_socket->fd = fd;
+            uring_socket->memory_size = memory_size;
+            uring_socket->buffer_ring = cast(io_uring_buf_ring *)memory;
+            uring_socket->receive_memory = memory + buffer_ring_size;
+            uring_socket->send_memory = uring_socket->receive_memory + LINUX_URING_RECEIVE_BUFFERS*LINUX_URING_RECEIVE_BUFFER_SIZE;
+            uring_socket->receive_header.msg_namelen = sizeof(sockaddr_in);
+
+            for(int32 index = 0; index < LINUX_URING_SEND_SLOTS; ++index)
+            {
+                uring_socket->free_slots[uring_socket->free_slot_count++] = cast(uint16)(LINUX_URING_SEND_SLOTS - 1 - index);
+            }
+            for(int32 index = 0; index < LINUX_URING_SEND_MESSAGES; ++index)
+            {
+                uring_socket->free_messages[uring_socket->free_message_count++] = cast(uint16)(LINUX_URING_SEND_MESSAGES - 1 - index);
+            }
+
+            if(linux_uring_setup(&uring_socket->ring, LINUX_URING_ENTRIES))
+            {
+                io_uring_buf_reg registration = {};
+                registration.ring_addr = cast(uint64)cast(uintptr_t)uring_socket->buffer_ring;
+                registration.ring_entries = LINUX_URING_RECEIVE_BUFFERS;
+                registration.bgid = 0;
+                if(syscall(__NR_io_uring_register, uring_socket->ring.fd, IORING_REGISTER_PBUF_RING, &registration, 1) == 0)
+                {
+                    for(int32 index = 0; index < LINUX_URING_RECEIVE_BUFFERS; ++index)
+                    {
+                        linux_uring_provide_buffer(uring_socket, cast(uint16)index);
+                    }
+
+                    linux_uring_arm_receive(uring_socket);
+                    if(linux_uring_submit(&uring_socket->ring, 0))
+                    {
+                        socket->handle.platform = uring_socket;
+                        socket->handle.no_error = true;
+                    }
+                }
+                else
+                {
+                    LOG("Failed registering the receive buffers: %s", strerror(errno));
+                }
+            }
+
+            if(!socket->handle.no_error)
+            {
+                linux_uring_close(&uring_socket->ring);
+                munmap(memory, memory_size);
+            }
+        }
+
+        if(!socket->handle.no_error)
+        {
+            LOG("Failed opening io_uring socket on port %u", socket->address.port);
+            close(fd);
+            socket->handle.platform = 0;
+        }
+    }
+}
+
+ZHC_CLOSE_SOCKET(linux_uring_close_socket)
+{
+    Linux_Uring_Socket *uring_socket = linux_uring_socket(socket);
+    if(uring_socket)
+    {
+        // NOTE(dgl): closing the ring cancels the posted receive
+        int32 fd = uring_socket->fd;
+        linux_uring_close(&uring_socket->ring);
+        uint8 *memory = cast(uint8 *)uring_socket->buffer_ring;
+        munmap(memory, uring_socket->memory_size);
+        close(fd);
+        socket->handle.platform = 0;
+        socket->handle.no_error = false;
+    }
+}
+
+// NOTE(dgl): the datagrams are copied into the send slots, so the caller can reuse the buffers.
+// If all slots are in flight, we wait for the completions of the previous sends.
+ZHC_SEND_DATA_BATCH(linux_uring_send_data_batch)
+{
+    Linux_Uring_Socket *uring_socket = linux_uring_socket(socket);
+    int32 offset = 0;
+    while(socket->handle.no_error && offset < count)
+    {
+#if defined(UDP_SEGMENT)
+        bool32 segment = !linux_segmentation_disabled;
+#else
+        bool32 segment = false;
+#endif
+        Zhc_Net_Datagram *first = datagrams + offset;
+        int32 segment_count = linux_segment_count(first, count - offset, segment);
+
+        linux_uring_reap(socket);
+        if(uring_socket->free_message_count == 0 || uring_socket->free_slot_count < segment_count)
+        {
+            socket->handle.no_error = linux_uring_submit(&uring_socket->ring, 1);
+            continue;
+        }
+
+        io_uring_sqe *sqe = linux_uring_get_sqe(&uring_socket->ring);
+        if(!sqe)
+        {
+            socket->handle.no_error = linux_uring_submit(&uring_socket->ring, 0);
+            continue;
+        }
+
+        uint32 message_index = uring_socket->free_messages[--uring_socket->free_message_count];
+        Linux_Uring_Message *message = uring_socket->messages + message_index;
+        message->header = {};
+        message->target = linux_sockaddr(&first->address);
+        message->header.msg_name = &message->target;
+        message->header.msg_namelen = sizeof(sockaddr_in);
+        message->header.msg_iov = message->vectors;
+        message->header.msg_iovlen = cast(usize)segment_count;
+        for(int32 index = 0; index < segment_count; ++index)
+        {
+            assert(first[index].size <= LINUX_URING_SEND_SLOT_SIZE, "Datagram too large for the send slot");
+            uint16 slot = uring_socket->free_slots[--uring_socket->free_slot_count];
+            uint8 *data = uring_socket->send_memory + cast(usize)slot*LINUX_URING_SEND_SLOT_SIZE;
+            dgl_memcpy(data, first[index].data, first[index].size);
+            message->slots[message->slot_count++] = slot;
+            message->vectors[index].iov_base = data;
+            message->vectors[index].iov_len = first[index].size;
+        }
+        if(segment_count > 1)
+        {
+            linux_set_segment_size(&message->header, message->control, first->size);
+        }
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = uring_socket->fd;
+        sqe->addr = cast(uint64)cast(uintptr_t)&message->header;
+        sqe->len = 1;
+        sqe->user_data = linux_uring_user_data(Linux_Uring_Op_Send, message_index);
+        offset += segment_count;
+    }
+
+    if(uring_socket && socket->handle.no_error)
+    {
+        socket->handle.no_error = linux_uring_submit(&uring_socket->ring, 0);
+    }
+}
+
+ZHC_RECEIVE_DATA_BATCH(linux_uring_receive_data_batch)
+{
+    int32 result = 0;
+    Linux_Uring_Socket *uring_socket = linux_uring_socket(socket);
+    if(socket->handle.no_error)
+    {
+        linux_uring_reap(socket);
+        while(result < count && uring_socket->received_count > 0)
+        {
+            Linux_Uring_Received *received = uring_socket->received + uring_socket->received_first;
+            uring_socket->received_first = (uring_socket->received_first + 1) % LINUX_URING_RECEIVE_BUFFERS;
+            uring_socket->received_count--;
+
+            // NOTE(dgl): the buffer starts with the header, followed by the peer address and the payload
+            uint8 *buffer = uring_socket->receive_memory + cast(usize)received->buffer_id*LINUX_URING_RECEIVE_BUFFER_SIZE;
+            io_uring_recvmsg_out *out = cast(io_uring_recvmsg_out *)buffer;
+            sockaddr_in *peer = cast(sockaddr_in *)(out + 1);
+            uint8 *payload = cast(uint8 *)(peer + 1);
+
+            Zhc_Net_Datagram *datagram = datagrams + result;
+            if(received->size > 0 &&
+               !(out->flags & MSG_TRUNC) &&
+               out->namelen >= sizeof(sockaddr_in) &&
+               out->payloadlen <= datagram->capacity)
+            {
+                dgl_memcpy(datagram->data, payload, out->payloadlen);
+                datagram->size = out->payloadlen;
+                datagram->address.host = peer->sin_addr.s_addr;
+                datagram->address.port = ntohs(peer->sin_port);
+                result++;
+            }
+            linux_uring_provide_buffer(uring_socket, received->buffer_id);
+        }
+
+        // NOTE(dgl): the multishot receive is only submitted again, if it stopped
+        if(!uring_socket->receive_armed) { linux_uring_reap(socket); }
+        if(uring_socket->ring.sq_local_tail != uring_socket->ring.sq_submitted)
+        {
+            socket->handle.no_error = linux_uring_submit(&uring_socket->ring, 0);
+        }
+    }
+
+    return(result);
+}
+
+ZHC_SEND_DATA(linux_uring_send_data)
+{
+    Zhc_Net_Datagram datagram = {};
+    datagram.address = *target_address;
+    datagram.data = buffer;
+    datagram.size = buffer_size;
+    linux_uring_send_data_batch(socket, &datagram, 1);
+}
+
+ZHC_RECEIVE_DATA(linux_uring_receive_data)
+{
+    Zhc_Net_Datagram datagram = {};
+    datagram.data = buffer;
+    datagram.capacity = buffer_size;
+    usize result = 0;
+    if(linux_uring_receive_data_batch(socket, &datagram, 1) > 0)
+    {
+        *peer_address = datagram.address;
+        result = datagram.size;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): the completions of the multishot receive are posted to the ring of the socket. The
+// ring is readable, if it has completions. The multicast socket is a native socket.
+ZHC_WAIT_FOR_DATA(linux_uring_wait_for_data)
+{
+    pollfd fds[2] = {};
+    nfds_t fd_count = 0;
+    bool32 has_data = false;
+    if(socket && socket->handle.no_error)
+    {
+        Linux_Uring_Socket *uring_socket = linux_uring_socket(socket);
+        linux_uring_reap(socket);
+        if(uring_socket->ring.sq_local_tail != uring_socket->ring.sq_submitted)
+        {
+            socket->handle.no_error = linux_uring_submit(&uring_socket->ring, 0);
+        }
+
+        has_data = (uring_socket->received_count > 0);
+        fds[fd_count].fd = uring_socket->ring.fd;
+        fds[fd_count++].events = POLLIN;
+    }
+    if(multicast_socket && multicast_socket->handle.no_error)
+    {
+        fds[fd_count].fd = linux_socket_fd(multicast_socket);
+        fds[fd_count++].events = POLLIN;
+    }
+
+    int32 timeout = has_data ? 0 : cast(int32)(timeout_ms + 0.5);
+    if(poll(fds, fd_count, timeout) < 0 && errno != EINTR)
+    {
+        LOG("Failed waiting for udp packages: %s", strerror(errno));
+    }
+}
+
+//
+// NOTE(dgl): Files
+//
+
+// NOTE(dgl): The file is read in pieces, which are submitted together with one system call.
+// Returns the number of read bytes.
+internal usize
+linux_uring_read(Linux_Uring *ring, int32 fd, uint8 *buffer, usize buffer_size)
+{
+    usize result = 0;
+    bool32 failed = false;
+    while(!failed && result < buffer_size)
+    {
+        usize start = result;
+        usize end = start;
+        uint32 submitted = 0;
+        while(end < buffer_size)
+        {
+            io_uring_sqe *sqe = linux_uring_get_sqe(ring);
+            if(!sqe) { break; }
+
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->off = end;
+            sqe->addr = cast(uint64)cast(uintptr_t)(buffer + end);
+            sqe->len = cast(uint32)dgl_min(buffer_size - end, LINUX_URING_READ_SIZE);
+            sqe->user_data = linux_uring_user_data(Linux_Uring_Op_Read, submitted++);
+            end += sqe->len;
+        }
+
+        // NOTE(dgl): a short read (e.g. the file changed) continues at the first incomplete piece
+        usize read_until = end;
+        uint32 completed = 0;
+        failed = (submitted == 0);
+        while(!failed && completed < submitted)
+        {
+            failed = !linux_uring_submit(ring, submitted - completed);
+            io_uring_cqe *cqe = 0;
+            while((cqe = linux_uring_peek_cqe(ring)) != 0)
+            {
+                usize offset = start + cast(usize)(cqe->user_data & 0xFFFFFFFF)*LINUX_URING_READ_SIZE;
+                usize expected = dgl_min(end - offset, LINUX_URING_READ_SIZE);
+                if(cqe->res < 0 || cast(usize)cqe->res < expected)
+                {
+                    failed |= (cqe->res <= 0);
+                    read_until = dgl_min(read_until, offset + cast(usize)dgl_max(cqe->res, 0));
+                }
+                completed++;
+                linux_uring_advance_cq(ring);
+            }
+        }
+        result = read_until;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Creates the ring of the file reads. Returns false if the kernel does not
+// support io_uring. Then the native backend should be used.
+internal bool32
+linux_uring_init()
+{
+    bool32 result = linux_file_ring.ring_memory || linux_uring_setup(&linux_file_ring, LINUX_URING_ENTRIES);
+    return(result);
+}
+
+// NOTE(dgl): The files are opened with SDL. Only files on disk have a file descriptor, assets
+// on android are read with SDL.
+ZHC_READ_ENTIRE_FILE(linux_uring_read_entire_file)
+{
+    SDL_RWops *io = cast(SDL_RWops *)handle->platform;
+    if(handle->no_error && io->type == SDL_RWOPS_STDFILE && linux_file_ring.ring_memory)
+    {
+        usize read = linux_uring_read(&linux_file_ring, fileno(io->hidden.stdio.fp), buffer, buffer_size);
+        if(read != buffer_size)
+        {
+            handle->no_error = false;
+            LOG_DEBUG("Could not read entire file: Handle: %p, Buffer: %p, Size: %zu, Read: %zu", io, buffer, buffer_size, read);
+        }
+    }
+    else
+    {
+        sdl_read_entire_file(handle, buffer, buffer_size);
+    }
+}
@@ -0,0 +1,158 @@
+#include <string.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_net.h>
+#include <sys/mman.h> /* mmap */
+
+#include "zhc_platform.h"
+#include <dirent.h> /* opendir, readdir */
+#include <errno.h>
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sdl2_api.cpp"
+#include "linux_net_api.cpp"
+#include "linux_uring_api.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "dgl_test_helpers.h"
+
+internal Zhc_Net_Address
+test_loopback_address(uint16 port)
+{
+    Zhc_Net_Address result = {};
+    result.ip[0] = 127;
+    result.ip[3] = 1;
+    result.port = port;
+
+    return(result);
+}
+
+int
+main(int argc, char **argv)
+{
+    // NOTE(dgl): the tests are skipped, if the kernel does not support io_uring (e.g. in a container)
+    if(!linux_uring_init())
+    {
+        LOG("io_uring is not supported. Skipping tests");
+        return(0);
+    }
+
+    DGL_BEGIN_TEST("Datagrams are received from the multishot receive and sent from the send slots");
+    {
+        Zhc_Net_Socket uring_socket = {};
+        linux_uring_open_socket(0, &uring_socket);
+        DGL_EXPECT_bool32(uring_socket.handle.no_error, ==, true);
+
+        Zhc_Net_Socket native_socket = {};
+        linux_open_socket(0, &native_socket);
+
+        // NOTE(dgl): more datagrams than receive buffers. The buffers are provided again after receiving.
+        uint8 data[32][1200] = {};
+        Zhc_Net_Datagram datagrams[32] = {};
+        uint8 buffer[32][1500] = {};
+        Zhc_Net_Datagram received[32] = {};
+        int32 received_count = 0;
+        bool32 in_order = true;
+        for(int32 burst = 0; burst < 3*LINUX_URING_RECEIVE_BUFFERS / 32; ++burst)
+        {
+            for(int32 index = 0; index < 32; ++index)
+            {
+                datagrams[index].address = test_loopback_address(uring_socket.address.port);
+                datagrams[index].data = data[index];
+                datagrams[index].size = array_count(data[index]);
+                dgl_memset(data[index], burst*32 + index, array_count(data[index]));
+            }
+            linux_send_data_batch(&native_socket, datagrams, 32);
+
+            for(int32 retry = 0; retry < 100 && received_count < (burst + 1)*32; ++retry)
+            {
+                for(int32 index = 0; index < 32; ++index)
+                {
+                    received[index].data = buffer[index];
+                    received[index].capacity = array_count(buffer[index]);
+                }
+
+                int32 count = linux_uring_receive_data_batch(&uring_socket, received, 32);
+                for(int32 index = 0; index < count; ++index)
+                {
+                    in_order &= (received[index].size == 1200);
+                    in_order &= (received[index].data[1199] == cast(uint8)received_count);
+                    in_order &= (received[index].address.port == native_socket.address.port);
+                    received_count++;
+                }
+                if(count == 0) { usleep(1000); }
+            }
+        }
+        DGL_EXPECT_int32(received_count, ==, 3*LINUX_URING_RECEIVE_BUFFERS);
+        DGL_EXPECT_bool32(in_order, ==, true);
+
+        for(int32 index = 0; index < 32; ++index)
+        {
+            datagrams[index].address = test_loopback_address(native_socket.address.port);
+            datagrams[index].size = (index == 31) ? 10 : 1200;
+        }
+        linux_uring_send_data_batch(&uring_socket, datagrams, 32);
+        DGL_EXPECT_bool32(uring_socket.handle.no_error, ==, true);
+
+        received_count = 0;
+        usize received_bytes = 0;
+        for(int32 retry = 0; retry < 100 && received_count < 32; ++retry)
+        {
+            for(int32 index = 0; index < 32; ++index)
+            {
+                received[index].data = buffer[index];
+                received[index].capacity = array_count(buffer[index]);
+            }
+
+            int32 count = linux_receive_data_batch(&native_socket, received, 32);
+            for(int32 index = 0; index < count; ++index) { received_bytes += received[index].size; }
+            received_count += count;
+            if(count == 0) { usleep(1000); }
+        }
+        DGL_EXPECT_int32(received_count, ==, 32);
+        DGL_EXPECT_usize(received_bytes, ==, 31*1200 + 10);
+
+        linux_uring_close_socket(&uring_socket);
+        linux_close_socket(&native_socket);
+        DGL_EXPECT_ptr(uring_socket.handle.platform, ==, 0);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Files larger than one read are read with one submit");
+    {
+        char path[] = "/tmp/zhc_uring_test_XXXXXX";
+        int32 fd = mkstemp(path);
+        DGL_EXPECT_int32(fd, >=, 0);
+
+        usize size = 3*LINUX_URING_READ_SIZE + 123;
+        uint8 *data = cast(uint8 *)mmap(0, 2*size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        uint8 *read_data = data + size;
+        for(usize index = 0; index < size; ++index) { data[index] = cast(uint8)(index*7); }
+        DGL_EXPECT_bool32(write(fd, data, size) == cast(ssize_t)size, ==, true);
+
+        usize read = linux_uring_read(&linux_file_ring, fd, read_data, size);
+        DGL_EXPECT_usize(read, ==, size);
+        DGL_EXPECT_int32(memcmp(data, read_data, size), ==, 0);
+
+        // NOTE(dgl): reading more than the file contains stops at the end of the file
+        DGL_EXPECT_usize(linux_uring_read(&linux_file_ring, fd, read_data, size + 1), ==, size);
+
+        close(fd);
+        unlink(path);
+        munmap(data, 2*size);
+    }
+    DGL_END_TEST();
+
+    if(dgl_test_result()) { return(0); }
+    else { return(1); }
+}
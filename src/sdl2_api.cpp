@@ -1,6 +1,54 @@
 // NOTE(dgl): Platform specific API implementations for the server and client platform.
 // DO NOT INCLUDE THIS FILE INTO THE PLATFORM INDEPENDENT CODE!
 
+ZHC_GET_TIME_IN_MS(sdl_get_time_in_ms)
+{
+    real64 result = 0.0;
+    real64 frequency = cast(real64)SDL_GetPerformanceFrequency();
+    result = cast(real64)SDL_GetPerformanceCounter() * 1000.0 / frequency;
+    return(result);
+}
+
+struct Sdl_Thread_Start
+{
+    Zhc_Thread_Proc *proc;
+    void *data;
+};
+
+internal int
+sdl_thread_proc(void *data)
+{
+    Sdl_Thread_Start start = *cast(Sdl_Thread_Start *)data;
+    SDL_free(data);
+    start.proc(start.data);
+    return(0);
+}
+
+// NOTE(dgl): the thread runs until the application exits
+ZHC_START_THREAD(sdl_start_thread)
+{
+    bool32 result = false;
+    Sdl_Thread_Start *start = cast(Sdl_Thread_Start *)SDL_malloc(sizeof(Sdl_Thread_Start));
+    if(start)
+    {
+        start->proc = proc;
+        start->data = data;
+        SDL_Thread *thread = SDL_CreateThread(sdl_thread_proc, thread_name, start);
+        if(thread)
+        {
+            SDL_DetachThread(thread);
+            result = true;
+        }
+        else
+        {
+            LOG("Failed creating thread %s: %s", thread_name, SDL_GetError());
+            SDL_free(start);
+        }
+    }
+
+    return(result);
+}
+
 // NOTE(dgl): to bind the udp socket to a random port, use a empty
 // Zhc_Net_Address structure.
 ZHC_OPEN_SOCKET(sdl_net_open_socket)
@@ -23,10 +23,24 @@
 // not in Microsoft Visual C++.
 #include <dirent.h> /* opendir, readdir */
 #include <errno.h>
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <sys/syscall.h> /* io_uring */
+#include <netinet/in.h>
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "sdl2_api.cpp"
+#include "linux_net_api.cpp"
+#include "linux_uring_api.cpp"
+#include "linux_net_capture.cpp"
 
 global bool32 global_running;
+global SDL_mutex *global_log_mutex;
 
 internal int64
 get_time_in_ms()
@@ -38,9 +52,18 @@ get_time_in_ms()
     return(result);
 }
 
+// NOTE(dgl): the net layer logs from its own thread
+internal void
+log_lock(bool32 lock)
+{
+    if(lock) { SDL_LockMutex(global_log_mutex); }
+    else { SDL_UnlockMutex(global_log_mutex); }
+}
+
 int main(int argc, char *argv[])
 {
-    dgl_log_init(get_time_in_ms);
+    global_log_mutex = SDL_CreateMutex();
+    dgl_log_init_threadsafe(get_time_in_ms, global_log_mutex ? log_lock : 0);
 
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
         LOG("Unable to initialize SDL: %s", SDL_GetError());
@@ -73,7 +96,33 @@ int main(int argc, char *argv[])
     void *base_address = 0;
 #endif
 
-    usize permanent_memory_size = megabytes(64);
+    // NOTE(dgl): usage: server_main_x64 [--max-clients <count>] [--shards <count>] [--io-uring] [--capture <file>]
+    int32 max_clients = 0;
+    int32 shard_count = 1;
+    bool32 use_io_uring = false;
+    char *capture_path = 0;
+    for(int32 index = 1; index < argc; ++index)
+    {
+        if(SDL_strcmp(argv[index], "--max-clients") == 0 && index + 1 < argc)
+        {
+            max_clients = SDL_atoi(argv[++index]);
+        }
+        else if(SDL_strcmp(argv[index], "--shards") == 0 && index + 1 < argc)
+        {
+            shard_count = dgl_clamp(SDL_atoi(argv[++index]), 1, ZHC_MAX_SERVER_SHARDS);
+        }
+        else if(SDL_strcmp(argv[index], "--io-uring") == 0)
+        {
+            use_io_uring = true;
+        }
+        else if(SDL_strcmp(argv[index], "--capture") == 0 && index + 1 < argc)
+        {
+            capture_path = argv[++index];
+        }
+    }
+
+    // NOTE(dgl): each shard has its own net thread, which binds its own socket to the server port
+    usize permanent_memory_size = megabytes(128) + cast(usize)(shard_count - 1)*ZHC_SHARD_MEMORY_SIZE;
     usize transient_memory_size = megabytes(16);
 
     // NOTE(dgl): Must be cleared to zero!!
@@ -90,16 +139,60 @@ int main(int argc, char *argv[])
         memory.permanent_storage = permanent_memory_block;
         memory.transient_storage_size = transient_memory_size;
         memory.transient_storage = transient_memory_block;
+
+        memory.max_clients = max_clients;
+        memory.shard_count = shard_count;
         memory.api.read_entire_file = sdl_read_entire_file;
         memory.api.close_file = sdl_close_file;
         memory.api.file_size = sdl_file_size;
         memory.api.get_directory_filenames = get_directory_filenames;
         memory.api.get_data_base_path = sdl_internal_storage_path;
         memory.api.get_user_data_base_path = sdl_external_storage_path;
-        memory.api.open_socket = sdl_net_open_socket;
-        memory.api.close_socket = sdl_net_close_socket;
-        memory.api.send_data = sdl_net_send_data;
-        memory.api.receive_data = sdl_net_receive_data;
+        memory.api.get_time_in_ms = sdl_get_time_in_ms;
+        // NOTE(dgl): the native sockets move the datagrams in batches (see linux_net_api_bench.cpp).
+        // The SDL_net functions (sdl_net_open_socket...) send and receive one datagram per call.
+        memory.api.open_socket = linux_open_socket;
+        memory.api.close_socket = linux_close_socket;
+        memory.api.send_data = linux_send_data;
+        memory.api.receive_data = linux_receive_data;
+        memory.api.send_data_batch = linux_send_data_batch;
+        memory.api.receive_data_batch = linux_receive_data_batch;
+        memory.api.open_multicast_socket = linux_open_multicast_socket;
+        memory.api.close_multicast_socket = linux_close_socket;
+        memory.api.receive_multicast_data = linux_receive_data;
+        memory.api.send_multicast_data = linux_send_data;
+        memory.api.receive_multicast_data_batch = linux_receive_data_batch;
+        memory.api.send_multicast_data_batch = linux_send_data_batch;
+        memory.api.start_thread = sdl_start_thread;
+        memory.api.wait_for_data = linux_wait_for_data;
+
+        // NOTE(dgl): the io_uring backend keeps a receive armed on each socket and submits a send batch
+        // with one syscall. Multicast stays on the native sockets.
+        if(use_io_uring)
+        {
+            if(linux_uring_init())
+            {
+                LOG("Using the io_uring backend");
+                memory.api.read_entire_file = linux_uring_read_entire_file;
+                memory.api.open_socket = linux_uring_open_socket;
+                memory.api.close_socket = linux_uring_close_socket;
+                memory.api.send_data = linux_uring_send_data;
+                memory.api.receive_data = linux_uring_receive_data;
+                memory.api.send_data_batch = linux_uring_send_data_batch;
+                memory.api.receive_data_batch = linux_uring_receive_data_batch;
+                memory.api.wait_for_data = linux_uring_wait_for_data;
+            }
+            else
+            {
+                LOG("io_uring is not supported by the kernel. Using the native sockets");
+            }
+        }
+
+        // NOTE(dgl): captures the datagrams of the backend for bench_zhc_net_replay_x64
+        if(capture_path)
+        {
+            linux_capture_begin(&memory.api, capture_path, true);
+        }
 
         Zhc_Offscreen_Buffer back_buffer = {};
         Zhc_Input input = {};
@@ -257,6 +350,7 @@ int main(int argc, char *argv[])
             last_counter = end_counter;
         }
 
+        linux_capture_end();
     }
     else
     {
@@ -0,0 +1,494 @@
+// NOTE(dgl): In-process network simulator behind the socket functions of the platform api. All sockets
+// are attached to one virtual network, which runs on a virtual clock. The clock only moves with
+// sim_advance, so the server and the clients can run in one process and a transfer of minutes takes
+// a few milliseconds. The datagrams are lost, duplicated, delayed and reordered with a seeded random
+// generator. A run with the same seed and the same calls delivers the same datagrams at the same time.
+// DO NOT INCLUDE THIS FILE INTO THE PLATFORM INDEPENDENT CODE!
+//
+// Each socket has its own host address (10.0.0.x), the sockets sharing a port share the host. The
+// link into a socket can have a rate limit with a drop tail queue, like the access point of a client.
+// There is no thread support. The lib steps the net layer each frame (start_thread is 0).
+
+#define SIM_MAX_SOCKETS 64
+#define SIM_MAX_DATAGRAM_SIZE 2048
+#define SIM_FIRST_EPHEMERAL_PORT 49152
+
+// NOTE(dgl): the conditions of the link into a socket. The loss, duplication and reordering are
+// probabilities from 0 to 1.
+struct Sim_Link
+{
+    real64 delay_ms;
+    real64 jitter_ms; /* NOTE(dgl): uniform in [-jitter, jitter]. Datagrams can overtake each other */
+    real32 loss;
+    real32 duplicate;
+    real32 reorder; /* NOTE(dgl): like netem, these datagrams are delivered without the delay */
+
+    // NOTE(dgl): bytes per ms the socket receives (0 is unlimited) and the bytes waiting for it,
+    // before new datagrams are dropped. The datagrams pass the limit in the order they were sent.
+    real64 rate;
+    usize queue_limit;
+};
+
+struct Sim_Datagram
+{
+    real64 deliver_at_ms;
+    uint64 sequence; /* NOTE(dgl): datagrams delivered at the same time arrive in the send order */
+    Zhc_Net_Address from;
+    usize size;
+    uint8 data[SIM_MAX_DATAGRAM_SIZE];
+};
+
+// NOTE(dgl): the datagrams in flight to the socket are a min heap ordered by the delivery time
+struct Sim_Socket
+{
+    bool32 open;
+    Zhc_Net_Address address;
+    Zhc_Net_Address group; /* NOTE(dgl): multicast group the socket joined */
+    int32 reuse_port_count;
+    int32 reuse_port_index;
+    Sim_Link link;
+    real64 busy_until_ms;
+
+    int32 in_flight;
+    int32 *heap;
+};
+
+struct Sim_Stats
+{
+    int32 sent;
+    int32 delivered;
+    int32 lost;
+    int32 duplicated;
+    int32 reordered;
+    int32 dropped; /* NOTE(dgl): by the queue of the rate limit or because the network is full */
+    usize bytes_delivered;
+};
+
+struct Sim_Network
+{
+    real64 now_ms;
+    uint32 random_state;
+    Sim_Link default_link;
+
+    int32 socket_count;
+    Sim_Socket sockets[SIM_MAX_SOCKETS];
+    uint16 next_port;
+
+    int32 capacity;
+    Sim_Datagram *datagrams;
+    int32 free_count;
+    int32 *free_slots;
+    uint64 next_sequence;
+
+    Sim_Stats stats;
+};
+
+global Sim_Network sim_network;
+
+internal uint32
+sim_random(void)
+{
+    // NOTE(dgl): xorshift32
+    uint32 x = sim_network.random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim_network.random_state = x;
+    return(x);
+}
+
+// NOTE(dgl): uniform in [0, 1)
+internal real64
+sim_random_unilateral(void)
+{
+    real64 result = cast(real64)sim_random() / 4294967296.0;
+    return(result);
+}
+
+// NOTE(dgl): The sockets opened before are forgotten. Capacity is the number of datagrams in flight.
+// The seed must not be 0.
+internal void
+sim_init(DGL_Mem_Arena *arena, int32 capacity, uint32 seed, Sim_Link link)
+{
+    assert(seed != 0, "The seed of the simulator must not be 0");
+    sim_network = {};
+    sim_network.random_state = seed;
+    sim_network.default_link = link;
+    sim_network.next_port = SIM_FIRST_EPHEMERAL_PORT;
+    sim_network.capacity = capacity;
+    sim_network.datagrams = dgl_mem_arena_push_array(arena, Sim_Datagram, cast(usize)capacity);
+    sim_network.free_slots = dgl_mem_arena_push_array(arena, int32, cast(usize)capacity);
+    for(int32 index = 0; index < capacity; ++index)
+    {
+        sim_network.free_slots[index] = capacity - 1 - index;
+    }
+    sim_network.free_count = capacity;
+
+    for(int32 index = 0; index < SIM_MAX_SOCKETS; ++index)
+    {
+        sim_network.sockets[index].heap = dgl_mem_arena_push_array(arena, int32, cast(usize)capacity);
+    }
+}
+
+internal void
+sim_advance(real64 ms)
+{
+    sim_network.now_ms += ms;
+}
+
+internal Sim_Socket *
+sim_socket(Zhc_Net_Socket *socket)
+{
+    Sim_Socket *result = 0;
+    intptr_t index = cast(intptr_t)socket->handle.platform - 1;
+    if(socket->handle.no_error && index >= 0 && index < sim_network.socket_count)
+    {
+        result = sim_network.sockets + index;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): the address the peers send to (the socket address only contains the port)
+internal Zhc_Net_Address
+sim_socket_address(Zhc_Net_Socket *socket)
+{
+    Zhc_Net_Address result = {};
+    Sim_Socket *sim = sim_socket(socket);
+    if(sim) { result = sim->address; }
+
+    return(result);
+}
+
+// NOTE(dgl): the link into the socket. It starts with the default link of the network.
+internal void
+sim_set_link(Zhc_Net_Socket *socket, Sim_Link link)
+{
+    Sim_Socket *sim = sim_socket(socket);
+    assert(sim, "Socket is not a simulated socket");
+    sim->link = link;
+}
+
+internal bool32
+sim_datagram_before(int32 a, int32 b)
+{
+    Sim_Datagram *first = sim_network.datagrams + a;
+    Sim_Datagram *second = sim_network.datagrams + b;
+    bool32 result = (first->deliver_at_ms < second->deliver_at_ms ||
+                     (first->deliver_at_ms == second->deliver_at_ms && first->sequence < second->sequence));
+    return(result);
+}
+
+internal void
+sim_heap_push(Sim_Socket *socket, int32 slot)
+{
+    int32 index = socket->in_flight++;
+    socket->heap[index] = slot;
+    while(index > 0)
+    {
+        int32 parent = (index - 1) / 2;
+        if(!sim_datagram_before(socket->heap[index], socket->heap[parent])) { break; }
+        int32 swap = socket->heap[parent];
+        socket->heap[parent] = socket->heap[index];
+        socket->heap[index] = swap;
+        index = parent;
+    }
+}
+
+internal int32
+sim_heap_pop(Sim_Socket *socket)
+{
+    int32 result = socket->heap[0];
+    socket->heap[0] = socket->heap[--socket->in_flight];
+    int32 index = 0;
+    for(;;)
+    {
+        int32 smallest = index;
+        int32 left = 2*index + 1;
+        int32 right = left + 1;
+        if(left < socket->in_flight && sim_datagram_before(socket->heap[left], socket->heap[smallest])) { smallest = left; }
+        if(right < socket->in_flight && sim_datagram_before(socket->heap[right], socket->heap[smallest])) { smallest = right; }
+        if(smallest == index) { break; }
+        int32 swap = socket->heap[smallest];
+        socket->heap[smallest] = socket->heap[index];
+        socket->heap[index] = swap;
+        index = smallest;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): the time of the next datagram to any socket, or -1 if nothing is in flight.
+// Drivers can jump the clock to it, instead of advancing in small steps.
+internal real64
+sim_next_delivery_ms(void)
+{
+    real64 result = -1.0;
+    for(int32 index = 0; index < sim_network.socket_count; ++index)
+    {
+        Sim_Socket *socket = sim_network.sockets + index;
+        if(socket->in_flight > 0)
+        {
+            real64 deliver_at_ms = sim_network.datagrams[socket->heap[0]].deliver_at_ms;
+            if(result < 0.0 || deliver_at_ms < result) { result = deliver_at_ms; }
+        }
+    }
+
+    return(result);
+}
+
+internal void
+sim_queue_datagram(Sim_Socket *target, Zhc_Net_Address from, uint8 *buffer, usize buffer_size)
+{
+    Sim_Link *link = &target->link;
+    int32 copies = 1;
+    if(sim_random_unilateral() < link->loss)
+    {
+        sim_network.stats.lost++;
+        copies = 0;
+    }
+    else if(sim_random_unilateral() < link->duplicate)
+    {
+        sim_network.stats.duplicated++;
+        copies = 2;
+    }
+
+    for(int32 copy = 0; copy < copies; ++copy)
+    {
+        real64 delay_ms = link->delay_ms + (2.0*sim_random_unilateral() - 1.0)*link->jitter_ms;
+        if(sim_random_unilateral() < link->reorder)
+        {
+            sim_network.stats.reordered++;
+            delay_ms = 0.0;
+        }
+        real64 deliver_at_ms = sim_network.now_ms + dgl_max(delay_ms, 0.0);
+
+        bool32 dropped = false;
+        if(link->rate > 0.0)
+        {
+            real64 start_ms = dgl_max(deliver_at_ms, target->busy_until_ms);
+            real64 queued_bytes = (start_ms - deliver_at_ms)*link->rate;
+            if(queued_bytes > cast(real64)link->queue_limit)
+            {
+                dropped = true;
+            }
+            else
+            {
+                deliver_at_ms = start_ms + cast(real64)buffer_size / link->rate;
+                target->busy_until_ms = deliver_at_ms;
+            }
+        }
+
+        if(!dropped && sim_network.free_count == 0)
+        {
+            LOG("The simulated network is full. Dropping datagram");
+            dropped = true;
+        }
+
+        if(dropped)
+        {
+            sim_network.stats.dropped++;
+        }
+        else
+        {
+            int32 slot = sim_network.free_slots[--sim_network.free_count];
+            Sim_Datagram *datagram = sim_network.datagrams + slot;
+            datagram->deliver_at_ms = deliver_at_ms;
+            datagram->sequence = sim_network.next_sequence++;
+            datagram->from = from;
+            datagram->size = buffer_size;
+            dgl_memcpy(datagram->data, buffer, buffer_size);
+            sim_heap_push(target, slot);
+        }
+    }
+}
+
+ZHC_GET_TIME_IN_MS(sim_get_time_in_ms)
+{
+    real64 result = sim_network.now_ms;
+    return(result);
+}
+
+ZHC_OPEN_SOCKET(sim_open_socket)
+{
+    // NOTE(dgl): the slots of closed sockets are reused
+    int32 index = 0;
+    while(index < sim_network.socket_count && sim_network.sockets[index].open) { index++; }
+
+    if(index < SIM_MAX_SOCKETS)
+    {
+        sim_network.socket_count = dgl_max(sim_network.socket_count, index + 1);
+        Sim_Socket *sim = sim_network.sockets + index;
+        int32 *heap = sim->heap;
+        *sim = {};
+        sim->heap = heap;
+        sim->open = true;
+        sim->link = sim_network.default_link;
+
+        if(socket->address.port == 0)
+        {
+            socket->address.port = sim_network.next_port++;
+        }
+        sim->address.port = socket->address.port;
+        sim->reuse_port_count = socket->reuse_port_count;
+        sim->address.ip[0] = 10;
+        sim->address.ip[2] = cast(uint8)(index / 250);
+        sim->address.ip[3] = cast(uint8)(1 + index % 250);
+
+        // NOTE(dgl): the sockets sharing a port are on the same host and numbered in the order they were opened
+        if(socket->reuse_port_count > 0)
+        {
+            for(int32 other = 0; other < sim_network.socket_count; ++other)
+            {
+                Sim_Socket *shared = sim_network.sockets + other;
+                if(shared != sim && shared->open && shared->reuse_port_count > 0 &&
+                   shared->address.port == sim->address.port)
+                {
+                    sim->address.host = shared->address.host;
+                    sim->reuse_port_index = dgl_max(sim->reuse_port_index, shared->reuse_port_index + 1);
+                }
+            }
+        }
+
+        socket->handle.platform = cast(void *)cast(intptr_t)(index + 1);
+        socket->handle.no_error = true;
+    }
+    else
+    {
+        LOG("Failed opening socket on port %u: the simulated network has no free socket", socket->address.port);
+    }
+}
+
+ZHC_CLOSE_SOCKET(sim_close_socket)
+{
+    Sim_Socket *sim = sim_socket(socket);
+    if(sim)
+    {
+        while(sim->in_flight > 0)
+        {
+            sim_network.free_slots[sim_network.free_count++] = sim_heap_pop(sim);
+        }
+        sim->open = false;
+    }
+    socket->handle.platform = 0;
+    socket->handle.no_error = false;
+}
+
+// NOTE(dgl): The group is the target address of the group. If join is set, the socket receives the
+// datagrams sent to the group. Otherwise it is only used to send to the group.
+ZHC_OPEN_MULTICAST_SOCKET(sim_open_multicast_socket)
+{
+    socket->address.port = join ? group->port : 0;
+    sim_open_socket(0, socket);
+    Sim_Socket *sim = sim_socket(socket);
+    if(sim && join)
+    {
+        sim->group = *group;
+    }
+}
+
+ZHC_SEND_DATA(sim_send_data)
+{
+    Sim_Socket *sender = sim_socket(socket);
+    if(sender && buffer_size <= SIM_MAX_DATAGRAM_SIZE)
+    {
+        sim_network.stats.sent++;
+        bool32 broadcast = (target_address->host == 0xFFFFFFFF);
+        for(int32 index = 0; index < sim_network.socket_count; ++index)
+        {
+            Sim_Socket *target = sim_network.sockets + index;
+            if(target == sender || !target->open) { continue; }
+
+            bool32 receives = false;
+            if(broadcast)
+            {
+                receives = (target->address.port == target_address->port);
+            }
+            else if(target->group.not_null)
+            {
+                receives = (target->group.host == target_address->host && target->group.port == target_address->port);
+            }
+            else if(target->address.host == target_address->host && target->address.port == target_address->port)
+            {
+                // NOTE(dgl): like the program attached by linux_open_socket
+                receives = (target->reuse_port_count == 0 ||
+                            target->reuse_port_index == sender->address.port % target->reuse_port_count);
+            }
+
+            if(receives)
+            {
+                sim_queue_datagram(target, sender->address, buffer, buffer_size);
+            }
+        }
+    }
+    else
+    {
+        LOG("Failed sending %zu bytes: invalid socket or datagram too large", buffer_size);
+    }
+}
+
+ZHC_RECEIVE_DATA(sim_receive_data)
+{
+    usize result = 0;
+    Sim_Socket *sim = sim_socket(socket);
+    if(sim && sim->in_flight > 0 &&
+       sim_network.datagrams[sim->heap[0]].deliver_at_ms <= sim_network.now_ms)
+    {
+        int32 slot = sim_heap_pop(sim);
+        Sim_Datagram *datagram = sim_network.datagrams + slot;
+        *peer_address = datagram->from;
+        // NOTE(dgl): truncated like a udp datagram in a small buffer
+        result = dgl_min(datagram->size, buffer_size);
+        dgl_memcpy(buffer, datagram->data, result);
+        sim_network.free_slots[sim_network.free_count++] = slot;
+
+        sim_network.stats.delivered++;
+        sim_network.stats.bytes_delivered += result;
+    }
+
+    return(result);
+}
+
+ZHC_SEND_DATA_BATCH(sim_send_data_batch)
+{
+    for(int32 index = 0; index < count; ++index)
+    {
+        Zhc_Net_Datagram *datagram = datagrams + index;
+        sim_send_data(socket, &datagram->address, datagram->data, datagram->size);
+    }
+}
+
+ZHC_RECEIVE_DATA_BATCH(sim_receive_data_batch)
+{
+    int32 result = 0;
+    while(result < count)
+    {
+        Zhc_Net_Datagram *datagram = datagrams + result;
+        datagram->size = sim_receive_data(socket, &datagram->address, datagram->data, datagram->capacity);
+        if(datagram->size == 0) { break; }
+        result++;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): sets the clock and socket functions. The file functions are left as they are.
+internal void
+sim_platform_api(Zhc_Platform_Api *api)
+{
+    api->get_time_in_ms = sim_get_time_in_ms;
+    api->open_socket = sim_open_socket;
+    api->close_socket = sim_close_socket;
+    api->receive_data = sim_receive_data;
+    api->send_data = sim_send_data;
+    api->open_multicast_socket = sim_open_multicast_socket;
+    api->close_multicast_socket = sim_close_socket;
+    api->receive_multicast_data = sim_receive_data;
+    api->send_multicast_data = sim_send_data;
+    api->receive_data_batch = sim_receive_data_batch;
+    api->send_data_batch = sim_send_data_batch;
+    api->receive_multicast_data_batch = sim_receive_data_batch;
+    api->send_multicast_data_batch = sim_send_data_batch;
+    api->start_thread = 0;
+    api->wait_for_data = 0;
+}
@@ -0,0 +1,319 @@
+#include "zhc_lib.h"
+#include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
+#include "zhc_net.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "sim_net_api.cpp"
+
+#include "dgl_test_helpers.h"
+#include <sys/mman.h> /* mmap */
+
+#define TEST_SEQUENCE_COUNT 1000
+
+// NOTE(dgl): sends numbered datagrams through the link and returns the numbers in the order they arrived
+internal int32
+test_received_sequence(DGL_Mem_Arena *arena, uint32 seed, Sim_Link link, uint32 *received, int32 capacity)
+{
+    sim_init(arena, 4*TEST_SEQUENCE_COUNT, seed, link);
+    Zhc_Net_Socket sender = {};
+    Zhc_Net_Socket receiver = {};
+    sim_open_socket(0, &sender);
+    sim_open_socket(0, &receiver);
+    Zhc_Net_Address target = sim_socket_address(&receiver);
+
+    for(uint32 number = 0; number < TEST_SEQUENCE_COUNT; ++number)
+    {
+        sim_send_data(&sender, &target, cast(uint8 *)&number, sizeof(number));
+        sim_advance(1.0);
+    }
+    sim_advance(1000.0);
+
+    int32 result = 0;
+    Zhc_Net_Address peer = {};
+    while(result < capacity &&
+          sim_receive_data(&receiver, &peer, cast(uint8 *)(received + result), sizeof(*received)) > 0)
+    {
+        result++;
+    }
+
+    return(result);
+}
+
+struct Test_Transfer
+{
+    bool32 complete;
+    bool32 valid;
+    real64 complete_ms;
+    Sim_Stats network;
+    Net_Stats server;
+};
+
+// NOTE(dgl): a server and a client on the virtual network. The client is stepped each frame like
+// the lib does, if the net thread is not running. It polls the hash and requests the file.
+internal Test_Transfer
+test_transfer(DGL_Mem_Arena *arena, uint32 seed, Sim_Link link, usize payload_size)
+{
+    Test_Transfer result = {};
+    DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+    sim_init(temp.arena, 4096, seed, link);
+    sim_platform_api(&platform);
+
+    uint8 *payload = dgl_mem_arena_push_array(temp.arena, uint8, payload_size);
+    for(usize index = 0; index < payload_size; ++index) { payload[index] = cast(uint8)(index*7 + (index >> 9)); }
+    Net_Message file = {};
+    file.type = Net_Message_Data_Res;
+    file.payload = payload;
+    file.payload_size = payload_size;
+    file.payload_hash = HASH_OFFSET_BASIS;
+    hash(&file.payload_hash, payload, payload_size);
+
+    Net_Context *server = net_init_server(temp.arena, 8);
+    net_open_socket(server);
+
+    Net_Context *client = net_init_client(temp.arena, payload_size);
+    Net_Thread *thread = net_thread_init(temp.arena, client, kilobytes(4), 2*payload_size);
+    net_thread_start(thread);
+
+    real64 poll_at_ms = 0.0;
+    real64 frame_ms = 1.0;
+    while(!result.complete && sim_get_time_in_ms() < 60000.0)
+    {
+        DGL_Mem_Temp_Arena frame = dgl_mem_arena_begin_temp(temp.arena);
+        Net_Message message = {};
+        Net_Conn_ID id = 0;
+        while((id = net_recv_message(frame.arena, server, &message)) >= 0)
+        {
+            if(message.type == Net_Message_Hash_Req)
+            {
+                Net_Message response = {};
+                response.type = Net_Message_Hash_Res;
+                response.payload = cast(uint8 *)&file.payload_hash;
+                response.payload_size = sizeof(file.payload_hash);
+                net_send_message(server, id, response);
+            }
+            else if(message.type == Net_Message_Data_Req)
+            {
+                net_send_message(server, id, file);
+            }
+        }
+        net_process_timers(server);
+        dgl_mem_arena_end_temp(frame);
+
+        Net_Queue_Entry *event = 0;
+        while((event = net_queue_peek(&thread->events)) != 0)
+        {
+            if(event->message.type == Net_Message_Hash_Res)
+            {
+                Net_Message request = {};
+                request.type = Net_Message_Data_Req;
+                net_thread_send_message(thread, event->id, request);
+            }
+            else if(event->message.type == Net_Message_Data_Res)
+            {
+                result.complete = true;
+                result.complete_ms = sim_get_time_in_ms();
+                result.valid = (event->message.payload_size == payload_size &&
+                                memcmp(event->message.payload, payload, payload_size) == 0);
+            }
+            net_queue_pop(&thread->events, event);
+        }
+
+        if(client->conns->state[0] == Net_Conn_State_Connected && sim_get_time_in_ms() >= poll_at_ms)
+        {
+            poll_at_ms = sim_get_time_in_ms() + 1000.0;
+            Net_Message request = {};
+            request.type = Net_Message_Hash_Req;
+            net_thread_send_message(thread, 0, request);
+        }
+        net_thread_step(thread);
+
+        sim_advance(frame_ms);
+    }
+
+    result.network = sim_network.stats;
+    result.server = server->stats;
+    dgl_mem_arena_end_temp(temp);
+
+    return(result);
+}
+
+int
+main(int argc, char **argv)
+{
+    usize memory_size = megabytes(256);
+    uint8 *memory_block = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
+    DGL_BEGIN_TEST("Datagrams arrive after the delay of the link and broadcasts reach all sockets on the port");
+    {
+        Sim_Link link = {};
+        link.delay_ms = 10.0;
+        sim_init(&arena, 64, 1, link);
+
+        Zhc_Net_Socket server = {};
+        server.address.port = ZHC_SERVER_PORT;
+        Zhc_Net_Socket clients[2] = {};
+        sim_open_socket(0, &server);
+        sim_open_socket(0, clients + 0);
+        sim_open_socket(0, clients + 1);
+        DGL_EXPECT_bool32(server.handle.no_error, ==, true);
+        DGL_EXPECT_uint32(server.address.port, ==, ZHC_SERVER_PORT);
+        DGL_EXPECT_bool32(clients[0].address.port != clients[1].address.port, ==, true);
+
+        Zhc_Net_Address server_address = sim_socket_address(&server);
+        for(uint8 number = 0; number < 3; ++number)
+        {
+            sim_send_data(clients + 0, &server_address, &number, sizeof(number));
+        }
+
+        uint8 data[16] = {};
+        Zhc_Net_Address peer = {};
+        DGL_EXPECT_usize(sim_receive_data(&server, &peer, data, sizeof(data)), ==, 0);
+        sim_advance(9.5);
+        DGL_EXPECT_usize(sim_receive_data(&server, &peer, data, sizeof(data)), ==, 0);
+        sim_advance(0.5);
+        for(uint8 number = 0; number < 3; ++number)
+        {
+            DGL_EXPECT_usize(sim_receive_data(&server, &peer, data, sizeof(data)), ==, 1);
+            DGL_EXPECT_uint32(data[0], ==, number);
+        }
+        DGL_EXPECT_bool32(address_compare(peer, sim_socket_address(clients + 0)), ==, true);
+
+        Zhc_Net_Address broadcast = parse_address("255.255.255.255", ZHC_SERVER_PORT);
+        sim_send_data(clients + 1, &broadcast, data, 4);
+        sim_advance(10.0);
+        DGL_EXPECT_usize(sim_receive_data(&server, &peer, data, sizeof(data)), ==, 4);
+        DGL_EXPECT_usize(sim_receive_data(clients + 0, &peer, data, sizeof(data)), ==, 0);
+
+        // NOTE(dgl): the datagrams to a closed socket are gone
+        sim_send_data(clients + 1, &server_address, data, 4);
+        sim_close_socket(&server);
+        DGL_EXPECT_int32(sim_network.free_count, ==, 64);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Losses, duplicates and the order of the datagrams follow the seed");
+    {
+        Sim_Link link = {};
+        link.delay_ms = 20.0;
+        link.jitter_ms = 5.0;
+        link.loss = 0.2f;
+        link.duplicate = 0.1f;
+        link.reorder = 0.1f;
+
+        uint32 *first = dgl_mem_arena_push_array(&arena, uint32, 2*TEST_SEQUENCE_COUNT);
+        uint32 *second = dgl_mem_arena_push_array(&arena, uint32, 2*TEST_SEQUENCE_COUNT);
+        DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(&arena);
+        int32 first_count = test_received_sequence(temp.arena, 42, link, first, 2*TEST_SEQUENCE_COUNT);
+        Sim_Stats stats = sim_network.stats;
+        dgl_mem_arena_end_temp(temp);
+
+        temp = dgl_mem_arena_begin_temp(&arena);
+        int32 second_count = test_received_sequence(temp.arena, 42, link, second, 2*TEST_SEQUENCE_COUNT);
+        dgl_mem_arena_end_temp(temp);
+
+        DGL_EXPECT_int32(first_count, ==, second_count);
+        DGL_EXPECT_int32(memcmp(first, second, sizeof(*first)*cast(usize)first_count), ==, 0);
+        DGL_EXPECT_int32(first_count, ==, TEST_SEQUENCE_COUNT - stats.lost + stats.duplicated);
+        DGL_EXPECT_int32(stats.lost, >, 150);
+        DGL_EXPECT_int32(stats.lost, <, 250);
+        DGL_EXPECT_int32(stats.duplicated, >, 50);
+        DGL_EXPECT_int32(stats.duplicated, <, 110);
+
+        int32 out_of_order = 0;
+        for(int32 index = 1; index < first_count; ++index)
+        {
+            out_of_order += (first[index] < first[index - 1]);
+        }
+        DGL_EXPECT_int32(out_of_order, >, 0);
+
+        temp = dgl_mem_arena_begin_temp(&arena);
+        second_count = test_received_sequence(temp.arena, 7, link, second, 2*TEST_SEQUENCE_COUNT);
+        dgl_mem_arena_end_temp(temp);
+        bool32 same = (first_count == second_count &&
+                       memcmp(first, second, sizeof(*first)*cast(usize)first_count) == 0);
+        DGL_EXPECT_bool32(same, ==, false);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The rate limit spaces the datagrams and drops them above the queue limit");
+    {
+        Sim_Link link = {};
+        link.rate = 120.0;
+        link.queue_limit = 3600;
+        sim_init(&arena, 64, 1, link);
+
+        Zhc_Net_Socket sender = {};
+        Zhc_Net_Socket receiver = {};
+        sim_open_socket(0, &sender);
+        sim_open_socket(0, &receiver);
+        Zhc_Net_Address target = sim_socket_address(&receiver);
+
+        uint8 data[1200] = {};
+        for(int32 index = 0; index < 10; ++index)
+        {
+            sim_send_data(&sender, &target, data, sizeof(data));
+        }
+        DGL_EXPECT_int32(sim_network.stats.dropped, ==, 6);
+
+        Zhc_Net_Address peer = {};
+        for(int32 index = 0; index < 4; ++index)
+        {
+            DGL_EXPECT_real64(sim_next_delivery_ms(), ==, 10.0*(index + 1));
+            sim_advance(sim_next_delivery_ms() - sim_get_time_in_ms());
+            DGL_EXPECT_usize(sim_receive_data(&receiver, &peer, data, sizeof(data)), ==, sizeof(data));
+            DGL_EXPECT_usize(sim_receive_data(&receiver, &peer, data, sizeof(data)), ==, 0);
+        }
+        DGL_EXPECT_real64(sim_next_delivery_ms(), ==, -1.0);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("A client receives a file through a lossy network on the virtual clock");
+    {
+        Sim_Link link = {};
+        link.delay_ms = 30.0;
+        link.jitter_ms = 10.0;
+        link.loss = 0.1f;
+        link.duplicate = 0.02f;
+        link.reorder = 0.05f;
+
+        Test_Transfer first = test_transfer(&arena, 1234, link, kilobytes(64));
+        Test_Transfer second = test_transfer(&arena, 1234, link, kilobytes(64));
+        DGL_EXPECT_bool32(first.complete, ==, true);
+        DGL_EXPECT_bool32(first.valid, ==, true);
+        DGL_EXPECT_uint64(first.server.datagrams_resent, >, 0);
+        DGL_EXPECT_int32(first.network.lost, >, 0);
+
+        // NOTE(dgl): the same seed repeats the run exactly
+        DGL_EXPECT_real64(first.complete_ms, ==, second.complete_ms);
+        DGL_EXPECT_int32(first.network.sent, ==, second.network.sent);
+        DGL_EXPECT_int32(first.network.lost, ==, second.network.lost);
+        DGL_EXPECT_uint64(first.server.datagrams_resent, ==, second.server.datagrams_resent);
+
+        // NOTE(dgl): a clean link is faster
+        Sim_Link clean = {};
+        clean.delay_ms = 30.0;
+        Test_Transfer fast = test_transfer(&arena, 1234, clean, kilobytes(64));
+        DGL_EXPECT_bool32(fast.complete, ==, true);
+        DGL_EXPECT_uint64(fast.server.datagrams_resent, ==, 0);
+        DGL_EXPECT_real64(fast.complete_ms, <, first.complete_ms);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    if(dgl_test_result()) { return(0); }
+    else { return(1); }
+}
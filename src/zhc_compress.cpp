@@ -0,0 +1,464 @@
+// NOTE(dgl): Simple LZ77 codec (similar to the LZ4 block format). Song files are plain text
+// and contain a lot of repeated lines (e.g. the chorus), which compresses very well.
+//
+// The compressed data is a list of sequences:
+//     token (literal count << 4 | (match length - LZ_MIN_MATCH))
+//     [literal count extension] literals
+//     offset (16 bit, little endian) [match length extension]
+// A count of 15 in the token is extended by the following bytes until a byte is smaller than 255.
+// The last sequence only contains literals and ends at the end of the compressed data.
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+
+internal usize
+lz_compress_bound(usize size)
+{
+    usize result = size + (size / 255) + 16;
+    return(result);
+}
+
+internal uint32
+lz_read32(uint8 *data)
+{
+    uint32 result = 0;
+    dgl_memcpy(&result, data, sizeof(result));
+    return(result);
+}
+
+internal uint32
+lz_hash(uint32 value)
+{
+    uint32 result = (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+    return(result);
+}
+
+internal uint8 *
+lz_write_length(uint8 *dest, usize length)
+{
+    while(length >= 255)
+    {
+        *dest++ = 255;
+        length -= 255;
+    }
+    *dest++ = cast(uint8)length;
+
+    return(dest);
+}
+
+// NOTE(dgl): returns false if the sequence does not fit into the destination.
+// A match length of 0 writes the last sequence (literals only).
+internal bool32
+lz_write_sequence(uint8 **dest, uint8 *dest_end, uint8 *literals, usize literal_count, usize offset, usize match_length)
+{
+    bool32 result = false;
+
+    usize match_code = (match_length > 0) ? match_length - LZ_MIN_MATCH : 0;
+    usize required = 1 + (literal_count / 255) + 1 + literal_count + 2 + (match_code / 255) + 1;
+    if(required <= cast(usize)(dest_end - *dest))
+    {
+        uint8 *out = *dest;
+        uint8 *token = out++;
+        *token = cast(uint8)(dgl_min(literal_count, 15) << 4);
+        if(literal_count >= 15) { out = lz_write_length(out, literal_count - 15); }
+
+        dgl_memcpy(out, literals, literal_count);
+        out += literal_count;
+
+        if(match_length > 0)
+        {
+            assert(offset > 0 && offset <= LZ_MAX_OFFSET, "Invalid match offset");
+            *token |= cast(uint8)dgl_min(match_code, 15);
+            *out++ = cast(uint8)(offset & 0xFF);
+            *out++ = cast(uint8)(offset >> 8);
+            if(match_code >= 15) { out = lz_write_length(out, match_code - 15); }
+        }
+
+        *dest = out;
+        result = true;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Returns the compressed size or 0 if the compressed data does not fit into dest.
+// Pass a dest_size smaller than the source_size to only accept a compression which saves space.
+internal usize
+lz_compress(uint8 *dest, usize dest_size, uint8 *source, usize source_size)
+{
+    usize result = 0;
+
+    // NOTE(dgl): positions of the last occurrence of a 4 byte sequence. Empty slots point to
+    // position 0 and are rejected by comparing the bytes.
+    uint32 table[1 << LZ_HASH_BITS] = {};
+
+    uint8 *out = dest;
+    uint8 *out_end = dest + dest_size;
+    bool32 fits = true;
+
+    usize anchor = 0;
+    usize pos = 0;
+    while(fits && pos + LZ_MIN_MATCH <= source_size)
+    {
+        uint32 value = lz_read32(source + pos);
+        uint32 slot = lz_hash(value);
+        usize candidate = table[slot];
+        table[slot] = cast(uint32)pos;
+
+        if(candidate < pos &&
+           (pos - candidate) <= LZ_MAX_OFFSET &&
+           lz_read32(source + candidate) == value)
+        {
+            usize match_length = LZ_MIN_MATCH;
+            while(pos + match_length < source_size &&
+                  source[candidate + match_length] == source[pos + match_length])
+            {
+                ++match_length;
+            }
+
+            fits = lz_write_sequence(&out, out_end, source + anchor, pos - anchor, pos - candidate, match_length);
+            pos += match_length;
+            anchor = pos;
+        }
+        else
+        {
+            ++pos;
+        }
+    }
+
+    if(fits)
+    {
+        fits = lz_write_sequence(&out, out_end, source + anchor, source_size - anchor, 0, 0);
+    }
+
+    if(fits)
+    {
+        result = cast(usize)(out - dest);
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Returns the decompressed size or 0 if the compressed data is invalid
+// or does not fit into dest.
+internal usize
+lz_decompress(uint8 *dest, usize dest_size, uint8 *source, usize source_size)
+{
+    usize result = 0;
+
+    uint8 *in = source;
+    uint8 *in_end = source + source_size;
+    uint8 *out = dest;
+    uint8 *out_end = dest + dest_size;
+    bool32 valid = (source_size > 0);
+
+    while(valid && in < in_end)
+    {
+        uint8 token = *in++;
+
+        usize literal_count = token >> 4;
+        if(literal_count == 15)
+        {
+            uint8 extension = 255;
+            while(valid && extension == 255)
+            {
+                valid = (in < in_end);
+                if(valid)
+                {
+                    extension = *in++;
+                    literal_count += extension;
+                }
+            }
+        }
+
+        valid = valid &&
+                literal_count <= cast(usize)(in_end - in) &&
+                literal_count <= cast(usize)(out_end - out);
+        if(!valid) { break; }
+
+        dgl_memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+
+        // NOTE(dgl): the last sequence has no match
+        if(in == in_end) { break; }
+
+        valid = (cast(usize)(in_end - in) >= 2);
+        if(!valid) { break; }
+
+        usize offset = cast(usize)in[0] | (cast(usize)in[1] << 8);
+        in += 2;
+
+        usize match_length = token & 0xF;
+        if(match_length == 15)
+        {
+            uint8 extension = 255;
+            while(valid && extension == 255)
+            {
+                valid = (in < in_end);
+                if(valid)
+                {
+                    extension = *in++;
+                    match_length += extension;
+                }
+            }
+        }
+        match_length += LZ_MIN_MATCH;
+
+        valid = valid &&
+                offset > 0 &&
+                offset <= cast(usize)(out - dest) &&
+                match_length <= cast(usize)(out_end - out);
+        if(!valid) { break; }
+
+        // NOTE(dgl): the match can overlap with the output (e.g. repeated characters),
+        // therefore we copy byte by byte.
+        uint8 *match = out - offset;
+        for(usize index = 0; index < match_length; ++index)
+        {
+            *out++ = *match++;
+        }
+    }
+
+    if(valid)
+    {
+        result = cast(usize)(out - dest);
+    }
+
+    return(result);
+}
+
+//
+// NOTE(dgl): Delta encoding
+//
+
+// NOTE(dgl): The delta describes the target as a list of operations on the base:
+//     Delta_Op_Copy   offset length   copies length bytes from the base at offset
+//     Delta_Op_Insert length bytes    inserts the following bytes
+// Numbers are stored as varints (7 bits per byte, the high bit marks a following byte).
+// Matches are searched with a hash table over all 8 byte sequences of the base.
+
+#define DELTA_MIN_MATCH 8
+#define DELTA_HASH_BITS 16
+#define DELTA_EMPTY_SLOT 0xFFFFFFFF
+
+enum Delta_Op
+{
+    Delta_Op_Copy = 1,
+    Delta_Op_Insert = 2,
+};
+
+internal uint32
+delta_hash(uint8 *data)
+{
+    uint64 value = 0;
+    dgl_memcpy(&value, data, sizeof(value));
+    uint32 result = cast(uint32)((value * 0x9E3779B97F4A7C15ULL) >> (64 - DELTA_HASH_BITS));
+    return(result);
+}
+
+// NOTE(dgl): returns 0 if the value does not fit into the destination
+internal uint8 *
+delta_write_varint(uint8 *dest, uint8 *dest_end, usize value)
+{
+    uint8 *result = dest;
+    do
+    {
+        if(result == dest_end) { result = 0; break; }
+
+        uint8 byte = cast(uint8)(value & 0x7F);
+        value >>= 7;
+        if(value > 0) { byte |= 0x80; }
+        *result++ = byte;
+    } while(value > 0);
+
+    return(result);
+}
+
+// NOTE(dgl): returns 0 if the varint is incomplete
+internal uint8 *
+delta_read_varint(uint8 *source, uint8 *source_end, usize *value)
+{
+    uint8 *result = source;
+    *value = 0;
+
+    int32 shift = 0;
+    while(result)
+    {
+        if(result == source_end || shift > 56) { result = 0; break; }
+
+        uint8 byte = *result++;
+        *value |= cast(usize)(byte & 0x7F) << shift;
+        shift += 7;
+        if((byte & 0x80) == 0) { break; }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): returns 0 if the insert does not fit into the destination
+internal uint8 *
+delta_write_insert(uint8 *dest, uint8 *dest_end, uint8 *data, usize size)
+{
+    uint8 *result = dest;
+    if(result && size > 0)
+    {
+        result = (result < dest_end) ? result : 0;
+        if(result)
+        {
+            *result++ = Delta_Op_Insert;
+            result = delta_write_varint(result, dest_end, size);
+        }
+
+        if(result && size <= cast(usize)(dest_end - result))
+        {
+            dgl_memcpy(result, data, size);
+            result += size;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Returns the size of the delta or 0 if it does not fit into dest. Pass a dest_size
+// smaller than the target size to only accept a delta which saves space.
+internal usize
+delta_encode(DGL_Mem_Arena *arena, uint8 *dest, usize dest_size,
+             uint8 *base, usize base_size, uint8 *target, usize target_size)
+{
+    usize result = 0;
+    DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+
+    usize table_count = 1 << DELTA_HASH_BITS;
+    uint32 *table = dgl_mem_arena_push_array(temp.arena, uint32, table_count);
+    dgl_memset(table, 0xFF, table_count*sizeof(*table));
+
+    // NOTE(dgl): we keep the first occurrence. Later copies of a repeated line in the base
+    // are found by extending the match.
+    for(usize pos = 0; pos + DELTA_MIN_MATCH <= base_size; ++pos)
+    {
+        uint32 slot = delta_hash(base + pos);
+        if(table[slot] == DELTA_EMPTY_SLOT) { table[slot] = cast(uint32)pos; }
+    }
+
+    uint8 *out = dest;
+    uint8 *out_end = dest + dest_size;
+    usize anchor = 0;
+    usize pos = 0;
+    while(out && pos + DELTA_MIN_MATCH <= target_size)
+    {
+        uint32 candidate = table[delta_hash(target + pos)];
+        if(candidate != DELTA_EMPTY_SLOT &&
+           memcmp(base + candidate, target + pos, DELTA_MIN_MATCH) == 0)
+        {
+            usize match_offset = candidate;
+            usize match_length = DELTA_MIN_MATCH;
+            while(pos + match_length < target_size &&
+                  match_offset + match_length < base_size &&
+                  base[match_offset + match_length] == target[pos + match_length])
+            {
+                ++match_length;
+            }
+
+            // NOTE(dgl): extend the match backwards into the pending insert
+            while(pos > anchor && match_offset > 0 && base[match_offset - 1] == target[pos - 1])
+            {
+                --pos;
+                --match_offset;
+                ++match_length;
+            }
+
+            out = delta_write_insert(out, out_end, target + anchor, pos - anchor);
+            if(out && out < out_end)
+            {
+                *out++ = Delta_Op_Copy;
+                out = delta_write_varint(out, out_end, match_offset);
+                if(out) { out = delta_write_varint(out, out_end, match_length); }
+            }
+            else
+            {
+                out = 0;
+            }
+
+            pos += match_length;
+            anchor = pos;
+        }
+        else
+        {
+            ++pos;
+        }
+    }
+
+    out = delta_write_insert(out, out_end, target + anchor, target_size - anchor);
+    if(out)
+    {
+        result = cast(usize)(out - dest);
+    }
+
+    dgl_mem_arena_end_temp(temp);
+    return(result);
+}
+
+// NOTE(dgl): Returns the size of the target or 0 if the delta is invalid
+// or the target does not fit into dest.
+internal usize
+delta_apply(uint8 *dest, usize dest_size, uint8 *base, usize base_size, uint8 *delta, usize delta_size)
+{
+    usize result = 0;
+
+    uint8 *in = delta;
+    uint8 *in_end = delta + delta_size;
+    usize out_size = 0;
+    bool32 valid = true;
+    while(valid && in < in_end)
+    {
+        uint8 op = *in++;
+        if(op == Delta_Op_Copy)
+        {
+            usize offset = 0;
+            usize length = 0;
+            in = delta_read_varint(in, in_end, &offset);
+            if(in) { in = delta_read_varint(in, in_end, &length); }
+
+            valid = (in &&
+                     offset <= base_size && length <= base_size - offset &&
+                     length <= dest_size - out_size);
+            if(valid)
+            {
+                dgl_memcpy(dest + out_size, base + offset, length);
+                out_size += length;
+            }
+        }
+        else if(op == Delta_Op_Insert)
+        {
+            usize length = 0;
+            in = delta_read_varint(in, in_end, &length);
+
+            valid = (in &&
+                     length <= cast(usize)(in_end - in) &&
+                     length <= dest_size - out_size);
+            if(valid)
+            {
+                dgl_memcpy(dest + out_size, in, length);
+                in += length;
+                out_size += length;
+            }
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    if(valid)
+    {
+        result = out_size;
+    }
+
+    return(result);
+}
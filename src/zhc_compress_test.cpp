@@ -0,0 +1,145 @@
+#include "zhc_lib.h"
+#include "zhc_compress.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "dgl_test_helpers.h"
+#include <string.h>
+
+int
+main(int argc, char **argv)
+{
+    DGL_BEGIN_TEST("Compressed text is decompressed to the same bytes");
+    {
+        char *line = "Amazing grace, how sweet the sound\n";
+        usize line_size = strlen(line);
+
+        uint8 text[4096] = {};
+        usize text_size = 0;
+        while(text_size + line_size <= array_count(text))
+        {
+            dgl_memcpy(text + text_size, line, line_size);
+            text_size += line_size;
+        }
+
+        uint8 compressed[4096] = {};
+        usize compressed_size = lz_compress(compressed, array_count(compressed), text, text_size);
+        DGL_EXPECT_usize(compressed_size, >, 0);
+        DGL_EXPECT_usize(compressed_size, <, text_size / 10);
+
+        uint8 decompressed[4096] = {};
+        usize decompressed_size = lz_decompress(decompressed, array_count(decompressed), compressed, compressed_size);
+        DGL_EXPECT_usize(decompressed_size, ==, text_size);
+        DGL_EXPECT_int32(memcmp(decompressed, text, text_size), ==, 0);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Compression fails if the result does not fit into the destination");
+    {
+        // NOTE(dgl): no repeated sequences
+        uint8 data[256] = {};
+        for(usize index = 0; index < array_count(data); ++index) { data[index] = cast(uint8)index; }
+
+        uint8 compressed[lz_compress_bound(array_count(data))] = {};
+        DGL_EXPECT_usize(lz_compress(compressed, array_count(data) - 1, data, array_count(data)), ==, 0);
+
+        usize compressed_size = lz_compress(compressed, array_count(compressed), data, array_count(data));
+        DGL_EXPECT_usize(compressed_size, >, array_count(data));
+
+        uint8 decompressed[256] = {};
+        DGL_EXPECT_usize(lz_decompress(decompressed, array_count(decompressed), compressed, compressed_size), ==, array_count(data));
+        DGL_EXPECT_uint8(decompressed[255], ==, 255);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Decompression rejects invalid data");
+    {
+        uint8 text[64] = {};
+        dgl_memset(text, 'a', array_count(text));
+
+        uint8 compressed[64] = {};
+        usize compressed_size = lz_compress(compressed, array_count(compressed), text, array_count(text));
+
+        // NOTE(dgl): destination too small
+        uint8 decompressed[64] = {};
+        DGL_EXPECT_usize(lz_decompress(decompressed, 32, compressed, compressed_size), ==, 0);
+
+        // NOTE(dgl): match offset before the start of the output
+        uint8 invalid[] = {0x10, 'a', 0x05, 0x00};
+        DGL_EXPECT_usize(lz_decompress(decompressed, array_count(decompressed), invalid, array_count(invalid)), ==, 0);
+
+        // NOTE(dgl): truncated literals
+        DGL_EXPECT_usize(lz_decompress(decompressed, array_count(decompressed), compressed, 1), ==, 0);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Delta of an edited text copies the unchanged parts from the base");
+    {
+        uint8 memory[kilobytes(512)] = {};
+        DGL_Mem_Arena arena = {};
+        dgl_mem_arena_init(&arena, memory, array_count(memory));
+
+        char *line = "Amazing grace, how sweet the sound that saved a wretch like me\n";
+        usize line_size = strlen(line);
+
+        uint8 base[4096] = {};
+        usize base_size = 0;
+        for(int32 index = 0; base_size + line_size + 4 <= array_count(base); ++index)
+        {
+            base[base_size++] = cast(uint8)('0' + (index % 10));
+            base[base_size++] = cast(uint8)('0' + (index / 10));
+            dgl_memcpy(base + base_size, line, line_size);
+            base_size += line_size;
+        }
+
+        // NOTE(dgl): fix a typo in the middle and append a line
+        uint8 target[4096 + 64] = {};
+        dgl_memcpy(target, base, base_size);
+        target[base_size / 2] = '!';
+        dgl_memcpy(target + base_size, "Amen\n", 5);
+        usize target_size = base_size + 5;
+
+        uint8 delta[256] = {};
+        usize delta_size = delta_encode(&arena, delta, array_count(delta), base, base_size, target, target_size);
+        DGL_EXPECT_usize(delta_size, >, 0);
+        DGL_EXPECT_usize(delta_size, <, 32);
+        DGL_EXPECT_usize(arena.curr_offset, ==, 0);
+
+        uint8 result[4096 + 64] = {};
+        usize result_size = delta_apply(result, array_count(result), base, base_size, delta, delta_size);
+        DGL_EXPECT_usize(result_size, ==, target_size);
+        DGL_EXPECT_int32(memcmp(result, target, target_size), ==, 0);
+
+        // NOTE(dgl): the delta does not fit, if the target is unrelated to the base
+        uint8 unrelated[256] = {};
+        for(usize index = 0; index < array_count(unrelated); ++index) { unrelated[index] = cast(uint8)index; }
+        DGL_EXPECT_usize(delta_encode(&arena, delta, array_count(unrelated) / 2, base, base_size, unrelated, array_count(unrelated)), ==, 0);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Applying a delta rejects invalid operations");
+    {
+        uint8 base[16] = {};
+        uint8 result[64] = {};
+
+        // NOTE(dgl): copy outside of the base
+        uint8 copy[] = {Delta_Op_Copy, 10, 10};
+        DGL_EXPECT_usize(delta_apply(result, array_count(result), base, array_count(base), copy, array_count(copy)), ==, 0);
+
+        // NOTE(dgl): insert longer than the delta
+        uint8 insert[] = {Delta_Op_Insert, 4, 'a', 'b'};
+        DGL_EXPECT_usize(delta_apply(result, array_count(result), base, array_count(base), insert, array_count(insert)), ==, 0);
+
+        uint8 unknown[] = {7};
+        DGL_EXPECT_usize(delta_apply(result, array_count(result), base, array_count(base), unknown, array_count(unknown)), ==, 0);
+
+        uint8 valid[] = {Delta_Op_Copy, 2, 4, Delta_Op_Insert, 2, 'a', 'b'};
+        DGL_EXPECT_usize(delta_apply(result, array_count(result), base, array_count(base), valid, array_count(valid)), ==, 6);
+        DGL_EXPECT_uint8(result[5], ==, 'b');
+    }
+    DGL_END_TEST();
+
+    if(dgl_test_result()) { return(0); }
+    else { return(1); }
+}
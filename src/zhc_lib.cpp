@@ -8,7 +8,6 @@
     - Rerender when switching to landscape (should work now)
     - Fast light tapping is not recognized (how can I debug this? Clicking in th emulator works totally fine -> Will be easier when we switch to render commands)
     - Better packet buffer strategy to be able to resend if necessary
-    - Packet throttle for large chunks to not flood the bandwidth
     - Image resizing for better size control of assets
 
 
@@ -23,6 +22,7 @@
 #include "zhc_renderer.cpp"
 #include "zhc_ui.cpp"
 #include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
 #include "zhc_net.cpp"
 
 #define STB_TRUETYPE_IMPLEMENTATION  // force following include to generate implementation
@@ -88,11 +88,22 @@ close_files(Zhc_File_Group *files)
 }
 
 internal void
-multicast_request(Net_Context *ctx, Net_Message_Type type)
+multicast_request(Net_Thread *net, Net_Message_Type type)
 {
     Net_Message message = {};
     message.type = type;
-    net_multicast_message(ctx, message);
+    net_thread_multicast_message(net, message);
+}
+
+internal void
+request_file(Net_Thread *net, File *file)
+{
+    // NOTE(dgl): the server can send only the changes if it knows our content
+    Net_Message message = {};
+    message.type = Net_Message_Data_Req;
+    message.payload = cast(uint8 *)&file->hash;
+    message.payload_size = sizeof(file->hash);
+    net_thread_multicast_message(net, message);
 }
 
 internal bool32
@@ -109,7 +120,7 @@ file_is_valid(File *file)
 }
 
 internal void
-send_filehash(Net_Context *ctx, Net_Conn_ID id, File *file)
+send_filehash(Net_Thread *net, Net_Conn_ID id, File *file)
 {
     if(file_is_valid(file))
     {
@@ -118,12 +129,12 @@ send_filehash(Net_Context *ctx, Net_Conn_ID id, File *file)
         message.payload = cast(uint8 *)&file->hash;
         message.payload_size = sizeof(file->hash);
         LOG_DEBUG("Sending hash %u", file->hash);
-        net_send_message(ctx, id, message);
+        net_thread_send_message(net, id, message);
     }
 }
 
 internal void
-send_file(Net_Context *ctx, Net_Conn_ID id, File *file)
+send_file(Net_Thread *net, Net_Conn_ID id, File *file)
 {
     if(file_is_valid(file))
     {
@@ -131,13 +142,14 @@ send_file(Net_Context *ctx, Net_Conn_ID id, File *file)
         message.type = Net_Message_Data_Res;
         message.payload = file->data;
         message.payload_size = file->info->size;
+        message.payload_hash = file->hash;
         LOG_DEBUG("Sending %d bytes of data with hash %u", message.payload_size, file->hash);
-        net_send_message(ctx, id, message);
+        net_thread_send_message(net, id, message);
     }
 }
 
 internal void
-multicast_file(Net_Context *ctx, File *file)
+multicast_file(Net_Thread *net, File *file)
 {
     LOG_DEBUG("Multicast file %p", file->data);
     if(file_is_valid(file))
@@ -146,9 +158,123 @@ multicast_file(Net_Context *ctx, File *file)
         message.type = Net_Message_Data_Res;
         message.payload = file->data;
         message.payload_size = file->info->size;
+        message.payload_hash = file->hash;
         LOG_DEBUG("Multicasting %d bytes of data with hash %u", message.payload_size, file->hash);
-        net_multicast_message(ctx, message);
+        net_thread_multicast_message(net, message);
+    }
+}
+
+internal File_Version *
+find_file_version(File_History *history, uint32 hash)
+{
+    File_Version *result = 0;
+    for(int32 index = 0; index < history->count; ++index)
+    {
+        File_Version *version = history->versions + index;
+        if(version->size > 0 && version->hash == hash)
+        {
+            result = version;
+            break;
+        }
+    }
+
+    return(result);
+}
+
+internal void
+remember_file_version(File_History *history, File *file)
+{
+    if(history->count > 0 && file_is_valid(file) && !find_file_version(history, file->hash))
+    {
+        File_Version *version = history->versions + history->next;
+        history->next = (history->next + 1) % history->count;
+
+        version->hash = file->hash;
+        version->size = file->info->size;
+        dgl_memcpy(version->data, file->data, version->size);
+    }
+}
+
+// NOTE(dgl): Builds a delta response from the base version to the file. Returns false if
+// the base version is unknown or the delta is not smaller than half of the file. The delta is
+// encoded into the least recently used cache entry, the scratch arena is only used while encoding.
+// The message points into the cache. It is valid until the next delta is built.
+internal bool32
+build_file_delta(DGL_Mem_Arena *scratch, File_Delta_Cache *cache, File_History *history, uint32 base_hash, File *file, Net_Message *message)
+{
+    bool32 result = false;
+
+    File_Version *base = find_file_version(history, base_hash);
+    if(base && file_is_valid(file) && file->hash != base_hash)
+    {
+        File_Delta *delta = 0;
+        File_Delta *oldest = cache->deltas;
+        for(int32 index = 0; index < cache->count; ++index)
+        {
+            File_Delta *entry = cache->deltas + index;
+            if(entry->last_used > 0 &&
+               entry->base_hash == base_hash &&
+               entry->target_hash == file->hash)
+            {
+                delta = entry;
+                break;
+            }
+
+            if(entry->last_used < oldest->last_used)
+            {
+                oldest = entry;
+            }
+        }
+
+        if(!delta)
+        {
+            delta = oldest;
+            delta->base_hash = base_hash;
+            delta->target_hash = file->hash;
+
+            File_Delta_Header header = {};
+            header.base_hash = base_hash;
+            header.target_hash = file->hash;
+            dgl_memcpy(delta->data, &header, sizeof(header));
+
+            usize max_delta_size = dgl_min(file->info->size / 2, cache->capacity - sizeof(header));
+            usize delta_size = delta_encode(scratch, delta->data + sizeof(header), max_delta_size,
+                                            base->data, base->size, file->data, file->info->size);
+            delta->size = (delta_size > 0) ? sizeof(header) + delta_size : 0;
+            LOG_DEBUG("Delta from %u to %u with %llu bytes (file %llu bytes)", base_hash, file->hash, delta_size, file->info->size);
+        }
+        delta->last_used = ++cache->use_counter;
+
+        if(delta->size > 0)
+        {
+            message->type = Net_Message_Delta_Res;
+            message->payload = delta->data;
+            message->payload_size = delta->size;
+            result = true;
+        }
     }
+
+    return(result);
+}
+
+internal void
+set_active_file_data(Lib_State *state, uint8 *source, usize size)
+{
+    state->active_file = {};
+    dgl_mem_arena_free_all(&state->io_arena);
+
+    // NOTE(dgl): push new data into the arena
+    Zhc_File_Info *info = dgl_mem_arena_push_struct(&state->io_arena, Zhc_File_Info);
+    info->filename = "\0";
+    info->size = size;
+    uint8 *data = dgl_mem_arena_push_array(&state->io_arena, uint8, info->size);
+    dgl_memcpy(data, source, info->size);
+
+    state->active_file.info = info;
+    state->active_file.data = data;
+    state->active_file.hash = HASH_OFFSET_BASIS;
+    hash(&state->active_file.hash, state->active_file.data, state->active_file.info->size);
+    LOG_DEBUG("Received %d bytes of data with the hash %u", info->size, state->active_file.hash);
 }
 
 internal bool32
@@ -243,7 +369,31 @@ zhc_update_and_render_server(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
         dgl_mem_arena_init(&state->permanent_arena, (uint8 *)memory->permanent_storage + sizeof(*state), ((DGL_Mem_Index)memory->permanent_storage_size - sizeof(*state)));
         dgl_mem_arena_init(&state->transient_arena, (uint8 *)memory->transient_storage, (DGL_Mem_Index)memory->transient_storage_size);
 
-        state->net_ctx = net_init_server(&state->permanent_arena);
+        // NOTE(dgl): the clients are split evenly between the shards. Only the first shard sends
+        // to the multicast group, the clients of the other shards receive the chunks directly.
+        int32 max_clients = memory->max_clients > 0 ? memory->max_clients : NET_DEFAULT_MAX_CLIENTS;
+        int32 shard_count = dgl_clamp(memory->shard_count, 1, ZHC_MAX_SERVER_SHARDS);
+        int32 shard_clients = dgl_max(max_clients / shard_count, 1);
+        Net_Context *shards[ZHC_MAX_SERVER_SHARDS] = {};
+        net_init_server_shards(&state->permanent_arena, shard_clients, shards, shard_count);
+        state->net_ctx = shards[0];
+        net_enable_multicast(state->net_ctx, parse_address(ZHC_MULTICAST_GROUP, ZHC_MULTICAST_PORT));
+        LOG_DEBUG("Running %d server shards with %d clients each", shard_count, shard_clients);
+
+        // NOTE(dgl): the server sends the files and only receives requests. The sockets are opened
+        // in the order of the shards, before the threads are started.
+        Net_Thread **next_shard = &state->net_thread;
+        for(int32 shard = 0; shard < shard_count; ++shard)
+        {
+            if(shard_count > 1) { net_open_socket(shards[shard]); }
+            *next_shard = net_thread_init(&state->permanent_arena, shards[shard], ZHC_FILE_QUEUE_SIZE, ZHC_MESSAGE_QUEUE_SIZE);
+            next_shard = &(*next_shard)->next_shard;
+        }
+
+        for(Net_Thread *net = state->net_thread; net; net = net->next_shard)
+        {
+            net_thread_start(net);
+        }
         state->ui_ctx = ui_context_init(&state->permanent_arena, &state->transient_arena, &state->cmd_buffer);
 
         // NOTE(dgl): Initialize IO Context
@@ -254,6 +404,22 @@ zhc_update_and_render_server(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
         dgl_mem_arena_init(&state->io_arena, io_arena_base, io_arena_size);
         state->io_update_timeout = 0.0f;
 
+        state->history.count = ZHC_FILE_HISTORY_COUNT;
+        state->history.versions = dgl_mem_arena_push_array(&state->permanent_arena, File_Version, ZHC_FILE_HISTORY_COUNT);
+        for(int32 index = 0; index < state->history.count; ++index)
+        {
+            state->history.versions[index].data = dgl_mem_arena_push_array(&state->permanent_arena, uint8, ZHC_MAX_FILESIZE);
+        }
+
+        File_Delta_Cache *delta_cache = &state->delta_cache;
+        delta_cache->count = ZHC_DELTA_CACHE_COUNT;
+        delta_cache->capacity = sizeof(File_Delta_Header) + ZHC_MAX_FILESIZE / 2;
+        delta_cache->deltas = dgl_mem_arena_push_array(&state->permanent_arena, File_Delta, ZHC_DELTA_CACHE_COUNT);
+        for(int32 index = 0; index < delta_cache->count; ++index)
+        {
+            delta_cache->deltas[index].data = dgl_mem_arena_push_array(&state->permanent_arena, uint8, delta_cache->capacity);
+        }
+
         // TODO(dgl): let user set this folder and store in config
         DGL_String_Builder temp_builder = dgl_string_builder_init(&state->transient_arena, 128);
 
@@ -307,11 +473,6 @@ zhc_update_and_render_server(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
     uint8 *render_buffer_base = dgl_mem_arena_push_array(&state->transient_arena, uint8, render_buffer_size);
     render_command_buffer_init(&state->cmd_buffer, render_buffer_base, render_buffer_size);
 
-    if(state->net_ctx->socket.handle.no_error == false)
-    {
-        net_open_socket(state->net_ctx);
-    }
-
     // NOTE(dgl): Reload the directory (file infos) every 10 seconds.
     // We clear the whole IO arena for simplicity reasons. This means the
     // active file must be reloaded and will be sent via multicast to
@@ -337,31 +498,88 @@ zhc_update_and_render_server(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
     state->active_file = read_file(&state->io_arena, state->files, &state->active_file, state->desired_file_id);
     if(state->active_file.hash != old_hash)
     {
-        multicast_file(state->net_ctx, &state->active_file);
         do_render = true;
     }
 
-    Net_Message message = {};
-    Net_Conn_ID client = 0;
-    while((client = net_recv_message(&state->transient_arena, state->net_ctx, input->last_frame_in_ms, &message)) >= 0)
+    // NOTE(dgl): The reload above loads the same content again. We only send the file if the
+    // content changed. If the clients have the previous version (e.g. the operator fixed
+    // a typo) we only send the changes.
+    if(state->active_file.hash != state->multicast_hash)
     {
-        switch(message.type)
+        Net_Message delta = {};
+        bool32 has_delta = build_file_delta(&state->transient_arena, &state->delta_cache, &state->history, state->multicast_hash, &state->active_file, &delta);
+        for(Net_Thread *net = state->net_thread; net; net = net->next_shard)
         {
-            case Net_Message_Hash_Req:
+            if(has_delta)
             {
-                send_filehash(state->net_ctx, client, &state->active_file);
-            } break;
-            case Net_Message_Data_Req:
+                net_thread_multicast_message(net, delta);
+            }
+            else
             {
-                send_file(state->net_ctx, client, &state->active_file);
-            } break;
-            default:
+                multicast_file(net, &state->active_file);
+            }
+        }
+
+        remember_file_version(&state->history, &state->active_file);
+        state->multicast_hash = state->active_file.hash;
+
+        // NOTE(dgl): the beacon is queued after the content, so the clients receive the content first
+        for(Net_Thread *net = state->net_thread; net; net = net->next_shard)
+        {
+            net_thread_set_beacon(net, state->multicast_hash);
+        }
+    }
+
+    // NOTE(dgl): the connection ids are only valid in the shard which received the message
+    for(Net_Thread *net = state->net_thread; net; net = net->next_shard)
+    {
+        Net_Queue_Entry *event = 0;
+        while((event = net_queue_peek(&net->events)) != 0)
+        {
+            Net_Conn_ID client = event->id;
+            Net_Message message = event->message;
+            switch(message.type)
             {
-                // TODO(dgl): do nothing
+                case Net_Message_Hash_Req:
+                case Net_Message_Data_Req:
+                {
+                    // NOTE(dgl): clients send the hash of their content. If we know this version,
+                    // we send the changes instead of the hash or the whole file.
+                    uint32 client_hash = 0;
+                    if(message.payload_size == sizeof(client_hash))
+                    {
+                        dgl_memcpy(&client_hash, message.payload, sizeof(client_hash));
+                    }
+
+                    Net_Message delta = {};
+                    if(client_hash != 0 &&
+                       client_hash != state->active_file.hash &&
+                       build_file_delta(&state->transient_arena, &state->delta_cache, &state->history, client_hash, &state->active_file, &delta))
+                    {
+                        net_thread_send_message(net, client, delta);
+                    }
+                    else if(message.type == Net_Message_Hash_Req)
+                    {
+                        send_filehash(net, client, &state->active_file);
+                    }
+                    else
+                    {
+                        send_file(net, client, &state->active_file);
+                    }
+                } break;
+                default:
+                {
+                    // TODO(dgl): do nothing
+                }
             }
+            net_queue_pop(&net->events, event);
+        }
+
+        if(!net->running)
+        {
+            net_thread_step(net);
         }
     }
-    net_send_pending_packet_buffers(state->net_ctx);
 
     if(do_render)
     {
@@ -413,7 +631,10 @@ zhc_update_and_render_client(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
         dgl_mem_arena_init(&state->transient_arena, (uint8 *)memory->transient_storage, (DGL_Mem_Index)memory->transient_storage_size);
         LOG_DEBUG("Permanent memory: %p (%lld), Lib_State size: %lld, permanent_arena: %p, transient_arena: %p", memory->permanent_storage, memory->permanent_storage_size, sizeof(*state), state->permanent_arena.base, state->transient_arena.base);
 
-        state->net_ctx = net_init_client(&state->permanent_arena);
+        state->net_ctx = net_init_client(&state->permanent_arena, ZHC_MAX_FILESIZE);
+        // NOTE(dgl): the client receives the files and only sends requests
+        state->net_thread = net_thread_init(&state->permanent_arena, state->net_ctx, ZHC_MESSAGE_QUEUE_SIZE, ZHC_FILE_QUEUE_SIZE);
+        net_thread_start(state->net_thread);
 
         // NOTE(dgl): at this state the cmd_buffer is not initialized.
         state->ui_ctx = ui_context_init(&state->permanent_arena, &state->transient_arena, &state->cmd_buffer);
@@ -424,7 +645,6 @@ zhc_update_and_render_client(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
         usize io_arena_size = ZHC_IO_MEMORY_SIZE;
         uint8 *io_arena_base = dgl_mem_arena_push_array(&state->permanent_arena, uint8, io_arena_size);
         dgl_mem_arena_init(&state->io_arena, io_arena_base, io_arena_size);
-        state->io_update_timeout = 0.0f;
 
         // NOTE(dgl): clear the input for the first frame because
         // sometimes the return action was triggert from executing
@@ -463,23 +683,16 @@ zhc_update_and_render_client(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
         state->force_render = false;
     }
 
-    if(state->net_ctx->socket.handle.no_error == false)
-    {
-        net_open_socket(state->net_ctx);
-    }
-
     dgl_mem_arena_free_all(&state->transient_arena);
     // NOTE(dgl): we reinit the command buffer on each loop.
     usize render_buffer_size = kilobytes(512);
     uint8 *render_buffer_base = dgl_mem_arena_push_array(&state->transient_arena, uint8, render_buffer_size);
     render_command_buffer_init(&state->cmd_buffer, render_buffer_base, render_buffer_size);
 
-    net_request_server_connection(state->net_ctx);
-
-    Net_Message message = {};
-    Net_Conn_ID client = 0;
-    while((client = net_recv_message(&state->transient_arena, state->net_ctx, input->last_frame_in_ms, &message)) >= 0)
+    Net_Queue_Entry *event = 0;
+    while((event = net_queue_peek(&state->net_thread->events)) != 0)
     {
+        Net_Message message = event->message;
         switch(message.type)
         {
             case Net_Message_Hash_Res:
@@ -491,42 +704,70 @@ zhc_update_and_render_client(Zhc_Memory *memory, Zhc_Input *input, Zhc_Offscreen
                 if(hash != state->active_file.hash)
                 {
                     // NOTE(dgl): we can send a multicast here, because the client only has one connection.
-                    multicast_request(state->net_ctx, Net_Message_Data_Req);
+                    request_file(state->net_thread, &state->active_file);
+                }
+            } break;
+            case Net_Message_Beacon:
+            {
+                // NOTE(dgl): the server announces its content after the connection is established (see
+                // Net_Message_Hash_Req) and multicasts the changes. The beacon only catches the changes
+                // we missed. The net layer drops the beacons while the content is on the way.
+                uint32 hash = 0;
+                assert(message.payload_size == sizeof(hash), "Invalid hash size");
+                hash = *cast(uint32 *)message.payload;
+                if(hash != state->active_file.hash)
+                {
+                    LOG_DEBUG("Beacon hash %u differs from active_file hash %u", hash, state->active_file.hash);
+                    request_file(state->net_thread, &state->active_file);
                 }
             } break;
             case Net_Message_Data_Res:
             {
-                 state->active_file = {};
-                 dgl_mem_arena_free_all(&state->io_arena);
-
-                 // NOTE(dgl): push new data into the arena
-                 Zhc_File_Info *info = dgl_mem_arena_push_struct(&state->io_arena, Zhc_File_Info);
-                 info->filename = "\0";
-                 info->size = message.payload_size;
-                 uint8 *data = dgl_mem_arena_push_array(&state->io_arena, uint8, info->size);
-                 dgl_memcpy(data, message.payload, info->size);
-
-                 state->active_file.info = info;
-                 state->active_file.data = data;
-                 state->active_file.hash = HASH_OFFSET_BASIS;
-                 hash(&state->active_file.hash, state->active_file.data, state->active_file.info->size);
-                 LOG_DEBUG("Received %d bytes of data with the hash %u", info->size, state->active_file.hash);
+                 set_active_file_data(state, message.payload, message.payload_size);
                  do_render = true;
             } break;
+            case Net_Message_Delta_Res:
+            {
+                File_Delta_Header header = {};
+                if(message.payload_size >= sizeof(header))
+                {
+                    dgl_memcpy(&header, message.payload, sizeof(header));
+                }
+
+                // NOTE(dgl): deltas to other versions are ignored. The request after the next beacons
+                // sends our version and the server replies with the matching delta.
+                if(file_is_valid(&state->active_file) && header.base_hash == state->active_file.hash)
+                {
+                    uint8 *target = dgl_mem_arena_push_array(&state->transient_arena, uint8, ZHC_MAX_FILESIZE);
+                    usize target_size = delta_apply(target, ZHC_MAX_FILESIZE,
+                                                    state->active_file.data, state->active_file.info->size,
+                                                    message.payload + sizeof(header), message.payload_size - sizeof(header));
+
+                    uint32 target_hash = HASH_OFFSET_BASIS;
+                    hash(&target_hash, target, target_size);
+                    if(target_size > 0 && target_hash == header.target_hash)
+                    {
+                        set_active_file_data(state, target, target_size);
+                        do_render = true;
+                    }
+                    else
+                    {
+                        LOG("Invalid delta from %u to %u. Requesting the whole file", header.base_hash, header.target_hash);
+                        multicast_request(state->net_thread, Net_Message_Data_Req);
+                    }
+                }
+            } break;
             default:
             {
                 // NOTE(dgl): do nothing
             }
         }
+        net_queue_pop(&state->net_thread->events, event);
     }
-    net_send_pending_packet_buffers(state->net_ctx);
 
-    state->io_update_timeout += input->last_frame_in_ms;
-    if(state->io_update_timeout > 5000.0f)
+    if(!state->net_thread->running)
     {
-        state->io_update_timeout = 0;
-        // NOTE(dgl): we can send a multicast here, because the client only has one connection.
-        multicast_request(state->net_ctx, Net_Message_Hash_Req);
+        net_thread_step(state->net_thread);
     }
 
     if(do_render)
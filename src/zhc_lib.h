@@ -10,15 +10,27 @@
 
 // TODO(dgl): use version stored in byte format.
 /* 16 bit major, 8 bit minor, 8 bit patch */
-#define ZHC_VERSION "0.2.2"
+#define ZHC_VERSION "0.3.0"
 #define ZHC_SERVER_PORT 8888
+// NOTE(dgl): organization local scope multicast group. Chunks are sent once to this group
+// if the clients are able to join it.
+#define ZHC_MULTICAST_GROUP "239.192.0.88"
+#define ZHC_MULTICAST_PORT 8889
 
-// NOTE(dgl): This size is cannot be larger than the amount of bits
-// that are available in an ACK package (MTU size - ACK header size)
-// the current max is about 1.2 megabytes. Therefore we max the size at
-// 1 megabyte. If larger files need to be sent, we need another ACK
-// strategy. Currently each bit determines a chunk slice.
-#define ZHC_MAX_FILESIZE megabytes(1)
+// NOTE(dgl): Chunks are acked with a sliding window (see NET_WINDOW_SIZE), so the size
+// is not limited by the ack packet anymore. It is limited by the memory we reserve for
+// the chunk store on the server and the receive buffers on the client.
+#define ZHC_MAX_FILESIZE megabytes(4)
+
+// NOTE(dgl): size of the queues between the lib and the net thread (see Net_Thread). The server
+// sends the files and the clients receive them.
+#define ZHC_FILE_QUEUE_SIZE (2*ZHC_MAX_FILESIZE + kilobytes(64))
+#define ZHC_MESSAGE_QUEUE_SIZE kilobytes(64)
+// NOTE(dgl): the server can split the clients between several net threads, e.g. one per core
+// (see net_init_server_shards). Each additional shard needs this much permanent memory for its
+// command queue and connections.
+#define ZHC_MAX_SERVER_SHARDS 16
+#define ZHC_SHARD_MEMORY_SIZE (ZHC_FILE_QUEUE_SIZE + megabytes(8))
 
 #define ZHC_ASSET_MEMORY_SIZE megabytes(32)
 #define ZHC_IO_MEMORY_SIZE megabytes(8)
@@ -32,6 +44,54 @@ struct File
     uint8 *data;
 };
 
+// NOTE(dgl): The server keeps the last sent versions of the active file. If a client
+// still has one of these versions, the server only sends the changes (see delta_encode).
+#define ZHC_FILE_HISTORY_COUNT 4
+
+struct File_Version
+{
+    uint32 hash;
+    usize size;
+    uint8 *data;
+};
+
+struct File_History
+{
+    int32 count;
+    int32 next;
+    File_Version *versions;
+};
+
+// NOTE(dgl): Delta responses start with this header, followed by the delta operations.
+// Clients only apply the delta if their content has the base hash.
+struct File_Delta_Header
+{
+    uint32 base_hash;
+    uint32 target_hash;
+};
+
+// NOTE(dgl): Delta responses are cached by the base and the target hash. Each delta is only
+// encoded once, no matter how many clients request it. A size of 0 marks versions which have
+// no delta smaller than half of the file.
+#define ZHC_DELTA_CACHE_COUNT ZHC_FILE_HISTORY_COUNT
+
+struct File_Delta
+{
+    uint32 base_hash;
+    uint32 target_hash;
+    usize size; /* NOTE(dgl): including the header */
+    uint64 last_used;
+    uint8 *data;
+};
+
+struct File_Delta_Cache
+{
+    int32 count;
+    uint64 use_counter;
+    usize capacity;
+    File_Delta *deltas;
+};
+
 struct Lib_State
 {
     DGL_Mem_Arena permanent_arena;
@@ -46,8 +106,12 @@ struct Lib_State
     File active_file;
     Zhc_File_Group *files;
     int32 desired_file_id;
+    File_History history; /* NOTE(dgl): server only */
+    File_Delta_Cache delta_cache; /* NOTE(dgl): server only */
+    uint32 multicast_hash; /* NOTE(dgl): hash of the content last sent to all clients */
 
-    Net_Context *net_ctx;
+    Net_Context *net_ctx; /* NOTE(dgl): owned by the net thread after it is started */
+    Net_Thread *net_thread; /* NOTE(dgl): the server has one thread per shard (see Net_Thread next_shard) */
 
     Zhc_Input old_input;
 
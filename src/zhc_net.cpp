@@ -106,34 +106,137 @@ unpack_uint32(Bitstream *buffer, uint32 min, uint32 max)
     return(result);
 }
 
+// NOTE(dgl): continues at the next word. The remaining bits of the current word are zero.
+internal void
+stream_align(Bitstream *buffer)
+{
+    if(buffer->is_writing && buffer->scratch_bits > 0)
+    {
+        stream_flush(buffer);
+    }
+    buffer->scratch = 0;
+    buffer->scratch_bits = 0;
+}
+
+// NOTE(dgl): Packet header schema (see serialize_packet). The header starts with the protocol id,
+// the type and the message type, followed by the type specific fields padded to a full word.
+// Handshake packets continue with the version and the salt, connected packets only with the session.
+// Messages have the sequence, the ack and the ack bits in front of the session (see Net_Reliable).
+// The last two words are the timestamp and the echo. The salt (or session), the timestamp and
+// the echo are patched right before sending. Their offset only depends on the type.
+#define NET_HEADER_PREFIX_BITS (NET_PROTOCOL_ID_BITS + NET_PACKET_TYPE_BITS + NET_MESSAGE_TYPE_BITS) /* id, type, message type */
+#define NET_HEADER_SIZE(field_bits, tail_words) \
+    ((((NET_HEADER_PREFIX_BITS + (field_bits) + 31) / 32) + (tail_words))*sizeof(uint32))
+#define NET_HANDSHAKE_HEADER_SIZE(field_bits) NET_HEADER_SIZE(field_bits, 5) /* version, salt, timestamp, echo */
+#define NET_CONNECTED_HEADER_SIZE(field_bits) NET_HEADER_SIZE(field_bits, 3) /* session, timestamp, echo */
+#define NET_MESSAGE_HEADER_SIZE(field_bits) NET_HEADER_SIZE(field_bits, 5) /* sequence and ack, ack bits, session, timestamp, echo */
+
+global usize packet_header_sizes[Packet_Type_Max] =
+{
+    NET_HANDSHAKE_HEADER_SIZE(0), /* Denied */
+    NET_HANDSHAKE_HEADER_SIZE(0), /* Server_Discovery */
+    NET_HANDSHAKE_HEADER_SIZE(0), /* Request */
+    NET_HANDSHAKE_HEADER_SIZE(2), /* Challenge: codec flags */
+    NET_HANDSHAKE_HEADER_SIZE(0), /* Challenge_Resp */
+    NET_CONNECTED_HEADER_SIZE(0), /* _Connected */
+    NET_CONNECTED_HEADER_SIZE(0), /* Disconnect */
+    NET_MESSAGE_HEADER_SIZE(0), /* Empty */
+    NET_MESSAGE_HEADER_SIZE(0), /* Payload */
+    NET_CONNECTED_HEADER_SIZE(32 + 11 + 16 + 7 + 1 + 32), /* Chunk: hash, last slice size, slice count, fec group size, codec, raw size */
+    NET_CONNECTED_HEADER_SIZE(32 + 16), /* Slice: hash, index */
+    NET_CONNECTED_HEADER_SIZE(32 + 16), /* Parity: hash, index */
+    NET_CONNECTED_HEADER_SIZE(32 + 16), /* Ack: hash, base */
+    NET_CONNECTED_HEADER_SIZE(32 + 16 + 64), /* Group: host, port, salt */
+    NET_CONNECTED_HEADER_SIZE(32 + 32), /* Beacon: hash, sequence */
+};
+
+internal usize
+packet_header_size(Packet_Type type)
+{
+    assert(type >= 0 && type < Packet_Type_Max, "Invalid packet type");
+    usize result = packet_header_sizes[type];
+    return(result);
+}
+
+// NOTE(dgl): the session identifies the connection in connected packets. Both peers know
+// the salt after the handshake, so the session does not need to be negotiated.
+internal uint32
+net_session(uint64 salt)
+{
+    uint32 result = cast(uint32)(salt ^ (salt >> 32));
+    return(result);
+}
+
+// NOTE(dgl): the type is stored in the low bits of the second byte (see serialize_packet).
+// Returns Packet_Type_Max if the data is no packet header.
+internal Packet_Type
+serialized_packet_type(uint8 *data, usize size)
+{
+    Packet_Type result = Packet_Type_Max;
+    if(size >= sizeof(uint32) && data[0] == NET_PROTOCOL_ID)
+    {
+        uint32 type = data[1] & ((1 << NET_PACKET_TYPE_BITS) - 1);
+        if(type < Packet_Type_Max && size >= packet_header_size(cast(Packet_Type)type))
+        {
+            result = cast(Packet_Type)type;
+        }
+    }
+
+    return(result);
+}
+
+internal bool32
+packet_is_message(Packet_Type type)
+{
+    bool32 result = (type == Packet_Type_Payload || type == Packet_Type_Empty);
+    return(result);
+}
+
+// NOTE(dgl): handshake packets carry the salt, connected packets the session derived from it
+internal bool32
+packet_salt_valid(Packet *packet, uint64 salt)
+{
+    bool32 result = false;
+    if(packet->type < _Packet_Type_Connected)
+    {
+        result = (packet->salt == salt);
+    }
+    else
+    {
+        result = (packet->session == net_session(salt));
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): only handshake packets carry the version. Peers with another version
+// cannot read our packets, therefore they are denied during the handshake.
+internal bool32
+packet_version_valid(Packet *packet)
+{
+    bool32 result = (packet->version == parse_version(ZHC_VERSION));
+    return(result);
+}
+
 internal usize
 serialize_packet(Bitstream *buffer, Packet *packet)
 {
     usize result = 0;
 
-    // TODO(dgl): handle different versions
-
     // NOTE(dgl): default serialization
     if(buffer->is_writing)
     {
-        stream_write_bits(buffer, cast(uint32)packet->id, 32);
-        stream_write_bits(buffer, packet->version, 32);
-        stream_write_bits(buffer, cast(uint32)(packet->salt & 0xFFFFFFFF), 32);
-        stream_write_bits(buffer, cast(uint32)(packet->salt >> 32), 32);
-        pack_uint32(buffer, cast(uint32)packet->type, 0, Packet_Type_Max - 1);
-        pack_uint32(buffer, cast(uint32)packet->msg_type, 0, Net_Message_Max - 1);
+        stream_write_bits(buffer, cast(uint32)packet->id, NET_PROTOCOL_ID_BITS);
+        stream_write_bits(buffer, cast(uint32)packet->type, NET_PACKET_TYPE_BITS);
+        stream_write_bits(buffer, cast(uint32)packet->msg_type, NET_MESSAGE_TYPE_BITS);
     }
     else if(buffer->is_reading)
     {
-        packet->id = cast(int32)stream_read_bits(buffer, 32);
-        uint32 tmp_version = stream_read_bits(buffer, 32);
-        packet->version = dgl_clamp(tmp_version, 1, 0xFFFFFFFF);
-        uint64 tmp_salt = 0;
-        tmp_salt = cast(uint64)stream_read_bits(buffer, 32);
-        tmp_salt |= (cast(uint64)stream_read_bits(buffer, 32)) << 32;
-        packet->salt = tmp_salt;
-        packet->type = cast(Packet_Type)unpack_uint32(buffer, 0, Packet_Type_Max - 1);
-        packet->msg_type = cast(Net_Message_Type)unpack_uint32(buffer, 0, Net_Message_Max - 1);
+        packet->id = cast(int32)stream_read_bits(buffer, NET_PROTOCOL_ID_BITS);
+        uint32 tmp_type = stream_read_bits(buffer, NET_PACKET_TYPE_BITS);
+        uint32 tmp_msg_type = stream_read_bits(buffer, NET_MESSAGE_TYPE_BITS);
+        packet->type = cast(Packet_Type)dgl_min(tmp_type, Packet_Type_Max - 1);
+        packet->msg_type = cast(Net_Message_Type)dgl_min(tmp_msg_type, Net_Message_Max - 1);
     }
      else
     {
@@ -149,13 +252,30 @@ serialize_packet(Bitstream *buffer, Packet *packet)
             {
                 stream_write_bits(buffer, cast(uint32)packet->chunk.hash, sizeof(packet->chunk.hash)*8);
                 pack_uint32(buffer, packet->chunk.last_slice_size, 0, NET_MTU_SIZE);
-                pack_uint32(buffer, packet->chunk.slice_count, 0, NET_MTU_SIZE*8);
+                pack_uint32(buffer, packet->chunk.slice_count, 0, NET_MAX_SLICE_COUNT);
+                pack_uint32(buffer, packet->chunk.fec_group_size, 0, NET_FEC_MAX_GROUP_SIZE);
+                pack_uint32(buffer, cast(uint32)packet->chunk.codec, 0, Net_Codec_Count - 1);
+                stream_write_bits(buffer, packet->chunk.raw_size, sizeof(packet->chunk.raw_size)*8);
             }
             else
             {
-                packet->chunk.hash = cast(uint16)stream_read_bits(buffer, sizeof(packet->chunk.hash)*8);
+                packet->chunk.hash = stream_read_bits(buffer, sizeof(packet->chunk.hash)*8);
                 packet->chunk.last_slice_size = unpack_uint32(buffer, 0, NET_MTU_SIZE);
-                packet->chunk.slice_count = unpack_uint32(buffer, 0, NET_MTU_SIZE*8);
+                packet->chunk.slice_count = unpack_uint32(buffer, 0, NET_MAX_SLICE_COUNT);
+                packet->chunk.fec_group_size = unpack_uint32(buffer, 0, NET_FEC_MAX_GROUP_SIZE);
+                packet->chunk.codec = cast(Net_Codec)unpack_uint32(buffer, 0, Net_Codec_Count - 1);
+                packet->chunk.raw_size = stream_read_bits(buffer, sizeof(packet->chunk.raw_size)*8);
+            }
+        } break;
+        case Packet_Type_Challenge:
+        {
+            if(buffer->is_writing)
+            {
+                pack_uint32(buffer, packet->challenge.codecs, 0, NET_CODEC_FLAG(Net_Codec_Count) - 1);
+            }
+            else
+            {
+                packet->challenge.codecs = unpack_uint32(buffer, 0, NET_CODEC_FLAG(Net_Codec_Count) - 1);
             }
         } break;
         case Packet_Type_Slice:
@@ -163,12 +283,25 @@ serialize_packet(Bitstream *buffer, Packet *packet)
             if(buffer->is_writing)
             {
                 stream_write_bits(buffer, cast(uint32)packet->slice.hash, sizeof(packet->slice.hash)*8);
-                pack_uint32(buffer, packet->slice.index, 0, NET_MTU_SIZE*8);
+                pack_uint32(buffer, packet->slice.index, 0, NET_MAX_SLICE_COUNT);
+            }
+            else
+            {
+                packet->slice.hash = stream_read_bits(buffer, sizeof(packet->slice.hash)*8);
+                packet->slice.index = unpack_uint32(buffer, 0, NET_MAX_SLICE_COUNT);
+            }
+        } break;
+        case Packet_Type_Parity:
+        {
+            if(buffer->is_writing)
+            {
+                stream_write_bits(buffer, cast(uint32)packet->parity.hash, sizeof(packet->parity.hash)*8);
+                pack_uint32(buffer, packet->parity.index, 0, NET_MAX_SLICE_COUNT);
             }
             else
             {
-                packet->slice.hash = cast(uint16)stream_read_bits(buffer, sizeof(packet->slice.hash)*8);
-                packet->slice.index = unpack_uint32(buffer, 0, NET_MTU_SIZE*8);
+                packet->parity.hash = stream_read_bits(buffer, sizeof(packet->parity.hash)*8);
+                packet->parity.index = unpack_uint32(buffer, 0, NET_MAX_SLICE_COUNT);
             }
         } break;
         case Packet_Type_Ack:
@@ -176,10 +309,43 @@ serialize_packet(Bitstream *buffer, Packet *packet)
             if(buffer->is_writing)
             {
                 stream_write_bits(buffer, cast(uint32)packet->ack.hash, sizeof(packet->ack.hash)*8);
+                pack_uint32(buffer, packet->ack.base, 0, NET_MAX_SLICE_COUNT);
+            }
+            else
+            {
+                 packet->ack.hash = stream_read_bits(buffer, sizeof(packet->ack.hash)*8);
+                 packet->ack.base = unpack_uint32(buffer, 0, NET_MAX_SLICE_COUNT);
+            }
+        } break;
+        case Packet_Type_Group:
+        {
+            if(buffer->is_writing)
+            {
+                stream_write_bits(buffer, packet->group.host, 32);
+                stream_write_bits(buffer, packet->group.port, 16);
+                stream_write_bits(buffer, cast(uint32)(packet->group.salt & 0xFFFFFFFF), 32);
+                stream_write_bits(buffer, cast(uint32)(packet->group.salt >> 32), 32);
+            }
+            else
+            {
+                packet->group.host = stream_read_bits(buffer, 32);
+                packet->group.port = cast(uint16)stream_read_bits(buffer, 16);
+                uint64 tmp_salt = cast(uint64)stream_read_bits(buffer, 32);
+                tmp_salt |= (cast(uint64)stream_read_bits(buffer, 32)) << 32;
+                packet->group.salt = tmp_salt;
+            }
+        } break;
+        case Packet_Type_Beacon:
+        {
+            if(buffer->is_writing)
+            {
+                stream_write_bits(buffer, packet->beacon.hash, sizeof(packet->beacon.hash)*8);
+                stream_write_bits(buffer, packet->beacon.seq, sizeof(packet->beacon.seq)*8);
             }
             else
             {
-                 packet->ack.hash = cast(uint16)stream_read_bits(buffer, sizeof(packet->ack.hash)*8);
+                packet->beacon.hash = stream_read_bits(buffer, sizeof(packet->beacon.hash)*8);
+                packet->beacon.seq = stream_read_bits(buffer, sizeof(packet->beacon.seq)*8);
             }
         } break;
         default:
@@ -188,12 +354,59 @@ serialize_packet(Bitstream *buffer, Packet *packet)
         }
     }
 
+    // NOTE(dgl): the patched fields
+    stream_align(buffer);
+    bool32 handshake = (packet->type < _Packet_Type_Connected);
+    bool32 is_message = packet_is_message(packet->type);
     if(buffer->is_writing)
     {
+        if(is_message)
+        {
+            stream_write_bits(buffer, cast(uint32)packet->message.seq | (cast(uint32)packet->message.ack << 16), 32);
+            stream_write_bits(buffer, packet->message.ack_bits, 32);
+        }
+        if(handshake)
+        {
+            stream_write_bits(buffer, packet->version, 32);
+            stream_write_bits(buffer, cast(uint32)(packet->salt & 0xFFFFFFFF), 32);
+            stream_write_bits(buffer, cast(uint32)(packet->salt >> 32), 32);
+        }
+        else
+        {
+            stream_write_bits(buffer, net_session(packet->salt), 32);
+        }
+        stream_write_bits(buffer, packet->timestamp, 32);
+        stream_write_bits(buffer, packet->echo, 32);
         stream_flush(buffer);
     }
+    else
+    {
+        if(is_message)
+        {
+            uint32 tmp_seq = stream_read_bits(buffer, 32);
+            packet->message.seq = cast(uint16)(tmp_seq & 0xFFFF);
+            packet->message.ack = cast(uint16)(tmp_seq >> 16);
+            packet->message.ack_bits = stream_read_bits(buffer, 32);
+        }
+        if(handshake)
+        {
+            uint32 tmp_version = stream_read_bits(buffer, 32);
+            packet->version = dgl_clamp(tmp_version, 1, 0xFFFFFFFF);
+            uint64 tmp_salt = 0;
+            tmp_salt = cast(uint64)stream_read_bits(buffer, 32);
+            tmp_salt |= (cast(uint64)stream_read_bits(buffer, 32)) << 32;
+            packet->salt = tmp_salt;
+        }
+        else
+        {
+            packet->session = stream_read_bits(buffer, 32);
+        }
+        packet->timestamp = stream_read_bits(buffer, 32);
+        packet->echo = stream_read_bits(buffer, 32);
+    }
 
     result = buffer->index * sizeof(*buffer->data);
+    assert(result == packet_header_size(packet->type), "The packet header does not match the schema");
     return(result);
 }
 
@@ -241,70 +454,79 @@ address_compare(Zhc_Net_Address a, Zhc_Net_Address b)
     return(result);
 }
 
-internal usize
-get_serialized_packet_size(Packet_Type type)
-{
-    // TODO(dgl): need a better way get the packet size. We should be able to get this on compile time
-    // for each type.
-    usize result = 0;
-
-    Packet tmp = {};
-    Bitstream writer = stream_writer_init(cast(uint8 *)&tmp, sizeof(tmp));
-    tmp.type = type;
-
-    result = serialize_packet(&writer, &tmp);
-    return(result);
-}
-
 //
 //
 //
 
-// NOTE(dgl): ignores disconnected connections
-internal Net_Conn_ID
-get_connection(Connection_List *conns, Zhc_Net_Address address)
+internal uint64
+timer_ticks(real64 time_ms)
 {
-    Net_Conn_ID result = -1;
+    uint64 result = cast(uint64)(time_ms / NET_TIMER_TICK_MS);
+    return(result);
+}
 
-    for(int32 index = 0; index < conns->max_count; ++index)
+internal void
+timer_wheel_init(DGL_Mem_Arena *arena, Net_Timer_Wheel *wheel, int32 count, uint64 tick)
+{
+    wheel->tick = tick;
+    wheel->count = count;
+    wheel->timers = dgl_mem_arena_push_array(arena, Net_Timer, cast(usize)count);
+    for(int32 index = 0; index < count; ++index)
     {
-        if(conns->state[index] == Net_Conn_State_Disconnected)
-        {
-            continue;
-        }
-
-        if(address_compare(conns->address[index], address))
-        {
-            result = index;
-            break;
-        }
+        Net_Timer *timer = wheel->timers + index;
+        timer->next = -1;
+        timer->prev = -1;
+        timer->list = -1;
     }
+    for(int32 index = 0; index < array_count(wheel->heads); ++index) { wheel->heads[index] = -1; }
+}
 
-    return(result);
+internal void
+timer_unlink(Net_Timer_Wheel *wheel, int32 id)
+{
+    assert(id >= 0 && id < wheel->count, "Invalid timer id");
+    Net_Timer *timer = wheel->timers + id;
+    if(timer->list >= 0)
+    {
+        if(timer->prev >= 0) { wheel->timers[timer->prev].next = timer->next; }
+        else { wheel->heads[timer->list] = timer->next; }
+        if(timer->next >= 0) { wheel->timers[timer->next].prev = timer->prev; }
+
+        timer->next = -1;
+        timer->prev = -1;
+        timer->list = -1;
+    }
 }
 
-internal Net_Conn_ID
-get_free_conn(Connection_List *conns)
+internal void
+timer_link(Net_Timer_Wheel *wheel, int32 id, int32 list)
 {
-    Net_Conn_ID result = -1;
+    assert(list >= 0 && list <= NET_TIMER_EXPIRED_LIST, "Invalid timer list");
+    Net_Timer *timer = wheel->timers + id;
+    timer->list = list;
+    timer->prev = -1;
+    timer->next = wheel->heads[list];
+    if(timer->next >= 0) { wheel->timers[timer->next].prev = id; }
+    wheel->heads[list] = id;
+}
 
-    int32 index = conns->index;
-    while(++index != conns->index)
+// NOTE(dgl): returns the slot of the lowest level, which contains the expiry tick.
+// Timers which already expired are processed with the next tick.
+internal int32
+timer_wheel_slot(Net_Timer_Wheel *wheel, uint64 expires)
+{
+    int32 result = -1;
+    expires = dgl_max(expires, wheel->tick);
+    uint64 delta = expires - wheel->tick;
+    for(int32 level = 0; level < NET_TIMER_WHEEL_LEVELS; ++level)
     {
-        // NOTE(dgl): we increase the counter first and then check the bound.
-        // this here is fine, because we will always have at least 1 element.
-        if(index >= conns->max_count) { index = 0; }
-
-        assert(index < conns->max_count, "Index is out of bounds");
-        // NOTE(dgl): We consider connecting connections as "free" to prevent
-        // opening connections fill up the conn slots and never do the full handshake.
-        if(conns->state[index] != Net_Conn_State_Connected)
+        uint32 shift = cast(uint32)(level*NET_TIMER_WHEEL_BITS);
+        uint64 level_range = 1ULL << (shift + NET_TIMER_WHEEL_BITS);
+        if(delta < level_range || level == NET_TIMER_WHEEL_LEVELS - 1)
         {
-            result = index;
-            // NOTE(dgl): we set the starting index to the result id, to prevent
-            // that it is overwritten on the next connection request because we always
-            // return the first not established connection in the list.
-            conns->index = result;
+            // NOTE(dgl): timers beyond the last level are cascaded again, when their slot comes up.
+            if(delta >= level_range) { expires = wheel->tick + level_range - 1; }
+            result = level*NET_TIMER_WHEEL_SLOTS + cast(int32)((expires >> shift) & (NET_TIMER_WHEEL_SLOTS - 1));
             break;
         }
     }
@@ -312,393 +534,2715 @@ get_free_conn(Connection_List *conns)
     return(result);
 }
 
-internal Net_Conn_ID
-push_connection(Connection_List *conns, Zhc_Net_Address address, uint64 salt)
+internal void
+timer_schedule(Net_Timer_Wheel *wheel, int32 id, real64 delay_ms)
 {
-    // NOTE(dgl): get_connection returns the first found connection with the address.
-    // This ensures that all addresses are unique. When pushing an
-    // existing address it simply gets overwritten. This should be no performance issue because
-    // we only check on new incoming connections.
-    Net_Conn_ID result = -1;
-    Net_Conn_ID existing = get_connection(conns, address);
-    if(existing >= 0)
-    {
-        result = existing;
-    }
-    else
+    timer_unlink(wheel, id);
+    Net_Timer *timer = wheel->timers + id;
+    timer->expires = wheel->tick + timer_ticks(delay_ms);
+    timer_link(wheel, id, timer_wheel_slot(wheel, timer->expires));
+}
+
+internal bool32
+timer_scheduled(Net_Timer_Wheel *wheel, int32 id)
+{
+    bool32 result = (wheel->timers[id].list >= 0);
+    return(result);
+}
+
+// NOTE(dgl): processes all ticks up to (including) the target tick and moves the timers which
+// expired to the expired list. The timers of the higher levels are moved down when the
+// lower level wraps around.
+internal void
+timer_wheel_advance(Net_Timer_Wheel *wheel, uint64 target_tick)
+{
+    while(wheel->tick <= target_tick)
     {
-        result = get_free_conn(conns);
+        for(int32 level = 1; level < NET_TIMER_WHEEL_LEVELS; ++level)
+        {
+            uint32 shift = cast(uint32)(level*NET_TIMER_WHEEL_BITS);
+            if(wheel->tick & ((1ULL << shift) - 1)) { break; }
+
+            int32 list = level*NET_TIMER_WHEEL_SLOTS + cast(int32)((wheel->tick >> shift) & (NET_TIMER_WHEEL_SLOTS - 1));
+            int32 id = wheel->heads[list];
+            wheel->heads[list] = -1;
+            while(id >= 0)
+            {
+                Net_Timer *timer = wheel->timers + id;
+                int32 next = timer->next;
+                timer_link(wheel, id, timer_wheel_slot(wheel, timer->expires));
+                id = next;
+            }
+        }
+
+        int32 list = cast(int32)(wheel->tick & (NET_TIMER_WHEEL_SLOTS - 1));
+        int32 id = wheel->heads[list];
+        wheel->heads[list] = -1;
+        while(id >= 0)
+        {
+            int32 next = wheel->timers[id].next;
+            timer_link(wheel, id, NET_TIMER_EXPIRED_LIST);
+            id = next;
+        }
+
+        wheel->tick++;
     }
+}
 
+// NOTE(dgl): returns -1 if no timer expired
+internal int32
+timer_pop_expired(Net_Timer_Wheel *wheel)
+{
+    int32 result = wheel->heads[NET_TIMER_EXPIRED_LIST];
     if(result >= 0)
     {
-        // NOTE(dgl): reset the fields and set the state to connecting, as we expect packets to be send/received.
-        conns->state[result] = Net_Conn_State_Connecting;
-        conns->address[result] = address;
-        conns->salt[result] = salt;
-        conns->no_timeout[result] = true;
-    }
-    else
-    {
-        LOG_DEBUG("No free connection available");
+        timer_unlink(wheel, result);
     }
 
     return(result);
 }
 
-internal Packet
-default_packet(Packet_Type type)
+internal void
+conn_timer_schedule(Connection_List *conns, Net_Conn_ID index, Net_Timer_Kind kind, real64 delay_ms)
 {
-    Packet result = {};
-    result.id = 0x1234;
-    result.version = parse_version(ZHC_VERSION);
-    result.type = type;
-
-    // NOTE(dgl): salt is added when we serialize and put the packet into the packet buffer
-    // because then we have the connection index available.
-
-    return(result);
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    timer_schedule(conns->timers, index*Net_Timer_Kind_Count + kind, delay_ms);
 }
 
 internal void
-packet_buffer_append(Packet_Buffer *buffer, uint8 *payload, usize payload_size)
+conn_timer_cancel(Connection_List *conns, Net_Conn_ID index, Net_Timer_Kind kind)
 {
-    assert(buffer->offset > 0, "Packet buffer must be initialized before appending");
-    // TODO(dgl): are we one off here?
-    assert(buffer->offset + payload_size <= array_count(buffer->data), "Payload too large. Packet buffer overflow");
-
-    dgl_memcpy(buffer->data + buffer->offset, payload, payload_size);
-
-    LOG_DEBUG("Appending payload with %llu bytes to the buffer at %p (%llu bytes).", payload_size, buffer->data, buffer->offset);
-    buffer->offset += payload_size;
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    timer_unlink(conns->timers, index*Net_Timer_Kind_Count + kind);
 }
 
-internal Packet_Buffer*
-packet_buffer_init(Connection_List *conns, Net_Conn_ID index, Packet packet)
+internal bool32
+conn_timer_scheduled(Connection_List *conns, Net_Conn_ID index, Net_Timer_Kind kind)
 {
-    assert(index >= 0, "Invalid index");
-    Packet_Buffer *result = 0;
-
-    packet.salt = conns->salt[index];
-
-    assert(conns->packet_buffer, "Packet buffer array not initialized");
-    Packet_Buffer *packet_buffer = conns->packet_buffer + index;
-    usize buffer_size = array_count(packet_buffer->data);
-
-    Bitstream writer = stream_writer_init(packet_buffer->data, buffer_size);
-    packet_buffer->offset = serialize_packet(&writer, &packet);
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    bool32 result = timer_scheduled(conns->timers, index*Net_Timer_Kind_Count + kind);
+    return(result);
+}
 
-    // NOTE(dgl): zeroing remaining buffer
-    dgl_memset(packet_buffer->data + packet_buffer->offset, 0, buffer_size - packet_buffer->offset);
-    LOG_DEBUG("Initializing packet of type %d with %llu bytes of data into the buffer at %p (Salt: %llx)", packet.type, packet_buffer->offset, packet_buffer->data, packet.salt);
+// NOTE(dgl): the timer of the group is the last timer of the wheel, after the timers of the connections
+internal int32
+group_timer_id(Connection_List *conns)
+{
+    int32 result = conns->max_count*Net_Timer_Kind_Count;
+    return(result);
+}
 
-    result = packet_buffer;
+// NOTE(dgl): 0 is reserved for "no timestamp"
+internal uint32
+net_timestamp(real64 time_ms)
+{
+    uint32 result = cast(uint32)cast(uint64)time_ms;
+    if(result == 0) { result = 1; }
     return(result);
 }
 
-// NOTE(dgl): closes current socket, if it exists.
 internal void
-net_open_socket(Net_Context *ctx)
+rtt_reset(Net_Rtt *rtt)
 {
-    Zhc_Net_Socket *socket = &ctx->socket;
-    // NOTE(dgl): we cannot notify the peers if the socket has an error. They will have to try
-    // and get a denied packet when trying to send data. Then they have to reauthenticate.
-    dgl_memset(ctx->conns->state, Net_Conn_State_Disconnected, cast(usize)ctx->conns->max_count);
-    platform.close_socket(socket);
-    // TODO(dgl): arena not needed. Will be removed later.
-    platform.open_socket(0, socket);
-    assert(socket->handle.no_error, "Failed to open socket");
-    LOG_DEBUG("Listening for connection: %d.%d.%d.%d:%d", socket->address.ip[0], socket->address.ip[1], socket->address.ip[2], socket->address.ip[3], socket->address.port);
+    *rtt = {};
+    rtt->rto = NET_INITIAL_RTO_MS;
 }
 
-// NOTE(dgl): must be sent without a packet buffer available. Therefore
-// this call is separate.
 internal void
-send_denied_packet(Net_Context *ctx, Zhc_Net_Address address)
+rtt_add_sample(Net_Rtt *rtt, real32 sample_ms)
 {
-    Packet packet = default_packet(Packet_Type_Denied);
+    rtt->recent[rtt->sample_count % NET_RTT_RECENT_COUNT] = sample_ms;
+    if(rtt->sample_count == 0)
+    {
+        rtt->srtt = sample_ms;
+        rtt->rttvar = sample_ms / 2.0f;
+        rtt->min_rtt = sample_ms;
+    }
+    else
+    {
+        real32 error = rtt->srtt - sample_ms;
+        if(error < 0.0f) { error = -error; }
+        rtt->rttvar = 0.75f*rtt->rttvar + 0.25f*error;
+        rtt->srtt = 0.875f*rtt->srtt + 0.125f*sample_ms;
+        rtt->min_rtt = dgl_min(rtt->min_rtt, sample_ms);
+    }
+    rtt->sample_count++;
 
-    uint8 buffer[NET_MTU_SIZE] = {};
-    Bitstream writer = stream_writer_init(buffer, array_count(buffer));
-    usize count = serialize_packet(&writer, &packet);
+    // NOTE(dgl): the variance is at least one tick of the timer wheel
+    real32 variance = dgl_max(cast(real32)NET_TIMER_TICK_MS, 4.0f*rtt->rttvar);
+    rtt->rto = dgl_clamp(rtt->srtt + variance, NET_MIN_RTO_MS, NET_MAX_RTO_MS);
+    rtt->backoff = 0;
+}
 
-    platform.send_data(&ctx->socket, &address, buffer, count);
-    LOG_DEBUG("Sending denied packet");
+internal real32
+rtt_timeout(Net_Rtt *rtt)
+{
+    real32 result = dgl_min(rtt->rto*cast(real32)(1 << rtt->backoff), NET_MAX_RTO_MS);
+    return(result);
 }
 
 internal void
-send_discovery_packet(Net_Context *ctx)
+congestion_reset(Net_Congestion *cc)
 {
-    Packet packet = default_packet(Packet_Type_Server_Discovery);
+    *cc = {};
+    cc->cwnd = NET_INITIAL_CWND;
+    cc->ssthresh = cast(real32)NET_WINDOW_SIZE;
+}
 
-    uint8 buffer[NET_MTU_SIZE] = {};
-    Bitstream writer = stream_writer_init(buffer, array_count(buffer));
-    usize count = serialize_packet(&writer, &packet);
+// NOTE(dgl): LEDBAT uses the one way delay. We only have the round trip time, so the
+// queuing delay is the round trip time above the minimum we have seen.
+internal real32
+rtt_queuing_delay(Net_Rtt *rtt)
+{
+    real32 result = 0.0f;
+    if(rtt->sample_count > 0)
+    {
+        uint32 count = dgl_min(rtt->sample_count, NET_RTT_RECENT_COUNT);
+        real32 current = rtt->recent[0];
+        for(uint32 index = 1; index < count; ++index) { current = dgl_min(current, rtt->recent[index]); }
+        result = current - rtt->min_rtt;
+    }
 
-    // TODO(dgl): should we use a subnet broadcast?
-    Zhc_Net_Address address = parse_address("255.255.255.255", ZHC_SERVER_PORT);
+    return(result);
+}
 
-    platform.send_data(&ctx->socket, &address, buffer, count);
-    LOG_DEBUG("Sending discovery packet");
+// NOTE(dgl): the jitter of the wifi looks like queuing delay. The target is at least the
+// variance of the round trip, otherwise the window would not grow on a jittery path.
+internal real32
+congestion_target(Net_Rtt *rtt)
+{
+    real32 result = dgl_max(NET_LEDBAT_TARGET_MS, 2.0f*rtt->rttvar);
+    return(result);
 }
 
-internal Net_Context *
-net_init_server(DGL_Mem_Arena *arena)
+internal void
+congestion_on_ack(Net_Congestion *cc, Net_Rtt *rtt, uint32 acked_count)
 {
-    Net_Context *result = dgl_mem_arena_push_struct(arena, Net_Context);
-    result->chunk_buffer_size = ZHC_MAX_FILESIZE;
-    result->chunk_buffer = dgl_mem_arena_push_array(arena, uint8, result->chunk_buffer_size);
-    result->conns = dgl_mem_arena_push_struct(arena, Connection_List);
-    {
-        Connection_List *conns = result->conns;
-        conns->max_count = NET_MAX_CLIENTS;
-        usize casted_count = cast(usize)conns->max_count;
-        conns->no_timeout = dgl_mem_arena_push_array(arena, bool32, casted_count);
-        dgl_memset(conns->no_timeout, false, sizeof(*conns->no_timeout)*casted_count);
-        conns->address = dgl_mem_arena_push_array(arena, Zhc_Net_Address, casted_count);
-        conns->salt = dgl_mem_arena_push_array(arena, uint64, casted_count);
-        conns->last_packet_hash = dgl_mem_arena_push_array(arena, uint32, casted_count);
-        conns->packet_buffer = dgl_mem_arena_push_array(arena, Packet_Buffer, casted_count);
-        conns->state = dgl_mem_arena_push_array(arena, Net_Conn_State, casted_count);
+    real32 acked = cast(real32)acked_count;
+    real32 target = congestion_target(rtt);
+    real32 off_target = dgl_clamp((target - rtt_queuing_delay(rtt)) / target, -1.0f, 1.0f);
+
+    // NOTE(dgl): slow start until the first congestion loss or until the queue grows
+    if(cc->cwnd < cc->ssthresh && off_target > 0.0f)
+    {
+        cc->cwnd += acked;
+    }
+    else
+    {
+        cc->cwnd += NET_LEDBAT_GAIN*off_target*acked / cc->cwnd;
     }
+    cc->cwnd = dgl_clamp(cc->cwnd, NET_MIN_CWND, cast(real32)NET_WINDOW_SIZE);
+}
 
-    result->socket.address.port = ZHC_SERVER_PORT;
+// NOTE(dgl): Only losses with a queue at the bottleneck halve the window (like TCP Veno).
+// The backlog is the number of slices waiting in the queue. The queuing delay must be
+// larger than the jitter of the path, otherwise the loss is a random loss of the wifi,
+// which is repaired without slowing down.
+internal void
+congestion_on_loss(Net_Congestion *cc, Net_Rtt *rtt)
+{
+    real32 queuing_delay = rtt_queuing_delay(rtt);
+    real32 backlog = cc->cwnd*queuing_delay / dgl_max(rtt->min_rtt + queuing_delay, 1.0f);
+    if(backlog >= NET_CONGESTION_BACKLOG && queuing_delay >= 2.0f*rtt->rttvar)
+    {
+        cc->ssthresh = dgl_max(cc->cwnd / 2.0f, NET_MIN_CWND);
+        cc->cwnd = cc->ssthresh;
+    }
+}
 
-    result->is_server = true;
+// NOTE(dgl): the peer did not ack anything for a whole timeout. We start with
+// the minimum window again.
+internal void
+congestion_on_timeout(Net_Congestion *cc)
+{
+    cc->ssthresh = dgl_max(cc->cwnd / 2.0f, NET_MIN_CWND);
+    cc->cwnd = NET_MIN_CWND;
+}
+
+// NOTE(dgl): the slices per ms to send the window in one round trip. Without a round
+// trip sample we cannot pace and only the window limits the slices.
+internal real32
+pacing_rate(Net_Congestion *cc, Net_Rtt *rtt)
+{
+    real32 result = 0.0f;
+    if(rtt->sample_count > 0)
+    {
+        result = NET_PACING_GAIN*cc->cwnd / dgl_max(rtt->srtt, 1.0f);
+    }
 
     return(result);
 }
 
-internal Net_Context *
-net_init_client(DGL_Mem_Arena *arena)
+// NOTE(dgl): the bucket holds the slices of one tick of the timer wheel (at least a small burst)
+internal void
+pacing_refill(Net_Congestion *cc, Net_Rtt *rtt, real64 time_ms)
 {
-    Net_Context *result = dgl_mem_arena_push_struct(arena, Net_Context);
-    result->chunk_buffer_size = ZHC_MAX_FILESIZE;
-    result->chunk_buffer = dgl_mem_arena_push_array(arena, uint8, result->chunk_buffer_size);
-    result->conns = dgl_mem_arena_push_struct(arena, Connection_List);
-    {
-        Connection_List *conns = result->conns;
-        // NOTE(dgl): if we allow more than one connections here, we need a way to only
-        // use the fastest connection or ignore already received packets. This is currently
-        // not needed. We maybe develop something like this just for educational reasons in the
-        // future.
-        conns->max_count = 1;
-        usize casted_count = cast(usize)conns->max_count;
-        conns->no_timeout = dgl_mem_arena_push_array(arena, bool32, casted_count);
-        dgl_memset(conns->no_timeout, false, sizeof(*conns->no_timeout)*casted_count);
-        conns->address = dgl_mem_arena_push_array(arena, Zhc_Net_Address, casted_count);
-        conns->salt = dgl_mem_arena_push_array(arena, uint64, casted_count);
-        conns->last_packet_hash = dgl_mem_arena_push_array(arena, uint32, casted_count);
-        conns->packet_buffer = dgl_mem_arena_push_array(arena, Packet_Buffer, casted_count);
-        conns->state = dgl_mem_arena_push_array(arena, Net_Conn_State, casted_count);
+    real32 rate = pacing_rate(cc, rtt);
+    if(rate > 0.0f)
+    {
+        real32 capacity = dgl_max(NET_PACING_MIN_BURST, rate*cast(real32)NET_TIMER_TICK_MS);
+        cc->tokens = dgl_min(cc->tokens + rate*cast(real32)(time_ms - cc->refill_at), capacity);
+    }
+    else
+    {
+        cc->tokens = cc->cwnd;
     }
+    cc->refill_at = time_ms;
+}
 
-    result->is_server = false;
+// NOTE(dgl): reschedules the timer of a resend. The peer did not reply in time,
+// so we wait twice as long for the next resend.
+internal void
+conn_timer_backoff(Connection_List *conns, Net_Conn_ID index, Net_Timer_Kind kind)
+{
+    Net_Rtt *rtt = conns->rtt + index;
+    rtt->backoff = dgl_min(rtt->backoff + 1, NET_MAX_RTO_BACKOFF);
+    conn_timer_schedule(conns, index, kind, rtt_timeout(rtt));
+}
+
+internal uint32
+address_hash(Zhc_Net_Address address)
+{
+    // NOTE(dgl): murmur3 finalizer to spread the host and port bits over the whole hash
+    uint32 result = address.host ^ (cast(uint32)address.port * 0x9E3779B1);
+    result ^= result >> 16;
+    result *= 0x85EBCA6B;
+    result ^= result >> 13;
+    result *= 0xC2B2AE35;
+    result ^= result >> 16;
 
     return(result);
 }
 
 internal void
-net_send_packet_buffer(Net_Context *ctx, Net_Conn_ID index)
+conn_lookup_insert(Connection_List *conns, Net_Conn_ID index)
 {
-    Connection_List *conns = ctx->conns;
-    assert(conns->packet_buffer, "Packet buffer not initialized");
-    assert(index >= 0, "Invalid connection index");
-
-    Packet_Buffer *buffer = conns->packet_buffer + index;
-    Zhc_Net_Address *address = conns->address + index;
-    LOG_DEBUG("Sending packet buffer to conn index %d (%llu bytes)", index, buffer->offset);
-    platform.send_data(&ctx->socket, address, buffer->data, buffer->offset);
+    uint32 mask = cast(uint32)conns->lookup_count - 1;
+    uint32 slot = address_hash(conns->address[index]) & mask;
+    while(conns->lookup[slot] >= 0)
+    {
+        assert(conns->lookup[slot] != index, "Connection is already in the lookup table");
+        slot = (slot + 1) & mask;
+    }
+    conns->lookup[slot] = index;
 }
 
+// NOTE(dgl): We do not use tombstones. The following entries of the probe sequence are
+// moved back into the removed slot, if their home slot allows it.
 internal void
-net_send_pending_packet_buffers(Net_Context *ctx)
+conn_lookup_remove(Connection_List *conns, Net_Conn_ID index)
 {
-    Connection_List *conns = ctx->conns;
-    assert(conns->packet_buffer, "Packet buffer not initialized");
+    uint32 mask = cast(uint32)conns->lookup_count - 1;
+    uint32 slot = address_hash(conns->address[index]) & mask;
+    while(conns->lookup[slot] >= 0 && conns->lookup[slot] != index)
+    {
+        slot = (slot + 1) & mask;
+    }
 
-    for(int32 index = 0; index < conns->max_count; ++index)
+    if(conns->lookup[slot] == index)
     {
-        if(conns->state[index] == Net_Conn_State_Connecting)
+        uint32 next = slot;
+        for(;;)
         {
-            net_send_packet_buffer(ctx, index);
+            next = (next + 1) & mask;
+            Net_Conn_ID entry = conns->lookup[next];
+            if(entry < 0) { break; }
+
+            // NOTE(dgl): the entry must stay if its home slot lies cyclically in (slot, next]
+            uint32 home = address_hash(conns->address[entry]) & mask;
+            bool32 stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+            if(!stays)
+            {
+                conns->lookup[slot] = entry;
+                slot = next;
+            }
         }
+        conns->lookup[slot] = -1;
     }
 }
 
-internal void
-net_request_server_connection(Net_Context *ctx)
+// NOTE(dgl): ignores disconnected connections
+internal Net_Conn_ID
+get_connection(Connection_List *conns, Zhc_Net_Address address)
 {
-    assert(!ctx->is_server, "Only clients can connect to a server");
-    // NOTE(dgl): a client only has one connection slot available.
-    // if this is not connected, we send a discovery packet to request
-    // the connection to a server. We connect to the server replying the fastest.
-    // However, currently we do not support having multiple servers.
-    if(ctx->conns->state[0] == Net_Conn_State_Disconnected)
+    Net_Conn_ID result = -1;
+
+    uint32 mask = cast(uint32)conns->lookup_count - 1;
+    uint32 slot = address_hash(address) & mask;
+    Net_Conn_ID index = -1;
+    while((index = conns->lookup[slot]) >= 0)
     {
-        send_discovery_packet(ctx);
+        if(address_compare(conns->address[index], address) &&
+           conns->state[index] != Net_Conn_State_Disconnected)
+        {
+            result = index;
+            break;
+        }
+        slot = (slot + 1) & mask;
     }
+
+    return(result);
 }
 
-internal bool32
-chunk_complete(uint8 *buffer, usize buffer_size, uint32 bit_count)
+internal Net_Conn_ID
+get_free_conn(Connection_List *conns)
 {
-    bool32 result = true;
-
-    int32 required_bytes = dgl_safe_uint32_to_int32(bit_count / 8) + 1;
-    assert(required_bytes <= buffer_size, "Bit count is larger than bytes available in buffer");
-
-    uint8 last_bits = cast(uint8)(bit_count % 8);
-    uint8 last_mask_bits = cast(uint8)~(0xFFFFFFFF << (last_bits));
+    Net_Conn_ID result = -1;
 
-    int32 index = required_bytes - 1;
-    LOG_DEBUG("Chunk buffer index 0x%X, mask 0x%X", buffer[index], last_mask_bits);
-    if(buffer[index--] != last_mask_bits)
+    if(conns->free_count > 0)
     {
-        result = false;
+        result = conns->free_list[--conns->free_count];
+        assert(conns->state[result] == Net_Conn_State_Disconnected, "Connections in the free list must be disconnected");
+    }
+    else
+    {
+        // NOTE(dgl): the scan starts after the last result and ends with it. All slots are
+        // checked once, even if all of them are connected.
+        int32 index = conns->index;
+        for(int32 step = 0; step < conns->max_count; ++step)
+        {
+            if(++index >= conns->max_count) { index = 0; }
+
+            assert(index < conns->max_count, "Index is out of bounds");
+            // NOTE(dgl): We consider connecting connections as "free" to prevent
+            // opening connections fill up the conn slots and never do the full handshake.
+            if(conns->state[index] != Net_Conn_State_Connected)
+            {
+                result = index;
+                // NOTE(dgl): we set the starting index to the result id, to prevent
+                // that it is overwritten on the next connection request because we always
+                // return the first not established connection in the list.
+                conns->index = result;
+                conn_lookup_remove(conns, result);
+                break;
+            }
+        }
     }
 
-    while(index >= 0)
+    return(result);
+}
+
+// NOTE(dgl): the lock is only taken, if the store is shared by the server shards
+internal void
+chunk_store_lock(Net_Chunk_Store *store)
+{
+    if(store && store->shared)
     {
-        // NOTE(dgl): @performance if this is too slow switch to 64bit integers
-        LOG_DEBUG("Chunk buffer index 0x%X, mask 0x%X", buffer[index], 0xFF);
-        if(buffer[index--] == 0xFF)
+        while(dgl_atomic_compare_exchange_uint32(&store->lock, 1, 0) != 0)
         {
-            result = false;
-            break;
+            // NOTE(dgl): we only spin on loads, the compare exchange takes the cache line exclusively
+            while(store->lock) { dgl_atomic_pause(); }
         }
     }
+}
+
+internal void
+chunk_store_unlock(Net_Chunk_Store *store)
+{
+    if(store && store->shared)
+    {
+        dgl_atomic_fence();
+        store->lock = 0;
+    }
+}
+
+// NOTE(dgl): releases the reference to the previous chunk of the connection
+// and acquires a reference to the new one. Pass 0 to only release the chunk.
+// A chunk which was replaced since it was set holds no reference anymore. The new chunk is not
+// set, if it was replaced after it was prepared (the generation changed).
+internal void
+conn_set_chunk(Connection_List *conns, Net_Conn_ID index, Net_Chunk *chunk, uint32 generation)
+{
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    chunk_store_lock(conns->chunk_store);
+    Net_Chunk *old_chunk = conns->chunk[index];
+    if(old_chunk && old_chunk->generation == conns->chunk_generation[index])
+    {
+        assert(old_chunk->ref_count > 0, "Chunk reference count underflow");
+        old_chunk->ref_count--;
+    }
+
+    if(chunk && chunk->generation != generation)
+    {
+        LOG("Chunk %u was replaced by another shard before it was sent", chunk->info.hash);
+        chunk = 0;
+    }
 
+    if(chunk)
+    {
+        chunk->ref_count++;
+    }
+
+    conns->chunk[index] = chunk;
+    conns->chunk_generation[index] = generation;
+    chunk_store_unlock(conns->chunk_store);
+}
+
+// NOTE(dgl): returns the chunk of the connection or 0, if it was replaced by another shard
+internal Net_Chunk *
+conn_chunk(Connection_List *conns, Net_Conn_ID index)
+{
+    Net_Chunk *result = conns->chunk[index];
+    if(result && result->generation != conns->chunk_generation[index])
+    {
+        conn_set_chunk(conns, index, 0, 0);
+        result = 0;
+    }
 
     return(result);
 }
 
-// NOTE(dgl): Make sure to send the chunk packet before sending the chunk buffer!
-// Otherwise the packets will be ignored by the client.
 internal void
-send_chunk_buffer(Net_Context *ctx, Net_Conn_ID index, uint8 *ack_mask, usize ack_mask_size)
+packet_ring_release(Connection_List *conns, Net_Outbound *entry)
 {
-    usize slice_space = NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Slice);
-    Packet packet = default_packet(Packet_Type_Slice);
-    packet.slice.hash = ctx->chunk_info.hash;
-    uint8 *root = ctx->chunk_buffer;
-    for(uint32 slice_index = 0;
-        slice_index < ctx->chunk_info.slice_count;
-        ++slice_index)
+    if(entry->flags & Net_Outbound_Flag_Pooled)
     {
-        if(ack_mask)
-        {
-            // NOTE(dgl): if the bit in the mask is set to 1 the slice has already been received.
-            // We can skip it in here.
-            int32 mask_byte = slice_index / 8;
-            uint32 mask_bit = 1 << (slice_index % 8);
-            assert(mask_byte < ack_mask_size, "Invalid ack mask byte");
+        dgl_mem_pool_release(conns->packet_pool, entry->buffer);
+    }
+    *entry = {};
+}
 
-            // TODO(dgl): this check does not work properly yet.
-            if((ack_mask[mask_byte] & mask_bit) == mask_bit)
-            {
-                LOG_DEBUG("Slice %u already received by the client. Skipping...", slice_index);
-                continue;
-            }
-        }
+// NOTE(dgl): drops all queued datagrams of the connection
+internal void
+packet_ring_reset(Connection_List *conns, Net_Conn_ID index)
+{
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    Net_Packet_Ring *ring = conns->outbound + index;
+    for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+    {
+        packet_ring_release(conns, ring->entries + (entry_index % NET_PACKET_RING_SIZE));
+    }
+    ring->read = 0;
+    ring->unsent = 0;
+    ring->write = 0;
+}
+
+// NOTE(dgl): Releases all sent entries, which do not have to be kept. The kept
+// entries are moved to the front of the ring. Must only be called after sending all entries.
+internal void
+packet_ring_retire(Connection_List *conns, Net_Conn_ID index)
+{
+    Net_Packet_Ring *ring = conns->outbound + index;
+    assert(ring->unsent == ring->write, "Only sent entries can be retired");
 
-        usize size = 0;
-        if(slice_index == ctx->chunk_info.slice_count - 1)
+    uint32 kept = ring->read;
+    for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+    {
+        Net_Outbound *entry = ring->entries + (entry_index % NET_PACKET_RING_SIZE);
+        bool32 keep = (((entry->flags & Net_Outbound_Flag_Keep) &&
+                        (!(entry->flags & Net_Outbound_Flag_Handshake) || conns->state[index] == Net_Conn_State_Connecting)) ||
+                       (entry->flags & Net_Outbound_Flag_Reliable));
+        if(keep)
         {
-            size = ctx->chunk_info.last_slice_size;
+            Net_Outbound *kept_entry = ring->entries + (kept++ % NET_PACKET_RING_SIZE);
+            if(kept_entry != entry)
+            {
+                *kept_entry = *entry;
+                *entry = {};
+            }
         }
         else
         {
-            size = slice_space;
+            packet_ring_release(conns, entry);
         }
-
-        packet.slice.index = slice_index;
-        Packet_Buffer *buffer = packet_buffer_init(ctx->conns, index, packet);
-        packet_buffer_append(buffer, root, size);
-        root += size;
-
-        net_send_packet_buffer(ctx, index);
-        LOG_DEBUG("Sending slice %u (%llu bytes)", packet.slice.index, size);
     }
+
+    ring->unsent = kept;
+    ring->write = kept;
 }
 
-// NOTE(dgl): messy. Needs a refactor @cleanup
 internal Net_Conn_ID
-net_recv_message(DGL_Mem_Arena *arena, Net_Context *ctx, real32 frametime_in_ms, Net_Message *message)
+push_connection(Connection_List *conns, Zhc_Net_Address address, uint64 salt)
 {
-    Connection_List *conns = ctx->conns;
-    // NOTE(dgl): index is used for the internal connection index. If we want to return
-    // the packet/message we put the index into result. This indicates the client that
-    // we received a message. Otherwise the messages are handled internal. We loop and
-    // handle all packets until we have a packet which is returned as message to the client.
+    // NOTE(dgl): get_connection returns the first found connection with the address.
+    // This ensures that all addresses are unique. When pushing an
+    // existing address it simply gets overwritten. This should be no performance issue because
+    // we only check on new incoming connections.
     Net_Conn_ID result = -1;
-    Net_Conn_ID index = -1;
+    Net_Conn_ID existing = get_connection(conns, address);
+    if(existing >= 0)
+    {
+        result = existing;
+    }
+    else
+    {
+        result = get_free_conn(conns);
+    }
 
-    // NOTE(dgl): disconnect connections which were not updated in the last x seconds.
-    ctx->message_timeout += frametime_in_ms;
-    if(ctx->message_timeout >= NET_CONN_TIMEOUT)
+    if(result >= 0)
     {
-        LOG_DEBUG("Checking connection timeouts");
-        ctx->message_timeout = 0.0f;
-        for(int32 index = 0; index < conns->max_count; ++index)
-        {
-            if(conns->no_timeout[index] == false)
-            {
-                // NOTE(dgl): We do not have to send a message here. If we hit a timeout, there is something
-                // wrong with this connection and the message will most likely not receive the peer.
-                conns->state[index] = Net_Conn_State_Disconnected;
-            }
-        }
-        dgl_memset(conns->no_timeout, false, sizeof(*conns->no_timeout)*cast(usize)conns->max_count);
+        // NOTE(dgl): reset the fields and set the state to connecting, as we expect packets to be send/received.
+        conns->state[result] = Net_Conn_State_Connecting;
+        conns->address[result] = address;
+        if(existing < 0) { conn_lookup_insert(conns, result); }
+        conns->salt[result] = salt;
+        conn_timer_schedule(conns, result, Net_Timer_Kind_Idle, NET_CONN_TIMEOUT);
+        conn_timer_cancel(conns, result, Net_Timer_Kind_Handshake);
+        conn_timer_cancel(conns, result, Net_Timer_Kind_Retransmit);
+        conn_timer_cancel(conns, result, Net_Timer_Kind_Message);
+        conn_timer_cancel(conns, result, Net_Timer_Kind_Message_Ack);
+        conns->reliable[result] = {};
+        conns->group_joined[result] = false;
+        conns->codecs[result] = 0;
+        conns->window_base[result] = 0;
+        conns->window_next[result] = 0;
+        conns->window_sent_at[result] = 0.0;
+        conns->window_repair_at[result] = 0.0;
+        dgl_memset(conns->repair_mask + cast(usize)result*NET_REPAIR_MASK_SIZE, 0, NET_REPAIR_MASK_SIZE);
+        conns->peer_timestamp[result] = 0;
+        rtt_reset(conns->rtt + result);
+        congestion_reset(conns->congestion + result);
+        conns->send_deficit[result] = 0;
+        conn_set_chunk(conns, result, 0, 0);
+        packet_ring_reset(conns, result);
+    }
+    else
+    {
+        LOG_DEBUG("No free connection available");
     }
 
-    bool32 chunk_buffer_updated = false;
-    Zhc_Net_Address address = {};
-    usize memory_max_size = NET_MTU_SIZE;
-    usize memory_size = 0;
-    usize memory_offset = 0;
-    uint8 *memory = dgl_mem_arena_push_array(arena, uint8, memory_size);
-    while((memory_size = platform.receive_data(&ctx->socket, &address, memory, memory_max_size)) > 0)
+    return(result);
+}
+
+internal void
+conn_disconnect(Connection_List *conns, Net_Conn_ID index)
+{
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    if(conns->state[index] != Net_Conn_State_Disconnected)
     {
-        memory_offset = 0;
+        conn_lookup_remove(conns, index);
+        conns->state[index] = Net_Conn_State_Disconnected;
+        assert(conns->free_count < conns->max_count, "Free list overflow");
+        conns->free_list[conns->free_count++] = index;
+    }
+    for(int32 kind = 0; kind < Net_Timer_Kind_Count; ++kind)
+    {
+        conn_timer_cancel(conns, index, cast(Net_Timer_Kind)kind);
+    }
+    conn_set_chunk(conns, index, 0, 0);
+    packet_ring_reset(conns, index);
+}
 
-        // NOTE(dgl): parse packet from memory buffer
-        Packet packet = {};
-        Bitstream reader = stream_reader_init(memory, memory_size);
-        usize packet_header_size = serialize_packet(&reader, &packet);
-        memory_offset = packet_header_size;
+// NOTE(dgl): the echo of our timestamp is a sample of the round trip time
+internal void
+conn_receive_timestamps(Net_Context *ctx, Net_Conn_ID index, Packet *packet)
+{
+    Connection_List *conns = ctx->conns;
+    conns->peer_timestamp[index] = packet->timestamp;
+    if(packet->echo)
+    {
+        // NOTE(dgl): echoes older than the max timeout are from an old connection of the address
+        uint32 sample_ms = net_timestamp(ctx->time_ms) - packet->echo;
+        if(sample_ms <= cast(uint32)NET_MAX_RTO_MS)
+        {
+            rtt_add_sample(conns->rtt + index, cast(real32)sample_ms);
+        }
+    }
+}
 
-        assert(memory_size >= memory_offset, "Packet memory offset cannot be bigger than the memory size");
-        uint8 *payload = memory + memory_offset;
-        usize payload_size = memory_size - memory_offset;
+internal Packet
+default_packet(Packet_Type type)
+{
+    Packet result = {};
+    result.id = NET_PROTOCOL_ID;
+    result.version = parse_version(ZHC_VERSION);
+    result.type = type;
 
-        LOG_DEBUG("Received packet (%d bytes) - Salt: %llx, Type: type %d, Header: %d bytes", memory_size, packet.salt, packet.type, packet_header_size);
+    // NOTE(dgl): salt is added when we serialize and put the packet into the packet buffer
+    // because then we have the connection index available.
 
-        // NOTE(dgl): handle packet
+    return(result);
+}
 
-        if(packet.id != 0x1234) { continue; }
+internal void
+packet_buffer_append(Packet_Buffer *buffer, uint8 *payload, usize payload_size)
+{
+    assert(buffer->offset > 0, "Packet buffer must be initialized before appending");
+    // TODO(dgl): are we one off here?
+    assert(buffer->offset + payload_size <= array_count(buffer->data), "Payload too large. Packet buffer overflow");
 
-        // NOTE(dgl): we mix client and server packets in here because they are handled very similarly.
-        // If this causes too much complexity it is easy to separate them. However in my opinion
-        // this is a cleaner code, at least for the current state. I hope I'll find a better solution
-        // because I don't really like mixing those.
-        // TODO(dgl): the disconnect/denied state is not really defined. Must we send a disconnect packet
-        // on each denied packet, to ensure a connection is reset if it has a connection state?
-        index = get_connection(conns, address);
-        if(index >= 0) { conns->no_timeout[index] = true; }
+    dgl_memcpy(buffer->data + buffer->offset, payload, payload_size);
 
-        if(packet.type > _Packet_Type_Connected)
-        {
-            if(index >= 0 &&
-               conns->state[index] > Net_Conn_State_Disconnected &&
-               conns->salt[index] == packet.salt)
-            {
-                conns->state[index] = Net_Conn_State_Connected;
+    LOG_DEBUG("Appending payload with %llu bytes to the buffer at %p (%llu bytes).", payload_size, buffer->data, buffer->offset);
+    buffer->offset += payload_size;
+}
 
-                switch(packet.type) {
+internal void
+packet_buffer_write(Packet_Buffer *buffer, Packet packet)
+{
+    usize buffer_size = array_count(buffer->data);
+
+    Bitstream writer = stream_writer_init(buffer->data, buffer_size);
+    buffer->offset = serialize_packet(&writer, &packet);
+
+    // NOTE(dgl): zeroing remaining buffer
+    dgl_memset(buffer->data + buffer->offset, 0, buffer_size - buffer->offset);
+}
+
+// NOTE(dgl): the salt (or the session) and the timestamps are the last words of the serialized
+// packet header (see serialize_packet). Prepared datagrams are shared between connections,
+// therefore we only patch them right before sending.
+internal uint32 *
+packet_buffer_header_end(Packet_Buffer *buffer)
+{
+    Packet_Type type = serialized_packet_type(buffer->data, buffer->offset);
+    assert(type < Packet_Type_Max, "Packet buffer must contain a serialized header");
+    uint32 *result = cast(uint32 *)(buffer->data + packet_header_size(type));
+    return(result);
+}
+
+internal void
+packet_buffer_set_salt(Packet_Buffer *buffer, uint64 salt)
+{
+    uint32 *end = packet_buffer_header_end(buffer);
+    if(serialized_packet_type(buffer->data, buffer->offset) < _Packet_Type_Connected)
+    {
+#if ZHC_BIG_ENDIAN
+        end[-4] = bswap32(cast(uint32)(salt & 0xFFFFFFFF));
+        end[-3] = bswap32(cast(uint32)(salt >> 32));
+#else
+        end[-4] = cast(uint32)(salt & 0xFFFFFFFF);
+        end[-3] = cast(uint32)(salt >> 32);
+#endif
+    }
+    else
+    {
+#if ZHC_BIG_ENDIAN
+        end[-3] = bswap32(net_session(salt));
+#else
+        end[-3] = net_session(salt);
+#endif
+    }
+}
+
+// NOTE(dgl): messages are acked with the state of the connection at the time they are (re)sent
+internal void
+packet_buffer_set_acks(Packet_Buffer *buffer, uint16 ack, uint32 ack_bits)
+{
+    assert(packet_is_message(serialized_packet_type(buffer->data, buffer->offset)), "Only messages carry acks");
+    uint32 *end = packet_buffer_header_end(buffer);
+#if ZHC_BIG_ENDIAN
+    uint32 seq = bswap32(end[-5]) & 0xFFFF;
+    end[-5] = bswap32(seq | (cast(uint32)ack << 16));
+    end[-4] = bswap32(ack_bits);
+#else
+    uint32 seq = end[-5] & 0xFFFF;
+    end[-5] = seq | (cast(uint32)ack << 16);
+    end[-4] = ack_bits;
+#endif
+}
+
+internal void
+packet_buffer_set_timestamps(Packet_Buffer *buffer, uint32 timestamp, uint32 echo)
+{
+    uint32 *end = packet_buffer_header_end(buffer);
+#if ZHC_BIG_ENDIAN
+    end[-2] = bswap32(timestamp);
+    end[-1] = bswap32(echo);
+#else
+    end[-2] = timestamp;
+    end[-1] = echo;
+#endif
+}
+
+internal void
+packet_ring_push(Net_Context *ctx, Net_Conn_ID index, Packet_Buffer *buffer, Packet_Type type, uint32 flags)
+{
+    Connection_List *conns = ctx->conns;
+    assert(index >= 0 && index < conns->max_count, "Invalid connection index");
+    Net_Packet_Ring *ring = conns->outbound + index;
+
+    // NOTE(dgl): the ring is flushed if it is full. Afterwards only the kept entries are left.
+    if(ring->write - ring->read == NET_PACKET_RING_SIZE)
+    {
+        net_flush_packets(ctx, index);
+    }
+    // NOTE(dgl): the peer does not ack our messages. We give up the oldest one.
+    if(ring->write - ring->read == NET_PACKET_RING_SIZE)
+    {
+        for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+        {
+            Net_Outbound *entry = ring->entries + (entry_index % NET_PACKET_RING_SIZE);
+            if(entry->flags & Net_Outbound_Flag_Reliable)
+            {
+                LOG_DEBUG("Giving up message %u of connection %d", entry->message_seq, index);
+                entry->flags &= ~Net_Outbound_Flag_Reliable;
+                break;
+            }
+        }
+        packet_ring_retire(conns, index);
+    }
+    assert(ring->write - ring->read < NET_PACKET_RING_SIZE, "Packet ring overflow. Too many kept entries");
+
+    // NOTE(dgl): a kept entry replaces the older entries with the same flags
+    uint32 keep_mask = Net_Outbound_Flag_Keep|Net_Outbound_Flag_Handshake;
+    if(flags & Net_Outbound_Flag_Keep)
+    {
+        for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+        {
+            Net_Outbound *entry = ring->entries + (entry_index % NET_PACKET_RING_SIZE);
+            if((entry->flags & keep_mask) == (flags & keep_mask))
+            {
+                entry->flags &= ~Net_Outbound_Flag_Keep;
+            }
+        }
+    }
+
+    Net_Outbound *entry = ring->entries + (ring->write++ % NET_PACKET_RING_SIZE);
+    entry->seq = ring->next_seq++;
+    entry->type = cast(uint8)type;
+    entry->flags = cast(uint8)flags;
+    entry->send_count = 0;
+    entry->message_seq = 0;
+    entry->sent_at = 0.0;
+    entry->buffer = buffer;
+}
+
+// NOTE(dgl): serializes the packet into a buffer of the packet pool and queues it. The returned
+// buffer can be used to append the payload until the connection is flushed.
+internal Packet_Buffer*
+packet_queue(Net_Context *ctx, Net_Conn_ID index, Packet packet, uint32 flags)
+{
+    assert(index >= 0, "Invalid index");
+    Connection_List *conns = ctx->conns;
+    packet.salt = conns->salt[index];
+
+    Packet_Buffer *result = dgl_mem_pool_push(conns->packet_pool, Packet_Buffer);
+    packet_buffer_write(result, packet);
+    packet_ring_push(ctx, index, result, packet.type, flags|Net_Outbound_Flag_Pooled);
+    LOG_DEBUG("Queueing packet of type %d with %llu bytes of data into the buffer at %p (Salt: %llx)", packet.type, result->offset, result->data, packet.salt);
+
+    return(result);
+}
+
+// NOTE(dgl): prepared datagrams are shared by all connections and must stay valid until the
+// connection is flushed. The chunk holding the datagram is referenced by the connection.
+internal void
+queue_prepared_datagram(Net_Context *ctx, Net_Conn_ID index, Packet_Buffer *buffer, Packet_Type type)
+{
+    packet_ring_push(ctx, index, buffer, type, 0);
+}
+
+// NOTE(dgl): closes current socket, if it exists.
+internal void
+net_open_socket(Net_Context *ctx)
+{
+    Zhc_Net_Socket *socket = &ctx->socket;
+    // NOTE(dgl): we cannot notify the peers if the socket has an error. They will have to try
+    // and get a denied packet when trying to send data. Then they have to reauthenticate.
+    for(int32 index = 0; index < ctx->conns->max_count; ++index)
+    {
+        conn_disconnect(ctx->conns, index);
+    }
+    platform.close_socket(socket);
+    // TODO(dgl): arena not needed. Will be removed later.
+    platform.open_socket(0, socket);
+    ctx->receive_batch.count = 0;
+    ctx->receive_batch.next = 0;
+    assert(socket->handle.no_error, "Failed to open socket");
+    LOG_DEBUG("Listening for connection: %d.%d.%d.%d:%d", socket->address.ip[0], socket->address.ip[1], socket->address.ip[2], socket->address.ip[3], socket->address.port);
+
+    // NOTE(dgl): The server only sends to the group. Clients join the group
+    // after the server announced it (see Packet_Type_Group).
+    Net_Multicast *multicast = &ctx->multicast;
+    if(multicast->socket.handle.no_error)
+    {
+        platform.close_multicast_socket(&multicast->socket);
+    }
+
+    if(ctx->is_server && multicast->enabled)
+    {
+        platform.open_multicast_socket(&multicast->socket, &multicast->group, false);
+        if(!multicast->socket.handle.no_error)
+        {
+            LOG("Failed to open multicast socket. Sending chunks to each connection instead.");
+        }
+    }
+}
+
+internal void
+net_enable_multicast(Net_Context *ctx, Zhc_Net_Address group)
+{
+    assert(ctx->is_server, "Only the server can enable multicast. Clients join the announced group");
+    if(platform.open_multicast_socket)
+    {
+        Net_Multicast *multicast = &ctx->multicast;
+        multicast->enabled = true;
+        multicast->group = group;
+        get_random_bytes(cast(uint8 *)&multicast->salt, sizeof(multicast->salt));
+        LOG_DEBUG("Multicast group enabled: %d.%d.%d.%d:%d", group.ip[0], group.ip[1], group.ip[2], group.ip[3], group.port);
+    }
+}
+
+internal void
+send_group_packet(Net_Context *ctx, Net_Conn_ID index, Packet_Group group)
+{
+    Packet packet = default_packet(Packet_Type_Group);
+    packet.group = group;
+    packet_queue(ctx, index, packet, 0);
+    net_flush_packets(ctx, index);
+}
+
+internal void
+join_multicast_group(Net_Context *ctx, Packet_Group group)
+{
+    assert(!ctx->is_server, "Only clients join a multicast group");
+    Net_Multicast *multicast = &ctx->multicast;
+    if(platform.open_multicast_socket)
+    {
+        if(!multicast->socket.handle.no_error ||
+           multicast->group.host != group.host ||
+           multicast->group.port != group.port)
+        {
+            if(multicast->socket.handle.no_error)
+            {
+                platform.close_multicast_socket(&multicast->socket);
+            }
+
+            multicast->group.host = group.host;
+            multicast->group.port = group.port;
+            platform.open_multicast_socket(&multicast->socket, &multicast->group, true);
+            LOG_DEBUG("Joining multicast group %d.%d.%d.%d:%d", multicast->group.ip[0], multicast->group.ip[1], multicast->group.ip[2], multicast->group.ip[3], multicast->group.port);
+        }
+
+        multicast->salt = group.salt;
+        multicast->enabled = multicast->socket.handle.no_error;
+    }
+}
+
+// NOTE(dgl): the queued datagrams are sent with one call, if the platform supports batches.
+internal void
+send_batch_submit(Net_Context *ctx)
+{
+    Net_Send_Batch *batch = &ctx->send_batch;
+    if(batch->count > 0)
+    {
+        bool32 group = (batch->socket == &ctx->multicast.socket);
+        Zhc_Send_Data_Batch *send_data_batch = group ? platform.send_multicast_data_batch : platform.send_data_batch;
+        ctx->stats.datagrams_sent += cast(uint64)batch->count;
+        for(int32 index = 0; index < batch->count; ++index)
+        {
+            ctx->stats.bytes_sent += batch->datagrams[index].size;
+        }
+        if(send_data_batch)
+        {
+            send_data_batch(batch->socket, batch->datagrams, batch->count);
+        }
+        else
+        {
+            Zhc_Send_Data *send_data = group ? platform.send_multicast_data : platform.send_data;
+            for(int32 index = 0; index < batch->count; ++index)
+            {
+                Zhc_Net_Datagram *datagram = batch->datagrams + index;
+                send_data(batch->socket, &datagram->address, datagram->data, datagram->size);
+            }
+        }
+        batch->count = 0;
+    }
+}
+
+// NOTE(dgl): the data is not copied. It must not change until the batch is submitted.
+internal void
+send_batch_push(Net_Context *ctx, Zhc_Net_Socket *socket, Zhc_Net_Address address, uint8 *data, usize size)
+{
+    Net_Send_Batch *batch = &ctx->send_batch;
+    if(batch->count == NET_IO_BATCH_SIZE || (batch->count > 0 && batch->socket != socket))
+    {
+        send_batch_submit(ctx);
+    }
+
+    Zhc_Net_Datagram *datagram = batch->datagrams + batch->count++;
+    batch->socket = socket;
+    datagram->address = address;
+    datagram->data = data;
+    datagram->size = size;
+}
+
+// NOTE(dgl): Copies a prepared datagram of a shared chunk store into the batch. The copy can
+// be patched without changing the datagram the other shards send. Returns 0, if the chunk was
+// replaced before or while copying. The copy must be pushed before anything else is queued.
+internal Packet_Buffer *
+send_batch_stage(Net_Context *ctx, Zhc_Net_Socket *socket, Net_Chunk *chunk, uint32 generation, Packet_Buffer *buffer)
+{
+    Net_Send_Batch *batch = &ctx->send_batch;
+    assert(batch->staging, "Send batch has no staging buffers");
+    if(batch->count == NET_IO_BATCH_SIZE || (batch->count > 0 && batch->socket != socket))
+    {
+        send_batch_submit(ctx);
+    }
+
+    Packet_Buffer *result = 0;
+    if(chunk && chunk->generation == generation)
+    {
+        dgl_atomic_fence();
+        result = batch->staging + batch->count;
+        result->offset = dgl_min(buffer->offset, cast(usize)NET_MTU_SIZE);
+        dgl_memcpy(result->data, buffer->data, result->offset);
+        dgl_atomic_fence();
+        if(chunk->generation != generation) { result = 0; }
+    }
+
+    return(result);
+}
+
+internal int32
+receive_batch(Net_Receive_Batch *batch, Zhc_Net_Socket *socket, Zhc_Receive_Data_Batch *receive_data_batch, Zhc_Receive_Data *receive_data)
+{
+    int32 result = 0;
+    if(receive_data_batch)
+    {
+        result = receive_data_batch(socket, batch->datagrams, NET_IO_BATCH_SIZE);
+    }
+    else
+    {
+        while(result < NET_IO_BATCH_SIZE)
+        {
+            Zhc_Net_Datagram *datagram = batch->datagrams + result;
+            datagram->size = receive_data(socket, &datagram->address, datagram->data, datagram->capacity);
+            if(datagram->size == 0) { break; }
+            result++;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): clients receive from the server connection and the multicast group. The next batch
+// is received after all datagrams of the current batch were handled. Returns 0 if no datagram is available.
+internal Zhc_Net_Datagram *
+receive_datagram(Net_Context *ctx, bool32 *from_group)
+{
+    Zhc_Net_Datagram *result = 0;
+    Net_Receive_Batch *batch = &ctx->receive_batch;
+    if(batch->next == batch->count)
+    {
+        batch->next = 0;
+        batch->count = receive_batch(batch, &ctx->socket, platform.receive_data_batch, platform.receive_data);
+        batch->from_group = false;
+
+        Net_Multicast *multicast = &ctx->multicast;
+        if(batch->count == 0 && !ctx->is_server && multicast->socket.handle.no_error)
+        {
+            batch->count = receive_batch(batch, &multicast->socket, platform.receive_multicast_data_batch, platform.receive_multicast_data);
+            batch->from_group = true;
+        }
+    }
+
+    if(batch->next < batch->count)
+    {
+        result = batch->datagrams + batch->next++;
+        *from_group = batch->from_group;
+        ctx->stats.datagrams_received++;
+        ctx->stats.bytes_received += result->size;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): must be sent without a packet buffer available. Therefore
+// this call is separate.
+internal void
+send_denied_packet(Net_Context *ctx, Zhc_Net_Address address)
+{
+    Packet packet = default_packet(Packet_Type_Denied);
+
+    uint8 buffer[NET_MTU_SIZE] = {};
+    Bitstream writer = stream_writer_init(buffer, array_count(buffer));
+    usize count = serialize_packet(&writer, &packet);
+
+    platform.send_data(&ctx->socket, &address, buffer, count);
+    ctx->stats.datagrams_sent++;
+    ctx->stats.bytes_sent += count;
+    LOG_DEBUG("Sending denied packet");
+}
+
+internal void
+send_discovery_packet(Net_Context *ctx)
+{
+    Packet packet = default_packet(Packet_Type_Server_Discovery);
+
+    uint8 buffer[NET_MTU_SIZE] = {};
+    Bitstream writer = stream_writer_init(buffer, array_count(buffer));
+    usize count = serialize_packet(&writer, &packet);
+
+    // TODO(dgl): should we use a subnet broadcast?
+    Zhc_Net_Address address = parse_address("255.255.255.255", ZHC_SERVER_PORT);
+
+    platform.send_data(&ctx->socket, &address, buffer, count);
+    ctx->stats.datagrams_sent++;
+    ctx->stats.bytes_sent += count;
+    LOG_DEBUG("Sending discovery packet");
+}
+
+internal Connection_List *
+push_connection_list(DGL_Mem_Arena *arena, Net_Context *ctx, int32 max_count)
+{
+    assert(max_count > 0, "The connection list needs at least one connection");
+    Connection_List *result = dgl_mem_arena_push_struct(arena, Connection_List);
+    result->max_count = max_count;
+    usize casted_count = cast(usize)result->max_count;
+    result->address = dgl_mem_arena_push_array(arena, Zhc_Net_Address, casted_count);
+    result->salt = dgl_mem_arena_push_array(arena, uint64, casted_count);
+    result->reliable = dgl_mem_arena_push_array(arena, Net_Reliable, casted_count);
+    result->outbound = dgl_mem_arena_push_array(arena, Net_Packet_Ring, casted_count);
+    result->packet_pool = &ctx->packet_pool;
+    result->timers = &ctx->timer_wheel;
+    timer_wheel_init(arena, result->timers, max_count*Net_Timer_Kind_Count + 1, timer_ticks(ctx->time_ms));
+    result->state = dgl_mem_arena_push_array(arena, Net_Conn_State, casted_count);
+    result->chunk = dgl_mem_arena_push_array(arena, Net_Chunk *, casted_count);
+    result->chunk_generation = dgl_mem_arena_push_array(arena, uint32, casted_count);
+    result->chunk_store = ctx->chunk_store;
+    result->group_joined = dgl_mem_arena_push_array(arena, bool32, casted_count);
+    result->codecs = dgl_mem_arena_push_array(arena, uint32, casted_count);
+    result->window_base = dgl_mem_arena_push_array(arena, uint32, casted_count);
+    result->window_next = dgl_mem_arena_push_array(arena, uint32, casted_count);
+    result->window_sent_at = dgl_mem_arena_push_array(arena, real64, casted_count);
+    result->window_repair_at = dgl_mem_arena_push_array(arena, real64, casted_count);
+    result->repair_base = dgl_mem_arena_push_array(arena, uint32, casted_count);
+    result->repair_mask = dgl_mem_arena_push_array(arena, uint8, casted_count*NET_REPAIR_MASK_SIZE);
+    result->repair_pending = dgl_mem_arena_push_array(arena, bool32, casted_count);
+    result->rtt = dgl_mem_arena_push_array(arena, Net_Rtt, casted_count);
+    result->congestion = dgl_mem_arena_push_array(arena, Net_Congestion, casted_count);
+    result->send_active = dgl_mem_arena_push_array(arena, bool32, casted_count);
+    result->send_deficit = dgl_mem_arena_push_array(arena, int32, casted_count);
+    result->peer_timestamp = dgl_mem_arena_push_array(arena, uint32, casted_count);
+
+    // NOTE(dgl): the lookup table has at least twice the slots of the connections, to keep the probes short.
+    result->lookup_count = 1;
+    while(result->lookup_count < 2*max_count) { result->lookup_count <<= 1; }
+    result->lookup = dgl_mem_arena_push_array(arena, Net_Conn_ID, cast(usize)result->lookup_count);
+    dgl_memset(result->lookup, 0xFF, sizeof(*result->lookup)*cast(usize)result->lookup_count);
+
+    Net_Send_Scheduler *scheduler = &ctx->scheduler;
+    scheduler->capacity = max_count;
+    scheduler->active = dgl_mem_arena_push_array(arena, Net_Conn_ID, casted_count);
+    scheduler->refill_at = ctx->time_ms;
+
+    ctx->repair.conns = dgl_mem_arena_push_array(arena, Net_Conn_ID, casted_count);
+
+    // NOTE(dgl): all connections are free. They are handed out in order.
+    result->free_list = dgl_mem_arena_push_array(arena, Net_Conn_ID, casted_count);
+    for(int32 index = 0; index < max_count; ++index)
+    {
+        result->free_list[result->free_count++] = max_count - 1 - index;
+    }
+
+    // NOTE(dgl): each connection keeps at most two packets (handshake and ack) in the ring
+    // after flushing. The rings are flushed after queueing, so only one ring is full at a time.
+    usize pool_count = 2*casted_count + NET_PACKET_RING_SIZE;
+    usize pool_size = pool_count*(sizeof(Packet_Buffer) + DEFAULT_ALIGNMENT);
+    uint8 *pool_memory = dgl_mem_arena_push_array(arena, uint8, pool_size);
+    dgl_mem_pool_init_struct(result->packet_pool, pool_memory, pool_size, Packet_Buffer);
+
+    return(result);
+}
+
+internal void
+push_receive_batch(DGL_Mem_Arena *arena, Net_Receive_Batch *batch)
+{
+    uint8 *memory = dgl_mem_arena_push_array(arena, uint8, NET_IO_BATCH_SIZE*NET_MTU_SIZE);
+    for(int32 index = 0; index < NET_IO_BATCH_SIZE; ++index)
+    {
+        Zhc_Net_Datagram *datagram = batch->datagrams + index;
+        datagram->data = memory + index*NET_MTU_SIZE;
+        datagram->capacity = NET_MTU_SIZE;
+    }
+}
+
+internal Net_Chunk_Store *
+push_chunk_store(DGL_Mem_Arena *arena)
+{
+    Net_Chunk_Store *result = dgl_mem_arena_push_struct(arena, Net_Chunk_Store);
+    result->count = NET_CHUNK_STORE_COUNT;
+    result->chunks = dgl_mem_arena_push_array(arena, Net_Chunk, cast(usize)result->count);
+
+    usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+    int32 slice_capacity = dgl_safe_size_to_int32(ZHC_MAX_FILESIZE / slice_space) + 1;
+    for(int32 index = 0; index < result->count; ++index)
+    {
+        Net_Chunk *chunk = result->chunks + index;
+        chunk->slice_capacity = slice_capacity;
+        chunk->slices = dgl_mem_arena_push_array(arena, Packet_Buffer, cast(usize)chunk->slice_capacity);
+        chunk->parity_capacity = (slice_capacity / NET_FEC_MIN_GROUP_SIZE) + 1;
+        chunk->parity = dgl_mem_arena_push_array(arena, Packet_Buffer, cast(usize)chunk->parity_capacity);
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): we only keep compressed payloads which are smaller than the raw payload.
+internal Net_Compress_Cache *
+push_compress_cache(DGL_Mem_Arena *arena)
+{
+    Net_Compress_Cache *result = dgl_mem_arena_push_struct(arena, Net_Compress_Cache);
+    result->count = NET_COMPRESS_CACHE_COUNT;
+    result->capacity = ZHC_MAX_FILESIZE;
+    result->payloads = dgl_mem_arena_push_array(arena, Net_Compressed_Payload, cast(usize)result->count);
+    for(int32 index = 0; index < result->count; ++index)
+    {
+        result->payloads[index].data = dgl_mem_arena_push_array(arena, uint8, result->capacity);
+    }
+
+    return(result);
+}
+
+internal Net_Context *
+push_server_context(DGL_Mem_Arena *arena, int32 max_clients, Net_Chunk_Store *chunk_store, Net_Compress_Cache *compress_cache)
+{
+    Net_Context *result = dgl_mem_arena_push_struct(arena, Net_Context);
+    result->time_ms = platform.get_time_in_ms();
+    // NOTE(dgl): the server never receives chunks. It only needs the chunk store
+    // to prepare the outgoing chunks.
+    result->chunk_store = chunk_store;
+    result->compress_cache = compress_cache;
+    result->fec_group_size = NET_FEC_GROUP_SIZE;
+    result->congestion_control = true;
+    result->send_budget_per_tick = NET_SEND_BUDGET_PER_TICK;
+    result->scheduler.budget = NET_SEND_BUDGET_PER_TICK;
+    result->multicast.max_rate = NET_MULTICAST_MAX_RATE;
+    result->conns = push_connection_list(arena, result, max_clients);
+    push_receive_batch(arena, &result->receive_batch);
+    result->send_batch.staging = dgl_mem_arena_push_array(arena, Packet_Buffer, NET_IO_BATCH_SIZE);
+
+    result->socket.address.port = ZHC_SERVER_PORT;
+
+    result->is_server = true;
+    result->shard_count = 1;
+
+    return(result);
+}
+
+internal Net_Context *
+net_init_server(DGL_Mem_Arena *arena, int32 max_clients)
+{
+    Net_Context *result = push_server_context(arena, max_clients, push_chunk_store(arena), push_compress_cache(arena));
+    return(result);
+}
+
+// NOTE(dgl): Each server shard handles the connections of one socket. All shards are bound to
+// ZHC_SERVER_PORT and each peer is always delivered to the same shard (see Zhc_Net_Socket). The
+// shards have their own connections and timers and each is run by its own net thread. They share
+// the chunk store and the compress cache, so each file is only prepared once.
+// NOTE(dgl): the sockets must be opened in the order of the shards (see net_open_socket).
+internal void
+net_init_server_shards(DGL_Mem_Arena *arena, int32 max_clients, Net_Context **shards, int32 shard_count)
+{
+    assert(shard_count > 0, "The server needs at least one shard");
+    Net_Chunk_Store *chunk_store = push_chunk_store(arena);
+    Net_Compress_Cache *compress_cache = push_compress_cache(arena);
+    chunk_store->shared = (shard_count > 1);
+    for(int32 index = 0; index < shard_count; ++index)
+    {
+        Net_Context *shard = push_server_context(arena, max_clients, chunk_store, compress_cache);
+        shard->shard_index = index;
+        shard->shard_count = shard_count;
+        if(shard_count > 1) { shard->socket.reuse_port_count = shard_count; }
+        shards[index] = shard;
+    }
+}
+
+// NOTE(dgl): the client can receive payloads up to max_payload_size bytes
+internal Net_Context *
+net_init_client(DGL_Mem_Arena *arena, usize max_payload_size)
+{
+    Net_Context *result = dgl_mem_arena_push_struct(arena, Net_Context);
+    result->time_ms = platform.get_time_in_ms();
+    {
+        // NOTE(dgl): the receive buffers are allocated when the first chunk arrives (see
+        // reserve_receive_buffers). We reserve enough memory for the largest chunk. A compressed
+        // chunk needs the raw and the compressed buffer.
+        usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+        usize slice_count = (max_payload_size / slice_space) + 1;
+        usize parity_count = (slice_count / NET_FEC_MIN_GROUP_SIZE) + 1;
+        usize receive_memory_size = 2*slice_count*slice_space + parity_count*slice_space +
+                                    (slice_count / 8) + (parity_count / 8) + 8*DEFAULT_ALIGNMENT;
+        uint8 *receive_memory = dgl_mem_arena_push_array(arena, uint8, receive_memory_size);
+        dgl_mem_arena_init(&result->receive_arena, receive_memory, receive_memory_size);
+    }
+    // NOTE(dgl): if we allow more than one connections here, we need a way to only
+    // use the fastest connection or ignore already received packets. This is currently
+    // not needed. We maybe develop something like this just for educational reasons in the
+    // future.
+    result->conns = push_connection_list(arena, result, 1);
+    push_receive_batch(arena, &result->receive_batch);
+
+    result->is_server = false;
+
+    return(result);
+}
+
+// NOTE(dgl): pushes the datagram of the entry into the send batch of the context
+internal void
+net_send_entry(Net_Context *ctx, Net_Conn_ID index, Net_Outbound *entry, uint32 timestamp)
+{
+    Connection_List *conns = ctx->conns;
+    Packet_Buffer *buffer = entry->buffer;
+
+    // NOTE(dgl): pooled buffers already contain the salt of the connection at the time they were queued.
+    // Prepared datagrams of a shared chunk store are patched in a copy. The datagrams of a
+    // replaced chunk are dropped, the peer requests the data again.
+    if(!(entry->flags & Net_Outbound_Flag_Pooled))
+    {
+        if(ctx->chunk_store && ctx->chunk_store->shared)
+        {
+            buffer = send_batch_stage(ctx, &ctx->socket, conns->chunk[index], conns->chunk_generation[index], buffer);
+        }
+        if(buffer) { packet_buffer_set_salt(buffer, conns->salt[index]); }
+    }
+
+    if(buffer)
+    {
+        // NOTE(dgl): the acks are piggybacked on every message. A pending ack is not needed anymore.
+        if(packet_is_message(cast(Packet_Type)entry->type))
+        {
+            Net_Reliable *reliable = conns->reliable + index;
+            packet_buffer_set_acks(buffer, reliable->remote_seq, reliable->received);
+            conn_timer_cancel(conns, index, Net_Timer_Kind_Message_Ack);
+        }
+
+        // NOTE(dgl): the timestamp of the peer is only echoed once. Echoing it again
+        // later would add the time we waited to the round trip time of the peer.
+        packet_buffer_set_timestamps(buffer, timestamp, conns->peer_timestamp[index]);
+        conns->peer_timestamp[index] = 0;
+
+        LOG_DEBUG("Sending packet %u to conn index %d (%llu bytes)", entry->seq, index, buffer->offset);
+        send_batch_push(ctx, &ctx->socket, conns->address[index], buffer->data, buffer->offset);
+        ctx->scheduler.budget -= dgl_min(ctx->scheduler.budget, buffer->offset);
+        if(entry->send_count > 0) { ctx->stats.datagrams_resent++; }
+    }
+    entry->sent_at = ctx->time_ms;
+    entry->send_count++;
+}
+
+// NOTE(dgl): sends all queued datagrams of the connection as one batch and retires the sent entries
+internal void
+net_flush_packets(Net_Context *ctx, Net_Conn_ID index)
+{
+    Connection_List *conns = ctx->conns;
+    assert(conns->outbound, "Packet ring not initialized");
+    assert(index >= 0, "Invalid connection index");
+
+    // NOTE(dgl): prepared datagrams could still be queued for the group. We patch their salt below.
+    send_batch_submit(ctx);
+
+    Net_Packet_Ring *ring = conns->outbound + index;
+    uint32 timestamp = net_timestamp(ctx->time_ms);
+    for(uint32 entry_index = ring->unsent; entry_index != ring->write; ++entry_index)
+    {
+        net_send_entry(ctx, index, ring->entries + (entry_index % NET_PACKET_RING_SIZE), timestamp);
+    }
+    ring->unsent = ring->write;
+    send_batch_submit(ctx);
+
+    packet_ring_retire(conns, index);
+}
+
+internal void
+net_resend_kept_packets(Net_Context *ctx, Net_Conn_ID index)
+{
+    Net_Packet_Ring *ring = ctx->conns->outbound + index;
+    ring->unsent = ring->read;
+    net_flush_packets(ctx, index);
+}
+
+// NOTE(dgl): only the messages are resent, the other kept entries have their own timers
+internal void
+net_resend_messages(Net_Context *ctx, Net_Conn_ID index)
+{
+    net_flush_packets(ctx, index);
+
+    Net_Packet_Ring *ring = ctx->conns->outbound + index;
+    uint32 timestamp = net_timestamp(ctx->time_ms);
+    for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+    {
+        Net_Outbound *entry = ring->entries + (entry_index % NET_PACKET_RING_SIZE);
+        if(entry->flags & Net_Outbound_Flag_Reliable)
+        {
+            net_send_entry(ctx, index, entry, timestamp);
+        }
+    }
+    send_batch_submit(ctx);
+}
+
+// NOTE(dgl): handshake packets are sent immediately and resent until the peer replies
+internal void
+queue_handshake_packet(Net_Context *ctx, Net_Conn_ID index, Packet packet)
+{
+    packet_queue(ctx, index, packet, Net_Outbound_Flag_Keep|Net_Outbound_Flag_Handshake);
+    net_flush_packets(ctx, index);
+    conn_timer_schedule(ctx->conns, index, Net_Timer_Kind_Handshake, rtt_timeout(ctx->conns->rtt + index));
+}
+
+// NOTE(dgl): true if the sequence a is more recent than b. The sequences wrap around.
+internal bool32
+sequence_greater(uint16 a, uint16 b)
+{
+    bool32 result = (((a > b) && (a - b <= 0x8000)) ||
+                     ((a < b) && (b - a > 0x8000)));
+    return(result);
+}
+
+internal uint16
+reliable_next_seq(Net_Reliable *reliable)
+{
+    if(++reliable->next_seq == 0) { reliable->next_seq = 1; }
+    return(reliable->next_seq);
+}
+
+// NOTE(dgl): returns false if the sequence was already received. Sequences older than the
+// ack bits cannot be tracked anymore and are dropped as well.
+internal bool32
+reliable_receive_seq(Net_Reliable *reliable, uint16 seq)
+{
+    bool32 result = false;
+    if(reliable->remote_seq == 0 || sequence_greater(seq, reliable->remote_seq))
+    {
+        uint32 shift = cast(uint16)(seq - reliable->remote_seq);
+        if(reliable->remote_seq == 0 || shift > NET_MESSAGE_ACK_BITS)
+        {
+            reliable->received = 0;
+        }
+        else
+        {
+            reliable->received = cast(uint32)(((cast(uint64)reliable->received << 1) | 1) << (shift - 1));
+        }
+        reliable->remote_seq = seq;
+        result = true;
+    }
+    else
+    {
+        uint32 distance = cast(uint16)(reliable->remote_seq - seq);
+        uint32 bit = (distance > 0 && distance <= NET_MESSAGE_ACK_BITS) ? (1u << (distance - 1)) : 0;
+        if(bit && !(reliable->received & bit))
+        {
+            reliable->received |= bit;
+            result = true;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): releases the messages acked by the peer. Messages older than the ack bits can not
+// be acked anymore, the peer drops them (see reliable_receive_seq). They are released as well.
+internal void
+reliable_receive_acks(Net_Context *ctx, Net_Conn_ID index, uint16 ack, uint32 ack_bits)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Packet_Ring *ring = conns->outbound + index;
+    if(ack != 0)
+    {
+        bool32 pending = false;
+        for(uint32 entry_index = ring->read; entry_index != ring->write; ++entry_index)
+        {
+            Net_Outbound *entry = ring->entries + (entry_index % NET_PACKET_RING_SIZE);
+            if(entry->flags & Net_Outbound_Flag_Reliable)
+            {
+                uint32 distance = cast(uint16)(ack - entry->message_seq);
+                bool32 acked = (distance == 0 ||
+                                (distance < 0x8000 &&
+                                 (distance > NET_MESSAGE_ACK_BITS || (ack_bits & (1u << (distance - 1))))));
+                if(acked) { entry->flags &= ~Net_Outbound_Flag_Reliable; }
+                else { pending = true; }
+            }
+        }
+
+        if(!pending) { conn_timer_cancel(conns, index, Net_Timer_Kind_Message); }
+        if(ring->unsent == ring->write) { packet_ring_retire(conns, index); }
+    }
+}
+
+internal void
+net_request_server_connection(Net_Context *ctx)
+{
+    assert(!ctx->is_server, "Only clients can connect to a server");
+    // NOTE(dgl): a client only has one connection slot available.
+    // if this is not connected, we send a discovery packet to request
+    // the connection to a server. We connect to the server replying the fastest.
+    // However, currently we do not support having multiple servers.
+    if(ctx->conns->state[0] == Net_Conn_State_Disconnected)
+    {
+        send_discovery_packet(ctx);
+    }
+}
+
+internal bool32
+chunk_complete(uint8 *buffer, usize buffer_size, uint32 bit_count)
+{
+    bool32 result = true;
+
+    int32 required_bytes = dgl_safe_uint32_to_int32(bit_count / 8) + 1;
+    assert(required_bytes <= buffer_size, "Bit count is larger than bytes available in buffer");
+
+    uint8 last_bits = cast(uint8)(bit_count % 8);
+    uint8 last_mask_bits = cast(uint8)~(0xFFFFFFFF << (last_bits));
+
+    int32 index = required_bytes - 1;
+    LOG_DEBUG("Chunk buffer index 0x%X, mask 0x%X", buffer[index], last_mask_bits);
+    if(buffer[index--] != last_mask_bits)
+    {
+        result = false;
+    }
+
+    while(index >= 0)
+    {
+        // NOTE(dgl): @performance if this is too slow switch to 64bit integers
+        LOG_DEBUG("Chunk buffer index 0x%X, mask 0x%X", buffer[index], 0xFF);
+        if(buffer[index--] != 0xFF)
+        {
+            result = false;
+            break;
+        }
+    }
+
+
+    return(result);
+}
+
+internal bool32
+slice_acked(uint8 *ack_mask, usize ack_mask_size, uint32 slice_index)
+{
+    bool32 result = false;
+    if(ack_mask)
+    {
+        // NOTE(dgl): if the bit in the mask is set to 1 the slice has already been received.
+        usize mask_byte = slice_index / 8;
+        uint32 mask_bit = 1 << (slice_index % 8);
+        assert(mask_byte < ack_mask_size, "Invalid ack mask byte");
+
+        result = ((ack_mask[mask_byte] & mask_bit) == mask_bit);
+    }
+
+    return(result);
+}
+
+internal void
+ack_mask_set(uint8 *ack_mask, usize ack_mask_size, uint32 slice_index)
+{
+    usize mask_byte = slice_index / 8;
+    assert(mask_byte < ack_mask_size, "Invalid ack mask byte");
+    ack_mask[mask_byte] |= cast(uint8)(1 << (slice_index % 8));
+}
+
+internal void
+ack_mask_clear(uint8 *ack_mask, usize ack_mask_size, uint32 slice_index)
+{
+    usize mask_byte = slice_index / 8;
+    assert(mask_byte < ack_mask_size, "Invalid ack mask byte");
+    ack_mask[mask_byte] &= cast(uint8)~(1 << (slice_index % 8));
+}
+
+internal void
+xor_bytes(uint8 *dest, uint8 *source, usize size)
+{
+    // NOTE(dgl): @performance the compiler vectorizes this loop
+    for(usize index = 0; index < size; ++index)
+    {
+        dest[index] ^= source[index];
+    }
+}
+
+// NOTE(dgl): returns the parity slice which is sent after the slice index, because the
+// slice completes its fec group. Returns 0 if the chunk has no parity or the group is not complete.
+internal Packet_Buffer *
+chunk_parity_after_slice(Net_Chunk *chunk, uint32 slice_index)
+{
+    Packet_Buffer *result = 0;
+    uint32 group_size = chunk->info.fec_group_size;
+    if(group_size > 0 &&
+       (((slice_index + 1) % group_size) == 0 || (slice_index + 1) == chunk->info.slice_count))
+    {
+        result = chunk->parity + (slice_index / group_size);
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): slices of compressed chunks are received into the compressed buffer
+internal uint8 *
+chunk_receive_buffer(Net_Context *ctx, usize *buffer_size)
+{
+    uint8 *result = ctx->chunk_buffer;
+    *buffer_size = ctx->chunk_buffer_size;
+    if(ctx->chunk_info.codec != Net_Codec_None)
+    {
+        result = ctx->compressed_buffer;
+        *buffer_size = ctx->compressed_buffer_size;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Makes sure the receive buffers are large enough for the chunk. The buffers are
+// only laid out again if the chunk is larger than all chunks received before. This discards the
+// content of the buffers, which is fine because we only receive one chunk at a time.
+// Returns false if the chunk does not fit into the receive arena.
+internal bool32
+reserve_receive_buffers(Net_Context *ctx, Packet_Chunk *info)
+{
+    bool32 result = true;
+
+    usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+    usize sent_size = cast(usize)info->slice_count*slice_space;
+    usize chunk_size = info->raw_size;
+    usize compressed_size = 0;
+    if(info->codec == Net_Codec_None)
+    {
+        chunk_size = dgl_max(chunk_size, sent_size);
+    }
+    else
+    {
+        compressed_size = sent_size;
+    }
+
+    uint32 group_count = 0;
+    if(info->fec_group_size > 0)
+    {
+        group_count = (info->slice_count + info->fec_group_size - 1) / info->fec_group_size;
+    }
+    usize parity_size = cast(usize)group_count*slice_space;
+    usize ack_mask_size = (info->slice_count / 8) + 1;
+    usize parity_mask_size = (group_count / 8) + 1;
+
+    if(chunk_size > ctx->chunk_buffer_size ||
+       compressed_size > ctx->compressed_buffer_size ||
+       parity_size > ctx->parity_buffer_size ||
+       ack_mask_size > ctx->ack_mask_size ||
+       parity_mask_size > ctx->parity_mask_size)
+    {
+        chunk_size = dgl_max(chunk_size, ctx->chunk_buffer_size);
+        compressed_size = dgl_max(compressed_size, ctx->compressed_buffer_size);
+        parity_size = dgl_max(parity_size, ctx->parity_buffer_size);
+        ack_mask_size = dgl_max(ack_mask_size, ctx->ack_mask_size);
+        parity_mask_size = dgl_max(parity_mask_size, ctx->parity_mask_size);
+
+        DGL_Mem_Arena *arena = &ctx->receive_arena;
+        usize required_size = chunk_size + compressed_size + parity_size + ack_mask_size + parity_mask_size + 5*DEFAULT_ALIGNMENT;
+        if(required_size <= arena->size)
+        {
+            dgl_mem_arena_free_all(arena);
+            ctx->chunk_buffer_size = chunk_size;
+            ctx->chunk_buffer = dgl_mem_arena_push_array(arena, uint8, chunk_size);
+            ctx->compressed_buffer_size = compressed_size;
+            ctx->compressed_buffer = dgl_mem_arena_push_array(arena, uint8, compressed_size);
+            ctx->parity_buffer_size = parity_size;
+            ctx->parity_buffer = dgl_mem_arena_push_array(arena, uint8, parity_size);
+            ctx->ack_mask_size = ack_mask_size;
+            ctx->ack_mask = dgl_mem_arena_push_array(arena, uint8, ack_mask_size);
+            ctx->parity_mask_size = parity_mask_size;
+            ctx->parity_mask = dgl_mem_arena_push_array(arena, uint8, parity_mask_size);
+            LOG_DEBUG("Grew receive buffers to %llu bytes", arena->curr_offset);
+        }
+        else
+        {
+            result = false;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Marks a slice of the received chunk in the ack mask. The received slices are counted,
+// so we know when the chunk is complete without checking the whole mask. The ack packet of the client
+// starts at the first slice which has not been received. Returns false if the slice was received before.
+internal bool32
+chunk_mark_received(Net_Context *ctx, uint32 slice_index)
+{
+    bool32 result = !slice_acked(ctx->ack_mask, ctx->ack_mask_size, slice_index);
+    if(result)
+    {
+        ack_mask_set(ctx->ack_mask, ctx->ack_mask_size, slice_index);
+        ctx->received_count++;
+        ctx->ack_pending++;
+        ctx->chunk_received_at = ctx->time_ms;
+
+        // NOTE(dgl): a slice after the end of the received slices means the slices between
+        // them are lost or reordered.
+        if(slice_index > ctx->received_end) { ctx->ack_now = true; }
+        ctx->received_end = dgl_max(ctx->received_end, slice_index + 1);
+
+        uint32 slice_count = ctx->chunk_info.slice_count;
+        while(ctx->received_base < slice_count && slice_acked(ctx->ack_mask, ctx->ack_mask_size, ctx->received_base))
+        {
+            ctx->received_base++;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): The ack payload contains the missing slices of the window after the base as ranges
+// (offset from the base and count). Without losses there is only one range, from the last received
+// slice to the end of the window. If there are more than NET_ACK_MAX_RANGES ranges, the last range
+// reaches to the end of the window. Received slices in it are reported as missing, which is only
+// a spurious resend. Returns the size of the payload (a multiple of 4 bytes).
+// NOTE(dgl): 5 bits for the range count and 9 bits for the offset and the count of each range
+#define NET_ACK_RANGES_MAX_SIZE (((5 + NET_ACK_MAX_RANGES*2*9 + 31) / 32)*sizeof(uint32))
+
+internal usize
+ack_ranges_encode(uint8 *ack_mask, usize ack_mask_size, uint32 base, uint32 window_count, uint8 *buffer, usize buffer_size)
+{
+    assert(window_count <= NET_WINDOW_SIZE, "The window is larger than NET_WINDOW_SIZE");
+    uint32 starts[NET_ACK_MAX_RANGES];
+    uint32 counts[NET_ACK_MAX_RANGES];
+    uint32 range_count = 0;
+    uint32 window_index = 0;
+    while(window_index < window_count)
+    {
+        if(slice_acked(ack_mask, ack_mask_size, base + window_index))
+        {
+            ++window_index;
+            continue;
+        }
+
+        uint32 start = window_index;
+        while(window_index < window_count && !slice_acked(ack_mask, ack_mask_size, base + window_index))
+        {
+            ++window_index;
+        }
+
+        if(range_count == NET_ACK_MAX_RANGES)
+        {
+            counts[range_count - 1] = window_count - starts[range_count - 1];
+            break;
+        }
+        starts[range_count] = start;
+        counts[range_count] = window_index - start;
+        range_count++;
+    }
+
+    Bitstream writer = stream_writer_init(buffer, buffer_size);
+    pack_uint32(&writer, range_count, 0, NET_ACK_MAX_RANGES);
+    for(uint32 range_index = 0; range_index < range_count; ++range_index)
+    {
+        pack_uint32(&writer, starts[range_index], 0, NET_WINDOW_SIZE - 1);
+        pack_uint32(&writer, counts[range_index], 1, NET_WINDOW_SIZE);
+    }
+    stream_align(&writer);
+
+    usize result = writer.index*sizeof(*writer.data);
+    return(result);
+}
+
+// NOTE(dgl): Expands the ranges of an ack payload into a mask of the window, received slices
+// are 1. Returns false if the payload is too short for its ranges.
+internal bool32
+ack_ranges_decode(uint8 *payload, usize payload_size, uint32 window_count, uint8 *window, usize window_size)
+{
+    assert(window_count <= window_size*8, "The window mask is too small");
+    Bitstream reader = stream_reader_init(payload, payload_size);
+    uint32 range_bits = 2*cast(uint32)bits_required(NET_WINDOW_SIZE - 1);
+    uint32 range_count = 0;
+    bool32 result = (reader.count > 0);
+    if(result)
+    {
+        range_count = unpack_uint32(&reader, 0, NET_ACK_MAX_RANGES);
+        usize bit_count = cast(usize)bits_required(NET_ACK_MAX_RANGES) + range_count*range_bits;
+        result = (bit_count <= reader.count*sizeof(*reader.data)*8);
+    }
+
+    if(result)
+    {
+        dgl_memset(window, 0, window_size);
+        for(uint32 window_index = 0; window_index < window_count; ++window_index)
+        {
+            ack_mask_set(window, window_size, window_index);
+        }
+
+        for(uint32 range_index = 0; range_index < range_count; ++range_index)
+        {
+            uint32 start = unpack_uint32(&reader, 0, NET_WINDOW_SIZE - 1);
+            uint32 count = unpack_uint32(&reader, 1, NET_WINDOW_SIZE);
+            uint32 end = dgl_min(start + count, window_count);
+            for(uint32 window_index = start; window_index < end; ++window_index)
+            {
+                ack_mask_clear(window, window_size, window_index);
+            }
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): The ack mask of the peer starts at the window base. Slices after the
+// end of the mask have not been received.
+internal bool32
+window_slice_acked(uint8 *ack_mask, usize ack_mask_size, uint32 window_index)
+{
+    bool32 result = false;
+    if(ack_mask && (window_index / 8) < ack_mask_size)
+    {
+        result = slice_acked(ack_mask, ack_mask_size, window_index);
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): returns the window index after the last slice received by the peer
+internal uint32
+window_acked_end(uint8 *ack_mask, usize ack_mask_size)
+{
+    uint32 result = 0;
+    if(ack_mask)
+    {
+        for(usize byte_index = ack_mask_size; byte_index > 0; --byte_index)
+        {
+            uint8 bits = ack_mask[byte_index - 1];
+            if(bits)
+            {
+                uint32 bit_index = 7;
+                while(!(bits & (1 << bit_index))) { --bit_index; }
+                result = cast(uint32)(byte_index - 1)*8 + bit_index + 1;
+                break;
+            }
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Rebuilds the missing slice of a fec group into the chunk receive buffer. This is only
+// possible if the parity of the group has been received and exactly one slice is missing.
+// The rebuilt slice is marked in the ack buffer, so the server does not resend it.
+internal bool32
+fec_rebuild_slice(Net_Context *ctx, uint32 group_index)
+{
+    bool32 result = false;
+
+    Packet_Chunk *info = &ctx->chunk_info;
+    uint32 group_size = info->fec_group_size;
+    uint8 *ack_mask = ctx->ack_mask;
+    usize ack_mask_size = ctx->ack_mask_size;
+    if(group_size > 0 &&
+       slice_acked(ctx->parity_mask, ctx->parity_mask_size, group_index))
+    {
+        uint32 first_slice = group_index*group_size;
+        uint32 end_slice = dgl_min(first_slice + group_size, info->slice_count);
+
+        uint32 missing_count = 0;
+        uint32 missing_index = 0;
+        for(uint32 slice_index = first_slice; slice_index < end_slice; ++slice_index)
+        {
+            if(!slice_acked(ack_mask, ack_mask_size, slice_index))
+            {
+                missing_count++;
+                missing_index = slice_index;
+            }
+        }
+
+        if(missing_count == 1)
+        {
+            usize receive_buffer_size = 0;
+            uint8 *receive_buffer = chunk_receive_buffer(ctx, &receive_buffer_size);
+            usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+            usize missing_size = (missing_index == info->slice_count - 1) ? info->last_slice_size : slice_space;
+            uint8 *missing = receive_buffer + cast(usize)missing_index*slice_space;
+            uint8 *parity = ctx->parity_buffer + cast(usize)group_index*slice_space;
+
+            dgl_memcpy(missing, parity, missing_size);
+            for(uint32 slice_index = first_slice; slice_index < end_slice; ++slice_index)
+            {
+                if(slice_index == missing_index) { continue; }
+
+                usize size = (slice_index == info->slice_count - 1) ? info->last_slice_size : slice_space;
+                xor_bytes(missing, receive_buffer + cast(usize)slice_index*slice_space, dgl_min(size, missing_size));
+            }
+
+            chunk_mark_received(ctx, missing_index);
+            LOG_DEBUG("Rebuilt slice %u from the parity of group %u", missing_index, group_index);
+            result = true;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): the slices of the first window are still sent to the group (see net_send_group_slices)
+internal bool32
+group_window_pending(Net_Context *ctx, Net_Conn_ID index, Net_Chunk *chunk)
+{
+    Net_Multicast *multicast = &ctx->multicast;
+    bool32 result = (ctx->conns->group_joined[index] &&
+                     multicast->chunk == chunk && multicast->generation == chunk->generation &&
+                     multicast->next < multicast->end);
+    return(result);
+}
+
+// NOTE(dgl): Sends the slices which moved into the window, up to max_bytes. With congestion control
+// the slices in flight are limited by the congestion window and the slices are paced over
+// the round trip. The pacing timer sends the remaining slices when the bucket is refilled.
+// Returns true if the byte limit stopped the connection, before the window did.
+internal bool32
+send_new_slices(Net_Context *ctx, Net_Conn_ID index, Net_Chunk *chunk, usize max_bytes, usize *sent_bytes)
+{
+    bool32 result = false;
+    Connection_List *conns = ctx->conns;
+    uint32 base = conns->window_base[index];
+    uint32 next = dgl_max(conns->window_next[index], base);
+    uint32 end = dgl_min(base + NET_WINDOW_SIZE, chunk->info.slice_count);
+    if(group_window_pending(ctx, index, chunk)) { end = next; }
+
+    Net_Rtt *rtt = conns->rtt + index;
+    Net_Congestion *cc = conns->congestion + index;
+    if(ctx->congestion_control && next < end)
+    {
+        pacing_refill(cc, rtt, ctx->time_ms);
+        uint32 in_flight = next - dgl_min(cc->acked, next);
+        uint32 cwnd = cast(uint32)cc->cwnd;
+        uint32 allowed = (cwnd > in_flight) ? cwnd - in_flight : 0;
+        uint32 tokens = cast(uint32)dgl_max(cc->tokens, 0.0f);
+        end = dgl_min(end, next + dgl_min(allowed, tokens));
+
+        // NOTE(dgl): if the window is full, the next ack sends the slices
+        if(tokens < allowed && end < chunk->info.slice_count)
+        {
+            real32 rate = pacing_rate(cc, rtt);
+            real32 delay_ms = (rate > 0.0f) ? (1.0f - (cc->tokens - cast(real32)tokens)) / rate : 0.0f;
+            conn_timer_schedule(conns, index, Net_Timer_Kind_Pacing, dgl_max(delay_ms, cast(real32)NET_TIMER_TICK_MS));
+        }
+    }
+
+    usize bytes = 0;
+    uint32 slice_index = next;
+    for(;
+        slice_index < end;
+        ++slice_index)
+    {
+        Packet_Buffer *slice = chunk->slices + slice_index;
+        if(bytes + slice->offset > max_bytes)
+        {
+            result = true;
+            break;
+        }
+
+        queue_prepared_datagram(ctx, index, slice, Packet_Type_Slice);
+        bytes += slice->offset;
+        LOG_DEBUG("Sending slice %u (%llu bytes)", slice_index, slice->offset);
+
+        Packet_Buffer *parity = chunk_parity_after_slice(chunk, slice_index);
+        if(parity)
+        {
+            queue_prepared_datagram(ctx, index, parity, Packet_Type_Parity);
+            bytes += parity->offset;
+            cc->tokens -= 1.0f;
+        }
+        cc->tokens -= 1.0f;
+    }
+
+    if(slice_index > next)
+    {
+        conns->window_sent_at[index] = ctx->time_ms;
+        conns->window_next[index] = slice_index;
+    }
+    *sent_bytes = bytes;
+
+    return(result);
+}
+
+// NOTE(dgl): the connection has new slices to send. They are sent when the scheduler
+// runs the next time (see net_send_scheduled_slices).
+internal void
+scheduler_activate(Net_Context *ctx, Net_Conn_ID index)
+{
+    Net_Send_Scheduler *scheduler = &ctx->scheduler;
+    if(!ctx->conns->send_active[index])
+    {
+        assert(scheduler->count < scheduler->capacity, "Send scheduler overflow");
+        scheduler->active[(scheduler->first + scheduler->count++) % scheduler->capacity] = index;
+        ctx->conns->send_active[index] = true;
+    }
+}
+
+// NOTE(dgl): The budget is refilled for the ticks since the last refill. Unused budget is only
+// carried over for a few ticks, to not send a large burst after a long frame.
+internal void
+scheduler_refill(Net_Context *ctx)
+{
+    Net_Send_Scheduler *scheduler = &ctx->scheduler;
+    real64 ticks = dgl_min((ctx->time_ms - scheduler->refill_at) / NET_TIMER_TICK_MS, 4.0);
+    usize refill = cast(usize)(ticks*cast(real64)ctx->send_budget_per_tick);
+    scheduler->budget = dgl_min(scheduler->budget + refill, dgl_max(refill, ctx->send_budget_per_tick));
+    scheduler->refill_at = ctx->time_ms;
+}
+
+// NOTE(dgl): Deficit round robin over the connections with new slices. Each round every connection
+// gets NET_SEND_QUANTUM bytes. A connection stays in the fifo until its window, the congestion
+// window or the pacing stops it. If the budget runs out, the connection stays at the front of
+// the fifo and continues with its remaining deficit.
+internal void
+net_send_scheduled_slices(Net_Context *ctx)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Send_Scheduler *scheduler = &ctx->scheduler;
+    bool32 use_budget = (ctx->send_budget_per_tick > 0);
+    if(use_budget) { scheduler_refill(ctx); }
+
+    while(scheduler->count > 0 && (!use_budget || scheduler->budget > 0))
+    {
+        Net_Conn_ID index = scheduler->active[scheduler->first];
+        scheduler->first = (scheduler->first + 1) % scheduler->capacity;
+        scheduler->count--;
+
+        bool32 more = false;
+        bool32 out_of_budget = false;
+        Net_Chunk *chunk = conn_chunk(conns, index);
+        if(conns->state[index] == Net_Conn_State_Connected && chunk)
+        {
+            if(!scheduler->resume) { conns->send_deficit[index] += NET_SEND_QUANTUM; }
+            scheduler->resume = false;
+
+            usize max_bytes = cast(usize)dgl_max(conns->send_deficit[index], 0);
+            if(use_budget && scheduler->budget < max_bytes)
+            {
+                max_bytes = scheduler->budget;
+                out_of_budget = true;
+            }
+
+            usize sent_bytes = 0;
+            more = send_new_slices(ctx, index, chunk, max_bytes, &sent_bytes);
+            conns->send_deficit[index] -= cast(int32)sent_bytes;
+            net_flush_packets(ctx, index);
+        }
+
+        if(more && out_of_budget)
+        {
+            scheduler->first = (scheduler->first + scheduler->capacity - 1) % scheduler->capacity;
+            scheduler->count++;
+            scheduler->resume = true;
+            break;
+        }
+        else if(more)
+        {
+            scheduler->active[(scheduler->first + scheduler->count++) % scheduler->capacity] = index;
+        }
+        else
+        {
+            conns->send_active[index] = false;
+            conns->send_deficit[index] = 0;
+        }
+    }
+}
+
+
+internal void
+send_group_datagram(Net_Context *ctx, Net_Chunk *chunk, uint32 generation, Packet_Buffer *buffer)
+{
+    Net_Multicast *multicast = &ctx->multicast;
+    if(ctx->chunk_store->shared)
+    {
+        buffer = send_batch_stage(ctx, &multicast->socket, chunk, generation, buffer);
+    }
+
+    // NOTE(dgl): the prepared datagram may still contain the timestamps of the last connection it was
+    // sent to (see net_flush_packets). The group has no timestamps.
+    if(buffer)
+    {
+        packet_buffer_set_salt(buffer, multicast->salt);
+        packet_buffer_set_timestamps(buffer, 0, 0);
+        send_batch_push(ctx, &multicast->socket, multicast->group, buffer->data, buffer->offset);
+        ctx->scheduler.budget -= dgl_min(ctx->scheduler.budget, buffer->offset);
+    }
+}
+
+// NOTE(dgl): Sends the slices of the first window to the group. The group has its own token bucket. Its rate
+// is the pacing rate of the slowest member and the slices in flight are limited by the smallest congestion
+// window of the members. Like the slices of the connections, the slices of the group use up the budget
+// of the tick. The timer of the group sends the remaining slices.
+internal void
+net_send_group_slices(Net_Context *ctx)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Multicast *multicast = &ctx->multicast;
+    Net_Chunk *chunk = multicast->chunk;
+
+    bool32 has_members = false;
+    real32 rate = multicast->max_rate;
+    uint32 allowed = NET_WINDOW_SIZE;
+    for(int32 index = 0; index < conns->max_count; ++index)
+    {
+        if(conns->state[index] == Net_Conn_State_Connected && conns->group_joined[index] &&
+           chunk && conn_chunk(conns, index) == chunk)
+        {
+            has_members = true;
+            if(ctx->congestion_control)
+            {
+                // NOTE(dgl): members without a round trip sample do not limit the rate
+                Net_Congestion *cc = conns->congestion + index;
+                real32 member_rate = pacing_rate(cc, conns->rtt + index);
+                if(member_rate > 0.0f) { rate = (rate > 0.0f) ? dgl_min(rate, member_rate) : member_rate; }
+
+                uint32 in_flight = multicast->next - dgl_min(cc->acked, multicast->next);
+                uint32 cwnd = cast(uint32)cc->cwnd;
+                allowed = dgl_min(allowed, (cwnd > in_flight) ? cwnd - in_flight : 0);
+            }
+        }
+    }
+
+    if(has_members)
+    {
+        if(rate > 0.0f)
+        {
+            real32 capacity = dgl_max(NET_PACING_MIN_BURST, rate*cast(real32)NET_TIMER_TICK_MS);
+            multicast->tokens = dgl_min(multicast->tokens + rate*cast(real32)(ctx->time_ms - multicast->refill_at), capacity);
+        }
+        else
+        {
+            multicast->tokens = cast(real32)allowed;
+        }
+        multicast->refill_at = ctx->time_ms;
+
+        bool32 use_budget = (ctx->send_budget_per_tick > 0);
+        if(use_budget) { scheduler_refill(ctx); }
+
+        uint32 tokens = cast(uint32)dgl_max(multicast->tokens, 0.0f);
+        uint32 end = dgl_min(multicast->end, multicast->next + dgl_min(allowed, tokens));
+        uint32 slice_index = multicast->next;
+        for(;
+            slice_index < end;
+            ++slice_index)
+        {
+            Packet_Buffer *slice = chunk->slices + slice_index;
+            Packet_Buffer *parity = chunk_parity_after_slice(chunk, slice_index);
+            usize bytes = slice->offset + (parity ? parity->offset : 0);
+            if(use_budget && ctx->scheduler.budget < bytes)
+            {
+                break;
+            }
+
+            send_group_datagram(ctx, chunk, multicast->generation, slice);
+            if(parity)
+            {
+                send_group_datagram(ctx, chunk, multicast->generation, parity);
+                multicast->tokens -= 1.0f;
+            }
+            multicast->tokens -= 1.0f;
+        }
+        send_batch_submit(ctx);
+
+        // NOTE(dgl): the members repair and continue after the slices sent to the group
+        bool32 done = (slice_index == multicast->end);
+        if(slice_index > multicast->next)
+        {
+            multicast->next = slice_index;
+            for(int32 index = 0; index < conns->max_count; ++index)
+            {
+                if(conns->state[index] == Net_Conn_State_Connected && conns->group_joined[index] &&
+                   conns->chunk[index] == chunk)
+                {
+                    conns->window_next[index] = slice_index;
+                    conns->window_sent_at[index] = ctx->time_ms;
+                    if(done && slice_index < chunk->info.slice_count) { scheduler_activate(ctx, index); }
+                }
+            }
+        }
+
+        if(done)
+        {
+            multicast->chunk = 0;
+        }
+        else
+        {
+            real32 delay_ms = cast(real32)NET_TIMER_TICK_MS;
+            if(rate > 0.0f && tokens < allowed)
+            {
+                delay_ms = dgl_max(delay_ms, (1.0f - (multicast->tokens - cast(real32)tokens)) / rate);
+            }
+            timer_schedule(conns->timers, group_timer_id(conns), delay_ms);
+        }
+    }
+    else
+    {
+        multicast->chunk = 0;
+    }
+}
+
+internal uint8 *
+conn_repair_mask(Connection_List *conns, Net_Conn_ID index)
+{
+    uint8 *result = conns->repair_mask + cast(usize)index*NET_REPAIR_MASK_SIZE;
+    return(result);
+}
+
+// NOTE(dgl): the slice is not repaired, if the peer acked it since it was collected
+internal bool32
+repair_needed(Connection_List *conns, Net_Conn_ID index, uint32 slice_index)
+{
+    bool32 result = false;
+    uint32 offset = slice_index - conns->repair_base[index];
+    if(slice_index >= conns->window_base[index] &&
+       slice_index >= conns->repair_base[index] && offset < NET_WINDOW_SIZE)
+    {
+        result = slice_acked(conn_repair_mask(conns, index), NET_REPAIR_MASK_SIZE, offset);
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Sends the collected repairs. A slice which is missed by enough connections is
+// sent once to the group, the others are sent to each connection which misses them.
+internal void
+net_flush_repairs(Net_Context *ctx)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Repair *repair = &ctx->repair;
+    Net_Chunk *chunk = repair->chunk;
+    if(chunk)
+    {
+        // NOTE(dgl): the connections could be disconnected or receive another chunk since
+        int32 count = 0;
+        for(int32 repair_index = 0; repair_index < repair->count; ++repair_index)
+        {
+            Net_Conn_ID index = repair->conns[repair_index];
+            if(conns->state[index] == Net_Conn_State_Connected &&
+               conn_chunk(conns, index) == chunk &&
+               conns->chunk_generation[index] == repair->generation)
+            {
+                repair->conns[count++] = index;
+            }
+            else
+            {
+                dgl_memset(conn_repair_mask(conns, index), 0, NET_REPAIR_MASK_SIZE);
+                conns->repair_pending[index] = false;
+            }
+        }
+        repair->count = count;
+
+        bool32 use_group = ctx->multicast.enabled && ctx->multicast.socket.handle.no_error;
+        for(uint32 slice_index = repair->first;
+            slice_index < repair->end;
+            ++slice_index)
+        {
+            int32 missing_count = 0;
+            for(int32 repair_index = 0; repair_index < repair->count; ++repair_index)
+            {
+                if(repair_needed(conns, repair->conns[repair_index], slice_index)) { missing_count++; }
+            }
+
+            Packet_Buffer *slice = chunk->slices + slice_index;
+            if(use_group && missing_count >= NET_REPAIR_GROUP_MIN)
+            {
+                LOG_DEBUG("Resending slice %u to the group (missed by %d connections)", slice_index, missing_count);
+                send_group_datagram(ctx, chunk, repair->generation, slice);
+                ctx->stats.repair_bytes_sent += slice->offset;
+            }
+            else if(missing_count > 0)
+            {
+                for(int32 repair_index = 0; repair_index < repair->count; ++repair_index)
+                {
+                    Net_Conn_ID index = repair->conns[repair_index];
+                    if(repair_needed(conns, index, slice_index))
+                    {
+                        queue_prepared_datagram(ctx, index, slice, Packet_Type_Slice);
+                        ctx->stats.repair_bytes_sent += slice->offset;
+                    }
+                }
+            }
+        }
+        send_batch_submit(ctx);
+
+        for(int32 repair_index = 0; repair_index < repair->count; ++repair_index)
+        {
+            Net_Conn_ID index = repair->conns[repair_index];
+            net_flush_packets(ctx, index);
+            dgl_memset(conn_repair_mask(conns, index), 0, NET_REPAIR_MASK_SIZE);
+            conns->repair_pending[index] = false;
+        }
+        repair->count = 0;
+        repair->chunk = 0;
+    }
+}
+
+// NOTE(dgl): Collects the repair of a connection in the multicast group. The repair mask of a
+// connection starts at its window base when the first repair is collected. Returns false, if the
+// slice has to be repaired right away (the peer is not in the group or the slice is after the mask).
+internal bool32
+repair_collect(Net_Context *ctx, Net_Conn_ID index, Net_Chunk *chunk, uint32 slice_index)
+{
+    bool32 result = false;
+    Connection_List *conns = ctx->conns;
+    Net_Repair *repair = &ctx->repair;
+    if(ctx->multicast.enabled && ctx->multicast.socket.handle.no_error && conns->group_joined[index])
+    {
+        if(repair->chunk && (repair->chunk != chunk || repair->generation != conns->chunk_generation[index]))
+        {
+            net_flush_repairs(ctx);
+        }
+
+        if(!repair->chunk)
+        {
+            repair->chunk = chunk;
+            repair->generation = conns->chunk_generation[index];
+            repair->first = slice_index;
+            repair->end = slice_index;
+            repair->flush_at = ctx->time_ms + NET_REPAIR_DELAY_MS;
+        }
+
+        if(!conns->repair_pending[index])
+        {
+            assert(repair->count < conns->max_count, "Repair list overflow");
+            repair->conns[repair->count++] = index;
+            conns->repair_pending[index] = true;
+            conns->repair_base[index] = conns->window_base[index];
+        }
+
+        uint32 offset = slice_index - conns->repair_base[index];
+        if(slice_index >= conns->repair_base[index] && offset < NET_WINDOW_SIZE)
+        {
+            ack_mask_set(conn_repair_mask(conns, index), NET_REPAIR_MASK_SIZE, offset);
+            repair->first = dgl_min(repair->first, slice_index);
+            repair->end = dgl_max(repair->end, slice_index + 1);
+            result = true;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Make sure to send the chunk packet before sending the chunk window!
+// Otherwise the packets will be ignored by the client.
+// Resends the slices of the window which have not been received by the peer and sends the
+// slices which moved into the window. The ack mask starts at the window base of the connection.
+// Pass 0 to send the first window of the chunk.
+internal void
+send_chunk_window(Net_Context *ctx, Net_Conn_ID index, Net_Chunk *chunk, uint8 *ack_mask, usize ack_mask_size)
+{
+    Connection_List *conns = ctx->conns;
+    uint32 base = conns->window_base[index];
+    uint32 next = dgl_max(conns->window_next[index], base);
+
+    // NOTE(dgl): the slices acked since the last ack grow the congestion window
+    Net_Rtt *rtt = conns->rtt + index;
+    Net_Congestion *cc = conns->congestion + index;
+    if(ack_mask)
+    {
+        uint32 acked = base;
+        for(uint32 slice_index = base; slice_index < next; ++slice_index)
+        {
+            if(window_slice_acked(ack_mask, ack_mask_size, slice_index - base)) { acked++; }
+        }
+
+        if(acked > cc->acked)
+        {
+            congestion_on_ack(cc, rtt, acked - cc->acked);
+            cc->acked = acked;
+        }
+    }
+
+    // NOTE(dgl): The ack contains all slices of the window, also the ones which are still on the way.
+    // Missing slices before the last received slice are lost. The others are only lost
+    // if the last new slice was sent more than a round trip ago. Missing slices are resent
+    // at most once per round trip, the resends of the last repair would be resent otherwise.
+    uint32 repair_end = base;
+    if(ctx->time_ms - conns->window_repair_at[index] >= rtt->srtt)
+    {
+        if(ctx->time_ms - conns->window_sent_at[index] >= rtt->srtt)
+        {
+            repair_end = next;
+        }
+        else
+        {
+            repair_end = dgl_min(base + window_acked_end(ack_mask, ack_mask_size), next);
+        }
+    }
+
+    uint32 repaired = 0;
+    for(uint32 slice_index = base;
+        slice_index < repair_end;
+        ++slice_index)
+    {
+        if(window_slice_acked(ack_mask, ack_mask_size, slice_index - base))
+        {
+            LOG_DEBUG("Slice %u already received by the client. Skipping...", slice_index);
+            continue;
+        }
+
+        // NOTE(dgl): parity slices are only sent with new slices. Resends after an ack
+        // contain the missing slices, which could not be rebuilt by the client.
+        Packet_Buffer *slice = chunk->slices + slice_index;
+        ctx->stats.repair_bytes_requested += slice->offset;
+        if(!repair_collect(ctx, index, chunk, slice_index))
+        {
+            queue_prepared_datagram(ctx, index, slice, Packet_Type_Slice);
+            ctx->stats.repair_bytes_sent += slice->offset;
+            LOG_DEBUG("Resending slice %u (%llu bytes)", slice_index, slice->offset);
+        }
+        conns->window_repair_at[index] = ctx->time_ms;
+        repaired++;
+    }
+
+    // NOTE(dgl): the repairs are sent regardless of the pacing, but they use up the tokens
+    // of the new slices.
+    if(ctx->congestion_control && repaired > 0)
+    {
+        congestion_on_loss(cc, rtt);
+        pacing_refill(cc, rtt, ctx->time_ms);
+        cc->tokens -= cast(real32)repaired;
+    }
+
+    scheduler_activate(ctx, index);
+    conn_timer_schedule(conns, index, Net_Timer_Kind_Retransmit, rtt_timeout(rtt));
+}
+
+// NOTE(dgl): the ack is kept in the packet ring until the next ack replaces it. It is resent by the
+// ack timer, until the chunk is complete.
+internal void
+send_chunk_ack(Net_Context *ctx, Net_Conn_ID index)
+{
+    Connection_List *conns = ctx->conns;
+    Packet ack_packet = default_packet(Packet_Type_Ack);
+    ack_packet.ack.hash = ctx->chunk_info.hash;
+    ack_packet.ack.base = ctx->received_base;
+
+    uint8 ranges[NET_ACK_RANGES_MAX_SIZE];
+    uint32 window_count = dgl_min(ctx->chunk_info.slice_count - ack_packet.ack.base, NET_WINDOW_SIZE);
+    usize ranges_size = ack_ranges_encode(ctx->ack_mask, ctx->ack_mask_size, ack_packet.ack.base, window_count,
+                                          ranges, array_count(ranges));
+
+    LOG_DEBUG("Sending chunk ack window at slice %u (%u slices since the last ack)", ack_packet.ack.base, ctx->ack_pending);
+    Packet_Buffer *buffer = packet_queue(ctx, index, ack_packet, Net_Outbound_Flag_Keep);
+    packet_buffer_append(buffer, ranges, ranges_size);
+    net_flush_packets(ctx, index);
+    ctx->ack_pending = 0;
+    ctx->ack_now = false;
+
+    if(ctx->received_count == ctx->chunk_info.slice_count) { conn_timer_cancel(conns, index, Net_Timer_Kind_Ack); }
+    else { conn_timer_schedule(conns, index, Net_Timer_Kind_Ack, rtt_timeout(conns->rtt + index)); }
+}
+
+internal void
+net_send_beacon(Net_Context *ctx)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Beacon *beacon = &ctx->beacon;
+    beacon->seq++;
+    beacon->send_at = ctx->time_ms + NET_BEACON_INTERVAL_MS;
+
+    Packet packet = default_packet(Packet_Type_Beacon);
+    packet.msg_type = Net_Message_Beacon;
+    packet.beacon.hash = beacon->hash;
+    packet.beacon.seq = beacon->seq;
+
+    bool32 use_group = ctx->multicast.enabled && ctx->multicast.socket.handle.no_error;
+    bool32 has_group_conns = false;
+    for(int32 index = 0; index < conns->max_count; ++index)
+    {
+        if(conns->state[index] == Net_Conn_State_Connected)
+        {
+            if(use_group && conns->group_joined[index])
+            {
+                has_group_conns = true;
+            }
+            else
+            {
+                packet_queue(ctx, index, packet, 0);
+                net_flush_packets(ctx, index);
+            }
+        }
+    }
+
+    if(has_group_conns)
+    {
+        Packet_Buffer buffer = {};
+        packet.salt = ctx->multicast.salt;
+        packet_buffer_write(&buffer, packet);
+        send_batch_push(ctx, &ctx->multicast.socket, ctx->multicast.group, buffer.data, buffer.offset);
+        send_batch_submit(ctx);
+    }
+}
+
+// NOTE(dgl): the content of the beacon is on the way, if a chunk is not complete yet and its
+// last slice arrived less than one beacon interval ago
+internal bool32
+chunk_receiving(Net_Context *ctx)
+{
+    bool32 result = (ctx->chunk_info.slice_count > 0 &&
+                     ctx->delivered_hash != ctx->chunk_info.hash &&
+                     ctx->time_ms - ctx->chunk_received_at < NET_BEACON_INTERVAL_MS);
+    return(result);
+}
+
+// NOTE(dgl): a changed hash is announced right away, the same hash is announced with the next beacon
+internal void
+net_set_beacon(Net_Context *ctx, uint32 hash)
+{
+    assert(ctx->is_server, "Only the server sends beacons");
+    if(ctx->beacon.hash != hash)
+    {
+        ctx->beacon.hash = hash;
+        if(hash != 0) { net_send_beacon(ctx); }
+    }
+}
+
+// NOTE(dgl): the timers are scheduled relative to the current tick of the wheel.
+// Expired timers are only collected here and handled in net_process_timers.
+internal void
+net_update_clock(Net_Context *ctx)
+{
+    ctx->time_ms = platform.get_time_in_ms();
+    timer_wheel_advance(ctx->conns->timers, timer_ticks(ctx->time_ms));
+}
+
+internal void
+net_process_timers(Net_Context *ctx)
+{
+    Connection_List *conns = ctx->conns;
+    Net_Timer_Wheel *wheel = conns->timers;
+    net_update_clock(ctx);
+
+    int32 id = -1;
+    while((id = timer_pop_expired(wheel)) >= 0)
+    {
+        if(id == group_timer_id(conns))
+        {
+            net_send_group_slices(ctx);
+            continue;
+        }
+
+        Net_Conn_ID index = id / Net_Timer_Kind_Count;
+        switch(id % Net_Timer_Kind_Count)
+        {
+            case Net_Timer_Kind_Idle:
+            {
+                // NOTE(dgl): We do not have to send a message here. If we hit a timeout, there is something
+                // wrong with this connection and the message will most likely not receive the peer.
+                LOG_DEBUG("Connection %d timed out", index);
+                conn_disconnect(conns, index);
+            } break;
+            case Net_Timer_Kind_Handshake:
+            {
+                if(conns->state[index] == Net_Conn_State_Connecting)
+                {
+                    net_resend_kept_packets(ctx, index);
+                    conn_timer_backoff(conns, index, Net_Timer_Kind_Handshake);
+                }
+            } break;
+            case Net_Timer_Kind_Retransmit:
+            {
+                // NOTE(dgl): only the first missing slice is resent. The peer replies with an ack
+                // containing its window and we resend the missing slices (see Packet_Type_Ack).
+                // The chunk packet is resent as well, if the peer did not ack anything yet.
+                Net_Chunk *chunk = conn_chunk(conns, index);
+                uint32 base = conns->window_base[index];
+                if(conns->state[index] == Net_Conn_State_Connected &&
+                   chunk && base < chunk->info.slice_count)
+                {
+                    LOG_DEBUG("Retransmitting slice %u to connection %d", base, index);
+                    if(base == 0)
+                    {
+                        queue_prepared_datagram(ctx, index, &chunk->header, Packet_Type_Chunk);
+                    }
+                    queue_prepared_datagram(ctx, index, chunk->slices + base, Packet_Type_Slice);
+                    net_flush_packets(ctx, index);
+                    conn_timer_backoff(conns, index, Net_Timer_Kind_Retransmit);
+                    if(ctx->congestion_control) { congestion_on_timeout(conns->congestion + index); }
+                }
+            } break;
+            case Net_Timer_Kind_Pacing:
+            {
+                Net_Chunk *chunk = conn_chunk(conns, index);
+                if(conns->state[index] == Net_Conn_State_Connected &&
+                   chunk && conns->window_next[index] < chunk->info.slice_count)
+                {
+                    scheduler_activate(ctx, index);
+                }
+            } break;
+            case Net_Timer_Kind_Ack:
+            {
+                // NOTE(dgl): the delayed ack is due, or the server did not send anything since our last ack
+                if(conns->state[index] == Net_Conn_State_Connected &&
+                   ctx->chunk_info.slice_count > 0 &&
+                   ctx->delivered_hash != ctx->chunk_info.hash)
+                {
+                    bool32 delayed = (ctx->ack_pending > 0);
+                    send_chunk_ack(ctx, index);
+                    if(!delayed)
+                    {
+                        LOG_DEBUG("Resent ack of chunk %u", ctx->chunk_info.hash);
+                        conn_timer_backoff(conns, index, Net_Timer_Kind_Ack);
+                    }
+                }
+            } break;
+            case Net_Timer_Kind_Message:
+            {
+                if(conns->state[index] == Net_Conn_State_Connected)
+                {
+                    LOG_DEBUG("Resending the unacked messages of connection %d", index);
+                    net_resend_messages(ctx, index);
+                    conn_timer_backoff(conns, index, Net_Timer_Kind_Message);
+                }
+            } break;
+            case Net_Timer_Kind_Message_Ack:
+            {
+                // NOTE(dgl): an ack only message is not sequenced and not acked by the peer
+                if(conns->state[index] == Net_Conn_State_Connected)
+                {
+                    Packet packet = default_packet(Packet_Type_Empty);
+                    packet.msg_type = Net_Message_Noop;
+                    packet_queue(ctx, index, packet, 0);
+                    net_flush_packets(ctx, index);
+                }
+            } break;
+            default:
+            {
+                assert(false, "Invalid timer kind");
+            }
+        }
+    }
+
+    if(ctx->is_server && ctx->beacon.hash != 0 && ctx->time_ms >= ctx->beacon.send_at)
+    {
+        net_send_beacon(ctx);
+    }
+
+    if(ctx->repair.chunk && ctx->time_ms >= ctx->repair.flush_at)
+    {
+        net_flush_repairs(ctx);
+    }
+
+    // NOTE(dgl): the slices of all transfers activated since the last call are interleaved here,
+    // after all received datagrams have been handled.
+    net_send_scheduled_slices(ctx);
+}
+
+
+// NOTE(dgl): messy. Needs a refactor @cleanup
+internal Net_Conn_ID
+net_recv_message(DGL_Mem_Arena *arena, Net_Context *ctx, Net_Message *message)
+{
+    Connection_List *conns = ctx->conns;
+    // NOTE(dgl): index is used for the internal connection index. If we want to return
+    // the packet/message we put the index into result. This indicates the client that
+    // we received a message. Otherwise the messages are handled internal. We loop and
+    // handle all packets until we have a packet which is returned as message to the client.
+    Net_Conn_ID result = -1;
+    Net_Conn_ID index = -1;
+
+    // NOTE(dgl): connections which were not updated in the last NET_CONN_TIMEOUT ms are
+    // disconnected by their idle timer (see net_process_timers).
+    net_update_clock(ctx);
+
+    bool32 chunk_buffer_updated = false;
+    bool32 ack_delayed = (ctx->ack_pending > 0); /* NOTE(dgl): the ack timer is already scheduled */
+    Zhc_Net_Address address = {};
+    usize memory_offset = 0;
+    bool32 from_group = false;
+    Zhc_Net_Datagram *datagram = 0;
+    while(result < 0 && (datagram = receive_datagram(ctx, &from_group)) != 0)
+    {
+        address = datagram->address;
+        uint8 *memory = datagram->data;
+        usize memory_size = datagram->size;
+        memory_offset = 0;
+
+        // NOTE(dgl): parse packet from memory buffer. Datagrams of other protocols or shorter
+        // than the header of their type are dropped.
+        if(serialized_packet_type(memory, memory_size) == Packet_Type_Max) { continue; }
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(memory, memory_size);
+        usize header_size = serialize_packet(&reader, &packet);
+        memory_offset = header_size;
+
+        assert(memory_size >= memory_offset, "Packet memory offset cannot be bigger than the memory size");
+        uint8 *payload = memory + memory_offset;
+        usize payload_size = memory_size - memory_offset;
+
+        LOG_DEBUG("Received packet (%d bytes) - Salt: %llx, Session: %x, Type: type %d, Header: %d bytes", memory_size, packet.salt, packet.session, packet.type, header_size);
+
+        // NOTE(dgl): handle packet
+
+        // NOTE(dgl): one message is returned per call, the other datagrams stay in the receive batch.
+        // A message after the slices of this call is returned by the next call, so the chunk
+        // they completed is returned first.
+        if(chunk_buffer_updated && (packet_is_message(packet.type) || packet.type == Packet_Type_Beacon))
+        {
+            ctx->receive_batch.next--;
+            break;
+        }
+
+        // NOTE(dgl): we mix client and server packets in here because they are handled very similarly.
+        // If this causes too much complexity it is easy to separate them. However in my opinion
+        // this is a cleaner code, at least for the current state. I hope I'll find a better solution
+        // because I don't really like mixing those.
+        // TODO(dgl): the disconnect/denied state is not really defined. Must we send a disconnect packet
+        // on each denied packet, to ensure a connection is reset if it has a connection state?
+        bool32 valid_salt = false;
+        if(from_group)
+        {
+            // NOTE(dgl): group datagrams are sent from another socket of the server. We only
+            // accept chunks and beacons from the group of our server connection (a client only has one connection).
+            if(conns->state[0] != Net_Conn_State_Connected ||
+               !packet_salt_valid(&packet, ctx->multicast.salt) ||
+               (packet.type != Packet_Type_Chunk && packet.type != Packet_Type_Slice &&
+                packet.type != Packet_Type_Parity && packet.type != Packet_Type_Beacon))
+            {
+                continue;
+            }
+            index = 0;
+            valid_salt = true;
+        }
+        else
+        {
+            index = get_connection(conns, address);
+            valid_salt = (index >= 0 && packet_salt_valid(&packet, conns->salt[index]));
+        }
+        // NOTE(dgl): the group datagrams have no timestamps, they are sent to all connections at once
+        if(index >= 0)
+        {
+            conn_timer_schedule(conns, index, Net_Timer_Kind_Idle, NET_CONN_TIMEOUT);
+            if(!from_group)
+            {
+                conn_receive_timestamps(ctx, index, &packet);
+            }
+        }
+
+        if(packet.type > _Packet_Type_Connected)
+        {
+            if(index >= 0 &&
+               conns->state[index] > Net_Conn_State_Disconnected &&
+               valid_salt)
+            {
+                bool32 was_connecting = (conns->state[index] == Net_Conn_State_Connecting);
+                conns->state[index] = Net_Conn_State_Connected;
+
+                // NOTE(dgl): announce the multicast group until the peer confirmed it. The announcement
+                // is repeated with every hash and data request, in case a packet got lost.
+                if(ctx->is_server &&
+                   ctx->multicast.socket.handle.no_error &&
+                   !conns->group_joined[index] &&
+                   (was_connecting || packet.msg_type == Net_Message_Hash_Req || packet.msg_type == Net_Message_Data_Req))
+                {
+                    Packet_Group group = {};
+                    group.host = ctx->multicast.group.host;
+                    group.port = ctx->multicast.group.port;
+                    group.salt = ctx->multicast.salt;
+                    send_group_packet(ctx, index, group);
+                }
+
+                // NOTE(dgl): the acks of the peer are piggybacked on its messages. Received messages
+                // are acked with our next message, or after a short delay without one. Resent
+                // messages we already received are acked again but not returned.
+                if(packet_is_message(packet.type))
+                {
+                    reliable_receive_acks(ctx, index, packet.message.ack, packet.message.ack_bits);
+                    if(packet.message.seq == 0) { continue; }
+
+                    bool32 is_new = reliable_receive_seq(conns->reliable + index, packet.message.seq);
+                    if(!conn_timer_scheduled(conns, index, Net_Timer_Kind_Message_Ack))
+                    {
+                        conn_timer_schedule(conns, index, Net_Timer_Kind_Message_Ack, NET_MESSAGE_ACK_DELAY_MS);
+                    }
+                    if(!is_new)
+                    {
+                        LOG_DEBUG("Dropping duplicate message %u of connection %d", packet.message.seq, index);
+                        ctx->stats.messages_duplicate++;
+                        continue;
+                    }
+                }
+
+                switch(packet.type) {
                 case Packet_Type_Disconnect:
                     {
-                        conns->state[index] = Net_Conn_State_Disconnected;
+                        conn_disconnect(conns, index);
                     } break;
                 case Packet_Type_Payload:
                     {
@@ -711,298 +3255,1088 @@ net_recv_message(DGL_Mem_Arena *arena, Net_Context *ctx, real32 frametime_in_ms,
                     {
                         if(ctx->chunk_info.hash != packet.chunk.hash)
                         {
-                            chunk_buffer_updated = true;
-                            usize slice_size = NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Slice);
+                            usize slice_size = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
                             usize chunk_size = (slice_size*packet.chunk.slice_count) - (slice_size - packet.chunk.last_slice_size);
-                            assert(chunk_size < ctx->chunk_buffer_size, "Chunk buffer overflow");
 
-                            ctx->chunk_info.slice_count = packet.chunk.slice_count;
-                            ctx->chunk_info.hash = packet.chunk.hash;
-                            ctx->chunk_info.last_slice_size= packet.chunk.last_slice_size;
-                            ctx->chunk_type = packet.msg_type;
+                            if(reserve_receive_buffers(ctx, &packet.chunk))
+                            {
+                                chunk_buffer_updated = true;
+                                ctx->chunk_info.slice_count = packet.chunk.slice_count;
+                                ctx->chunk_info.hash = packet.chunk.hash;
+                                ctx->chunk_info.last_slice_size= packet.chunk.last_slice_size;
+                                ctx->chunk_info.fec_group_size = packet.chunk.fec_group_size;
+                                ctx->chunk_info.codec = packet.chunk.codec;
+                                ctx->chunk_info.raw_size = packet.chunk.raw_size;
+                                ctx->chunk_type = packet.msg_type;
+
+                                dgl_memset(ctx->ack_mask, 0, ctx->ack_mask_size);
+                                dgl_memset(ctx->parity_mask, 0, ctx->parity_mask_size);
+                                ctx->received_count = 0;
+                                ctx->received_base = 0;
+                                ctx->received_end = 0;
+                                ctx->ack_pending = 1; /* NOTE(dgl): the chunk packet is acked with the slices */
+                                ctx->ack_now = false;
+                                ctx->chunk_received_at = ctx->time_ms;
+                                LOG_DEBUG("Prepare receiving new chunk %u of size %llu", packet.chunk.hash, chunk_size);
+                            }
+                            else
+                            {
+                                LOG("Chunk %u is too large (%llu bytes, %u raw bytes). Ignoring...", packet.chunk.hash, chunk_size, packet.chunk.raw_size);
+                            }
+                        }
+                    } break;
+                case Packet_Type_Slice:
+                    {
+                        // TODO(dgl): @cleanup should be returned by recv_packet
+                        // It would be great to have recv_packet and recv_payload separately.
+                        usize slice_size = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+                        usize offset = cast(usize)packet.slice.index * slice_size;
+                        usize receive_buffer_size = 0;
+                        uint8 *receive_buffer = chunk_receive_buffer(ctx, &receive_buffer_size);
+                        // NOTE(dgl): slices outside of the chunk or the receive buffer are ignored
+                        if(ctx->chunk_info.hash == packet.slice.hash &&
+                           packet.slice.index < ctx->chunk_info.slice_count &&
+                           offset + payload_size <= receive_buffer_size)
+                        {
+                            // NOTE(dgl): the server resends slices we already have, if it missed our last ack.
+                            // The repairs of the other connections in the group are not acked.
+                            if(chunk_mark_received(ctx, packet.slice.index))
+                            {
+                                chunk_buffer_updated = true;
+                                dgl_memcpy(receive_buffer + offset, payload, payload_size);
+                                if(ctx->chunk_info.fec_group_size > 0)
+                                {
+                                    fec_rebuild_slice(ctx, packet.slice.index / ctx->chunk_info.fec_group_size);
+                                }
+                            }
+                            else if(!from_group)
+                            {
+                                chunk_buffer_updated = true;
+                                ctx->ack_now = true;
+                            }
+                        }
+                    } break;
+                case Packet_Type_Parity:
+                    {
+                        usize slice_size = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+                        usize offset = cast(usize)packet.parity.index * slice_size;
+                        if(ctx->chunk_info.hash == packet.parity.hash &&
+                           ctx->chunk_info.fec_group_size > 0 &&
+                           packet.parity.index*ctx->chunk_info.fec_group_size < ctx->chunk_info.slice_count &&
+                           offset + payload_size <= ctx->parity_buffer_size)
+                        {
+                            chunk_buffer_updated = true;
+                            dgl_memcpy(ctx->parity_buffer + offset, payload, payload_size);
+                            ack_mask_set(ctx->parity_mask, ctx->parity_mask_size, packet.parity.index);
+                            fec_rebuild_slice(ctx, packet.parity.index);
+                        }
+                    } break;
+                case Packet_Type_Ack:
+                    {
+                        // NOTE(dgl): acks with a smaller base arrived out of order. They would
+                        // move the window backwards.
+                        Net_Chunk *chunk = conn_chunk(conns, index);
+                        uint8 window[(NET_WINDOW_SIZE / 8) + 1];
+                        uint32 base = dgl_min(packet.ack.base, chunk ? chunk->info.slice_count : 0);
+                        uint32 window_count = chunk ? dgl_min(chunk->info.slice_count - base, NET_WINDOW_SIZE) : 0;
+                        if(chunk &&
+                           packet.ack.hash == chunk->info.hash &&
+                           packet.ack.base >= conns->window_base[index] &&
+                           ack_ranges_decode(payload, payload_size, window_count, window, array_count(window)))
+                        {
+                            conns->window_base[index] = base;
+                            if(conns->window_base[index] < chunk->info.slice_count)
+                            {
+                                send_chunk_window(ctx, index, chunk, window, array_count(window));
+                                net_flush_packets(ctx, index);
+                            }
+                            else
+                            {
+                                // NOTE(dgl): the transfer is complete. The chunk can be replaced,
+                                // if no other connection receives it.
+                                conn_timer_cancel(conns, index, Net_Timer_Kind_Retransmit);
+                                conn_set_chunk(conns, index, 0, 0);
+                            }
+                        }
+                    } break;
+                case Packet_Type_Group:
+                    {
+                        if(ctx->is_server)
+                        {
+                            // NOTE(dgl): the peer confirmed that it joined the group
+                            conns->group_joined[index] = (packet.group.salt == ctx->multicast.salt &&
+                                                          packet.group.host == ctx->multicast.group.host &&
+                                                          packet.group.port == ctx->multicast.group.port);
+                        }
+                        else
+                        {
+                            join_multicast_group(ctx, packet.group);
+                            if(ctx->multicast.enabled)
+                            {
+                                send_group_packet(ctx, index, packet.group);
+                            }
+                        }
+                    } break;
+                case Packet_Type_Beacon:
+                    {
+                        // NOTE(dgl): the beacon can arrive from the group and directly. Only the newer
+                        // beacon is returned, the lib decides if it requests the content. While we receive
+                        // a chunk, the content of the beacon is on the way and the beacon is dropped.
+                        Net_Beacon *beacon = &ctx->beacon;
+                        if(!ctx->is_server &&
+                           (beacon->seq == 0 || cast(int32)(packet.beacon.seq - beacon->seq) > 0))
+                        {
+                            beacon->hash = packet.beacon.hash;
+                            beacon->seq = packet.beacon.seq;
+                            if(chunk_receiving(ctx))
+                            {
+                                LOG_DEBUG("Dropping beacon %u while receiving chunk %u", packet.beacon.seq, ctx->chunk_info.hash);
+                            }
+                            else
+                            {
+                                message->type = Net_Message_Beacon;
+                                message->payload = cast(uint8 *)&beacon->hash;
+                                message->payload_size = sizeof(beacon->hash);
+                                result = index;
+                            }
+                        }
+                    } break;
+                default:
+                    {
+                        message->type = packet.msg_type;
+                        message->payload = 0;
+                        message->payload_size = 0;
+                        result = index;
+                    }
+                }
+            }
+            else
+            {
+                LOG_DEBUG("Invalid packet.");
+                // TODO(dgl): I think the easiest way would be for now to rely on
+                // connection timeouts. But we need a proper solution for this.
+//                 if(index >= 0)
+//                 {
+//                     Net_Message message = {};
+//                     message.type = Net_Message_Disconnect;
+//                     net_send_message(ctx, index, message);
+//                     LOG_DEBUG("Send disconnect message");
+//                     conns->state[index] = Net_Conn_State_Disconnected;
+//                 }
+            }
+        }
+        else
+        {
+            // NOTE(dgl): Handle connection handshake packets
+            if(index < 0)
+            {
+                // NOTE(dgl): the discovery is a broadcast, which reaches all shards of the server.
+                // Only the shard receiving the other datagrams of the peer replies.
+                if(ctx->is_server && packet.type == Packet_Type_Server_Discovery &&
+                   (address.port % ctx->shard_count) != ctx->shard_index)
+                {
+                    LOG_DEBUG("Discovery of %u.%u.%u.%u:%u is handled by another shard", address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port);
+                }
+                else if(!ctx->is_server && packet.type == Packet_Type_Request && !packet_version_valid(&packet))
+                {
+                    LOG("Server %u.%u.%u.%u:%u has version %08x (ours: %08x). Sending denied packet", address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port, packet.version, parse_version(ZHC_VERSION));
+                    send_denied_packet(ctx, address);
+                }
+                // NOTE(dgl): handling connection requests
+                else if((ctx->is_server && packet.type == Packet_Type_Server_Discovery) ||
+                   (!ctx->is_server && packet.type == Packet_Type_Request))
+                {
+                    uint64 salt = 0;
+                    get_random_bytes(cast(uint8 *)&salt, sizeof(salt));
+                    index = push_connection(conns, address, salt);
+                    LOG_DEBUG("Connection request from %u.%u.%u.%u:%u", address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port);
+                    if(index < 0)
+                    {
+                        LOG("No free connection available");
+                        send_denied_packet(ctx, address);
+                    }
+                    else
+                    {
+                        conn_receive_timestamps(ctx, index, &packet);
+                        if(ctx->is_server)
+                        {
+                            Packet resp = default_packet(Packet_Type_Request);
+                            queue_handshake_packet(ctx, index, resp);
+                        }
+                        else
+                        {
+                            Packet resp = default_packet(Packet_Type_Challenge);
+                            resp.challenge.codecs = NET_SUPPORTED_CODECS;
+                            queue_handshake_packet(ctx, index, resp);
+                            conns->salt[index] ^= packet.salt;
+                        }
+                    }
+                }
+                else
+                {
+                    LOG_DEBUG("Invalid connection request of type %d from from %u.%u.%u.%u:%u", packet.type, address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port);
+                    send_denied_packet(ctx, address);
+                }
+            }
+            else
+            {
+                // NOTE(dgl): connection which are disconnected are ignored.
+                if(conns->state[index] > Net_Conn_State_Disconnected)
+                {
+                    // NOTE(dgl): if the connection is already connected, we simply ignore the packet.
+                    // this also makes sure only not established connections can receive a denied packet.
+                    if(conns->state[index] == Net_Conn_State_Connected) { continue; }
 
-                            dgl_memset(ctx->ack_buffer.data, 0, array_count(ctx->ack_buffer.data));
-                            LOG_DEBUG("Prepare receiving new chunk %u of size %llu", packet.chunk.hash, chunk_size);
-                        }
-                    } break;
-                case Packet_Type_Slice:
-                    {
-                        if(ctx->chunk_info.hash == packet.slice.hash)
+                    switch(packet.type) {
+                    case Packet_Type_Denied:
                         {
-                            assert(packet.slice.index < ctx->chunk_info.slice_count, "Invalid slice index");
-                            chunk_buffer_updated = true;
-                            usize slice_size = NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Slice);
-                            usize offset = cast(usize)packet.slice.index * slice_size;
-
-                            // TODO(dgl): @cleanup should be returned by recv_packet
-                            // It would be great to have recv_packet and recv_payload separately.
-                            dgl_memcpy(ctx->chunk_buffer + offset, payload, payload_size);
-
-                            usize ack_size = get_serialized_packet_size(Packet_Type_Ack);
-                            assert((ctx->chunk_info.slice_count / 8) + 1 <= array_count(ctx->ack_buffer.data) - ack_size, "Cannot have more slices than bits in the ack buffer");
-                            int32 mask_byte = packet.slice.index / 8;
-                            uint32 mask_bit = 1 << (packet.slice.index % 8);
-                            ctx->ack_buffer.data[mask_byte] |= mask_bit;
-                        }
-                    } break;
-                case Packet_Type_Ack:
-                    {
-                        if(packet.ack.hash == ctx->chunk_info.hash)
+                            conn_disconnect(conns, index);
+                        } break;
+                    case Packet_Type_Challenge:
+                        {
+                            if(ctx->is_server && !packet_version_valid(&packet))
+                            {
+                                LOG("Client %d has version %08x (ours: %08x). Sending denied packet", index, packet.version, parse_version(ZHC_VERSION));
+                                conn_disconnect(conns, index);
+                                send_denied_packet(ctx, address);
+                            }
+                            else if(ctx->is_server)
+                            {
+                                LOG_DEBUG("Challenge salt %llx, conn salt %llx", packet.salt, conns->salt[index]);
+                                conns->salt[index] ^= packet.salt;
+                                conns->codecs[index] = packet.challenge.codecs & NET_SUPPORTED_CODECS;
+                                Packet resp = default_packet(Packet_Type_Challenge_Resp);
+                                queue_handshake_packet(ctx, index, resp);
+                            }
+                        } break;
+                    case Packet_Type_Challenge_Resp:
                         {
-                            uint8 *ack_buffer = payload;
-                            usize ack_buffer_size = payload_size;
-                            assert(ack_buffer, "Invalid ack buffer");
-                            if(!chunk_complete(ack_buffer, ack_buffer_size, ctx->chunk_info.slice_count))
+                            if(!ctx->is_server)
                             {
-                                send_chunk_buffer(ctx, index, ack_buffer, ack_buffer_size);
+                                if(conns->salt[index] == packet.salt)
+                                {
+                                    conns->state[index] = Net_Conn_State_Connected;
+                                    // NOTE(dgl): the server starts a new beacon sequence
+                                    ctx->beacon = {};
+                                    Net_Message message = {};
+                                    message.type = Net_Message_Hash_Req;
+                                    net_send_message(ctx, index, message);
+                                }
+                                else
+                                {
+                                    LOG_DEBUG("Challenge response salt invalid (packet salt: %llx, conn salt: %llx). Sending denied packet", conns->salt[index], packet.salt);
+                                    send_denied_packet(ctx, address);
+                                }
                             }
+                        } break;
+                    default:
+                        {
+                            LOG_DEBUG("Invalid packet of type %d. Ignoring...", packet.type);
                         }
-                    } break;
-                default:
-                    {
-                        message->type = packet.msg_type;
-                        message->payload = 0;
-                        message->payload_size = 0;
-                        result = index;
                     }
                 }
+                else
+                {
+                    // NOTE(dgl): we send a denied packet to let the peer reset its connection state
+                    LOG_DEBUG("Connection %d is disconnected. Sending denied packet", index);
+                    send_denied_packet(ctx, address);
+                }
+            }
+        }
+    }
+
+    if(chunk_buffer_updated)
+    {
+        bool32 complete = (ctx->chunk_info.slice_count > 0 && ctx->received_count == ctx->chunk_info.slice_count);
+        assert(complete == (ctx->chunk_info.slice_count > 0 && chunk_complete(ctx->ack_mask, ctx->ack_mask_size, ctx->chunk_info.slice_count)),
+               "The received slices do not match the ack mask");
+        if(complete && ctx->delivered_hash != ctx->chunk_info.hash)
+        {
+            LOG_DEBUG("All chunk slices received");
+            usize slice_size = packet_header_size(Packet_Type_Slice);
+            usize payload_size = NET_MTU_SIZE - slice_size;
+            usize chunk_size = (cast(usize)(ctx->chunk_info.slice_count - 1) * payload_size) + ctx->chunk_info.last_slice_size;
+
+            if(ctx->chunk_info.codec == Net_Codec_LZ)
+            {
+                chunk_size = lz_decompress(ctx->chunk_buffer, ctx->chunk_buffer_size, ctx->compressed_buffer, chunk_size);
+            }
+
+            if(chunk_size == ctx->chunk_info.raw_size)
+            {
+                message->type = ctx->chunk_type;
+                message->payload_size = chunk_size;
+                message->payload = ctx->chunk_buffer;
+                result = index;
+                ctx->delivered_hash = ctx->chunk_info.hash;
+            }
+            else
+            {
+                // NOTE(dgl): the chunk is received again after the next data request
+                LOG("Failed decompressing chunk %u (%llu of %u bytes)", ctx->chunk_info.hash, chunk_size, ctx->chunk_info.raw_size);
+                ctx->chunk_info = {};
+                complete = false;
+            }
+        }
+
+        // NOTE(dgl): we only ack the window after the first missing slice. The server never sends
+        // slices after this window. The ack of a complete chunk has an empty window. The ack
+        // is delayed, the server only needs it to move the window and to repair the gaps.
+        if(ctx->chunk_info.slice_count > 0)
+        {
+            if(complete || ctx->ack_now || ctx->ack_pending >= NET_ACK_SLICE_COUNT)
+            {
+                send_chunk_ack(ctx, index);
+            }
+            else if(ctx->ack_pending > 0 && !ack_delayed)
+            {
+                conn_timer_schedule(conns, index, Net_Timer_Kind_Ack, NET_ACK_DELAY_MS);
+            }
+        }
+    }
+
+    return(result);
+}
+
+// TODO(dgl): @cleanup find better name, can we get rid of the net_message here?
+// NOTE(dgl): payloads which do not fit into a single packet are sent as chunk.
+// The chunk packet itself is prepared by net_prepare_chunk.
+internal Packet
+build_packet(Net_Message message)
+{
+    Packet result = {};
+    switch(message.type)
+    {
+        case Net_Message_Hash_Req:
+        case Net_Message_Data_Req:
+        {
+            // NOTE(dgl): hash requests can contain the hash of the client content
+            if(message.payload)
+            {
+                assert(message.payload_size <= NET_MTU_SIZE - packet_header_size(Packet_Type_Payload), "Request payload too large");
+                result = default_packet(Packet_Type_Payload);
+            }
+            else
+            {
+                result = default_packet(Packet_Type_Empty);
+            }
+        } break;
+        case Net_Message_Hash_Res:
+        case Net_Message_Data_Res:
+        case Net_Message_Delta_Res:
+        {
+            assert(message.payload, "Message with this type must have a payload");
+            usize max_payload_size = NET_MTU_SIZE - packet_header_size(Packet_Type_Payload);
+            if(message.payload_size > max_payload_size)
+            {
+                result = default_packet(Packet_Type_Chunk);
             }
             else
             {
-                LOG_DEBUG("Invalid packet.");
-                // TODO(dgl): I think the easiest way would be for now to rely on
-                // connection timeouts. But we need a proper solution for this.
-//                 if(index >= 0)
-//                 {
-//                     Net_Message message = {};
-//                     message.type = Net_Message_Disconnect;
-//                     net_send_message(ctx, index, message);
-//                     LOG_DEBUG("Send disconnect message");
-//                     conns->state[index] = Net_Conn_State_Disconnected;
-//                 }
+                result = default_packet(Packet_Type_Payload);
+            }
+        } break;
+        default:
+        {
+            result = default_packet(Packet_Type_Empty);
+        } break;
+    }
+
+    result.msg_type = message.type;
+
+    return(result);
+}
+
+// NOTE(dgl): only data responses are compressed. The other messages are too small to benefit.
+internal Net_Codec
+select_codec(Net_Message_Type type, uint32 codecs)
+{
+    Net_Codec result = Net_Codec_None;
+    if(type == Net_Message_Data_Res &&
+       (codecs & NET_CODEC_FLAG(Net_Codec_LZ)))
+    {
+        result = Net_Codec_LZ;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): Returns the cached compressed payload or reserves the least recently used entry
+// which is not in use. The payload of a reserved entry must be compressed (see net_compress_payload).
+// Returns 0, if all entries are in use. Must be called under the lock of the chunk store.
+internal Net_Compressed_Payload *
+compress_cache_acquire(Net_Compress_Cache *cache, uint32 payload_hash, Net_Codec codec, usize raw_size, bool32 *reserved)
+{
+    Net_Compressed_Payload *result = 0;
+    Net_Compressed_Payload *oldest = 0;
+    for(int32 index = 0; index < cache->count; ++index)
+    {
+        Net_Compressed_Payload *entry = cache->payloads + index;
+        if(entry->last_used > 0 &&
+           entry->hash == payload_hash &&
+           entry->codec == codec &&
+           entry->raw_size == raw_size)
+        {
+            result = entry;
+            break;
+        }
+
+        if(entry->ref_count == 0 && (!oldest || entry->last_used < oldest->last_used))
+        {
+            oldest = entry;
+        }
+    }
+
+    *reserved = false;
+    if(result)
+    {
+        result->last_used = ++cache->use_counter;
+    }
+    else if(oldest)
+    {
+        result = oldest;
+        result->hash = payload_hash;
+        result->codec = codec;
+        result->raw_size = raw_size;
+        result->last_used = 0;
+        *reserved = true;
+    }
+
+    if(result) { result->ref_count++; }
+    return(result);
+}
+
+// NOTE(dgl): Must be called under the lock of the chunk store. A reserved entry can be found
+// by the other shards afterwards.
+internal void
+compress_cache_release(Net_Compress_Cache *cache, Net_Compressed_Payload *entry, bool32 reserved)
+{
+    assert(entry->ref_count > 0, "Compressed payload reference count underflow");
+    if(reserved) { entry->last_used = ++cache->use_counter; }
+    entry->ref_count--;
+}
+
+// NOTE(dgl): compresses the payload into the reserved cache entry. The compressed payload must be
+// smaller than the raw payload. Otherwise the size is 0 and the payload is sent uncompressed.
+internal void
+net_compress_payload(Net_Compress_Cache *cache, Net_Compressed_Payload *entry, Net_Message message)
+{
+    assert(entry->codec == Net_Codec_LZ, "Unsupported codec");
+    usize max_size = dgl_min(cache->capacity, message.payload_size - 1);
+    entry->size = (message.payload_size > 0) ? lz_compress(entry->data, max_size, message.payload, message.payload_size) : 0;
+    if(entry->size > 0)
+    {
+        entry->compressed_hash = HASH_OFFSET_BASIS;
+        hash(&entry->compressed_hash, entry->data, entry->size);
+    }
+
+    LOG_DEBUG("Compressed payload %u from %llu to %llu bytes", entry->hash, message.payload_size, entry->size);
+}
+
+// NOTE(dgl): Returns the prepared chunk for the message payload. If the payload
+// was already prepared, the existing chunk is returned and nothing is hashed or serialized.
+// Otherwise the payload is sliced into a free chunk of the store. Chunks which are still
+// referenced by connections are only replaced if there is no free chunk left. Their transfers
+// are restarted by the next data request.
+// NOTE(dgl): If the codec is not supported by the payload (it does not get smaller) the
+// chunk is prepared uncompressed.
+// NOTE(dgl): The lock of a shared store is only held to find or reserve the chunk and to publish it.
+// The payload is compressed and sliced without the lock. If another shard prepares the same payload
+// (or all chunks are in preparation), we wait until it is published.
+internal Net_Chunk *
+net_prepare_chunk(Net_Context *ctx, Net_Message message, Net_Codec codec)
+{
+    Net_Chunk_Store *store = ctx->chunk_store;
+    assert(store, "Chunk store not initialized. Only the server can send chunks");
+    assert(message.payload, "Chunk message must have a payload");
+
+    uint32 payload_hash = message.payload_hash;
+    if(payload_hash == 0)
+    {
+        payload_hash = HASH_OFFSET_BASIS;
+        hash(&payload_hash, message.payload, message.payload_size);
+    }
+
+    Net_Chunk *result = 0;
+    bool32 prepare = false;
+    Net_Compressed_Payload *compressed = 0;
+    bool32 compress = false;
+    while(!result)
+    {
+        chunk_store_lock(store);
+        bool32 wait = false;
+        Net_Chunk *free_chunk = 0;
+        for(int32 index = 0; index < store->count; ++index)
+        {
+            Net_Chunk *chunk = store->chunks + index;
+            bool32 in_preparation = (chunk->generation & 1);
+            if((in_preparation || chunk->info.slice_count > 0) &&
+               chunk->payload_hash == payload_hash &&
+               (chunk->codec == codec || (!in_preparation && chunk->info.codec == codec)) &&
+               chunk->info.fec_group_size == ctx->fec_group_size &&
+               chunk->type == message.type)
+            {
+                if(in_preparation)
+                {
+                    wait = true;
+                }
+                else
+                {
+                    // NOTE(dgl): the chunk can be replaced after the lock is released
+                    result = chunk;
+                    ctx->prepared_generation = chunk->generation;
+                }
+                break;
+            }
+
+            // NOTE(dgl): prefer empty chunks over unreferenced ones. Unreferenced
+            // chunks are still valid and can be reused if the payload is requested again.
+            if(!in_preparation &&
+               (!free_chunk ||
+                (chunk->ref_count < free_chunk->ref_count) ||
+                (chunk->ref_count == free_chunk->ref_count && chunk->info.slice_count == 0)))
+            {
+                free_chunk = chunk;
+            }
+        }
+
+        if(!result && !wait && free_chunk)
+        {
+            result = free_chunk;
+            prepare = true;
+
+            if(result->ref_count > 0)
+            {
+                // NOTE(dgl): connections receiving the replaced chunk do not get any resends.
+                // They request the data again after the next hash request. The connections of
+                // the other shards drop the chunk when they use it the next time (see conn_chunk).
+                LOG("No free chunk available. Replacing chunk %u with %d references", result->info.hash, result->ref_count);
+                Connection_List *conns = ctx->conns;
+                for(int32 index = 0; index < conns->max_count; ++index)
+                {
+                    if(conns->chunk[index] == result)
+                    {
+                        conns->chunk[index] = 0;
+                    }
+                }
+                result->ref_count = 0;
+            }
+
+            // NOTE(dgl): the key of the chunk is set right away, so the other shards wait for it
+            result->generation++;
+            dgl_atomic_fence();
+            result->type = message.type;
+            result->payload_hash = payload_hash;
+            result->codec = codec;
+            result->info.slice_count = 0;
+            result->info.fec_group_size = ctx->fec_group_size;
+
+            // NOTE(dgl): if all cache entries are in use, the chunk is prepared uncompressed
+            if(codec != Net_Codec_None)
+            {
+                compressed = compress_cache_acquire(ctx->compress_cache, payload_hash, codec, message.payload_size, &compress);
+            }
+        }
+        chunk_store_unlock(store);
+
+        if(!result) { dgl_atomic_pause(); }
+    }
+
+    if(prepare)
+    {
+        if(compress) { net_compress_payload(ctx->compress_cache, compressed, message); }
+
+        // NOTE(dgl): the chunk hash identifies the bytes on the wire. Compressed chunks
+        // use the hash of the compressed payload, so clients never mix slices of both.
+        uint8 *payload = message.payload;
+        usize payload_size = message.payload_size;
+        uint32 chunk_hash = payload_hash;
+        if(compressed && compressed->size > 0)
+        {
+            payload = compressed->data;
+            payload_size = compressed->size;
+            chunk_hash = compressed->compressed_hash;
+        }
+        else
+        {
+            codec = Net_Codec_None;
+        }
+
+        usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+        uint32 slice_count = cast(uint32)((cast(real32)(payload_size) / cast(real32)(slice_space)) + 1.0f);
+
+        assert(slice_count <= NET_MAX_SLICE_COUNT, "Payload too large. Cannot address all slices");
+        assert(slice_count <= cast(uint32)result->slice_capacity, "Payload too large. Not enough slices available");
+
+        result->info.hash = chunk_hash;
+        result->info.last_slice_size = dgl_safe_size_to_uint32(payload_size % slice_space);
+        result->info.codec = codec;
+        result->info.raw_size = dgl_safe_size_to_uint32(message.payload_size);
+        assert(ctx->fec_group_size == 0 ||
+               (ctx->fec_group_size >= NET_FEC_MIN_GROUP_SIZE && ctx->fec_group_size <= NET_FEC_MAX_GROUP_SIZE), "Invalid fec group size");
+
+        Packet_Chunk info = result->info;
+        info.slice_count = slice_count;
+        Packet header = default_packet(Packet_Type_Chunk);
+        header.msg_type = message.type;
+        header.chunk = info;
+        packet_buffer_write(&result->header, header);
+
+        Packet packet = default_packet(Packet_Type_Slice);
+        packet.slice.hash = chunk_hash;
+        uint8 *root = payload;
+        for(uint32 slice_index = 0; slice_index < slice_count; ++slice_index)
+        {
+            usize size = (slice_index == slice_count - 1) ? result->info.last_slice_size : slice_space;
+
+            packet.slice.index = slice_index;
+            Packet_Buffer *buffer = result->slices + slice_index;
+            packet_buffer_write(buffer, packet);
+            packet_buffer_append(buffer, root, size);
+            root += size;
+        }
+
+        // NOTE(dgl): the parity of a group is as large as its first slice. Shorter slices
+        // (only the last slice of the chunk) are padded with zeros.
+        uint32 group_size = result->info.fec_group_size;
+        if(group_size > 0)
+        {
+            Packet parity_packet = default_packet(Packet_Type_Parity);
+            parity_packet.parity.hash = chunk_hash;
+            usize header_size = packet_header_size(Packet_Type_Parity);
+            uint32 group_count = (slice_count + group_size - 1) / group_size;
+            assert(group_count <= cast(uint32)result->parity_capacity, "Not enough parity slices available");
+            for(uint32 group_index = 0; group_index < group_count; ++group_index)
+            {
+                uint32 first_slice = group_index*group_size;
+                uint32 end_slice = dgl_min(first_slice + group_size, slice_count);
+
+                parity_packet.parity.index = group_index;
+                Packet_Buffer *buffer = result->parity + group_index;
+                packet_buffer_write(buffer, parity_packet);
+                assert(buffer->offset == header_size, "Parity header must have the size of the slice header");
+
+                uint8 *parity = buffer->data + header_size;
+                for(uint32 slice_index = first_slice; slice_index < end_slice; ++slice_index)
+                {
+                    Packet_Buffer *slice = result->slices + slice_index;
+                    xor_bytes(parity, slice->data + header_size, slice->offset - header_size);
+                }
+                buffer->offset += result->slices[first_slice].offset - header_size;
+            }
+        }
+
+        // NOTE(dgl): the slice count marks the chunk as prepared
+        chunk_store_lock(store);
+        if(compressed) { compress_cache_release(ctx->compress_cache, compressed, compress); }
+        result->info.slice_count = slice_count;
+        dgl_atomic_fence();
+        result->generation++;
+        ctx->prepared_generation = result->generation;
+        chunk_store_unlock(store);
+        LOG_DEBUG("Prepared chunk %u with %u slices (%llu bytes, codec %d)", result->info.hash, slice_count, payload_size, codec);
+    }
+
+    return(result);
+}
+
+// TODO(dgl): refactor this into send message and send message with payload
+internal void
+net_send_message(Net_Context *ctx, Net_Conn_ID index, Net_Message message)
+{
+    if(index >= 0 && ctx->conns->state[index] == Net_Conn_State_Connected)
+    {
+        Packet packet = build_packet(message);
+
+        // NOTE(dgl): the requested chunk is returned again, even if we already received it
+        if(message.type == Net_Message_Data_Req) { ctx->delivered_hash = 0; }
+
+        if(packet.type == Packet_Type_Chunk)
+        {
+            Net_Codec codec = select_codec(message.type, ctx->conns->codecs[index]);
+            Net_Chunk *chunk = net_prepare_chunk(ctx, message, codec);
+            conn_set_chunk(ctx->conns, index, chunk, ctx->prepared_generation);
+            ctx->conns->window_base[index] = 0;
+            ctx->conns->window_next[index] = 0;
+            ctx->conns->congestion[index].acked = 0;
+
+            queue_prepared_datagram(ctx, index, &chunk->header, Packet_Type_Chunk);
+            send_chunk_window(ctx, index, chunk, 0, 0);
+        }
+        else
+        {
+            // NOTE(dgl): messages are resent until the peer acks them
+            Connection_List *conns = ctx->conns;
+            packet.message.seq = reliable_next_seq(conns->reliable + index);
+            Packet_Buffer *buffer = packet_queue(ctx, index, packet, Net_Outbound_Flag_Reliable);
+            Net_Packet_Ring *ring = conns->outbound + index;
+            ring->entries[(ring->write - 1) % NET_PACKET_RING_SIZE].message_seq = packet.message.seq;
+
+            if(packet.type == Packet_Type_Payload)
+            {
+                packet_buffer_append(buffer, message.payload, message.payload_size);
+            }
+
+            if(!conn_timer_scheduled(conns, index, Net_Timer_Kind_Message))
+            {
+                conn_timer_schedule(conns, index, Net_Timer_Kind_Message, rtt_timeout(conns->rtt + index));
+            }
+        }
+
+        net_flush_packets(ctx, index);
+    }
+    else
+    {
+        LOG("Client on index %d is not connected. Cannot send message", index);
+    }
+}
+
+internal void
+net_multicast_message(Net_Context *ctx, Net_Message message)
+{
+    Connection_List *conns = ctx->conns;
+    Packet packet = build_packet(message);
+    if(packet.type == Packet_Type_Chunk)
+    {
+        // NOTE(dgl): the chunk is prepared once and the datagrams are fanned out to
+        // all connections. Connections which joined the multicast group receive the datagrams
+        // only once via the group. The send scheduler interleaves the slices of the other connections,
+        // to not let the last connection wait for all the others.
+        // The chunk is compressed if all connections support the codec.
+        uint32 codecs = NET_SUPPORTED_CODECS;
+        for(int32 index = 0; index < conns->max_count; ++index)
+        {
+            if(conns->state[index] == Net_Conn_State_Connected)
+            {
+                codecs &= conns->codecs[index];
             }
         }
-        else
+
+        Net_Chunk *chunk = net_prepare_chunk(ctx, message, select_codec(message.type, codecs));
+        bool32 use_group = ctx->multicast.enabled && ctx->multicast.socket.handle.no_error;
+        bool32 has_group_conns = false;
+        for(int32 index = 0; index < conns->max_count; ++index)
         {
-            // NOTE(dgl): Handle connection handshake packets
-            if(index < 0)
+            if(conns->state[index] == Net_Conn_State_Connected)
             {
-                // NOTE(dgl): handling connection requests
-                if((ctx->is_server && packet.type == Packet_Type_Server_Discovery) ||
-                   (!ctx->is_server && packet.type == Packet_Type_Request))
+                conn_set_chunk(conns, index, chunk, ctx->prepared_generation);
+                if(use_group && conns->group_joined[index])
                 {
-                    uint64 salt = 0;
-                    get_random_bytes(cast(uint8 *)&salt, sizeof(salt));
-                    index = push_connection(conns, address, salt);
-                    LOG_DEBUG("Connection request from %u.%u.%u.%u:%u", address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port);
-                    if(index < 0)
-                    {
-                        LOG("No free connection available");
-                        send_denied_packet(ctx, address);
-                    }
-                    else
-                    {
-                        if(ctx->is_server)
-                        {
-                            Packet resp = default_packet(Packet_Type_Request);
-                            packet_buffer_init(conns, index, resp);
-                        }
-                        else
-                        {
-                            Packet resp = default_packet(Packet_Type_Challenge);
-                            packet_buffer_init(conns, index, resp);
-                            conns->salt[index] ^= packet.salt;
-                        }
-                    }
+                    has_group_conns = true;
                 }
                 else
                 {
-                    LOG_DEBUG("Invalid connection request of type %d from from %u.%u.%u.%u:%u", packet.type, address.ip[0], address.ip[1], address.ip[2], address.ip[3], address.port);
-                    send_denied_packet(ctx, address);
+                    queue_prepared_datagram(ctx, index, &chunk->header, Packet_Type_Chunk);
                 }
             }
-            else
+        }
+
+        if(has_group_conns) { send_group_datagram(ctx, chunk, ctx->prepared_generation, &chunk->header); }
+
+        for(int32 index = 0; index < conns->max_count; ++index)
+        {
+            if(conns->state[index] == Net_Conn_State_Connected && conns->chunk[index] == chunk)
             {
-                // NOTE(dgl): connection which are disconnected are ignored.
-                if(conns->state[index] > Net_Conn_State_Disconnected)
-                {
-                    // NOTE(dgl): if the connection is already connected, we simply ignore the packet.
-                    // this also makes sure only not established connections can receive a denied packet.
-                    if(conns->state[index] == Net_Conn_State_Connected) { continue; }
+                conns->window_base[index] = 0;
+                conns->window_next[index] = 0;
+                conns->window_sent_at[index] = ctx->time_ms;
+                conns->congestion[index].acked = 0;
+                conn_timer_schedule(conns, index, Net_Timer_Kind_Retransmit, rtt_timeout(conns->rtt + index));
 
-                    switch(packet.type) {
-                    case Packet_Type_Denied:
-                        {
-                            conns->state[index] = Net_Conn_State_Disconnected;
-                        } break;
-                    case Packet_Type_Challenge:
-                        {
-                            if(ctx->is_server)
-                            {
-                                LOG_DEBUG("Challenge salt %llx, conn salt %llx", packet.salt, conns->salt[index]);
-                                conns->salt[index] ^= packet.salt;
-                                Packet resp = default_packet(Packet_Type_Challenge_Resp);
-                                packet_buffer_init(conns, index, resp);
-                            }
-                        } break;
-                    case Packet_Type_Challenge_Resp:
-                        {
-                            if(!ctx->is_server)
-                            {
-                                if(conns->salt[index] == packet.salt)
-                                {
-                                    conns->state[index] = Net_Conn_State_Connected;
-                                    Net_Message message = {};
-                                    message.type = Net_Message_Hash_Req;
-                                    net_send_message(ctx, index, message);
-                                }
-                                else
-                                {
-                                    LOG_DEBUG("Challenge response salt invalid (packet salt: %llx, conn salt: %llx). Sending denied packet", conns->salt[index], packet.salt);
-                                    send_denied_packet(ctx, address);
-                                }
-                            }
-                        } break;
-                    default:
-                        {
-                            LOG_DEBUG("Invalid packet of type %d. Ignoring...", packet.type);
-                        }
-                    }
-                }
-                else
+                if(!(use_group && conns->group_joined[index]))
                 {
-                    // NOTE(dgl): we send a denied packet to let the peer reset its connection state
-                    LOG_DEBUG("Connection %d is disconnected. Sending denied packet", index);
-                    send_denied_packet(ctx, address);
+                    scheduler_activate(ctx, index);
                 }
             }
         }
-    }
 
-    if(chunk_buffer_updated)
-    {
-        if(chunk_complete(ctx->ack_buffer.data, array_count(ctx->ack_buffer.data), ctx->chunk_info.slice_count))
+        // NOTE(dgl): only the first window is sent to the group, paced by the timer of the group. The following
+        // slices are sent to each connection, when its window moves forward (see send_chunk_window).
+        if(has_group_conns)
         {
-            LOG_DEBUG("All chunk slices received");
-            usize slice_size = get_serialized_packet_size(Packet_Type_Slice);
-            usize payload_size = NET_MTU_SIZE - slice_size;
+            Net_Multicast *multicast = &ctx->multicast;
+            multicast->chunk = chunk;
+            multicast->generation = ctx->prepared_generation;
+            multicast->next = 0;
+            multicast->end = dgl_min(chunk->info.slice_count, NET_WINDOW_SIZE);
+            net_send_group_slices(ctx);
+        }
 
-            message->type = ctx->chunk_type;
-            message->payload_size = (cast(usize)(ctx->chunk_info.slice_count - 1) * payload_size) + ctx->chunk_info.last_slice_size;
-            message->payload = ctx->chunk_buffer;
-            result = index;
+        for(int32 index = 0; index < conns->max_count; ++index)
+        {
+            if(conns->state[index] == Net_Conn_State_Connected && conns->chunk[index] == chunk)
+            {
+                net_flush_packets(ctx, index);
+            }
         }
-        else
+    }
+    else
+    {
+        for(int32 index = 0; index < conns->max_count; ++index)
         {
-            LOG_DEBUG("Sending chunk ack buffer");
-            Packet ack_packet = default_packet(Packet_Type_Ack);
-            ack_packet.ack.hash = ctx->chunk_info.hash;
-            Packet_Buffer *buffer = packet_buffer_init(conns, index, ack_packet);
-            // TODO(dgl): send only the necessary bits...
-            packet_buffer_append(buffer, ctx->ack_buffer.data, (ctx->chunk_info.slice_count / 8) + 1);
-            net_send_packet_buffer(ctx, index);
+            if(conns->state[index] == Net_Conn_State_Connected)
+            {
+                net_send_message(ctx, index, message);
+            }
         }
     }
+}
+
+//
+// NOTE(dgl): Net thread
+//
 
+internal usize
+net_queue_entry_size(usize payload_size)
+{
+    usize result = sizeof(Net_Queue_Entry) + payload_size;
+    result = (result + NET_QUEUE_ALIGNMENT - 1) & ~cast(usize)(NET_QUEUE_ALIGNMENT - 1);
     return(result);
 }
 
-// TODO(dgl): @cleanup find better name, can we get rid of the net_message here?
-internal Packet
-build_packet(Net_Context *ctx, Net_Message message)
+internal void
+net_queue_init(DGL_Mem_Arena *arena, Net_Queue *queue, usize capacity)
 {
-    Packet result = {};
-    switch(message.type)
+    // NOTE(dgl): all entries are aligned, so the skip entry at the end of the ring always fits
+    queue->capacity = (capacity + NET_QUEUE_ALIGNMENT - 1) & ~cast(usize)(NET_QUEUE_ALIGNMENT - 1);
+    queue->data = cast(uint8 *)dgl_mem_arena_alloc_align(arena, queue->capacity, NET_QUEUE_ALIGNMENT);
+    queue->write = 0;
+    queue->read = 0;
+}
+
+// NOTE(dgl): returns false if the queue is full. Only called by the producer.
+internal bool32
+net_queue_push(Net_Queue *queue, Net_Queue_Entry_Kind kind, Net_Conn_ID id, Net_Message message)
+{
+    bool32 result = false;
+    usize size = net_queue_entry_size(message.payload_size);
+    usize write = queue->write;
+    usize read = dgl_atomic_load_usize(&queue->read);
+
+    usize offset = write % queue->capacity;
+    usize skip = 0;
+    if(offset + size > queue->capacity)
     {
-        case Net_Message_Hash_Req:
-        case Net_Message_Data_Req:
-        {
-            result = default_packet(Packet_Type_Empty);
-        } break;
-        case Net_Message_Hash_Res:
-        case Net_Message_Data_Res:
+        skip = queue->capacity - offset;
+    }
+
+    if(write + skip + size - read <= queue->capacity)
+    {
+        if(skip > 0)
         {
-            assert(message.payload, "Message with this type must have a payload");
-            usize max_payload_size = NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Payload);
-            if(message.payload_size > max_payload_size)
-            {
-                uint32 payload_hash = HASH_OFFSET_BASIS;
-                hash(&payload_hash, message.payload, message.payload_size);
+            Net_Queue_Entry *skip_entry = cast(Net_Queue_Entry *)(queue->data + offset);
+            skip_entry->size = skip;
+            skip_entry->kind = Net_Queue_Entry_Skip;
+            offset = 0;
+        }
 
-                assert(message.payload_size <= ctx->chunk_buffer_size, "Payload larger than max file");
-                if(payload_hash != ctx->chunk_info.hash)
-                {
-                    LOG_DEBUG("Copying new payload into chunk buffer");
-                    dgl_memcpy(ctx->chunk_buffer, message.payload, message.payload_size);
-                    ctx->chunk_info.hash = payload_hash;
-                }
+        Net_Queue_Entry *entry = cast(Net_Queue_Entry *)(queue->data + offset);
+        entry->size = size;
+        entry->kind = kind;
+        entry->id = id;
+        entry->message = message;
+        entry->message.payload = 0;
+        if(message.payload_size > 0)
+        {
+            entry->message.payload = cast(uint8 *)(entry + 1);
+            dgl_memcpy(entry->message.payload, message.payload, message.payload_size);
+        }
 
-                usize slice_space = NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Slice);
-                uint32 slice_count = cast(uint32)((cast(real32)(message.payload_size) / cast(real32)(slice_space)) + 1.0f);
-                ctx->chunk_info.slice_count = slice_count;
-                ctx->chunk_info.last_slice_size = dgl_safe_size_to_uint32(message.payload_size % slice_space);
+        dgl_atomic_store_usize(&queue->write, write + skip + size);
+        result = true;
+    }
 
-                usize ack_bit_count = (NET_MTU_SIZE - get_serialized_packet_size(Packet_Type_Ack))*8;
-                assert(slice_count <= ack_bit_count*8, "Payload too large. Not enough ack bits available");
+    return(result);
+}
 
-                result = default_packet(Packet_Type_Chunk);
-                result.chunk.hash = ctx->chunk_info.hash;
-                result.chunk.last_slice_size = ctx->chunk_info.last_slice_size;
-                result.chunk.slice_count = ctx->chunk_info.slice_count;
-            }
-            else
-            {
-                result = default_packet(Packet_Type_Payload);
-            }
-        } break;
-        default:
+// NOTE(dgl): returns the next entry or 0 if the queue is empty. The entry stays valid until it is
+// popped. Only called by the consumer.
+internal Net_Queue_Entry *
+net_queue_peek(Net_Queue *queue)
+{
+    Net_Queue_Entry *result = 0;
+    usize write = dgl_atomic_load_usize(&queue->write);
+    while(!result && queue->read != write)
+    {
+        Net_Queue_Entry *entry = cast(Net_Queue_Entry *)(queue->data + (queue->read % queue->capacity));
+        if(entry->kind == Net_Queue_Entry_Skip)
         {
-            result = default_packet(Packet_Type_Empty);
-        } break;
+            dgl_atomic_store_usize(&queue->read, queue->read + entry->size);
+        }
+        else
+        {
+            result = entry;
+        }
     }
 
-    result.msg_type = message.type;
+    return(result);
+}
+
+internal void
+net_queue_pop(Net_Queue *queue, Net_Queue_Entry *entry)
+{
+    assert(entry == cast(Net_Queue_Entry *)(queue->data + (queue->read % queue->capacity)), "Only the first entry can be popped");
+    dgl_atomic_store_usize(&queue->read, queue->read + entry->size);
+}
+
+internal Net_Thread *
+net_thread_init(DGL_Mem_Arena *arena, Net_Context *ctx, usize command_queue_size, usize event_queue_size)
+{
+    Net_Thread *result = dgl_mem_arena_push_struct(arena, Net_Thread);
+    result->ctx = ctx;
+    net_queue_init(arena, &result->commands, command_queue_size);
+    net_queue_init(arena, &result->events, event_queue_size);
+
+    usize scratch_size = kilobytes(64);
+    dgl_mem_arena_init(&result->arena, dgl_mem_arena_push_array(arena, uint8, scratch_size), scratch_size);
 
     return(result);
 }
 
-// TODO(dgl): refactor this into send message and send message with payload
+// NOTE(dgl): sends the messages of the lib, receives the datagrams and processes the timers.
+// Called by the net thread or by the lib once per frame, if the thread is not running.
 internal void
-net_send_message(Net_Context *ctx, Net_Conn_ID index, Net_Message message)
+net_thread_step(Net_Thread *thread)
 {
-    if(index >= 0 && ctx->conns->state[index] == Net_Conn_State_Connected)
+    Net_Context *ctx = thread->ctx;
+    if(ctx->socket.handle.no_error == false)
     {
-        Packet packet = build_packet(ctx, message);
-        Packet_Buffer *buffer = packet_buffer_init(ctx->conns, index, packet);
+        net_open_socket(ctx);
+    }
 
-        if(packet.type == Packet_Type_Payload)
+    Net_Queue_Entry *command = 0;
+    while((command = net_queue_peek(&thread->commands)) != 0)
+    {
+        switch(command->kind)
         {
-            packet_buffer_append(buffer, message.payload, message.payload_size);
+            case Net_Queue_Entry_Send:
+            {
+                net_send_message(ctx, command->id, command->message);
+            } break;
+            case Net_Queue_Entry_Multicast:
+            {
+                net_multicast_message(ctx, command->message);
+            } break;
+            case Net_Queue_Entry_Beacon:
+            {
+                net_set_beacon(ctx, command->message.payload_hash);
+            } break;
+            default:
+            {
+                assert(false, "Invalid command");
+            }
         }
+        net_queue_pop(&thread->commands, command);
+    }
 
-        net_send_packet_buffer(ctx, index);
+    real64 now = platform.get_time_in_ms();
+    if(!ctx->is_server && now >= thread->discovery_at)
+    {
+        thread->discovery_at = now + NET_DISCOVERY_INTERVAL_MS;
+        net_request_server_connection(ctx);
+    }
 
-        if(packet.type == Packet_Type_Chunk)
+    if(thread->has_pending &&
+       net_queue_push(&thread->events, Net_Queue_Entry_Received, thread->pending_id, thread->pending))
+    {
+        thread->has_pending = false;
+    }
+
+    if(!thread->has_pending)
+    {
+        Net_Message message = {};
+        Net_Conn_ID id = 0;
+        while((id = net_recv_message(&thread->arena, ctx, &message)) >= 0)
         {
-            send_chunk_buffer(ctx, index, 0, 0);
+            if(net_queue_entry_size(message.payload_size) > thread->events.capacity)
+            {
+                LOG("Message (%zu bytes) is larger than the event queue. Dropping message", message.payload_size);
+            }
+            else if(!net_queue_push(&thread->events, Net_Queue_Entry_Received, id, message))
+            {
+                thread->has_pending = true;
+                thread->pending_id = id;
+                thread->pending = message;
+                break;
+            }
         }
     }
-    else
+
+    net_process_timers(ctx);
+    dgl_mem_arena_free_all(&thread->arena);
+}
+
+internal ZHC_THREAD_PROC(net_thread_run)
+{
+    Net_Thread *thread = cast(Net_Thread *)data;
+    Net_Context *ctx = thread->ctx;
+    for(;;)
     {
-        LOG("Client on index %d is not connected. Cannot send message", index);
+        net_thread_step(thread);
+
+        // NOTE(dgl): the thread wakes up on the next datagram or timer tick. While a message is
+        // pending, we do not receive and only wait for the lib to pop the events.
+        if(thread->has_pending)
+        {
+            platform.wait_for_data(0, 0, NET_TIMER_TICK_MS);
+        }
+        else
+        {
+            platform.wait_for_data(&ctx->socket, &ctx->multicast.socket, NET_TIMER_TICK_MS);
+        }
     }
 }
 
+// NOTE(dgl): The net context must not be used by the lib after starting the thread.
 internal void
-net_multicast_message(Net_Context *ctx, Net_Message message)
+net_thread_start(Net_Thread *thread)
 {
-    Connection_List *conns = ctx->conns;
-    for(int32 index = 0; index < conns->max_count; ++index)
+    if(platform.start_thread && platform.wait_for_data)
     {
-        if(conns->state[index] == Net_Conn_State_Connected)
-        {
-            net_send_message(ctx, index, message);
-        }
+        thread->running = platform.start_thread(net_thread_run, thread, "zhc_net");
+    }
+
+    if(!thread->running)
+    {
+        LOG("Net thread is not running. The net context is updated once per frame");
+    }
+}
+
+internal bool32
+net_thread_send_message(Net_Thread *thread, Net_Conn_ID index, Net_Message message)
+{
+    bool32 result = net_queue_push(&thread->commands, Net_Queue_Entry_Send, index, message);
+    if(!result)
+    {
+        LOG("Command queue is full. Dropping message %d to connection %d", message.type, index);
+    }
+
+    return(result);
+}
+
+internal bool32
+net_thread_multicast_message(Net_Thread *thread, Net_Message message)
+{
+    bool32 result = net_queue_push(&thread->commands, Net_Queue_Entry_Multicast, -1, message);
+    if(!result)
+    {
+        LOG("Command queue is full. Dropping multicast message %d", message.type);
     }
+
+    return(result);
 }
 
+internal bool32
+net_thread_set_beacon(Net_Thread *thread, uint32 hash)
+{
+    Net_Message message = {};
+    message.type = Net_Message_Beacon;
+    message.payload_hash = hash;
+    bool32 result = net_queue_push(&thread->commands, Net_Queue_Entry_Beacon, -1, message);
+    if(!result)
+    {
+        LOG("Command queue is full. Dropping beacon %u", hash);
+    }
+
+    return(result);
+}
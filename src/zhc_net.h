@@ -22,8 +22,53 @@ struct Bitstream
 //
 
 #define NET_MTU_SIZE 1200
-#define NET_MAX_CLIENTS 128
-#define NET_CONN_TIMEOUT 10000.0f
+// NOTE(dgl): the server capacity is set at runtime (see net_init_server)
+#define NET_DEFAULT_MAX_CLIENTS 128
+#define NET_CONN_TIMEOUT 10000.0
+// NOTE(dgl): handshake packets, acks and slices are resent if the peer does not reply within
+// the retransmission timeout (RTO). The RTO is estimated from the round trip time of the
+// connection and doubles with each resend without reply, up to NET_MAX_RTO_BACKOFF times.
+#define NET_INITIAL_RTO_MS 500.0f
+#define NET_MIN_RTO_MS 30.0f
+#define NET_MAX_RTO_MS 8000.0f
+#define NET_MAX_RTO_BACKOFF 6
+// NOTE(dgl): The congestion window limits the slices in flight per connection. It grows with the
+// acks of the peer as long as the queuing delay is below the LEDBAT target (RFC 6817) and is
+// halved on losses caused by a queue of more than NET_CONGESTION_BACKLOG slices. The pacing
+// spreads the window over the round trip instead of sending it in one burst, which would
+// overflow the queues of the access points.
+#define NET_INITIAL_CWND 16.0f
+#define NET_MIN_CWND 2.0f
+#define NET_LEDBAT_TARGET_MS 25.0f
+#define NET_LEDBAT_GAIN 4.0f
+#define NET_CONGESTION_BACKLOG 3.0f
+// NOTE(dgl): the queuing delay is the minimum of the last samples to filter out the jitter
+#define NET_RTT_RECENT_COUNT 16
+// NOTE(dgl): the pacing rate is a bit faster than cwnd/srtt, so the window can still grow.
+#define NET_PACING_GAIN 1.25f
+#define NET_PACING_MIN_BURST 4.0f
+// NOTE(dgl): The new slices of all connections are sent by a deficit round robin scheduler. Each
+// round a connection may send NET_SEND_QUANTUM bytes. All connections share the byte budget
+// per timer tick. Control packets are sent immediately and use up the budget first.
+#define NET_SEND_QUANTUM (4*NET_MTU_SIZE)
+#define NET_SEND_BUDGET_PER_TICK kilobytes(64)
+// NOTE(dgl): number of slices protected by one parity slice (0 disables forward error correction).
+// One lost slice per group can be rebuilt by the client without a resend.
+#define NET_FEC_GROUP_SIZE 8
+#define NET_FEC_MIN_GROUP_SIZE 2
+#define NET_FEC_MAX_GROUP_SIZE 64
+// NOTE(dgl): the server keeps at most NET_WINDOW_SIZE slices of a chunk in flight per connection.
+// The window moves forward with the acks of the peer. The chunk size is only limited by
+// the number of slices we can address (and the memory of the chunk store).
+#define NET_WINDOW_SIZE 512
+#define NET_MAX_SLICE_COUNT 0xFFFF
+
+// NOTE(dgl): The client delays the ack of a chunk until NET_ACK_SLICE_COUNT new slices arrived or
+// NET_ACK_DELAY_MS passed. A gap in the received slices, a duplicate slice and the last slice
+// are acked right away. The ack lists at most NET_ACK_MAX_RANGES ranges of missing slices.
+#define NET_ACK_SLICE_COUNT 8
+#define NET_ACK_DELAY_MS 10.0
+#define NET_ACK_MAX_RANGES 16
 typedef int32 Net_Conn_ID;
 
 enum Net_Conn_State
@@ -39,17 +84,188 @@ struct Packet_Buffer
     uint8 data[NET_MTU_SIZE];
 };
 
+struct Net_Chunk;
+struct Net_Chunk_Store;
+
+// NOTE(dgl): Each connection queues its outbound datagrams in a ring. Control packets are written
+// into a buffer of the packet pool, which is shared by all connections. Prepared datagrams of the
+// chunk store are only referenced and not copied. The salt of prepared datagrams is patched when
+// they are sent. Must be a power of two.
+#define NET_PACKET_RING_SIZE 32
+
+enum Net_Outbound_Flags
+{
+    Net_Outbound_Flag_Pooled = (1 << 0), /* the buffer is released to the packet pool */
+    // NOTE(dgl): kept entries stay in the ring after sending, until a newer entry with the
+    // same flags is queued. Handshake entries are dropped when the connection is established.
+    Net_Outbound_Flag_Keep = (1 << 1),
+    Net_Outbound_Flag_Handshake = (1 << 2),
+    // NOTE(dgl): reliable messages stay in the ring until the peer acked them (see Net_Reliable)
+    Net_Outbound_Flag_Reliable = (1 << 3),
+};
+
+struct Net_Outbound
+{
+    uint32 seq;
+    uint8 type; /* Packet_Type */
+    uint8 flags;
+    uint16 send_count;
+    uint16 message_seq; /* NOTE(dgl): sequence of a reliable message */
+    real64 sent_at; /* NOTE(dgl): context time in ms when the datagram was sent the last time */
+    Packet_Buffer *buffer;
+};
+
+struct Net_Packet_Ring
+{
+    uint32 next_seq;
+    // NOTE(dgl): the indices only increase. Entries from read to unsent have been
+    // sent at least once, entries from unsent to write have not been sent yet.
+    uint32 read;
+    uint32 unsent;
+    uint32 write;
+    Net_Outbound entries[NET_PACKET_RING_SIZE];
+};
+
+// NOTE(dgl): Payload codecs. The client announces the codecs it supports in the
+// challenge packet. The server only compresses data responses for peers supporting the codec.
+enum Net_Codec
+{
+    Net_Codec_None,
+    Net_Codec_LZ,
+    Net_Codec_Count
+};
+
+#define NET_CODEC_FLAG(codec) (1 << (codec))
+#define NET_SUPPORTED_CODECS (NET_CODEC_FLAG(Net_Codec_LZ))
+
+// NOTE(dgl): Hierarchical timer wheel. Level 0 has one slot per tick, each slot of the
+// next level covers all slots of the previous level. Timers of a higher level are moved down
+// (cascaded) when the lower level wraps around. Each connection has one timer per kind.
+// The timers are intrusive lists, so scheduling and cancelling a timer is O(1).
+#define NET_TIMER_TICK_MS 10.0
+#define NET_TIMER_WHEEL_BITS 6
+#define NET_TIMER_WHEEL_SLOTS (1 << NET_TIMER_WHEEL_BITS)
+#define NET_TIMER_WHEEL_LEVELS 4
+// NOTE(dgl): the last list contains the expired timers
+#define NET_TIMER_EXPIRED_LIST (NET_TIMER_WHEEL_LEVELS*NET_TIMER_WHEEL_SLOTS)
+
+enum Net_Timer_Kind
+{
+    Net_Timer_Kind_Idle, /* NOTE(dgl): disconnects the connection if the peer is silent */
+    Net_Timer_Kind_Handshake, /* NOTE(dgl): resends the kept handshake packets */
+    Net_Timer_Kind_Retransmit, /* NOTE(dgl): resends the first slice of the window, which was not acked */
+    Net_Timer_Kind_Ack, /* NOTE(dgl): sends the delayed ack or resends the ack of a chunk, which is not complete */
+    Net_Timer_Kind_Pacing, /* NOTE(dgl): sends the next slices, when the pacing allows it */
+    Net_Timer_Kind_Message, /* NOTE(dgl): resends the reliable messages, which were not acked */
+    Net_Timer_Kind_Message_Ack, /* NOTE(dgl): acks the received messages, if we did not send a message since */
+    Net_Timer_Kind_Count
+};
+
+struct Net_Timer
+{
+    int32 next;
+    int32 prev;
+    int32 list; /* NOTE(dgl): -1 if the timer is not scheduled */
+    uint64 expires; /* NOTE(dgl): in ticks */
+};
+
+struct Net_Timer_Wheel
+{
+    uint64 tick; /* NOTE(dgl): next tick to process */
+    int32 count; /* NOTE(dgl): max connections * timer kinds and the timer of the group */
+    Net_Timer *timers;
+    int32 heads[NET_TIMER_EXPIRED_LIST + 1];
+};
+
+// NOTE(dgl): fifo of the connections which have new slices to send. A connection is
+// in the fifo at most once.
+struct Net_Send_Scheduler
+{
+    Net_Conn_ID *active;
+    int32 first;
+    int32 count;
+    int32 capacity;
+    usize budget; /* NOTE(dgl): bytes which can be sent until the next refill */
+    real64 refill_at;
+    bool32 resume; /* NOTE(dgl): the first connection ran out of budget and keeps its deficit */
+};
+
+// NOTE(dgl): Jacobson/Karels estimation of the round trip time (RFC 6298). The samples are
+// measured from the timestamps the peer echoes in the packet header.
+struct Net_Rtt
+{
+    uint32 sample_count;
+    real32 srtt;
+    real32 rttvar;
+    real32 rto;
+    uint32 backoff;
+    real32 min_rtt; /* NOTE(dgl): the base delay to estimate the queuing delay */
+    real32 recent[NET_RTT_RECENT_COUNT];
+};
+
+struct Net_Congestion
+{
+    real32 cwnd; /* NOTE(dgl): in slices */
+    real32 ssthresh;
+    real32 tokens; /* NOTE(dgl): slices the pacing allows to send */
+    real64 refill_at;
+    uint32 acked; /* NOTE(dgl): slices of the chunk acked by the peer (base and received slices of the window) */
+};
+
+// NOTE(dgl): Reliable messages (payload and empty packets). Every message gets a 16 bit sequence
+// and carries the most recent sequence received from the peer and a bitfield of the 32 sequences
+// before it. Unacked messages stay in the packet ring and are resent after the retransmission timeout.
+// The received sequences drop the duplicates of resent messages. If there is no message to
+// piggyback the acks, an unsequenced noop message is sent after NET_MESSAGE_ACK_DELAY_MS.
+// The sequence 0 is skipped, it marks ack only messages and "nothing received".
+#define NET_MESSAGE_ACK_BITS 32
+#define NET_MESSAGE_ACK_DELAY_MS 20.0
+
+struct Net_Reliable
+{
+    uint16 next_seq;
+    uint16 remote_seq; /* NOTE(dgl): most recent sequence received from the peer (0 = none) */
+    uint32 received; /* NOTE(dgl): bit n is set, if remote_seq - 1 - n was received */
+};
+
+// NOTE(dgl): Connections are found by their address in an open addressing hash table
+// with linear probing. The slots contain the connection index or -1 if the slot is empty.
+// Only connections which are not disconnected are in the table.
+// Disconnected connections are kept in the free list.
 struct Connection_List
 {
     int32 max_count;
     int32 index;
 
-    bool32 *no_timeout;
+    int32 lookup_count; /* power of two */
+    Net_Conn_ID *lookup;
+    int32 free_count;
+    Net_Conn_ID *free_list;
+
     Zhc_Net_Address *address;
     uint64 *salt; /* TODO(dgl): replace with a crypto signature */
     Net_Conn_State *state;
-    uint32 *last_packet_hash;
-    Packet_Buffer *packet_buffer; /* to be able to resend packages. */
+    Net_Reliable *reliable;
+    Net_Packet_Ring *outbound; /* to be able to queue and resend packages. */
+    DGL_Mem_Pool *packet_pool; /* NOTE(dgl): buffers of the queued control packets */
+    Net_Timer_Wheel *timers; /* NOTE(dgl): timers of all connections (see Net_Timer_Kind) */
+    Net_Chunk **chunk; /* NOTE(dgl): prepared chunk the connection is receiving (holds a reference until the peer acked all slices) */
+    uint32 *chunk_generation; /* NOTE(dgl): generation of the chunk when it was set (see Net_Chunk) */
+    Net_Chunk_Store *chunk_store; /* NOTE(dgl): 0 on clients */
+    bool32 *group_joined; /* NOTE(dgl): the peer confirmed that it receives the multicast group */
+    uint32 *codecs; /* NOTE(dgl): flags of the codecs supported by the peer (see Net_Codec) */
+    uint32 *window_base; /* NOTE(dgl): first slice of the chunk not received by the peer */
+    uint32 *window_next; /* NOTE(dgl): next slice of the chunk which has never been sent */
+    real64 *window_sent_at; /* NOTE(dgl): time the last new slice was sent */
+    real64 *window_repair_at; /* NOTE(dgl): time of the last resend of missing slices */
+    uint32 *repair_base; /* NOTE(dgl): first slice of the repair mask */
+    uint8 *repair_mask; /* NOTE(dgl): NET_REPAIR_MASK_SIZE bytes per connection, the collected repairs (see Net_Repair) */
+    bool32 *repair_pending; /* NOTE(dgl): the connection is in the list of the collected repairs */
+    Net_Rtt *rtt;
+    Net_Congestion *congestion;
+    bool32 *send_active; /* NOTE(dgl): the connection is in the fifo of the send scheduler */
+    int32 *send_deficit; /* NOTE(dgl): bytes the connection may send in this round */
+    uint32 *peer_timestamp; /* NOTE(dgl): last timestamp of the peer, echoed in the next datagram (0 = none) */
 };
 
 enum Net_Message_Type
@@ -60,6 +276,8 @@ enum Net_Message_Type
     Net_Message_Hash_Res,
     Net_Message_Data_Req,
     Net_Message_Data_Res,
+    Net_Message_Delta_Res,
+    Net_Message_Beacon,
     Net_Message_Max
 };
 
@@ -80,16 +298,20 @@ enum Packet_Type
     Packet_Type_Payload,
     Packet_Type_Chunk,
     Packet_Type_Slice,
+    Packet_Type_Parity,
     Packet_Type_Ack,
+    Packet_Type_Group,
+    Packet_Type_Beacon,
     Packet_Type_Max
 };
 
 struct Packet_Ack
 {
     uint32 hash;
-    // NOTE(dgl): we use a bitfield of NET_MTU_SIZE to indicate which
-    // message ids have been received. This bitfield is stored in the message
-    // payload pointer. Received slices are 1, not received slices are 0.
+    // NOTE(dgl): all slices before the base have been received. The payload contains the
+    // ranges of the missing slices in the window of up to NET_WINDOW_SIZE slices after
+    // the base (see ack_ranges_encode). The other slices of the window have been received.
+    uint32 base;
 };
 
 struct Packet_Chunk
@@ -100,6 +322,11 @@ struct Packet_Chunk
     // is sent in the first chunk packet.
     uint32 last_slice_size;
     uint32 slice_count;
+    uint32 fec_group_size; /* 0 if the chunk has no parity slices */
+    // NOTE(dgl): the slices contain the compressed payload. The payload
+    // is raw_size bytes large after decompressing it.
+    Net_Codec codec;
+    uint32 raw_size;
 };
 
 struct Packet_Slice
@@ -108,11 +335,70 @@ struct Packet_Slice
     uint32 index;
 };
 
+// NOTE(dgl): The parity slice contains the xor of all slices in the fec group index.
+// Slices shorter than the first slice of the group are padded with zeros. The header has the
+// same size as the slice header, so the payload space is the same.
+struct Packet_Parity
+{
+    uint32 hash;
+    uint32 index;
+};
+
+struct Packet_Message
+{
+    uint16 seq; /* NOTE(dgl): 0 for ack only messages */
+    uint16 ack;
+    uint32 ack_bits;
+};
+
+struct Packet_Challenge
+{
+    uint32 codecs;
+};
+
+// NOTE(dgl): The server announces the multicast group to connected clients. Clients
+// reply with the same packet after joining the group. Group datagrams are signed with
+// the group salt instead of the connection salt.
+struct Packet_Group
+{
+    uint32 host;
+    uint16 port;
+    uint64 salt;
+};
+
+// NOTE(dgl): The server announces the hash of its content in a beacon, periodically and right
+// after the content changed. Clients only request the content if the hash differs, instead of
+// polling the hash. The sequence increases with every beacon, older beacons are dropped.
+struct Packet_Beacon
+{
+    uint32 hash;
+    uint32 seq;
+};
+
+// NOTE(dgl): the first byte of each datagram. The header layout changed with 0.3.0, the
+// datagrams of older versions (0x1234) are dropped.
+#define NET_PROTOCOL_ID 0x5A
+#define NET_PROTOCOL_ID_BITS 8
+// NOTE(dgl): the widths of the type and the message type in the header. Adding a type
+// beyond these widths changes the header layout (and requires a new protocol id).
+#define NET_PACKET_TYPE_BITS 4
+#define NET_MESSAGE_TYPE_BITS 3
+static_assert(Packet_Type_Max <= (1 << NET_PACKET_TYPE_BITS), "Packet types do not fit into NET_PACKET_TYPE_BITS");
+static_assert(Net_Message_Max <= (1 << NET_MESSAGE_TYPE_BITS), "Message types do not fit into NET_MESSAGE_TYPE_BITS");
+
 struct Packet
 {
     int32 id;
+    // NOTE(dgl): only handshake packets (see _Packet_Type_Connected) carry the version and the salt.
+    // The connected packets carry the session instead, which is derived from the salt (see net_session).
+    // On writing the session is always derived from the salt.
     uint32 version; /* 16 bit major, 8 bit minor, 8 bit patch */
     uint64 salt;
+    uint32 session;
+    // NOTE(dgl): millisecond clock of the sender and the last timestamp it received from the peer
+    // (0 = none). Like the salt, they are patched right before sending (see net_flush_packets).
+    uint32 timestamp;
+    uint32 echo;
     // TODO(dgl): put CRC32 in here?
 
     Packet_Type type;
@@ -123,7 +409,12 @@ struct Packet
         // NOTE(dgl): should not be used by
         Packet_Chunk chunk;
         Packet_Slice slice;
+        Packet_Parity parity;
         Packet_Ack ack;
+        Packet_Group group;
+        Packet_Beacon beacon;
+        Packet_Challenge challenge;
+        Packet_Message message;
     };
 };
 
@@ -131,61 +422,339 @@ struct Net_Message
 {
     Net_Message_Type type;
 
+    // NOTE(dgl): optional fnv-1a hash of the payload. If the caller already knows
+    // the hash (e.g. the file hash), we do not have to hash the payload again.
+    // If it is 0 the hash is calculated when preparing the chunk.
+    uint32 payload_hash;
     usize payload_size;
     uint8 *payload;
 };
 
+//
+// NOTE(dgl): Outbound chunk store
+//
+
+// NOTE(dgl): A prepared chunk contains the serialized chunk packet and all slice datagrams
+// of a payload. It is hashed and sliced only once and shared by all connections receiving it.
+// Only the session differs between the connections. It is patched in place right before sending.
+// NOTE(dgl): The server shards share one chunk store (see net_init_server_shards). The lock of the store
+// is only held to find or reserve a chunk and to publish it. The chunk is compressed and sliced without
+// the lock, the datagrams are read without it. The generation is odd while a chunk is replaced.
+// A shard which needs the payload of a chunk in preparation waits until it is published.
+// A connection only uses its chunk, if the generation did not change since it was set.
+// The shards copy the datagrams before patching them (see send_batch_stage).
+// NOTE(dgl): The chunks are keyed by the payload hash and are immutable while connections
+// reference them. A connection references its chunk until the peer acked all slices. The store has
+// room for the current file, the next file and a connection still catching up with an older file.
+#define NET_CHUNK_STORE_COUNT 4
+
+struct Net_Chunk
+{
+    int32 ref_count; /* NOTE(dgl): of all shards, only changed under the lock of a shared store */
+    uint32 volatile generation;
+    Net_Message_Type type;
+    uint32 payload_hash; /* NOTE(dgl): hash of the raw payload. info.hash is the hash of the sent bytes */
+    Net_Codec codec; /* NOTE(dgl): the requested codec. info.codec is none, if the payload did not get smaller */
+    Packet_Chunk info;
+
+    Packet_Buffer header;
+    int32 slice_capacity;
+    Packet_Buffer *slices;
+    int32 parity_capacity;
+    Packet_Buffer *parity;
+};
+
+struct Net_Chunk_Store
+{
+    int32 count;
+    Net_Chunk *chunks;
+    bool32 shared;
+    uint32 volatile lock;
+};
+
+// NOTE(dgl): Compressed payloads are cached by the payload hash. Each file is only
+// compressed once, even if the chunk store replaces the prepared chunk. A size of 0 marks
+// payloads which cannot be compressed. Entries which are used to prepare a chunk are not replaced.
+#define NET_COMPRESS_CACHE_COUNT 4
+
+struct Net_Compressed_Payload
+{
+    uint32 hash; /* of the raw payload */
+    uint32 compressed_hash;
+    Net_Codec codec;
+    usize raw_size;
+    usize size;
+    uint64 last_used; /* NOTE(dgl): 0 while the payload is compressed */
+    int32 ref_count; /* NOTE(dgl): chunks prepared from the payload. Only changed under the lock of the store */
+    uint8 *data;
+};
+
+struct Net_Compress_Cache
+{
+    int32 count;
+    uint64 use_counter;
+    usize capacity;
+    Net_Compressed_Payload *payloads;
+};
+
+// NOTE(dgl): Chunks are sent once to the multicast group instead of to each connection.
+// Only connections which confirmed the group receive the chunks this way. Their repairs (resends
+// after an ack) are collected, see Net_Repair.
+// The first window is paced with its own token bucket (see net_send_group_slices). The rate is the pacing
+// rate of the slowest member, at most max_rate slices per ms (0 means no cap).
+#define NET_MULTICAST_MAX_RATE 0.0f
+struct Net_Multicast
+{
+    bool32 enabled;
+    Zhc_Net_Address group;
+    uint64 salt;
+    Zhc_Net_Socket socket;
+
+    real32 max_rate;
+    real32 tokens; /* NOTE(dgl): slices the pacing of the group allows to send */
+    real64 refill_at;
+    Net_Chunk *chunk; /* NOTE(dgl): the chunk of the first window which is sent to the group */
+    uint32 generation;
+    uint32 next; /* NOTE(dgl): the next slice of the first window */
+    uint32 end;
+};
+
+// NOTE(dgl): The repairs of the connections in the multicast group are collected for NET_REPAIR_DELAY_MS
+// and merged per slice (see net_flush_repairs). A slice which is missed by at least NET_REPAIR_GROUP_MIN
+// connections is resent once to the group, otherwise to each of the connections. Connections which did
+// not join the group are repaired right away. The repairs are collected for one chunk at a time.
+#define NET_REPAIR_DELAY_MS NET_TIMER_TICK_MS
+#define NET_REPAIR_GROUP_MIN 2
+#define NET_REPAIR_MASK_SIZE (NET_WINDOW_SIZE / 8)
+
+struct Net_Repair
+{
+    Net_Chunk *chunk; /* NOTE(dgl): 0 if no repairs are collected */
+    uint32 generation; /* NOTE(dgl): generation of the chunk when the first repair was collected */
+    uint32 first; /* NOTE(dgl): range of the collected slices */
+    uint32 end;
+    real64 flush_at;
+    int32 count;
+    Net_Conn_ID *conns; /* NOTE(dgl): connections with collected repairs */
+};
+
+// NOTE(dgl): The beacon is sent once to the multicast group and to each connection which did
+// not join the group. Like the group datagrams, it is not resent. The next beacon replaces it.
+// The server queues the beacon after the content. Clients drop the beacons while they receive a
+// chunk, the content is on the way. A stalled chunk does not hold back the beacons longer than
+// one interval.
+#define NET_BEACON_INTERVAL_MS 1000.0
+
+struct Net_Beacon
+{
+    uint32 hash; /* NOTE(dgl): hash of the content (0 = no content, the server sends no beacon) */
+    uint32 seq;
+    real64 send_at; /* NOTE(dgl): only used by the server */
+};
+
+// NOTE(dgl): Datagrams are moved through the platform in batches (see Zhc_Net_Datagram). A flushed
+// packet ring is sent as one batch and net_recv_message drains the socket one batch at a time.
+#define NET_IO_BATCH_SIZE NET_PACKET_RING_SIZE
+
+struct Net_Send_Batch
+{
+    int32 count;
+    Zhc_Net_Socket *socket; /* the socket of the queued datagrams */
+    Zhc_Net_Datagram datagrams[NET_IO_BATCH_SIZE];
+    Packet_Buffer *staging; /* NOTE(dgl): copies of shared prepared datagrams (only with a shared chunk store) */
+};
+
+// NOTE(dgl): the received datagrams point into the memory of the batch. They are valid until
+// the next batch is received.
+struct Net_Receive_Batch
+{
+    int32 count;
+    int32 next;
+    bool32 from_group;
+    Zhc_Net_Datagram datagrams[NET_IO_BATCH_SIZE];
+};
+
+// NOTE(dgl): counters of the wire traffic of a context. Only the thread owning the context writes them.
+// The datagrams of the multicast group are included.
+struct Net_Stats
+{
+    uint64 datagrams_sent;
+    uint64 bytes_sent;
+    uint64 datagrams_received;
+    uint64 bytes_received;
+    uint64 datagrams_resent; /* NOTE(dgl): handshake packets, acks, messages and slices sent again */
+    uint64 messages_duplicate; /* NOTE(dgl): received reliable messages, which were dropped as duplicates */
+    uint64 repair_bytes_requested; /* NOTE(dgl): bytes of the missing slices, if each connection was repaired on its own */
+    uint64 repair_bytes_sent; /* NOTE(dgl): bytes of the resent slices. The difference was saved by the group repairs */
+};
+
 struct Net_Context
 {
-    // TODO(dgl): dont really like the packet buffer per connection
-    // I think it would be better to make a packet stack and then send
-    // all packages in the stack. Afterwards reset the stack. Or use a ring
-    // buffer. This is probably better, because then we can have longer living
-    // packets, like the ack packet.
-
-    // NOTE(dgl): We currently support to send one chunk at a time
-    // This creates the issue that if we change the active file while
-    // sending a chunk, and another client requests the data, it gets the
-    // old chunk. This is temporary for now. Later we will support a double
-    // buffer. One for the old and one for the new data, to prevent this issue
-    // This double buffer is only necessary on the server. Clients ony receive
-    // one chunk at a time.
-    // Another option would be to have a chunk reset package and resend the whole
-    // data if a new chunk will be sent. This would be more memory efficient.
-    // However, if we do this, we lose our spamming packets incase they are lost
-    // ability during the connecting state. IMO this should not be a big issue.
-    // But we have to test this.
+    // NOTE(dgl): the outbound datagrams are queued in a ring per connection (see Net_Packet_Ring).
+    // The buffers of the control packets are allocated from the packet pool.
+    DGL_Mem_Pool packet_pool;
+
+    // NOTE(dgl): monotonic clock of the platform. It is updated when receiving messages and
+    // processing the timers. The timers of the connections are driven by this clock.
+    real64 time_ms;
+    Net_Timer_Wheel timer_wheel;
+
+    // NOTE(dgl): 0 disables the budget
+    usize send_budget_per_tick;
+    Net_Send_Scheduler scheduler;
+
+    // NOTE(dgl): Outgoing chunks are prepared in the chunk store. Each connection references the
+    // chunk it receives and keeps its own window (see Connection_List), so the connections can
+    // receive different files at the same time. Changing the active file does not touch the chunks
+    // which are still sent.
     // NOTE(dgl): It is not possible to send and receive a chunk at the same time.
     // In this application only the server sends chunks to the client!!
+    // The chunk_info and chunk_buffer are only used to receive a chunk. Clients only receive
+    // one chunk at a time, a new chunk replaces the one they are receiving.
+    Net_Chunk_Store *chunk_store;
+    Net_Compress_Cache *compress_cache;
+    uint32 prepared_generation; /* NOTE(dgl): generation of the chunk returned by net_prepare_chunk */
     Packet_Chunk chunk_info;
     Net_Message_Type chunk_type;
+    uint32 delivered_hash; /* NOTE(dgl): the chunk was returned as message. Resent slices only trigger an ack */
+    real64 chunk_received_at; /* NOTE(dgl): the chunk packet or a new slice was received */
     usize chunk_buffer_size;
     uint8 *chunk_buffer;
 
-    // NOTE(dgl): dont like this in here. Should have this in an arena. @cleanup
-    Packet_Buffer ack_buffer;
+    // NOTE(dgl): compressed chunks are received into the compressed buffer and
+    // decompressed into the chunk buffer when all slices are received.
+    usize compressed_buffer_size;
+    uint8 *compressed_buffer;
+
+    // NOTE(dgl): the benchmarks disable the congestion control to compare it to sending
+    // the whole window at once.
+    bool32 congestion_control;
+
+    // NOTE(dgl): The server adds parity slices to the chunks it prepares. Clients store
+    // the received parity payloads to rebuild lost slices of the current chunk.
+    uint32 fec_group_size;
+    usize parity_buffer_size;
+    uint8 *parity_buffer;
+    usize parity_mask_size;
+    uint8 *parity_mask;
+
+    // NOTE(dgl): one bit per slice of the received chunk. The ack packet only
+    // contains the window after the first missing slice.
+    usize ack_mask_size;
+    uint8 *ack_mask;
+    uint32 received_count; /* NOTE(dgl): slices set in the ack mask */
+    uint32 received_base; /* NOTE(dgl): first slice which has not been received */
+    uint32 received_end; /* NOTE(dgl): slice after the last received slice */
+    uint32 ack_pending; /* NOTE(dgl): slices received since the last ack (the delayed ack is scheduled) */
+    bool32 ack_now; /* NOTE(dgl): a gap or a duplicate was received, the ack is not delayed */
+
+    // NOTE(dgl): The receive buffers of the client are allocated from the receive arena.
+    // They grow with the chunks the client receives, but never shrink.
+    DGL_Mem_Arena receive_arena;
 
     // NOTE(dgl): is there a better way?
     // we use this to send the correct packet types
     // based on connection states
     bool32 is_server;
 
-    real32 message_timeout;
+    // NOTE(dgl): the server can be split into shards, which share the port (see net_init_server_shards).
+    // A shard only replies to the discoveries of its peers.
+    int32 shard_index;
+    int32 shard_count;
+
     Zhc_Net_Socket socket;
+    Net_Multicast multicast;
+    Net_Repair repair; /* NOTE(dgl): only used by the server */
+    Net_Beacon beacon; /* NOTE(dgl): the server sends it, the client keeps the last received beacon */
+    Net_Send_Batch send_batch;
+    Net_Receive_Batch receive_batch;
+    Net_Stats stats;
 
     Connection_List *conns;
 };
 
 
-internal Net_Context * net_init_server(DGL_Mem_Arena *arena);
-internal Net_Context * net_init_client(DGL_Mem_Arena *arena);
+//
+// NOTE(dgl): Net thread
+//
+
+// NOTE(dgl): The net thread owns the net context (sockets, timers and resends). The lib talks to it
+// through two single producer single consumer queues. The lib pushes the messages to send into the
+// command queue and the net thread pushes the received messages into the event queue. The entries
+// are written into a byte ring and the payload is copied behind the entry. An entry which does
+// not fit before the end of the ring is written at the start, the rest of the ring is skipped.
+#define NET_QUEUE_ALIGNMENT 16
+// NOTE(dgl): the clients send discovery packets in this interval, until they are connected
+#define NET_DISCOVERY_INTERVAL_MS 20.0
+
+enum Net_Queue_Entry_Kind
+{
+    Net_Queue_Entry_Skip, /* NOTE(dgl): the rest of the ring is not used */
+    Net_Queue_Entry_Send,
+    Net_Queue_Entry_Multicast,
+    Net_Queue_Entry_Beacon, /* NOTE(dgl): the payload hash of the message is the content hash */
+    Net_Queue_Entry_Received,
+};
+
+struct Net_Queue_Entry
+{
+    usize size; /* NOTE(dgl): including the payload and the alignment */
+    Net_Queue_Entry_Kind kind;
+    Net_Conn_ID id;
+    Net_Message message; /* NOTE(dgl): the payload points behind the entry */
+};
+
+// NOTE(dgl): the indices only increase. Only the producer writes the write index and
+// only the consumer writes the read index.
+struct Net_Queue
+{
+    usize capacity;
+    uint8 *data;
+    usize volatile write;
+    usize volatile read;
+};
+
+struct Net_Thread
+{
+    Net_Context *ctx;
+    Net_Queue commands; /* NOTE(dgl): lib -> net thread */
+    Net_Queue events; /* NOTE(dgl): net thread -> lib */
+
+    // NOTE(dgl): the message could not be pushed, because the event queue is full. No other
+    // datagrams are received until it is pushed, so the payload stays valid.
+    bool32 has_pending;
+    Net_Conn_ID pending_id;
+    Net_Message pending;
+
+    real64 discovery_at;
+    DGL_Mem_Arena arena; /* NOTE(dgl): scratch memory of the net thread */
+    bool32 running; /* NOTE(dgl): the lib steps the net context each frame, if the thread is not running */
+    Net_Thread *next_shard; /* NOTE(dgl): the thread of the next server shard (see net_init_server_shards) */
+};
+
+internal Net_Context * net_init_server(DGL_Mem_Arena *arena, int32 max_clients);
+internal void net_init_server_shards(DGL_Mem_Arena *arena, int32 max_clients, Net_Context **shards, int32 shard_count);
+internal Net_Context * net_init_client(DGL_Mem_Arena *arena, usize max_payload_size);
 internal void net_open_socket(Net_Context *ctx);
+internal void net_enable_multicast(Net_Context *ctx, Zhc_Net_Address group);
 internal void net_send_message(Net_Context *ctx, Net_Conn_ID index, Net_Message message);
+internal void net_multicast_message(Net_Context *ctx, Net_Message message);
+internal void net_set_beacon(Net_Context *ctx, uint32 hash);
 internal Net_Conn_ID net_recv_message(DGL_Mem_Arena *arena, Net_Context *ctx, Net_Message *message);
-internal void net_send_packet_buffer(Net_Context *ctx, Net_Conn_ID index);
-internal void net_send_pending_packet_buffers(Net_Context *ctx);
+internal void net_flush_packets(Net_Context *ctx, Net_Conn_ID index);
+internal void net_resend_kept_packets(Net_Context *ctx, Net_Conn_ID index);
+internal void net_process_timers(Net_Context *ctx);
 internal void net_request_server_connection(Net_Context *ctx);
 
+internal Net_Thread * net_thread_init(DGL_Mem_Arena *arena, Net_Context *ctx, usize command_queue_size, usize event_queue_size);
+internal void net_thread_start(Net_Thread *thread);
+internal void net_thread_step(Net_Thread *thread);
+internal bool32 net_thread_send_message(Net_Thread *thread, Net_Conn_ID index, Net_Message message);
+internal bool32 net_thread_multicast_message(Net_Thread *thread, Net_Message message);
+internal bool32 net_thread_set_beacon(Net_Thread *thread, uint32 hash);
+internal Net_Queue_Entry * net_queue_peek(Net_Queue *queue);
+internal void net_queue_pop(Net_Queue *queue, Net_Queue_Entry *entry);
+
 
 
 #endif // ZHC_NET_H
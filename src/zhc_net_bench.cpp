@@ -0,0 +1,718 @@
+#include "zhc_lib.h"
+#include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
+#include "zhc_net.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include <sys/mman.h> /* mmap */
+#include <time.h>
+
+// NOTE(dgl): Network benchmarks. The platform socket functions are replaced by counters,
+// to measure what the server puts on the wire without depending on the network.
+// If the bench link is enabled, the datagrams are delivered between a server and a
+// client context with a delay, jitter and random loss, using a virtual clock.
+// The link to the client can have a bottleneck with a drop tail queue, like the access
+// point of the venue.
+
+global struct
+{
+    int32 datagrams;
+    usize bytes;
+    int32 group_datagrams;
+    usize group_bytes;
+} bench_wire;
+
+#define BENCH_LINK_CAPACITY 4096
+
+struct Bench_Datagram
+{
+    real64 deliver_at_ms;
+    Zhc_Net_Address from;
+    usize size;
+    uint8 data[NET_MTU_SIZE];
+};
+
+// NOTE(dgl): the jitter does not reorder datagrams, so each direction is a fifo queue.
+struct Bench_Queue
+{
+    int32 first;
+    int32 count;
+    int32 received;
+    real64 last_deliver_at_ms;
+    Bench_Datagram *datagrams;
+};
+
+global struct
+{
+    bool32 enabled;
+    real64 now_ms;
+    real64 delay_ms;
+    real64 jitter_ms;
+    real32 loss;
+    uint32 random_state;
+
+    // NOTE(dgl): datagrams per ms through the bottleneck (0 is unlimited) and the
+    // number of datagrams waiting in its queue before it drops new ones.
+    real64 rate;
+    int32 queue_limit;
+    real64 busy_until_ms;
+    int32 dropped;
+
+    Bench_Queue to_server;
+    Bench_Queue to_client;
+} bench_link;
+
+internal uint32
+bench_random(uint32 *state)
+{
+    // NOTE(dgl): xorshift32
+    uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return(x);
+}
+
+internal Bench_Queue *
+bench_link_queue(Zhc_Net_Address *address)
+{
+    Bench_Queue *result = (address->port == ZHC_SERVER_PORT) ? &bench_link.to_server : &bench_link.to_client;
+    return(result);
+}
+
+ZHC_SEND_DATA(bench_send_data)
+{
+    if(socket->address.port == ZHC_SERVER_PORT)
+    {
+        bench_wire.datagrams++;
+        bench_wire.bytes += buffer_size;
+    }
+
+    if(bench_link.enabled)
+    {
+        real32 chance = cast(real32)(bench_random(&bench_link.random_state) % 10000) / 10000.0f;
+        Bench_Queue *queue = bench_link_queue(target_address);
+        real64 departure_ms = bench_link.now_ms;
+        if(queue == &bench_link.to_client && bench_link.rate > 0.0)
+        {
+            real64 backlog = dgl_max(bench_link.busy_until_ms - bench_link.now_ms, 0.0)*bench_link.rate;
+            if(backlog >= cast(real64)bench_link.queue_limit)
+            {
+                bench_link.dropped++;
+                return;
+            }
+            departure_ms = dgl_max(bench_link.busy_until_ms, bench_link.now_ms) + 1.0 / bench_link.rate;
+            bench_link.busy_until_ms = departure_ms;
+        }
+
+        if(chance >= bench_link.loss && queue->count < BENCH_LINK_CAPACITY)
+        {
+            real64 jitter = (cast(real64)(bench_random(&bench_link.random_state) % 2001) / 1000.0 - 1.0)*bench_link.jitter_ms;
+            Bench_Datagram *datagram = queue->datagrams + ((queue->first + queue->count++) % BENCH_LINK_CAPACITY);
+            datagram->deliver_at_ms = dgl_max(departure_ms + bench_link.delay_ms + jitter, queue->last_deliver_at_ms);
+            queue->last_deliver_at_ms = datagram->deliver_at_ms;
+            datagram->from = socket->address;
+            datagram->size = buffer_size;
+            dgl_memcpy(datagram->data, buffer, buffer_size);
+        }
+    }
+}
+
+ZHC_RECEIVE_DATA(bench_receive_data)
+{
+    usize result = 0;
+    Bench_Queue *queue = bench_link_queue(&socket->address);
+    if(queue->count > 0)
+    {
+        Bench_Datagram *datagram = queue->datagrams + queue->first;
+        if(datagram->deliver_at_ms <= bench_link.now_ms)
+        {
+            assert(datagram->size <= buffer_size, "Receive buffer too small");
+            dgl_memcpy(buffer, datagram->data, datagram->size);
+            *peer_address = datagram->from;
+            result = datagram->size;
+
+            queue->first = (queue->first + 1) % BENCH_LINK_CAPACITY;
+            queue->count--;
+            queue->received++;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): the net layer runs on the virtual clock of the bench link
+ZHC_GET_TIME_IN_MS(bench_get_time_in_ms)
+{
+    return(bench_link.now_ms);
+}
+
+ZHC_SEND_DATA(bench_send_multicast_data)
+{
+    bench_wire.group_datagrams++;
+    bench_wire.group_bytes += buffer_size;
+}
+
+internal real64
+bench_time_in_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    real64 result = cast(real64)now.tv_sec * 1000.0 + cast(real64)now.tv_nsec * 1e-6;
+    return(result);
+}
+
+internal void
+bench_connect_clients(Net_Context *ctx, int32 count, bool32 join_group)
+{
+    Connection_List *conns = ctx->conns;
+    for(int32 index = 0; index < count; ++index)
+    {
+        Zhc_Net_Address address = parse_address("10.0.0.1", cast(uint16)(10000 + index));
+        Net_Conn_ID id = push_connection(conns, address, cast(uint64)index + 1);
+        conns->state[id] = Net_Conn_State_Connected;
+        conns->group_joined[id] = join_group;
+    }
+}
+
+internal void
+bench_fill_payload(uint8 *payload, usize payload_size, uint32 seed)
+{
+    // NOTE(dgl): text like payload, different for each song switch
+    for(usize index = 0; index < payload_size; ++index)
+    {
+        payload[index] = cast(uint8)('a' + ((index * 7 + seed) % 26));
+    }
+}
+
+// NOTE(dgl): song like text. Verses are random lines, the chorus is repeated after each verse.
+internal void
+bench_fill_song(uint8 *payload, usize payload_size, uint32 seed)
+{
+    char *words[] = {"grace", "love", "light", "the", "of", "and", "you", "my", "heart", "sing",
+                     "praise", "glory", "lord", "forever", "is", "in", "we", "will", "your", "name",
+                     "holy", "mercy", "shine", "king", "above", "all", "rise", "now", "hope", "way"};
+    uint32 random_state = seed*7919 + 1;
+
+    uint8 chorus[256] = {};
+    usize chorus_size = 0;
+    char *chorus_line = "[Chorus]\nHow great is our God, sing with me\nHow great is our God, and all will see\n\n";
+    while(chorus_line[chorus_size]) { chorus[chorus_size] = cast(uint8)chorus_line[chorus_size]; ++chorus_size; }
+
+    usize offset = 0;
+    int32 line_index = 0;
+    while(offset < payload_size)
+    {
+        if(line_index > 0 && (line_index % 8) == 0)
+        {
+            usize size = dgl_min(chorus_size, payload_size - offset);
+            dgl_memcpy(payload + offset, chorus, size);
+            offset += size;
+        }
+
+        int32 word_count = 4 + cast(int32)(bench_random(&random_state) % 5);
+        for(int32 word_index = 0; word_index < word_count && offset < payload_size; ++word_index)
+        {
+            char *word = words[bench_random(&random_state) % array_count(words)];
+            while(*word && offset < payload_size) { payload[offset++] = cast(uint8)*word++; }
+            if(offset < payload_size) { payload[offset++] = (word_index == word_count - 1) ? '\n' : ' '; }
+        }
+        ++line_index;
+    }
+}
+
+internal void
+bench_compression_slices_per_switch(DGL_Mem_Arena *arena)
+{
+    printf("Slices per song switch with and without compression\n");
+    printf("%10s %10s %12s %12s %14s %14s\n", "raw KB", "codec", "bytes", "slices", "prepare ms", "cached ms");
+
+    usize payload_sizes[] = {kilobytes(8), kilobytes(60), kilobytes(250)};
+    for(int32 size_index = 0; size_index < array_count(payload_sizes); ++size_index)
+    {
+        for(int32 codec = Net_Codec_None; codec < Net_Codec_Count; ++codec)
+        {
+            DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+            Net_Context *ctx = net_init_server(temp.arena, NET_DEFAULT_MAX_CLIENTS);
+            ctx->fec_group_size = 0;
+
+            usize payload_size = payload_sizes[size_index];
+            uint8 *payload = dgl_mem_arena_push_array(temp.arena, uint8, payload_size);
+            bench_fill_song(payload, payload_size, cast(uint32)size_index);
+
+            Net_Message message = {};
+            message.type = Net_Message_Data_Res;
+            message.payload = payload;
+            message.payload_size = payload_size;
+
+            real64 start = bench_time_in_ms();
+            Net_Chunk *chunk = net_prepare_chunk(ctx, message, cast(Net_Codec)codec);
+            real64 prepare_ms = bench_time_in_ms() - start;
+
+            // NOTE(dgl): the chunk store is cleared to measure the compress cache
+            chunk->info.slice_count = 0;
+            start = bench_time_in_ms();
+            chunk = net_prepare_chunk(ctx, message, cast(Net_Codec)codec);
+            real64 cached_ms = bench_time_in_ms() - start;
+
+            usize slice_space = NET_MTU_SIZE - packet_header_size(Packet_Type_Slice);
+            usize bytes = (chunk->info.slice_count - 1)*slice_space + chunk->info.last_slice_size;
+            printf("%10zu %10s %12zu %12u %14.3f %14.3f\n", payload_size / 1024, (chunk->info.codec == Net_Codec_LZ) ? "lz" : "none",
+                   bytes, chunk->info.slice_count, prepare_ms, cached_ms);
+
+            dgl_mem_arena_end_temp(temp);
+        }
+    }
+    printf("\n");
+}
+
+internal void
+bench_multicast_bytes_per_switch(DGL_Mem_Arena *arena)
+{
+    printf("Server bytes sent per song switch (60 KB payload)\n");
+    printf("%8s %10s %14s %14s %12s\n", "clients", "mode", "bytes", "datagrams", "ms/switch");
+
+    usize payload_size = kilobytes(60);
+    int32 client_counts[] = {1, 8, 32, 128};
+    int32 switch_count = 10;
+    for(int32 count_index = 0; count_index < array_count(client_counts); ++count_index)
+    {
+        for(int32 mode = 0; mode < 2; ++mode)
+        {
+            bool32 use_group = (mode == 1);
+
+            DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+            Net_Context *ctx = net_init_server(temp.arena, NET_DEFAULT_MAX_CLIENTS);
+            ctx->congestion_control = false;
+            ctx->send_budget_per_tick = 0;
+            uint8 *payload = dgl_mem_arena_push_array(temp.arena, uint8, payload_size);
+            bench_connect_clients(ctx, client_counts[count_index], use_group);
+            if(use_group)
+            {
+                ctx->multicast.enabled = true;
+                ctx->multicast.group = parse_address(ZHC_MULTICAST_GROUP, ZHC_MULTICAST_PORT);
+                ctx->multicast.socket.handle.no_error = true;
+            }
+
+            bench_wire = {};
+            real64 total_ms = 0.0;
+            for(int32 switch_index = 0; switch_index < switch_count; ++switch_index)
+            {
+                bench_fill_payload(payload, payload_size, cast(uint32)switch_index);
+
+                Net_Message message = {};
+                message.type = Net_Message_Data_Res;
+                message.payload = payload;
+                message.payload_size = payload_size;
+
+                real64 start = bench_time_in_ms();
+                net_multicast_message(ctx, message);
+                net_send_scheduled_slices(ctx);
+                total_ms += bench_time_in_ms() - start;
+            }
+
+            usize bytes = (bench_wire.bytes + bench_wire.group_bytes) / cast(usize)switch_count;
+            int32 datagrams = (bench_wire.datagrams + bench_wire.group_datagrams) / switch_count;
+            printf("%8d %10s %14zu %14d %12.3f\n", client_counts[count_index], use_group ? "multicast" : "unicast",
+                   bytes, datagrams, total_ms / cast(real64)switch_count);
+
+            dgl_mem_arena_end_temp(temp);
+        }
+    }
+    printf("\n");
+}
+
+// NOTE(dgl): The lookup happens for every received datagram. The linear scan is the lookup
+// before the hash table. Every client sends from a different port on a few hosts.
+internal void
+bench_connection_lookup(DGL_Mem_Arena *arena)
+{
+    printf("Connection lookup per received datagram\n");
+    printf("%8s %14s %14s\n", "clients", "scan ns", "hash ns");
+
+    int32 client_counts[] = {128, 512, 1024, 4096, 16384};
+    int32 lookup_count = 1 << 20;
+    for(int32 count_index = 0; count_index < array_count(client_counts); ++count_index)
+    {
+        int32 client_count = client_counts[count_index];
+
+        DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+        Net_Context *ctx = dgl_mem_arena_push_struct(temp.arena, Net_Context);
+        Connection_List *conns = push_connection_list(temp.arena, ctx, client_count);
+
+        Zhc_Net_Address *addresses = dgl_mem_arena_push_array(temp.arena, Zhc_Net_Address, cast(usize)client_count);
+        for(int32 index = 0; index < client_count; ++index)
+        {
+            addresses[index].host = 0x0A000001 + cast(uint32)(index / 1024);
+            addresses[index].port = cast(uint16)(10000 + (index % 1024));
+            Net_Conn_ID id = push_connection(conns, addresses[index], cast(uint64)index + 1);
+            conns->state[id] = Net_Conn_State_Connected;
+        }
+
+        uint32 random_state = 0x9E3779B9;
+        int32 found = 0;
+        real64 start = bench_time_in_ms();
+        for(int32 lookup = 0; lookup < lookup_count; ++lookup)
+        {
+            Zhc_Net_Address address = addresses[bench_random(&random_state) % cast(uint32)client_count];
+            for(int32 index = 0; index < conns->max_count; ++index)
+            {
+                if(address_compare(conns->address[index], address) &&
+                   conns->state[index] != Net_Conn_State_Disconnected)
+                {
+                    found++;
+                    break;
+                }
+            }
+        }
+        real64 scan_ms = bench_time_in_ms() - start;
+
+        random_state = 0x9E3779B9;
+        start = bench_time_in_ms();
+        for(int32 lookup = 0; lookup < lookup_count; ++lookup)
+        {
+            Zhc_Net_Address address = addresses[bench_random(&random_state) % cast(uint32)client_count];
+            if(get_connection(conns, address) >= 0) { found--; }
+        }
+        real64 hash_ms = bench_time_in_ms() - start;
+        assert(found == 0, "Both lookups must find the same connections");
+
+        printf("%8d %14.1f %14.1f\n", client_count, scan_ms*1e6 / cast(real64)lookup_count,
+               hash_ms*1e6 / cast(real64)lookup_count);
+
+        dgl_mem_arena_end_temp(temp);
+    }
+    printf("\n");
+}
+
+// NOTE(dgl): Transfers one chunk from a server to a client over the bench link and returns
+// the time until the client completed the chunk or a negative value if it failed.
+// The client resends its last ack (or the data request, if it did not receive
+// the chunk packet) if it did not receive anything for resend_ms. The application itself only
+// requests the hash every few seconds, which would hide the effect of the resends.
+internal real64
+bench_transfer_chunk(DGL_Mem_Arena *arena, Net_Context *server, usize payload_size, uint32 seed, real64 max_ms)
+{
+    real64 result = -1.0;
+    real64 resend_ms = 100.0;
+    Zhc_Net_Address server_address = parse_address("10.0.0.1", ZHC_SERVER_PORT);
+    Zhc_Net_Address client_address = parse_address("10.0.0.2", 40000);
+
+    bench_link.enabled = true;
+    bench_link.to_server.datagrams = dgl_mem_arena_push_array(arena, Bench_Datagram, BENCH_LINK_CAPACITY);
+    bench_link.to_client.datagrams = dgl_mem_arena_push_array(arena, Bench_Datagram, BENCH_LINK_CAPACITY);
+    bench_wire = {};
+
+    server->socket.address = server_address;
+    Net_Conn_ID server_id = push_connection(server->conns, client_address, 0x42);
+    server->conns->state[server_id] = Net_Conn_State_Connected;
+
+    Net_Context *client = net_init_client(arena, ZHC_MAX_FILESIZE);
+    client->socket.address = client_address;
+    Net_Conn_ID client_id = push_connection(client->conns, server_address, 0x42);
+    client->conns->state[client_id] = Net_Conn_State_Connected;
+
+    uint8 *payload = dgl_mem_arena_push_array(arena, uint8, payload_size);
+    bench_fill_payload(payload, payload_size, seed);
+    Net_Message data = {};
+    data.type = Net_Message_Data_Res;
+    data.payload = payload;
+    data.payload_size = payload_size;
+    net_send_message(server, server_id, data);
+    uint32 chunk_hash = server->conns->chunk[server_id]->info.hash;
+
+    bool32 complete = false;
+    real64 last_activity_ms = 0.0;
+    while(!complete && bench_link.now_ms < max_ms)
+    {
+        bench_link.now_ms += 1.0;
+
+        Net_Message message = {};
+        DGL_Mem_Temp_Arena frame = dgl_mem_arena_begin_temp(arena);
+        while(net_recv_message(frame.arena, server, &message) >= 0)
+        {
+            if(message.type == Net_Message_Data_Req) { net_send_message(server, server_id, data); }
+        }
+
+        int32 received = bench_link.to_client.received;
+        while(net_recv_message(frame.arena, client, &message) >= 0)
+        {
+            complete |= (message.type == Net_Message_Data_Res && message.payload_size == payload_size);
+        }
+        dgl_mem_arena_end_temp(frame);
+        net_process_timers(server);
+        net_process_timers(client);
+
+        if(received != bench_link.to_client.received)
+        {
+            last_activity_ms = bench_link.now_ms;
+        }
+        else if(!complete && bench_link.now_ms - last_activity_ms >= resend_ms)
+        {
+            last_activity_ms = bench_link.now_ms;
+            if(client->chunk_info.hash == chunk_hash)
+            {
+                net_resend_kept_packets(client, client_id);
+            }
+            else
+            {
+                Net_Message request = {};
+                request.type = Net_Message_Data_Req;
+                net_send_message(client, client_id, request);
+            }
+        }
+    }
+
+    if(complete) { result = bench_link.now_ms; }
+
+    return(result);
+}
+
+internal void
+bench_fec_time_to_complete(DGL_Mem_Arena *arena)
+{
+    real64 delay_ms = 20.0;
+    usize payload_size = kilobytes(512);
+    int32 run_count = 20;
+
+    printf("Time to complete a chunk (%zu KB payload, %.0f ms one way delay, 100 ms resend timeout, %d runs)\n",
+           payload_size / 1024, delay_ms, run_count);
+    printf("%8s %10s %12s %12s %14s %10s\n", "loss", "fec group", "avg ms", "max ms", "server KB", "failed");
+
+    real32 losses[] = {0.0f, 0.05f, 0.1f, 0.2f, 0.3f};
+    uint32 group_sizes[] = {0, 16, 8, 4};
+    for(int32 loss_index = 0; loss_index < array_count(losses); ++loss_index)
+    {
+        for(int32 group_index = 0; group_index < array_count(group_sizes); ++group_index)
+        {
+            real64 total_ms = 0.0;
+            real64 worst_ms = 0.0;
+            usize total_bytes = 0;
+            int32 failed = 0;
+            for(int32 run = 0; run < run_count; ++run)
+            {
+                DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+
+                bench_link = {};
+                bench_link.delay_ms = delay_ms;
+                bench_link.loss = losses[loss_index];
+                bench_link.random_state = 0x9E3779B9 ^ cast(uint32)(run + 1);
+
+                Net_Context *server = net_init_server(temp.arena, NET_DEFAULT_MAX_CLIENTS);
+                server->fec_group_size = group_sizes[group_index];
+                real64 complete_ms = bench_transfer_chunk(temp.arena, server, payload_size, cast(uint32)run, 60000.0);
+                if(complete_ms >= 0.0)
+                {
+                    total_ms += complete_ms;
+                    worst_ms = dgl_max(worst_ms, complete_ms);
+                }
+                else
+                {
+                    failed++;
+                }
+                total_bytes += bench_wire.bytes;
+
+                dgl_mem_arena_end_temp(temp);
+            }
+
+            int32 complete_count = dgl_max(run_count - failed, 1);
+            printf("%7.0f%% %10u %12.1f %12.1f %14zu %10d\n", cast(real64)losses[loss_index] * 100.0, group_sizes[group_index],
+                   total_ms / cast(real64)complete_count, worst_ms, total_bytes / cast(usize)run_count / 1024, failed);
+        }
+    }
+    bench_link = {};
+    printf("\n");
+}
+
+// NOTE(dgl): Without congestion control the server sends the whole window at once and
+// overflows the queue of the bottleneck. The send budget is disabled, to only compare the
+// congestion control. The netem condition is the one of network_simulator.sh
+// (netem reorders datagrams with jitter, the bench link does not).
+internal void
+bench_congestion_goodput(DGL_Mem_Arena *arena)
+{
+    usize payload_size = kilobytes(512);
+    int32 run_count = 10;
+
+    printf("Goodput with and without congestion control (%zu KB payload, %d runs)\n", payload_size / 1024, run_count);
+    printf("%10s %6s %12s %12s %14s %14s %12s %10s\n", "link", "cc", "avg ms", "max ms", "goodput KB/s", "server KB", "drops", "failed");
+
+    struct
+    {
+        char *name;
+        real64 delay_ms;
+        real64 jitter_ms;
+        real32 loss;
+        real64 rate;
+        int32 queue_limit;
+    } conditions[] =
+    {
+        {"lan", 1.0, 0.0, 0.0f, 10.0, 64},
+        {"wifi", 5.0, 3.0, 0.02f, 1.5, 128},
+        {"netem", 100.0, 40.0, 0.3f, 0.0, 0},
+    };
+
+    for(int32 condition_index = 0; condition_index < array_count(conditions); ++condition_index)
+    {
+        for(int32 mode = 1; mode >= 0; --mode)
+        {
+            real64 total_ms = 0.0;
+            real64 worst_ms = 0.0;
+            usize total_bytes = 0;
+            int32 total_dropped = 0;
+            int32 failed = 0;
+            for(int32 run = 0; run < run_count; ++run)
+            {
+                DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+
+                bench_link = {};
+                bench_link.delay_ms = conditions[condition_index].delay_ms;
+                bench_link.jitter_ms = conditions[condition_index].jitter_ms;
+                bench_link.loss = conditions[condition_index].loss;
+                bench_link.rate = conditions[condition_index].rate;
+                bench_link.queue_limit = conditions[condition_index].queue_limit;
+                bench_link.random_state = 0x9E3779B9 ^ cast(uint32)(run + 1);
+
+                Net_Context *server = net_init_server(temp.arena, NET_DEFAULT_MAX_CLIENTS);
+                server->congestion_control = (mode == 1);
+                server->send_budget_per_tick = 0;
+                real64 complete_ms = bench_transfer_chunk(temp.arena, server, payload_size, cast(uint32)run, 120000.0);
+                if(complete_ms >= 0.0)
+                {
+                    total_ms += complete_ms;
+                    worst_ms = dgl_max(worst_ms, complete_ms);
+                }
+                else
+                {
+                    failed++;
+                }
+                total_bytes += bench_wire.bytes;
+                total_dropped += bench_link.dropped;
+
+                dgl_mem_arena_end_temp(temp);
+            }
+
+            int32 complete_count = dgl_max(run_count - failed, 1);
+            real64 avg_ms = total_ms / cast(real64)complete_count;
+            printf("%10s %6s %12.1f %12.1f %14.1f %14zu %12d %10d\n", conditions[condition_index].name, mode ? "on" : "off",
+                   avg_ms, worst_ms, cast(real64)(payload_size / 1024)*1000.0 / dgl_max(avg_ms, 1.0),
+                   total_bytes / cast(usize)run_count / 1024, total_dropped / run_count, failed);
+        }
+    }
+    bench_link = {};
+    printf("\n");
+}
+
+// NOTE(dgl): All clients request the chunk in the same frame. In fifo order each transfer is
+// only started when the one before was sent completely, like the server did before the send
+// scheduler. Reports when the first and the last slice of the chunk were sent to each client.
+internal void
+bench_scheduler_time_to_first_render(DGL_Mem_Arena *arena)
+{
+    usize payload_size = kilobytes(60);
+    printf("Time until the chunk is sent to each client (%zu KB payload, %zu KB send budget per tick)\n",
+           payload_size / 1024, cast(usize)NET_SEND_BUDGET_PER_TICK / 1024);
+    printf("%8s %6s %14s %14s %14s %14s %14s\n", "clients", "order", "first avg ms", "first max ms",
+           "last min ms", "last avg ms", "last max ms");
+
+    int32 client_counts[] = {8, 32, 128};
+    for(int32 count_index = 0; count_index < array_count(client_counts); ++count_index)
+    {
+        for(int32 mode = 0; mode < 2; ++mode)
+        {
+            bool32 fifo = (mode == 0);
+            int32 client_count = client_counts[count_index];
+
+            DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(arena);
+            bench_link = {};
+            Net_Context *ctx = net_init_server(temp.arena, NET_DEFAULT_MAX_CLIENTS);
+            ctx->congestion_control = false;
+            bench_connect_clients(ctx, client_count, false);
+
+            Net_Message message = {};
+            message.type = Net_Message_Data_Res;
+            message.payload = dgl_mem_arena_push_array(temp.arena, uint8, payload_size);
+            message.payload_size = payload_size;
+            bench_fill_payload(message.payload, payload_size, 0);
+
+            real64 *first_ms = dgl_mem_arena_push_array(temp.arena, real64, cast(usize)client_count);
+            real64 *last_ms = dgl_mem_arena_push_array(temp.arena, real64, cast(usize)client_count);
+            int32 started = 0;
+            int32 done = 0;
+            if(fifo) { net_send_message(ctx, started++, message); }
+            else
+            {
+                while(started < client_count) { net_send_message(ctx, started++, message); }
+            }
+
+            while(done < client_count)
+            {
+                bench_link.now_ms += 1.0;
+                net_process_timers(ctx);
+
+                done = 0;
+                for(int32 index = 0; index < started; ++index)
+                {
+                    uint32 next = ctx->conns->window_next[index];
+                    if(next > 0 && first_ms[index] == 0.0) { first_ms[index] = bench_link.now_ms; }
+                    if(next == ctx->conns->chunk[index]->info.slice_count)
+                    {
+                        if(last_ms[index] == 0.0) { last_ms[index] = bench_link.now_ms; }
+                        done++;
+                    }
+                }
+
+                if(fifo && done == started && started < client_count) { net_send_message(ctx, started++, message); }
+            }
+
+            real64 first_total = 0.0;
+            real64 first_max = 0.0;
+            real64 last_total = 0.0;
+            real64 last_min = last_ms[0];
+            real64 last_max = 0.0;
+            for(int32 index = 0; index < client_count; ++index)
+            {
+                first_total += first_ms[index];
+                first_max = dgl_max(first_max, first_ms[index]);
+                last_total += last_ms[index];
+                last_min = dgl_min(last_min, last_ms[index]);
+                last_max = dgl_max(last_max, last_ms[index]);
+            }
+
+            printf("%8d %6s %14.1f %14.1f %14.1f %14.1f %14.1f\n", client_count, fifo ? "fifo" : "drr",
+                   first_total / cast(real64)client_count, first_max, last_min, last_total / cast(real64)client_count, last_max);
+
+            dgl_mem_arena_end_temp(temp);
+        }
+    }
+    bench_link = {};
+    printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    platform.send_data = bench_send_data;
+    platform.send_multicast_data = bench_send_multicast_data;
+    platform.receive_data = bench_receive_data;
+    platform.get_time_in_ms = bench_get_time_in_ms;
+
+    usize memory_size = megabytes(64);
+    uint8 *memory_block = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
+    bench_multicast_bytes_per_switch(&arena);
+    bench_compression_slices_per_switch(&arena);
+    bench_fec_time_to_complete(&arena);
+    bench_congestion_goodput(&arena);
+    bench_scheduler_time_to_first_render(&arena);
+    bench_connection_lookup(&arena);
+
+    return(0);
+}
@@ -0,0 +1,548 @@
+#include "zhc_lib.h"
+#include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
+#include "zhc_net.cpp"
+
+#include <string.h>
+#include <stdlib.h> /* atoi */
+#include <errno.h>
+#include <sys/mman.h> /* mmap */
+#include <sys/socket.h> /* native sockets */
+#include <poll.h> /* poll */
+#include <netinet/in.h>
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#include <linux/filter.h> /* SO_ATTACH_REUSEPORT_CBPF */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "linux_net_api.cpp"
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+// NOTE(dgl): Headless load generator. Runs many virtual clients in one process, like the audience
+// joining at the start of a show. Each client has its own socket and net context and does what the
+// lib does: discovery, handshake and requesting the data if the hash of the file or the beacon of the
+// server differs. With --poll-ms the clients poll the hash in this interval as well, to compare both.
+// The clients are driven by a few threads.
+// By default the server runs in the same process, with one thread per shard (see
+// net_init_server_shards), so its cpu time and traffic can be measured. With --external the clients
+// connect to the server replying to the discovery on the network and only the client side is reported.
+// The report is written as JSON.
+// NOTE(dgl): the wall clock times only improve with the shards, if the machine has more cores than
+// shards plus client threads.
+//
+// Usage: bench_zhc_net_load_x64 [--clients N] [--threads N] [--shards N] [--size KB] [--poll-ms MS]
+//                               [--timeout-ms MS] [--external] [--output FILE]
+
+#define LOAD_MAX_CLIENT_THREADS 16
+// NOTE(dgl): the discovery is a broadcast, which every client sends until it is connected. The lib
+// sends it each NET_DISCOVERY_INTERVAL_MS, hundreds of clients doing this would only measure the broadcast.
+#define LOAD_DISCOVERY_INTERVAL_MS 250.0
+#define LOAD_SCRATCH_SIZE kilobytes(256)
+
+struct Load_Config
+{
+    int32 client_count;
+    int32 thread_count;
+    int32 shard_count;
+    usize payload_size;
+    real64 poll_interval_ms; /* NOTE(dgl): 0 = the clients only rely on the beacon */
+    real64 timeout_ms;
+    bool32 external;
+    char *output_path; /* NOTE(dgl): 0 writes the report to stdout */
+};
+
+struct Load_Shard
+{
+    Net_Context *ctx;
+    DGL_Mem_Arena arena;
+    pthread_t thread;
+    real64 cpu_ms;
+    int32 data_requests;
+};
+
+// NOTE(dgl): the times are relative to the start of the run and -1 until they happened
+struct Load_Client
+{
+    Net_Context *ctx;
+    uint32 file_hash; /* NOTE(dgl): hash of the received file, 0 before */
+    real64 discovery_at;
+    real64 poll_at;
+    real64 connected_ms;
+    real64 requested_ms; /* NOTE(dgl): the first data request */
+    real64 complete_ms;
+};
+
+struct Load_Client_Thread
+{
+    Load_Client *clients;
+    int32 count;
+    DGL_Mem_Arena arena;
+    pthread_t thread;
+};
+
+global bool32 volatile load_running;
+global real64 load_start_ms;
+global Load_Config load_config;
+global Net_Message load_file;
+
+internal real64
+load_time_in_ms(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    real64 result = cast(real64)now.tv_sec * 1000.0 + cast(real64)now.tv_nsec * 1e-6;
+    return(result);
+}
+
+ZHC_GET_TIME_IN_MS(load_get_time_in_ms)
+{
+    real64 result = load_time_in_ms();
+    return(result);
+}
+
+// NOTE(dgl): replies like the lib, without deltas
+internal void *
+load_shard_run(void *data)
+{
+    Load_Shard *shard = cast(Load_Shard *)data;
+    Net_Context *ctx = shard->ctx;
+    net_set_beacon(ctx, load_file.payload_hash);
+    while(load_running)
+    {
+        Net_Message message = {};
+        Net_Conn_ID id = 0;
+        while((id = net_recv_message(&shard->arena, ctx, &message)) >= 0)
+        {
+            if(message.type == Net_Message_Hash_Req)
+            {
+                Net_Message response = {};
+                response.type = Net_Message_Hash_Res;
+                response.payload = cast(uint8 *)&load_file.payload_hash;
+                response.payload_size = sizeof(load_file.payload_hash);
+                net_send_message(ctx, id, response);
+            }
+            else if(message.type == Net_Message_Data_Req)
+            {
+                net_send_message(ctx, id, load_file);
+                shard->data_requests++;
+            }
+        }
+        net_process_timers(ctx);
+        dgl_mem_arena_free_all(&shard->arena);
+        linux_wait_for_data(&ctx->socket, 0, NET_TIMER_TICK_MS);
+    }
+    shard->cpu_ms = load_time_in_ms(CLOCK_THREAD_CPUTIME_ID);
+
+    return(0);
+}
+
+internal void
+load_client_send(Net_Context *ctx, Net_Message_Type type, uint32 *file_hash)
+{
+    Net_Message message = {};
+    message.type = type;
+    if(file_hash)
+    {
+        message.payload = cast(uint8 *)file_hash;
+        message.payload_size = sizeof(*file_hash);
+    }
+    net_send_message(ctx, 0, message);
+}
+
+internal void
+load_client_update(Load_Client *client, DGL_Mem_Arena *arena, real64 now)
+{
+    Net_Context *ctx = client->ctx;
+    Connection_List *conns = ctx->conns;
+    if(conns->state[0] == Net_Conn_State_Disconnected && now >= client->discovery_at)
+    {
+        client->discovery_at = now + LOAD_DISCOVERY_INTERVAL_MS;
+        net_request_server_connection(ctx);
+    }
+
+    Net_Message message = {};
+    Net_Conn_ID id = 0;
+    while((id = net_recv_message(arena, ctx, &message)) >= 0)
+    {
+        if(message.type == Net_Message_Hash_Res && message.payload_size == sizeof(uint32))
+        {
+            uint32 hash = *cast(uint32 *)message.payload;
+            if(hash != client->file_hash)
+            {
+                load_client_send(ctx, Net_Message_Data_Req, 0);
+                if(client->requested_ms < 0.0) { client->requested_ms = now - load_start_ms; }
+            }
+        }
+        else if(message.type == Net_Message_Beacon && message.payload_size == sizeof(uint32))
+        {
+            // NOTE(dgl): like the lib, the net layer drops the beacons while the data is on the way
+            uint32 hash = *cast(uint32 *)message.payload;
+            if(hash != client->file_hash)
+            {
+                load_client_send(ctx, Net_Message_Data_Req, 0);
+            }
+        }
+        else if(message.type == Net_Message_Data_Res)
+        {
+            uint32 file_hash = HASH_OFFSET_BASIS;
+            hash(&file_hash, message.payload, message.payload_size);
+            client->file_hash = file_hash;
+            if(client->complete_ms < 0.0) { client->complete_ms = now - load_start_ms; }
+        }
+    }
+
+    // NOTE(dgl): the polling clients keep polling after they received the file
+    if(conns->state[0] == Net_Conn_State_Connected)
+    {
+        // NOTE(dgl): the handshake ends with a hash request (see Packet_Type_Challenge_Resp)
+        if(client->connected_ms < 0.0)
+        {
+            client->connected_ms = now - load_start_ms;
+            client->poll_at = now + load_config.poll_interval_ms;
+        }
+        if(load_config.poll_interval_ms > 0.0 && now >= client->poll_at)
+        {
+            load_client_send(ctx, Net_Message_Hash_Req, &client->file_hash);
+            client->poll_at = now + load_config.poll_interval_ms;
+        }
+    }
+    net_process_timers(ctx);
+}
+
+internal void *
+load_clients_run(void *data)
+{
+    Load_Client_Thread *thread = cast(Load_Client_Thread *)data;
+    pollfd *fds = dgl_mem_arena_push_array(&thread->arena, pollfd, cast(usize)thread->count);
+    for(int32 index = 0; index < thread->count; ++index)
+    {
+        fds[index].fd = linux_socket_fd(&thread->clients[index].ctx->socket);
+        fds[index].events = POLLIN;
+    }
+
+    while(load_running)
+    {
+        real64 now = load_time_in_ms();
+        for(int32 index = 0; index < thread->count; ++index)
+        {
+            DGL_Mem_Temp_Arena scratch = dgl_mem_arena_begin_temp(&thread->arena);
+            load_client_update(thread->clients + index, scratch.arena, now);
+            dgl_mem_arena_end_temp(scratch);
+        }
+
+        poll(fds, cast(nfds_t)thread->count, 1);
+    }
+
+    return(0);
+}
+
+internal void
+load_sort(real64 *values, int32 count)
+{
+    for(int32 index = 1; index < count; ++index)
+    {
+        real64 value = values[index];
+        int32 insert = index;
+        while(insert > 0 && values[insert - 1] > value)
+        {
+            values[insert] = values[insert - 1];
+            insert--;
+        }
+        values[insert] = value;
+    }
+}
+
+// NOTE(dgl): the values must be sorted. The values of the clients which did not get there
+// are negative and sorted to the front, they are ignored.
+internal real64
+load_percentile(real64 *values, int32 count, real64 percentile)
+{
+    real64 result = -1.0;
+    int32 first = 0;
+    while(first < count && values[first] < 0.0) { first++; }
+    if(first < count)
+    {
+        int32 index = first + cast(int32)(percentile*cast(real64)(count - first - 1) + 0.5);
+        result = values[index];
+    }
+
+    return(result);
+}
+
+internal void
+load_write_percentiles(FILE *out, char *name, real64 *values, int32 count, char *separator)
+{
+    load_sort(values, count);
+    fprintf(out, "    \"%s\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}%s\n", name,
+            load_percentile(values, count, 0.5), load_percentile(values, count, 0.9),
+            load_percentile(values, count, 0.99), load_percentile(values, count, 1.0), separator);
+}
+
+internal void
+load_write_stats(FILE *out, char *name, Net_Stats *stats, char *separator)
+{
+    fprintf(out, "    \"%s\": {\"datagrams_sent\": %llu, \"bytes_sent\": %llu, \"datagrams_received\": %llu, "
+            "\"bytes_received\": %llu, \"datagrams_resent\": %llu, \"repair_bytes_requested\": %llu, "
+            "\"repair_bytes_sent\": %llu}%s\n", name,
+            cast(unsigned long long)stats->datagrams_sent, cast(unsigned long long)stats->bytes_sent,
+            cast(unsigned long long)stats->datagrams_received, cast(unsigned long long)stats->bytes_received,
+            cast(unsigned long long)stats->datagrams_resent, cast(unsigned long long)stats->repair_bytes_requested,
+            cast(unsigned long long)stats->repair_bytes_sent, separator);
+}
+
+internal void
+load_add_stats(Net_Stats *total, Net_Stats *stats)
+{
+    total->datagrams_sent += stats->datagrams_sent;
+    total->bytes_sent += stats->bytes_sent;
+    total->datagrams_received += stats->datagrams_received;
+    total->bytes_received += stats->bytes_received;
+    total->datagrams_resent += stats->datagrams_resent;
+    total->repair_bytes_requested += stats->repair_bytes_requested;
+    total->repair_bytes_sent += stats->repair_bytes_sent;
+}
+
+internal bool32
+load_run(DGL_Mem_Arena *arena, Load_Config *config)
+{
+    Load_Shard shards[ZHC_MAX_SERVER_SHARDS] = {};
+    int32 shard_count = config->external ? 0 : config->shard_count;
+    if(shard_count > 0)
+    {
+        Net_Context *contexts[ZHC_MAX_SERVER_SHARDS] = {};
+        net_init_server_shards(arena, config->client_count, contexts, shard_count);
+        for(int32 index = 0; index < shard_count; ++index)
+        {
+            Load_Shard *shard = shards + index;
+            shard->ctx = contexts[index];
+            net_open_socket(shard->ctx);
+            uint8 *scratch = dgl_mem_arena_push_array(arena, uint8, LOAD_SCRATCH_SIZE);
+            dgl_mem_arena_init(&shard->arena, scratch, LOAD_SCRATCH_SIZE);
+        }
+    }
+
+    Load_Client *clients = dgl_mem_arena_push_array(arena, Load_Client, cast(usize)config->client_count);
+    for(int32 index = 0; index < config->client_count; ++index)
+    {
+        Load_Client *client = clients + index;
+        client->ctx = net_init_client(arena, config->payload_size);
+        net_open_socket(client->ctx);
+        client->connected_ms = -1.0;
+        client->requested_ms = -1.0;
+        client->complete_ms = -1.0;
+    }
+
+    Load_Client_Thread threads[LOAD_MAX_CLIENT_THREADS] = {};
+    for(int32 index = 0; index < config->thread_count; ++index)
+    {
+        Load_Client_Thread *thread = threads + index;
+        int32 first = (index*config->client_count) / config->thread_count;
+        thread->clients = clients + first;
+        thread->count = ((index + 1)*config->client_count) / config->thread_count - first;
+        uint8 *scratch = dgl_mem_arena_push_array(arena, uint8, LOAD_SCRATCH_SIZE);
+        dgl_mem_arena_init(&thread->arena, scratch, LOAD_SCRATCH_SIZE);
+    }
+
+    load_running = true;
+    load_start_ms = load_time_in_ms();
+    real64 start_cpu_ms = load_time_in_ms(CLOCK_PROCESS_CPUTIME_ID);
+    for(int32 index = 0; index < shard_count; ++index)
+    {
+        pthread_create(&shards[index].thread, 0, load_shard_run, shards + index);
+    }
+    for(int32 index = 0; index < config->thread_count; ++index)
+    {
+        pthread_create(&threads[index].thread, 0, load_clients_run, threads + index);
+    }
+
+    // NOTE(dgl): the run ends when all clients received the file
+    int32 complete_count = 0;
+    while(complete_count < config->client_count && load_time_in_ms() - load_start_ms < config->timeout_ms)
+    {
+        usleep(10000);
+        complete_count = 0;
+        for(int32 index = 0; index < config->client_count; ++index)
+        {
+            complete_count += (clients[index].complete_ms >= 0.0);
+        }
+    }
+    real64 duration_ms = load_time_in_ms() - load_start_ms;
+    load_running = false;
+
+    Net_Stats client_stats = {};
+    for(int32 index = 0; index < config->thread_count; ++index)
+    {
+        pthread_join(threads[index].thread, 0);
+    }
+    for(int32 index = 0; index < config->client_count; ++index)
+    {
+        load_add_stats(&client_stats, &clients[index].ctx->stats);
+        platform.close_socket(&clients[index].ctx->socket);
+    }
+
+    Net_Stats server_stats = {};
+    real64 server_cpu_ms = 0.0;
+    real64 max_shard_cpu_ms = 0.0;
+    int32 data_requests = 0;
+    for(int32 index = 0; index < shard_count; ++index)
+    {
+        Load_Shard *shard = shards + index;
+        pthread_join(shard->thread, 0);
+        server_cpu_ms += shard->cpu_ms;
+        max_shard_cpu_ms = dgl_max(max_shard_cpu_ms, shard->cpu_ms);
+        data_requests += shard->data_requests;
+        load_add_stats(&server_stats, &shard->ctx->stats);
+        platform.close_socket(&shard->ctx->socket);
+    }
+    real64 process_cpu_ms = load_time_in_ms(CLOCK_PROCESS_CPUTIME_ID) - start_cpu_ms;
+
+    real64 *connect_ms = dgl_mem_arena_push_array(arena, real64, cast(usize)config->client_count);
+    real64 *transfer_ms = dgl_mem_arena_push_array(arena, real64, cast(usize)config->client_count);
+    real64 *complete_ms = dgl_mem_arena_push_array(arena, real64, cast(usize)config->client_count);
+    for(int32 index = 0; index < config->client_count; ++index)
+    {
+        Load_Client *client = clients + index;
+        connect_ms[index] = client->connected_ms;
+        complete_ms[index] = client->complete_ms;
+        transfer_ms[index] = (client->complete_ms >= 0.0) ? client->complete_ms - client->requested_ms : -1.0;
+    }
+
+    FILE *out = stdout;
+    if(config->output_path)
+    {
+        out = fopen(config->output_path, "w");
+        if(!out)
+        {
+            printf("Unable to open %s: %s\n", config->output_path, strerror(errno));
+            return(false);
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "    \"clients\": %d,\n", config->client_count);
+    fprintf(out, "    \"client_threads\": %d,\n", config->thread_count);
+    fprintf(out, "    \"shards\": %d,\n", shard_count);
+    fprintf(out, "    \"cores\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "    \"payload_size\": %zu,\n", config->payload_size);
+    fprintf(out, "    \"completed\": %d,\n", complete_count);
+    fprintf(out, "    \"duration_ms\": %.1f,\n", duration_ms);
+    fprintf(out, "    \"process_cpu_ms\": %.1f,\n", process_cpu_ms);
+    if(shard_count > 0)
+    {
+        fprintf(out, "    \"server_cpu_ms\": %.1f,\n", server_cpu_ms);
+        fprintf(out, "    \"max_shard_cpu_ms\": %.1f,\n", max_shard_cpu_ms);
+        fprintf(out, "    \"data_requests\": %d,\n", data_requests);
+        load_write_stats(out, "server", &server_stats, ",");
+    }
+    load_write_stats(out, "clients_wire", &client_stats, ",");
+    load_write_percentiles(out, "connect_ms", connect_ms, config->client_count, ",");
+    load_write_percentiles(out, "transfer_ms", transfer_ms, config->client_count, ",");
+    load_write_percentiles(out, "complete_ms", complete_ms, config->client_count, "");
+    fprintf(out, "}\n");
+
+    if(out != stdout) { fclose(out); }
+
+    return(true);
+}
+
+int
+main(int argc, char **argv)
+{
+    Load_Config *config = &load_config;
+    config->client_count = 256;
+    config->thread_count = 2;
+    config->shard_count = 1;
+    config->payload_size = kilobytes(16);
+    config->poll_interval_ms = 0.0;
+    config->timeout_ms = 30000.0;
+    for(int32 index = 1; index < argc; ++index)
+    {
+        // NOTE(dgl): the value is read once, dgl_min and dgl_max evaluate their arguments twice
+        char *value = (index + 1 < argc) ? argv[index + 1] : 0;
+        if(strcmp(argv[index], "--clients") == 0 && value)
+        {
+            config->client_count = dgl_max(atoi(value), 1);
+            index++;
+        }
+        else if(strcmp(argv[index], "--threads") == 0 && value)
+        {
+            config->thread_count = dgl_clamp(atoi(value), 1, LOAD_MAX_CLIENT_THREADS);
+            index++;
+        }
+        else if(strcmp(argv[index], "--shards") == 0 && value)
+        {
+            config->shard_count = dgl_clamp(atoi(value), 1, ZHC_MAX_SERVER_SHARDS);
+            index++;
+        }
+        else if(strcmp(argv[index], "--size") == 0 && value)
+        {
+            int32 size_kb = dgl_clamp(atoi(value), 1, cast(int32)(ZHC_MAX_FILESIZE / kilobytes(1)));
+            config->payload_size = kilobytes(cast(usize)size_kb);
+            index++;
+        }
+        else if(strcmp(argv[index], "--poll-ms") == 0 && value)
+        {
+            real64 poll_ms = atof(value);
+            config->poll_interval_ms = (poll_ms > 0.0) ? dgl_max(poll_ms, 10.0) : 0.0;
+            index++;
+        }
+        else if(strcmp(argv[index], "--timeout-ms") == 0 && value)
+        {
+            config->timeout_ms = atof(value);
+            index++;
+        }
+        else if(strcmp(argv[index], "--external") == 0)
+        {
+            config->external = true;
+        }
+        else if(strcmp(argv[index], "--output") == 0 && value)
+        {
+            config->output_path = value;
+            index++;
+        }
+        else
+        {
+            printf("Unknown argument %s\n", argv[index]);
+            return(1);
+        }
+    }
+    config->thread_count = dgl_min(config->thread_count, config->client_count);
+
+    platform.get_time_in_ms = load_get_time_in_ms;
+    platform.open_socket = linux_open_socket;
+    platform.close_socket = linux_close_socket;
+    platform.send_data = linux_send_data;
+    platform.receive_data = linux_receive_data;
+    platform.send_data_batch = linux_send_data_batch;
+    platform.receive_data_batch = linux_receive_data_batch;
+
+    // NOTE(dgl): each client context has its own receive buffers for the payload
+    usize memory_size = megabytes(256) + cast(usize)config->client_count*(megabytes(1) + 4*config->payload_size);
+    uint8 *memory_block = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if(memory_block == MAP_FAILED)
+    {
+        printf("Unable to map %zu MB\n", cast(usize)(memory_size / megabytes(1)));
+        return(1);
+    }
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
+    load_file.type = Net_Message_Data_Res;
+    load_file.payload_size = config->payload_size;
+    load_file.payload = dgl_mem_arena_push_array(&arena, uint8, load_file.payload_size);
+    for(usize index = 0; index < load_file.payload_size; ++index)
+    {
+        load_file.payload[index] = cast(uint8)((index*31) ^ (index >> 7));
+    }
+    load_file.payload_hash = HASH_OFFSET_BASIS;
+    hash(&load_file.payload_hash, load_file.payload, load_file.payload_size);
+
+    int result = load_run(&arena, config) ? 0 : 1;
+    return(result);
+}
@@ -0,0 +1,116 @@
+#include "zhc_lib.h"
+#include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
+#include "zhc_net.cpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h> /* atoi */
+#include <errno.h>
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#define DGL_IMPLEMENTATION
+#include "dgl.h"
+
+#include "linux_net_capture.cpp"
+
+// NOTE(dgl): Replays a capture (see server_main --capture) into net_recv_message as fast as possible.
+// This is the regression benchmark for parsing and dispatching the datagrams with real traffic. The
+// server replays the datagrams received on the server port. A client replays the datagrams received
+// on --port and the group.
+//
+// Usage: bench_zhc_net_replay_x64 <capture> [--iterations N] [--client] [--port P] [--max-clients N]
+
+int
+main(int argc, char **argv)
+{
+    char *path = 0;
+    int32 iterations = 10;
+    int32 server = -1; /* NOTE(dgl): -1 takes the role of the capture */
+    int32 port = -1;
+    int32 max_clients = NET_DEFAULT_MAX_CLIENTS;
+    for(int32 index = 1; index < argc; ++index)
+    {
+        char *value = (index + 1 < argc) ? argv[index + 1] : 0;
+        if(strcmp(argv[index], "--iterations") == 0 && value)
+        {
+            iterations = dgl_max(atoi(value), 1);
+            index++;
+        }
+        else if(strcmp(argv[index], "--client") == 0) { server = 0; }
+        else if(strcmp(argv[index], "--port") == 0 && value)
+        {
+            port = dgl_clamp(atoi(value), 0, 0xFFFF);
+            index++;
+        }
+        else if(strcmp(argv[index], "--max-clients") == 0 && value)
+        {
+            max_clients = dgl_max(atoi(value), 1);
+            index++;
+        }
+        else { path = argv[index]; }
+    }
+
+    if(!path)
+    {
+        printf("Usage: %s <capture> [--iterations N] [--client] [--port P] [--max-clients N]\n", argv[0]);
+        return(1);
+    }
+
+    int32 fd = open(path, O_RDONLY);
+    struct stat info = {};
+    if(fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        printf("Failed opening the capture %s: %s\n", path, strerror(errno));
+        return(1);
+    }
+    usize file_size = cast(usize)info.st_size;
+    uint8 *file = cast(uint8 *)mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    usize memory_size = gigabytes(1);
+    uint8 *memory_block = cast(uint8 *)mmap(0, memory_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if(file == MAP_FAILED || memory_block == MAP_FAILED)
+    {
+        printf("Not enough memory available\n");
+        return(1);
+    }
+
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
+    Net_Capture capture = {};
+    if(!net_capture_parse(&arena, file, file_size, &capture))
+    {
+        printf("%s is no capture\n", path);
+        return(1);
+    }
+
+    if(server < 0) { server = (capture.flags & Net_Capture_File_Flag_Server) ? 1 : 0; }
+    if(port < 0) { port = server ? ZHC_SERVER_PORT : 0; }
+    net_replay_prepare(&arena, &capture, server, cast(uint16)port, max_clients);
+
+    printf("Replay of %s: %d records, %d received by the %s on port %d\n", path, capture.record_count,
+           net_replay.count, server ? "server" : "client", port);
+    printf("%10s %12s %12s %12s %12s %12s\n", "iteration", "ms", "datagrams", "messages", "ns/datagram", "MB/s");
+
+    Net_Replay_Stats best = {};
+    for(int32 iteration = 0; iteration < iterations; ++iteration)
+    {
+        Net_Replay_Stats stats = net_replay_run(&arena, 0, 0);
+        real64 ns_per_datagram = (stats.datagrams > 0) ? stats.elapsed_ms*1000000.0 / cast(real64)stats.datagrams : 0.0;
+        real64 megabytes_per_second = (stats.elapsed_ms > 0.0) ? cast(real64)stats.bytes / (stats.elapsed_ms*1000.0) : 0.0;
+        printf("%10d %12.3f %12llu %12llu %12.1f %12.1f\n", iteration, stats.elapsed_ms, stats.datagrams, stats.messages,
+               ns_per_datagram, megabytes_per_second);
+        if(iteration == 0 || stats.elapsed_ms < best.elapsed_ms) { best = stats; }
+    }
+
+    printf("best %.3f ms, %llu bytes, %llu replies dropped, %llu group datagrams skipped\n", best.elapsed_ms,
+           best.bytes, best.datagrams_sent, best.skipped);
+
+    return(0);
+}
@@ -1,15 +1,174 @@
 #include "zhc_lib.h"
 #include "zhc_crypto.cpp"
+#include "zhc_compress.cpp"
 #include "zhc_net.cpp"
 
 #define DGL_IMPLEMENTATION
 #include "dgl.h"
 
 #include "dgl_test_helpers.h"
+#include <sys/mman.h> /* mmap */
+
+// NOTE(dgl): captures all sent datagrams instead of sending them over a socket
+global struct
+{
+    int32 count;
+    int32 group_count;
+    usize bytes;
+    Zhc_Net_Address last_address;
+    Packet_Buffer last;
+    Packet_Buffer last_group;
+} sent_datagrams;
+
+ZHC_SEND_DATA(test_send_data)
+{
+    assert(buffer_size <= array_count(sent_datagrams.last.data), "Datagram too large");
+    sent_datagrams.count++;
+    sent_datagrams.bytes += buffer_size;
+    sent_datagrams.last_address = *target_address;
+    sent_datagrams.last.offset = buffer_size;
+    dgl_memcpy(sent_datagrams.last.data, buffer, buffer_size);
+}
+
+// NOTE(dgl): the tests control the monotonic clock
+global real64 test_time_ms;
+
+ZHC_GET_TIME_IN_MS(test_get_time_in_ms)
+{
+    return(test_time_ms);
+}
+
+// NOTE(dgl): datagrams which are returned by receive_data
+global struct
+{
+    int32 count;
+    int32 index;
+    Zhc_Net_Address address[16];
+    Packet_Buffer datagrams[16];
+} test_inbox;
+
+internal void
+test_inbox_push(Packet_Buffer *buffer, Zhc_Net_Address address, uint64 salt)
+{
+    assert(test_inbox.count < array_count(test_inbox.datagrams), "Test inbox is full");
+    Packet_Buffer *datagram = test_inbox.datagrams + test_inbox.count;
+    test_inbox.address[test_inbox.count++] = address;
+    *datagram = *buffer;
+    packet_buffer_set_salt(datagram, salt);
+}
+
+ZHC_RECEIVE_DATA(test_receive_data)
+{
+    usize result = 0;
+    if(test_inbox.index < test_inbox.count)
+    {
+        Packet_Buffer *datagram = test_inbox.datagrams + test_inbox.index;
+        *peer_address = test_inbox.address[test_inbox.index++];
+        assert(datagram->offset <= buffer_size, "Receive buffer too small");
+        dgl_memcpy(buffer, datagram->data, datagram->offset);
+        result = datagram->offset;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): clients receive the group datagrams of the inbox, if the unicast socket receives nothing
+ZHC_RECEIVE_DATA(test_receive_nothing)
+{
+    return(0);
+}
+
+ZHC_SEND_DATA(test_send_multicast_data)
+{
+    sent_datagrams.group_count++;
+    test_send_data(socket, target_address, buffer, buffer_size);
+    sent_datagrams.last_group = sent_datagrams.last;
+}
+
+// NOTE(dgl): counts the batches and forwards the datagrams to the functions above
+global struct
+{
+    int32 send_count;
+    int32 group_send_count;
+    int32 receive_count;
+    int32 last_count;
+} batch_calls;
+
+ZHC_SEND_DATA_BATCH(test_send_data_batch)
+{
+    batch_calls.send_count++;
+    batch_calls.last_count = count;
+    for(int32 index = 0; index < count; ++index)
+    {
+        test_send_data(socket, &datagrams[index].address, datagrams[index].data, datagrams[index].size);
+    }
+}
+
+ZHC_SEND_DATA_BATCH(test_send_multicast_data_batch)
+{
+    batch_calls.group_send_count++;
+    batch_calls.last_count = count;
+    for(int32 index = 0; index < count; ++index)
+    {
+        test_send_multicast_data(socket, &datagrams[index].address, datagrams[index].data, datagrams[index].size);
+    }
+}
+
+ZHC_RECEIVE_DATA_BATCH(test_receive_data_batch)
+{
+    int32 result = 0;
+    batch_calls.receive_count++;
+    while(result < count)
+    {
+        Zhc_Net_Datagram *datagram = datagrams + result;
+        datagram->size = test_receive_data(socket, &datagram->address, datagram->data, datagram->capacity);
+        if(datagram->size == 0) { break; }
+        result++;
+    }
+
+    return(result);
+}
+
+// NOTE(dgl): appends the ranges of the missing slices of a window mask (received slices are 1)
+// to an ack packet. The slices after the mask are missing.
+internal void
+test_append_ack_window(Packet_Buffer *buffer, uint8 *window, usize window_size)
+{
+    uint8 mask[(NET_WINDOW_SIZE / 8) + 1] = {};
+    dgl_memcpy(mask, window, dgl_min(window_size, array_count(mask)));
+    uint8 ranges[NET_ACK_RANGES_MAX_SIZE];
+    usize ranges_size = ack_ranges_encode(mask, array_count(mask), 0, NET_WINDOW_SIZE, ranges, array_count(ranges));
+    packet_buffer_append(buffer, ranges, ranges_size);
+}
+
+internal void
+connect_test_clients(Net_Context *ctx, Net_Conn_ID *ids, int32 count)
+{
+    Connection_List *conns = ctx->conns;
+    for(int32 index = 0; index < count; ++index)
+    {
+        Zhc_Net_Address address = parse_address("127.0.0.1", cast(uint16)(9000 + index));
+        Net_Conn_ID id = push_connection(conns, address, 0x1000 + cast(uint64)index);
+        conns->state[id] = Net_Conn_State_Connected;
+        ids[index] = id;
+    }
+}
 
 int
 main(int argc, char **argv)
 {
+    platform.send_data = test_send_data;
+    platform.send_multicast_data = test_send_multicast_data;
+    platform.receive_data = test_receive_data;
+    platform.get_time_in_ms = test_get_time_in_ms;
+
+    usize memory_size = megabytes(64);
+    uint8 *memory_block = dgl_cast(uint8 *)mmap(0, memory_size,
+                              PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    DGL_Mem_Arena arena = {};
+    dgl_mem_arena_init(&arena, memory_block, memory_size);
+
     DGL_BEGIN_TEST("bits_required returns the required bits for an integer");
     {
         DGL_EXPECT_int32(bits_required(1), ==, 1);
@@ -60,32 +219,2195 @@ main(int argc, char **argv)
     DGL_BEGIN_TEST("serializes packet");
     {
         Packet packet1 = {};
-        packet1.id = 0x9988;
+        packet1.id = 0x99;
         packet1.version = parse_version("1.2.3");
         packet1.type = Packet_Type_Request;
         packet1.salt = 0xFFFF00000000FFFF;
+        packet1.timestamp = 0x1234;
+        packet1.echo = 0x5678;
 
         uint8 memory[sizeof(packet1)] = {};
         Bitstream writer = stream_writer_init(memory, array_count(memory));
 
         usize count = serialize_packet(&writer, &packet1);
 
-        DGL_EXPECT(count, ==, 20, usize, "%zu");
-        DGL_EXPECT(writer.data[0], ==, 0x09988, uint32, "0x%X");
+        DGL_EXPECT(count, ==, 24, usize, "%zu");
+        DGL_EXPECT(writer.data[0], ==, 0x299, uint32, "0x%X");
         DGL_EXPECT(writer.data[1], ==, 0x10203, uint32, "0x%X");
         DGL_EXPECT(writer.data[2], ==, 0x0000FFFF, uint32, "0x%X");
         DGL_EXPECT(writer.data[3], ==, 0xFFFF0000, uint32, "0x%X");
-        DGL_EXPECT(writer.data[4], ==, 0x2, uint32, "0x%X");
+        DGL_EXPECT(writer.data[4], ==, 0x1234, uint32, "0x%X");
+        DGL_EXPECT(writer.data[5], ==, 0x5678, uint32, "0x%X");
 
         Packet packet2 = {};
         Bitstream reader = stream_reader_init(memory, array_count(memory));
 
         count = serialize_packet(&reader, &packet2);
-        DGL_EXPECT(count, ==, 20, usize, "%zu");
+        DGL_EXPECT(count, ==, 24, usize, "%zu");
         DGL_EXPECT_int32(packet2.id, ==, packet1.id);
         DGL_EXPECT_uint32(packet2.version, ==, packet1.version);
         DGL_EXPECT_uint32(packet2.type, ==, packet1.type);
         DGL_EXPECT_uint64(packet2.salt, ==, packet1.salt);
+        DGL_EXPECT_uint32(packet2.timestamp, ==, packet1.timestamp);
+        DGL_EXPECT_uint32(packet2.echo, ==, packet1.echo);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Connected packets carry the session instead of the version and the salt");
+    {
+        Packet packet1 = default_packet(Packet_Type_Slice);
+        packet1.salt = 0x1111222233334444;
+        packet1.timestamp = 0x1234;
+        packet1.echo = 0x5678;
+        packet1.slice.hash = 0xABCDEF01;
+        packet1.slice.index = 0xFFFF;
+
+        uint8 memory[sizeof(packet1)] = {};
+        Bitstream writer = stream_writer_init(memory, array_count(memory));
+        usize count = serialize_packet(&writer, &packet1);
+        DGL_EXPECT(count, ==, 20, usize, "%zu");
+        DGL_EXPECT(writer.data[2], ==, 0x22226666, uint32, "0x%X");
+        DGL_EXPECT(writer.data[3], ==, 0x1234, uint32, "0x%X");
+        DGL_EXPECT(writer.data[4], ==, 0x5678, uint32, "0x%X");
+
+        Packet packet2 = {};
+        Bitstream reader = stream_reader_init(memory, array_count(memory));
+        count = serialize_packet(&reader, &packet2);
+        DGL_EXPECT(count, ==, 20, usize, "%zu");
+        DGL_EXPECT_uint32(packet2.type, ==, Packet_Type_Slice);
+        DGL_EXPECT_uint64(packet2.salt, ==, 0);
+        DGL_EXPECT(packet2.session, ==, 0x22226666, uint32, "0x%X");
+        DGL_EXPECT_bool32(packet_salt_valid(&packet2, packet1.salt), ==, true);
+        DGL_EXPECT_bool32(packet_salt_valid(&packet2, packet1.salt + 1), ==, false);
+        DGL_EXPECT(packet2.slice.hash, ==, 0xABCDEF01, uint32, "0x%X");
+        DGL_EXPECT_uint32(packet2.slice.index, ==, 0xFFFF);
+        DGL_EXPECT_uint32(packet2.timestamp, ==, packet1.timestamp);
+        DGL_EXPECT_uint32(packet2.echo, ==, packet1.echo);
+
+        // NOTE(dgl): the patched fields are found by the type of the datagram
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, packet1);
+        packet_buffer_set_salt(&buffer, 0x5555666677778888);
+        packet_buffer_set_timestamps(&buffer, 1, 2);
+        reader = stream_reader_init(buffer.data, buffer.offset);
+        serialize_packet(&reader, &packet2);
+        DGL_EXPECT(packet2.session, ==, net_session(0x5555666677778888), uint32, "0x%X");
+        DGL_EXPECT_uint32(packet2.timestamp, ==, 1);
+        DGL_EXPECT_uint32(packet2.echo, ==, 2);
+        DGL_EXPECT(packet2.slice.hash, ==, 0xABCDEF01, uint32, "0x%X");
+
+        // NOTE(dgl): datagrams of other protocols or shorter than their header are no packets
+        DGL_EXPECT_uint32(serialized_packet_type(buffer.data, buffer.offset), ==, Packet_Type_Slice);
+        DGL_EXPECT_uint32(serialized_packet_type(buffer.data, buffer.offset - 1), ==, Packet_Type_Max);
+        buffer.data[0] = 0x34;
+        DGL_EXPECT_uint32(serialized_packet_type(buffer.data, buffer.offset), ==, Packet_Type_Max);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("chunk_complete checks if all slice bits are set");
+    {
+        uint8 ack[3] = {0xFF, 0xFF, 0x03};
+        DGL_EXPECT_bool32(chunk_complete(ack, array_count(ack), 18), ==, true);
+
+        ack[1] = 0xEF;
+        DGL_EXPECT_bool32(chunk_complete(ack, array_count(ack), 18), ==, false);
+
+        ack[1] = 0xFF;
+        ack[2] = 0x01;
+        DGL_EXPECT_bool32(chunk_complete(ack, array_count(ack), 18), ==, false);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Handshake packets are kept in the packet ring until the connection is established");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Zhc_Net_Address address = parse_address("127.0.0.1", 9000);
+        Net_Conn_ID id = push_connection(ctx->conns, address, 0x1000);
+        Net_Packet_Ring *ring = ctx->conns->outbound + id;
+
+        sent_datagrams = {};
+        queue_handshake_packet(ctx, id, default_packet(Packet_Type_Request));
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 1);
+
+        // NOTE(dgl): other packets do not replace the handshake packet
+        Packet_Group group = {};
+        group.salt = 0xABCD;
+        send_group_packet(ctx, id, group);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 1);
+
+        // NOTE(dgl): the handshake timer resends the packet
+        test_time_ms = NET_INITIAL_RTO_MS - NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+        test_time_ms = NET_INITIAL_RTO_MS + NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 3);
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Request);
+        DGL_EXPECT_uint64(packet.salt, ==, 0x1000);
+        Net_Outbound *entry = ring->entries + (ring->read % NET_PACKET_RING_SIZE);
+        DGL_EXPECT_uint32(entry->seq, ==, 0);
+        DGL_EXPECT_uint32(entry->send_count, ==, 2);
+        DGL_EXPECT(entry->sent_at, ==, test_time_ms, real64, "%f");
+
+        // NOTE(dgl): a newer handshake packet replaces the older one
+        packet_queue(ctx, id, default_packet(Packet_Type_Challenge_Resp), Net_Outbound_Flag_Keep|Net_Outbound_Flag_Handshake);
+        net_flush_packets(ctx, id);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 1);
+        entry = ring->entries + (ring->read % NET_PACKET_RING_SIZE);
+        DGL_EXPECT_uint32(entry->type, ==, Packet_Type_Challenge_Resp);
+        DGL_EXPECT_uint32(entry->seq, ==, 2);
+
+        // NOTE(dgl): more packets than the ring size are flushed while queueing
+        ctx->conns->state[id] = Net_Conn_State_Connected;
+        sent_datagrams = {};
+        for(int32 index = 0; index < 3*NET_PACKET_RING_SIZE; ++index)
+        {
+            packet_queue(ctx, id, default_packet(Packet_Type_Empty), 0);
+        }
+        net_flush_packets(ctx, id);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 3*NET_PACKET_RING_SIZE);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 0);
+
+        // NOTE(dgl): all buffers are back in the pool
+        int32 free_count = 0;
+        for(DGL_Mem_Pool_Free_Node *node = ctx->packet_pool.head; node; node = node->next) { free_count++; }
+        DGL_EXPECT_int32(free_count, ==, cast(int32)(ctx->packet_pool.size / ctx->packet_pool.chunk_size));
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Peers with another version are denied during the handshake");
+    {
+        Zhc_Net_Address client_address = parse_address("127.0.0.1", 9000);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        uint32 other_version = parse_version(ZHC_VERSION) + 1;
+        Net_Message message = {};
+        Packet packet = {};
+        Bitstream reader = {};
+
+        // NOTE(dgl): the server denies a challenge with another version and drops the connection
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID id = push_connection(server->conns, client_address, 0x1000);
+        server->conns->state[id] = Net_Conn_State_Connecting;
+        Packet challenge = default_packet(Packet_Type_Challenge);
+        challenge.version = other_version;
+        Packet_Buffer datagram = {};
+        packet_buffer_write(&datagram, challenge);
+        test_inbox = {};
+        test_inbox_push(&datagram, client_address, 0x1000);
+        sent_datagrams = {};
+        net_recv_message(&arena, server, &message);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Denied);
+        DGL_EXPECT_uint32(server->conns->state[id], ==, Net_Conn_State_Disconnected);
+
+        // NOTE(dgl): the same version is answered with the challenge response
+        id = push_connection(server->conns, client_address, 0x1000);
+        server->conns->state[id] = Net_Conn_State_Connecting;
+        datagram = {};
+        packet_buffer_write(&datagram, default_packet(Packet_Type_Challenge));
+        test_inbox = {};
+        test_inbox_push(&datagram, client_address, 0x1000);
+        sent_datagrams = {};
+        net_recv_message(&arena, server, &message);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Challenge_Resp);
+        DGL_EXPECT_uint32(server->conns->state[id], ==, Net_Conn_State_Connecting);
+
+        // NOTE(dgl): the client denies a request with another version without creating a connection
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Packet request = default_packet(Packet_Type_Request);
+        request.version = other_version;
+        datagram = {};
+        packet_buffer_write(&datagram, request);
+        test_inbox = {};
+        test_inbox_push(&datagram, server_address, 0x2000);
+        sent_datagrams = {};
+        net_recv_message(&arena, client, &message);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Denied);
+        DGL_EXPECT_int32(get_connection(client->conns, server_address), <, 0);
+
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Multicast prepares a chunk once and fans out the datagrams to all connections");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        Net_Conn_ID ids[4] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+
+        uint8 payload[5000];
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)index; }
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        sent_datagrams = {};
+        net_multicast_message(ctx, message);
+        net_process_timers(ctx);
+
+        Net_Chunk *chunk = ctx->conns->chunk[ids[0]];
+        DGL_EXPECT_ptr(chunk, !=, 0);
+        DGL_EXPECT_int32(chunk->ref_count, ==, 4);
+        DGL_EXPECT_uint32(chunk->info.slice_count, ==, 5);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 4*(1 + 5));
+
+        // NOTE(dgl): the last datagram is the last slice for the last connection in the list
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        usize header_size = serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Slice);
+        DGL_EXPECT_uint32(packet.slice.index, ==, 4);
+        DGL_EXPECT_uint32(packet.slice.hash, ==, chunk->info.hash);
+        DGL_EXPECT_uint32(packet.session, ==, net_session(0x1003));
+        DGL_EXPECT_uint32(sent_datagrams.last_address.port, ==, 9003);
+        DGL_EXPECT_usize(sent_datagrams.last.offset - header_size, ==, chunk->info.last_slice_size);
+
+        // NOTE(dgl): sending the same payload again reuses the prepared chunk
+        net_send_message(ctx, ids[1], message);
+        DGL_EXPECT_ptr(ctx->conns->chunk[ids[1]], ==, chunk);
+        DGL_EXPECT_int32(chunk->ref_count, ==, 4);
+
+        message.payload_size = 4000;
+        net_send_message(ctx, ids[1], message);
+        DGL_EXPECT_ptr(ctx->conns->chunk[ids[1]], !=, chunk);
+        DGL_EXPECT_int32(chunk->ref_count, ==, 3);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Server shards share the prepared chunks and drop the chunks another shard replaced");
+    {
+        Net_Context *shards[2] = {};
+        net_init_server_shards(&arena, 2*NET_CHUNK_STORE_COUNT, shards, array_count(shards));
+        Net_Context *first = shards[0];
+        Net_Context *second = shards[1];
+        first->fec_group_size = 0;
+        second->fec_group_size = 0;
+        DGL_EXPECT_ptr(second->chunk_store, ==, first->chunk_store);
+        DGL_EXPECT_bool32(first->chunk_store->shared, ==, true);
+        DGL_EXPECT_int32(second->socket.reuse_port_count, ==, 2);
+
+        Net_Conn_ID first_ids[2*(NET_CHUNK_STORE_COUNT - 1)] = {};
+        Net_Conn_ID second_id = 0;
+        connect_test_clients(first, first_ids, array_count(first_ids));
+        connect_test_clients(second, &second_id, 1);
+
+        uint8 payload[5000];
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)index; }
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        sent_datagrams = {};
+        net_multicast_message(first, message);
+        net_multicast_message(second, message);
+        net_process_timers(first);
+        net_process_timers(second);
+
+        Net_Chunk *chunk = first->conns->chunk[first_ids[0]];
+        DGL_EXPECT_ptr(second->conns->chunk[second_id], ==, chunk);
+        DGL_EXPECT_int32(chunk->ref_count, ==, array_count(first_ids) + 1);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, (array_count(first_ids) + 1)*(1 + 5));
+
+        // NOTE(dgl): the session is patched into a copy, the prepared datagrams stay unchanged
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.slice.index, ==, 4);
+        DGL_EXPECT_uint32(packet.session, ==, net_session(0x1000));
+        reader = stream_reader_init(chunk->slices[4].data, chunk->slices[4].offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.session, ==, 0);
+
+        // NOTE(dgl): the connections of the first shard move to other payloads in pairs, until all chunks
+        // are referenced. The next payload replaces the chunk, which is only referenced by the second shard.
+        for(int32 index = 0; index < array_count(first_ids); ++index)
+        {
+            message.payload_size = 4000 - 100*cast(usize)(index / 2);
+            net_send_message(first, first_ids[index], message);
+        }
+        DGL_EXPECT_int32(chunk->ref_count, ==, 1);
+        message.payload_size = 3000;
+        net_send_message(first, first_ids[0], message);
+        DGL_EXPECT_ptr(first->conns->chunk[first_ids[0]], ==, chunk);
+        DGL_EXPECT_int32(chunk->ref_count, ==, 1);
+
+        // NOTE(dgl): the second shard drops the datagrams of the replaced chunk and the chunk itself
+        sent_datagrams = {};
+        queue_prepared_datagram(second, second_id, chunk->slices, Packet_Type_Slice);
+        net_flush_packets(second, second_id);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+
+        test_time_ms += 1000.0;
+        net_process_timers(second);
+        DGL_EXPECT_ptr(second->conns->chunk[second_id], ==, 0);
+        DGL_EXPECT_int32(chunk->ref_count, ==, 1);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+
+        // NOTE(dgl): the discovery reaches both shards, but only the shard of the peer replies
+        Packet_Buffer discovery = {};
+        packet_buffer_write(&discovery, default_packet(Packet_Type_Server_Discovery));
+        Zhc_Net_Address peers[2] = {parse_address("127.0.0.1", 9100), parse_address("127.0.0.1", 9101)};
+        for(int32 shard = 0; shard < array_count(shards); ++shard)
+        {
+            test_inbox = {};
+            test_inbox_push(&discovery, peers[0], 0);
+            test_inbox_push(&discovery, peers[1], 0);
+            Net_Message received = {};
+            net_recv_message(&arena, shards[shard], &received);
+            DGL_EXPECT_int32(get_connection(shards[shard]->conns, peers[shard]), >=, 0);
+            DGL_EXPECT_int32(get_connection(shards[shard]->conns, peers[1 - shard]), ==, -1);
+        }
+        test_inbox = {};
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Chunks and compressed payloads which another shard prepares are not replaced");
+    {
+        Net_Context *shards[2] = {};
+        net_init_server_shards(&arena, NET_DEFAULT_MAX_CLIENTS, shards, array_count(shards));
+        Net_Context *ctx = shards[0];
+        Net_Chunk_Store *store = ctx->chunk_store;
+        Net_Compress_Cache *cache = ctx->compress_cache;
+
+        // NOTE(dgl): the other shard prepares all chunks but the last and compresses into the first cache entry
+        for(int32 index = 0; index < store->count - 1; ++index) { store->chunks[index].generation++; }
+        bool32 reserved = false;
+        Net_Compressed_Payload *entry = compress_cache_acquire(cache, 0x1234, Net_Codec_LZ, 100, &reserved);
+        DGL_EXPECT_bool32(reserved, ==, true);
+        DGL_EXPECT_ptr(entry, ==, cache->payloads);
+
+        char *line = "How great thou art, how great thou art\n";
+        usize line_size = strlen(line);
+        uint8 payload[20000] = {};
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)line[index % line_size]; }
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        Net_Chunk *chunk = net_prepare_chunk(ctx, message, Net_Codec_LZ);
+        DGL_EXPECT_ptr(chunk, ==, store->chunks + store->count - 1);
+        DGL_EXPECT_uint32(chunk->generation & 1, ==, 0);
+        DGL_EXPECT_uint32(ctx->prepared_generation, ==, chunk->generation);
+        DGL_EXPECT_uint32(chunk->info.codec, ==, Net_Codec_LZ);
+        DGL_EXPECT_usize(cache->payloads[1].size, >, 0);
+        DGL_EXPECT_int32(cache->payloads[1].ref_count, ==, 0);
+        DGL_EXPECT_int32(entry->ref_count, ==, 1);
+        DGL_EXPECT_uint64(entry->last_used, ==, 0);
+
+        // NOTE(dgl): the reserved entry is found after the other shard released it
+        compress_cache_release(cache, entry, reserved);
+        DGL_EXPECT_ptr(compress_cache_acquire(cache, 0x1234, Net_Codec_LZ, 100, &reserved), ==, entry);
+        DGL_EXPECT_bool32(reserved, ==, false);
+        compress_cache_release(cache, entry, reserved);
+        DGL_EXPECT_int32(entry->ref_count, ==, 0);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Connections receive different files at once and release the chunk when the transfer is complete");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        Net_Conn_ID ids[NET_CHUNK_STORE_COUNT - 1] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+        Connection_List *conns = ctx->conns;
+
+        uint8 payload[5000];
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)index; }
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+
+        Net_Chunk *chunks[array_count(ids)] = {};
+        uint32 generations[array_count(ids)] = {};
+        for(int32 index = 0; index < array_count(ids); ++index)
+        {
+            message.payload_size = 5000 - 500*cast(usize)index;
+            net_send_message(ctx, ids[index], message);
+            chunks[index] = conns->chunk[ids[index]];
+            generations[index] = chunks[index]->generation;
+            DGL_EXPECT_int32(chunks[index]->ref_count, ==, 1);
+        }
+        DGL_EXPECT_ptr(chunks[0], !=, chunks[1]);
+        DGL_EXPECT_ptr(chunks[1], !=, chunks[2]);
+
+        // NOTE(dgl): the first connection acked all slices
+        Packet ack = default_packet(Packet_Type_Ack);
+        ack.ack.hash = chunks[0]->info.hash;
+        ack.ack.base = chunks[0]->info.slice_count;
+        Packet_Buffer ack_buffer = {};
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, 0, 0);
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+        Net_Message received = {};
+        net_recv_message(&arena, ctx, &received);
+        DGL_EXPECT_ptr(conns->chunk[ids[0]], ==, 0);
+        DGL_EXPECT_int32(chunks[0]->ref_count, ==, 0);
+
+        // NOTE(dgl): the next files use the free chunks, the files in flight are not replaced
+        for(int32 round = 0; round < 2; ++round)
+        {
+            message.payload_size = 2500 - 100*cast(usize)round;
+            net_send_message(ctx, ids[0], message);
+        }
+        DGL_EXPECT_ptr(conns->chunk[ids[0]], ==, chunks[0]);
+        for(int32 index = 1; index < array_count(ids); ++index)
+        {
+            DGL_EXPECT_ptr(conn_chunk(conns, ids[index]), ==, chunks[index]);
+            DGL_EXPECT_uint32(chunks[index]->generation, ==, generations[index]);
+            DGL_EXPECT_int32(chunks[index]->ref_count, ==, 1);
+        }
+
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Multicast sends chunks once to the group for connections which joined the group");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        Net_Conn_ID ids[4] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        ctx->conns->group_joined[ids[0]] = true;
+        ctx->conns->group_joined[ids[1]] = true;
+        ctx->conns->group_joined[ids[2]] = true;
+
+        uint8 payload[5000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        sent_datagrams = {};
+        net_multicast_message(ctx, message);
+        net_process_timers(ctx);
+
+        Net_Chunk *chunk = ctx->conns->chunk[ids[0]];
+        DGL_EXPECT_int32(chunk->ref_count, ==, 4);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 5);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2*(1 + 5));
+
+        // NOTE(dgl): the last slice goes to the connection which did not join the group
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.session, ==, net_session(0x1003));
+        DGL_EXPECT_uint32(sent_datagrams.last_address.port, ==, 9003);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Group datagrams carry no timestamps and clients take no timestamps from the group");
+    {
+        test_time_ms = 1000.0;
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        ctx->congestion_control = false;
+        Net_Conn_ID ids[2] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+        Connection_List *conns = ctx->conns;
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        conns->group_joined[ids[1]] = true;
+
+        uint8 payload[2500] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        // NOTE(dgl): the unicast send patches the timestamps into the prepared datagrams, the group copy is sent afterwards
+        conns->peer_timestamp[ids[0]] = 777;
+        net_send_message(ctx, ids[0], message);
+        net_process_timers(ctx);
+        Net_Chunk *chunk = conns->chunk[ids[0]];
+        uint32 slice_count = chunk->info.slice_count;
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(chunk->slices[slice_count - 1].data, chunk->slices[slice_count - 1].offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.timestamp, !=, 0);
+
+        sent_datagrams = {};
+        net_multicast_message(ctx, message);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + cast(int32)slice_count);
+        reader = stream_reader_init(sent_datagrams.last_group.data, sent_datagrams.last_group.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Slice);
+        DGL_EXPECT_uint32(packet.timestamp, ==, 0);
+        DGL_EXPECT_uint32(packet.echo, ==, 0);
+
+        // NOTE(dgl): a group datagram with timestamps does not change the round trip of the server connection
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+        client->multicast.enabled = true;
+        client->multicast.salt = 0xABCD;
+        client->multicast.socket.handle.no_error = true;
+
+        Packet_Buffer stale = chunk->slices[0];
+        packet_buffer_set_timestamps(&stale, 555, net_timestamp(test_time_ms) - 10);
+        platform.receive_data = test_receive_nothing;
+        platform.receive_multicast_data = test_receive_data;
+        test_inbox = {};
+        test_inbox_push(&stale, ctx->multicast.group, 0xABCD);
+        Net_Message received = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_uint32(client->conns->rtt[id].sample_count, ==, 0);
+        DGL_EXPECT_uint32(client->conns->peer_timestamp[id], ==, 0);
+
+        platform.receive_data = test_receive_data;
+        platform.receive_multicast_data = 0;
+        test_inbox = {};
+        test_time_ms = 0.0;
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The first window of the group is paced by the rate of the group and uses up the send budget");
+    {
+        test_time_ms = 1000.0;
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        ctx->congestion_control = false;
+        Net_Conn_ID ids[2] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+        Connection_List *conns = ctx->conns;
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        ctx->multicast.max_rate = 0.5f;
+        conns->group_joined[ids[0]] = true;
+        conns->group_joined[ids[1]] = true;
+
+        uint8 payload[20000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        // NOTE(dgl): the bucket holds the slices of one tick
+        sent_datagrams = {};
+        net_multicast_message(ctx, message);
+        Net_Chunk *chunk = conns->chunk[ids[0]];
+        int32 slice_count = cast(int32)chunk->info.slice_count;
+        DGL_EXPECT_int32(slice_count, >, 12);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 5);
+        DGL_EXPECT_uint32(conns->window_next[ids[1]], ==, 5);
+
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 5);
+        test_time_ms += NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 10);
+
+        // NOTE(dgl): without a rate the budget of the tick limits the slices. The timer
+        // of the group expires in the second tick after it was scheduled.
+        ctx->multicast.max_rate = 0.0f;
+        ctx->send_budget_per_tick = 2*chunk->slices[0].offset;
+        ctx->scheduler.budget = 0;
+        test_time_ms += NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 10);
+        test_time_ms += NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 12);
+        DGL_EXPECT_ptr(ctx->multicast.chunk, ==, chunk);
+
+        ctx->send_budget_per_tick = 0;
+        test_time_ms += 2*NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + slice_count);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1 + slice_count);
+        DGL_EXPECT_uint32(conns->window_next[ids[0]], ==, chunk->info.slice_count);
+        DGL_EXPECT_ptr(ctx->multicast.chunk, ==, 0);
+
+        test_time_ms = 0.0;
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Repairs of the group are merged per slice and sent once to the group if enough connections miss them");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        ctx->congestion_control = false;
+        Net_Conn_ID ids[4] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+        Connection_List *conns = ctx->conns;
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        conns->group_joined[ids[0]] = true;
+        conns->group_joined[ids[1]] = true;
+        conns->group_joined[ids[2]] = true;
+
+        uint8 payload[5000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        // NOTE(dgl): the slices before the last received slice are lost and repaired right away
+        test_time_ms += 1000.0;
+        net_multicast_message(ctx, message);
+        net_process_timers(ctx);
+        Net_Chunk *chunk = conns->chunk[ids[0]];
+        DGL_EXPECT_uint32(chunk->info.slice_count, ==, 5);
+
+        // NOTE(dgl): slice 1 is missed by the connections 0, 1 and 3, slice 2 by 0 and 2, slice 3 by 1
+        uint8 received_masks[4] = {0x19, 0x15, 0x1B, 0x1D};
+        test_inbox = {};
+        for(int32 index = 0; index < array_count(ids); ++index)
+        {
+            Packet ack = default_packet(Packet_Type_Ack);
+            ack.ack.hash = chunk->info.hash;
+            Packet_Buffer ack_buffer = {};
+            packet_buffer_write(&ack_buffer, ack);
+            test_append_ack_window(&ack_buffer, received_masks + index, 1);
+            test_inbox_push(&ack_buffer, conns->address[ids[index]], conns->salt[ids[index]]);
+        }
+
+        // NOTE(dgl): the connection which did not join the group is repaired right away
+        ctx->stats = {};
+        sent_datagrams = {};
+        Net_Message received = {};
+        net_recv_message(&arena, ctx, &received);
+        usize slice_size = chunk->slices[1].offset;
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        DGL_EXPECT_uint32(sent_datagrams.last_address.port, ==, 9003);
+        DGL_EXPECT_ptr(ctx->repair.chunk, ==, chunk);
+        DGL_EXPECT_uint64(ctx->stats.repair_bytes_requested, ==, 6*slice_size);
+        DGL_EXPECT_uint64(ctx->stats.repair_bytes_sent, ==, slice_size);
+
+        // NOTE(dgl): slice 1 and 2 are sent to the group, slice 3 to connection 1
+        sent_datagrams = {};
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+        test_time_ms += NET_REPAIR_DELAY_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 3);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 2);
+        DGL_EXPECT_uint32(sent_datagrams.last_address.port, ==, 9001);
+        DGL_EXPECT_ptr(ctx->repair.chunk, ==, 0);
+        DGL_EXPECT_uint64(ctx->stats.repair_bytes_sent, ==, 4*slice_size);
+
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Slice);
+        DGL_EXPECT_uint32(packet.slice.index, ==, 3);
+
+        // NOTE(dgl): clients do not ack the group repairs of slices they already received
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+        client->multicast.enabled = true;
+        client->multicast.salt = 0xABCD;
+        client->multicast.socket.handle.no_error = true;
+        platform.receive_multicast_data = test_receive_nothing;
+
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        test_inbox_push(chunk->slices + 0, server_address, 0x42);
+        test_inbox_push(chunk->slices + 1, server_address, 0x42);
+        net_recv_message(&arena, client, &received);
+
+        platform.receive_data = test_receive_nothing;
+        platform.receive_multicast_data = test_receive_data;
+        test_inbox = {};
+        test_inbox_push(chunk->slices + 1, ctx->multicast.group, 0xABCD);
+        sent_datagrams = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+        DGL_EXPECT_uint32(client->received_count, ==, 2);
+
+        platform.receive_data = test_receive_data;
+        platform.receive_multicast_data = 0;
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Flushed packet rings and the group datagrams are sent and received in batches");
+    {
+        platform.send_data_batch = test_send_data_batch;
+        platform.send_multicast_data_batch = test_send_multicast_data_batch;
+        platform.receive_data_batch = test_receive_data_batch;
+
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 0;
+        Net_Conn_ID ids[2] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        ctx->conns->group_joined[ids[0]] = true;
+
+        uint8 payload[5000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        // NOTE(dgl): the chunk packet and the slices for the group are one batch. The connection which
+        // did not join the group gets the chunk packet and the scheduler sends one batch per round.
+        sent_datagrams = {};
+        batch_calls = {};
+        net_multicast_message(ctx, message);
+        DGL_EXPECT_int32(batch_calls.group_send_count, ==, 1);
+        DGL_EXPECT_int32(batch_calls.send_count, ==, 1);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1 + 5);
+
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(batch_calls.send_count, ==, 1 + 2);
+        DGL_EXPECT_int32(batch_calls.last_count, ==, 5 - NET_SEND_QUANTUM / NET_MTU_SIZE);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2*(1 + 5));
+
+        // NOTE(dgl): all received datagrams are handled with one batch. The second call finds the socket empty.
+        Packet_Buffer discovery = {};
+        packet_buffer_write(&discovery, default_packet(Packet_Type_Server_Discovery));
+        test_inbox = {};
+        for(int32 index = 0; index < 3; ++index)
+        {
+            test_inbox_push(&discovery, parse_address("127.0.0.1", cast(uint16)(9100 + index)), 0);
+        }
+        Net_Message received = {};
+        net_recv_message(&arena, ctx, &received);
+        DGL_EXPECT_int32(batch_calls.receive_count, ==, 2);
+        DGL_EXPECT_int32(ctx->conns->free_count, ==, NET_DEFAULT_MAX_CLIENTS - 2 - 3);
+
+        platform.send_data_batch = 0;
+        platform.send_multicast_data_batch = 0;
+        platform.receive_data_batch = 0;
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Prepared chunks contain one parity slice per fec group");
+    {
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        ctx->fec_group_size = 4;
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+
+        uint8 payload[5000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        sent_datagrams = {};
+        net_send_message(ctx, ids[0], message);
+        net_process_timers(ctx);
+
+        // NOTE(dgl): 5 slices are protected by 2 parity slices. The last one only covers the last slice.
+        Net_Chunk *chunk = ctx->conns->chunk[ids[0]];
+        DGL_EXPECT_uint32(chunk->info.fec_group_size, ==, 4);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1 + 5 + 2);
+        DGL_EXPECT_usize(chunk->parity[0].offset, ==, chunk->slices[0].offset);
+        DGL_EXPECT_usize(chunk->parity[1].offset, ==, chunk->slices[4].offset);
+
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Parity);
+        DGL_EXPECT_uint32(packet.parity.index, ==, 1);
+        DGL_EXPECT_uint32(packet.parity.hash, ==, chunk->info.hash);
+
+        // NOTE(dgl): changing the group size prepares the chunk again
+        ctx->fec_group_size = 0;
+        net_send_message(ctx, ids[0], message);
+        DGL_EXPECT_ptr(ctx->conns->chunk[ids[0]], !=, chunk);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Clients rebuild lost slices from the parity slices");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 4;
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        uint8 payload[5000];
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)(index * 7); }
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+        Net_Chunk *chunk = net_prepare_chunk(server, message, Net_Codec_None);
+
+        // NOTE(dgl): slice 1 is lost in the first group and the last slice in the second group
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        test_inbox_push(chunk->slices + 0, server_address, 0x42);
+        test_inbox_push(chunk->slices + 2, server_address, 0x42);
+        test_inbox_push(chunk->slices + 3, server_address, 0x42);
+        test_inbox_push(chunk->parity + 0, server_address, 0x42);
+        test_inbox_push(chunk->parity + 1, server_address, 0x42);
+
+        Net_Message received = {};
+        Net_Conn_ID result = net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(result, ==, id);
+        DGL_EXPECT_uint32(received.type, ==, Net_Message_Data_Res);
+        DGL_EXPECT_usize(received.payload_size, ==, array_count(payload));
+        DGL_EXPECT_int32(memcmp(received.payload, payload, array_count(payload)), ==, 0);
+        DGL_EXPECT_uint8(client->ack_mask[0], ==, 0x1F);
+
+        // NOTE(dgl): two lost slices in one group cannot be rebuilt
+        message.payload_size = 4000;
+        chunk = net_prepare_chunk(server, message, Net_Codec_None);
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        test_inbox_push(chunk->slices + 0, server_address, 0x42);
+        test_inbox_push(chunk->slices + 3, server_address, 0x42);
+        test_inbox_push(chunk->parity + 0, server_address, 0x42);
+
+        sent_datagrams = {};
+        result = net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(result, ==, -1);
+        DGL_EXPECT_uint8(client->ack_mask[0], ==, 0x09);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Clients ignore slices outside of the chunk");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        uint8 payload[3000] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+        Net_Chunk *chunk = net_prepare_chunk(server, message, Net_Codec_None);
+
+        // NOTE(dgl): the first slice with the index right after the chunk and an index beyond the receive buffer
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(chunk->slices[0].data, chunk->slices[0].offset);
+        serialize_packet(&reader, &packet);
+        usize header_size = packet_header_size(Packet_Type_Slice);
+        uint32 indices[2] = {chunk->info.slice_count, 0xFFFF};
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        for(uint32 index = 0; index < array_count(indices); ++index)
+        {
+            Packet_Buffer forged = {};
+            packet.slice.index = indices[index];
+            packet_buffer_write(&forged, packet);
+            packet_buffer_append(&forged, chunk->slices[0].data + header_size, chunk->slices[0].offset - header_size);
+            test_inbox_push(&forged, server_address, 0x42);
+        }
+
+        Net_Message received = {};
+        Net_Conn_ID result = net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(result, ==, -1);
+        DGL_EXPECT_uint32(client->chunk_info.hash, ==, chunk->info.hash);
+        DGL_EXPECT_uint32(client->received_count, ==, 0);
+        DGL_EXPECT_uint8(client->ack_mask[0], ==, 0);
+
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Chunks larger than the window are sent as the acks move the window forward");
+    {
+        // NOTE(dgl): without congestion control and send budget the whole window is sent at once
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        server->congestion_control = false;
+        server->send_budget_per_tick = 0;
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload_size = megabytes(2);
+        message.payload = dgl_mem_arena_push_array(&arena, uint8, message.payload_size);
+        for(usize index = 0; index < message.payload_size; ++index) { message.payload[index] = cast(uint8)(index * 13); }
+
+        sent_datagrams = {};
+        net_send_message(server, ids[0], message);
+        net_process_timers(server);
+        Net_Chunk *chunk = server->conns->chunk[ids[0]];
+        DGL_EXPECT_uint32(chunk->info.slice_count, >, 3*NET_WINDOW_SIZE);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1 + NET_WINDOW_SIZE);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, NET_WINDOW_SIZE);
+
+        // NOTE(dgl): the client received everything before slice 100 and everything
+        // in the window except slice 103.
+        Packet ack = default_packet(Packet_Type_Ack);
+        ack.ack.hash = chunk->info.hash;
+        ack.ack.base = 100;
+        uint8 window[NET_WINDOW_SIZE / 8] = {};
+        dgl_memset(window, 0xFF, array_count(window));
+        window[0] = 0xF7;
+        Packet_Buffer ack_buffer = {};
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        sent_datagrams = {};
+        Net_Message received = {};
+        net_recv_message(&arena, server, &received);
+        net_process_timers(server);
+
+        // NOTE(dgl): slice 103 is resent and the slices up to 100 + NET_WINDOW_SIZE are sent
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1 + 100);
+        DGL_EXPECT_uint32(server->conns->window_base[ids[0]], ==, 100);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, 100 + NET_WINDOW_SIZE);
+
+        // NOTE(dgl): an older ack does not move the window back
+        ack.ack.base = 50;
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        sent_datagrams = {};
+        net_recv_message(&arena, server, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+        DGL_EXPECT_uint32(server->conns->window_base[ids[0]], ==, 100);
+
+        // NOTE(dgl): the client grows its receive buffers and acks the window after the first missing slice
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        test_inbox_push(chunk->slices + 0, server_address, 0x42);
+        test_inbox_push(chunk->slices + 1, server_address, 0x42);
+        test_inbox_push(chunk->slices + 2, server_address, 0x42);
+        test_inbox_push(chunk->slices + 5, server_address, 0x42);
+
+        sent_datagrams = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &received), ==, -1);
+        DGL_EXPECT_usize(client->chunk_buffer_size, >=, message.payload_size);
+
+        Packet client_ack = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        usize header_size = serialize_packet(&reader, &client_ack);
+        DGL_EXPECT_uint32(client_ack.type, ==, Packet_Type_Ack);
+        DGL_EXPECT_uint32(client_ack.ack.base, ==, 3);
+
+        // NOTE(dgl): the gap before slice 5 is acked right away. The ack contains two ranges,
+        // slice 3 and 4 and the slices after slice 5.
+        uint8 client_window[(NET_WINDOW_SIZE / 8) + 1];
+        DGL_EXPECT_usize(sent_datagrams.last.offset - header_size, ==, sizeof(uint32)*2);
+        DGL_EXPECT_bool32(ack_ranges_decode(sent_datagrams.last.data + header_size, sent_datagrams.last.offset - header_size,
+                                            NET_WINDOW_SIZE, client_window, array_count(client_window)), ==, true);
+        DGL_EXPECT_uint8(client_window[0], ==, 0x04);
+        DGL_EXPECT_uint8(client_window[1], ==, 0x00);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Clients delay the chunk acks and ack gaps right away");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload_size = kilobytes(64);
+        message.payload = dgl_mem_arena_push_array(&arena, uint8, message.payload_size);
+        Net_Chunk *chunk = net_prepare_chunk(server, message, Net_Codec_None);
+
+        // NOTE(dgl): a few slices are acked after the delay
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        for(int32 index = 0; index < 4; ++index) { test_inbox_push(chunk->slices + index, server_address, 0x42); }
+        sent_datagrams = {};
+        Net_Message received = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+
+        test_time_ms += NET_ACK_DELAY_MS + NET_TIMER_TICK_MS;
+        net_process_timers(client);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        Packet ack = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &ack);
+        DGL_EXPECT_uint32(ack.type, ==, Packet_Type_Ack);
+        DGL_EXPECT_uint32(ack.ack.base, ==, 4);
+
+        // NOTE(dgl): every NET_ACK_SLICE_COUNT slices are acked right away
+        test_inbox = {};
+        for(int32 index = 4; index < 4 + NET_ACK_SLICE_COUNT; ++index) { test_inbox_push(chunk->slices + index, server_address, 0x42); }
+        sent_datagrams = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+
+        // NOTE(dgl): a gap is acked right away, the slice before the gap is the base
+        uint32 gap = 4 + NET_ACK_SLICE_COUNT;
+        test_inbox = {};
+        test_inbox_push(chunk->slices + gap + 1, server_address, 0x42);
+        sent_datagrams = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &ack);
+        DGL_EXPECT_uint32(ack.ack.base, ==, gap);
+
+        // NOTE(dgl): the next slices are delayed again
+        test_inbox = {};
+        test_inbox_push(chunk->slices + gap + 2, server_address, 0x42);
+        sent_datagrams = {};
+        net_recv_message(&arena, client, &received);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+        DGL_EXPECT_uint32(client->received_count, ==, gap + 2);
+
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Ack ranges contain the missing slices and the last range reaches to the end of the window");
+    {
+        // NOTE(dgl): every second slice is missing, these are more ranges than fit into the ack
+        uint8 mask[(NET_WINDOW_SIZE / 8) + 1] = {};
+        dgl_memset(mask, 0x55, array_count(mask));
+        uint8 ranges[NET_ACK_RANGES_MAX_SIZE];
+        usize ranges_size = ack_ranges_encode(mask, array_count(mask), 8, 100, ranges, array_count(ranges));
+        DGL_EXPECT_usize(ranges_size, <=, NET_ACK_RANGES_MAX_SIZE);
+
+        uint8 window[(NET_WINDOW_SIZE / 8) + 1];
+        DGL_EXPECT_bool32(ack_ranges_decode(ranges, ranges_size, 100, window, array_count(window)), ==, true);
+        DGL_EXPECT_uint8(window[0], ==, 0x55);
+        DGL_EXPECT_uint8(window[3], ==, 0x55);
+        DGL_EXPECT_uint8(window[4], ==, 0x00);
+        DGL_EXPECT_uint8(window[12], ==, 0x00);
+        DGL_EXPECT_uint8(window[13], ==, 0x00);
+
+        // NOTE(dgl): without a gap there is one range after the received slices
+        dgl_memset(mask, 0xFF, 4);
+        dgl_memset(mask + 4, 0x00, array_count(mask) - 4);
+        ranges_size = ack_ranges_encode(mask, array_count(mask), 0, NET_WINDOW_SIZE, ranges, array_count(ranges));
+        DGL_EXPECT_usize(ranges_size, ==, sizeof(uint32));
+        DGL_EXPECT_bool32(ack_ranges_decode(ranges, ranges_size, NET_WINDOW_SIZE, window, array_count(window)), ==, true);
+        DGL_EXPECT_uint8(window[3], ==, 0xFF);
+        DGL_EXPECT_uint8(window[4], ==, 0x00);
+
+        // NOTE(dgl): payloads which are too short for their ranges are invalid
+        DGL_EXPECT_bool32(ack_ranges_decode(ranges, 0, NET_WINDOW_SIZE, window, array_count(window)), ==, false);
+        uint32 truncated = NET_ACK_MAX_RANGES;
+        DGL_EXPECT_bool32(ack_ranges_decode(cast(uint8 *)&truncated, sizeof(truncated), NET_WINDOW_SIZE, window, array_count(window)), ==, false);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Data responses are compressed for peers which support the codec");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[2] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        // NOTE(dgl): the client announces its codecs in the challenge packet
+        Packet challenge = default_packet(Packet_Type_Challenge);
+        challenge.challenge.codecs = NET_SUPPORTED_CODECS;
+        uint8 memory[NET_MTU_SIZE] = {};
+        Bitstream writer = stream_writer_init(memory, array_count(memory));
+        serialize_packet(&writer, &challenge);
+        Packet received_challenge = {};
+        Bitstream reader = stream_reader_init(memory, array_count(memory));
+        serialize_packet(&reader, &received_challenge);
+        DGL_EXPECT_uint32(received_challenge.challenge.codecs, ==, NET_SUPPORTED_CODECS);
+        server->conns->codecs[ids[0]] = received_challenge.challenge.codecs;
+
+        char *line = "How great thou art, how great thou art\n";
+        usize line_size = strlen(line);
+        uint8 payload[20000] = {};
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)line[index % line_size]; }
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        net_send_message(server, ids[0], message);
+        net_send_message(server, ids[1], message);
+        Net_Chunk *compressed = server->conns->chunk[ids[0]];
+        Net_Chunk *raw = server->conns->chunk[ids[1]];
+        DGL_EXPECT_uint32(compressed->info.codec, ==, Net_Codec_LZ);
+        DGL_EXPECT_uint32(compressed->info.raw_size, ==, array_count(payload));
+        DGL_EXPECT_uint32(compressed->info.slice_count, <, raw->info.slice_count);
+        DGL_EXPECT_uint32(compressed->info.hash, !=, raw->info.hash);
+        DGL_EXPECT_uint32(raw->info.codec, ==, Net_Codec_None);
+
+        // NOTE(dgl): the compressed payload is cached by the payload hash. A prepared chunk
+        // is returned without using the cache.
+        uint64 use_counter = server->compress_cache->use_counter;
+        DGL_EXPECT_ptr(net_prepare_chunk(server, message, Net_Codec_LZ), ==, compressed);
+        DGL_EXPECT_uint64(server->compress_cache->use_counter, ==, use_counter);
+        uint32 fec_group_size = server->fec_group_size;
+        server->fec_group_size = NET_FEC_MIN_GROUP_SIZE;
+        Net_Chunk *other_fec = net_prepare_chunk(server, message, Net_Codec_LZ);
+        server->fec_group_size = fec_group_size;
+        DGL_EXPECT_uint32(other_fec->info.hash, ==, compressed->info.hash);
+        DGL_EXPECT_uint64(server->compress_cache->use_counter, ==, use_counter + 1);
+        DGL_EXPECT_usize(server->compress_cache->payloads[0].size, >, 0);
+        DGL_EXPECT_usize(server->compress_cache->payloads[1].size, ==, 0);
+        DGL_EXPECT_int32(server->compress_cache->payloads[0].ref_count, ==, 0);
+
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        test_inbox = {};
+        test_inbox_push(&compressed->header, server_address, 0x42);
+        for(uint32 slice_index = 0; slice_index < compressed->info.slice_count; ++slice_index)
+        {
+            test_inbox_push(compressed->slices + slice_index, server_address, 0x42);
+        }
+
+        Net_Message received = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &received), ==, id);
+        DGL_EXPECT_usize(received.payload_size, ==, array_count(payload));
+        DGL_EXPECT_ptr(received.payload, ==, client->chunk_buffer);
+        DGL_EXPECT_int32(memcmp(received.payload, payload, array_count(payload)), ==, 0);
+
+        // NOTE(dgl): the complete chunk is acked and resent slices do not return the message again
+        Packet ack = {};
+        Bitstream ack_reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&ack_reader, &ack);
+        DGL_EXPECT_uint32(ack.type, ==, Packet_Type_Ack);
+        DGL_EXPECT_uint32(ack.ack.base, ==, compressed->info.slice_count);
+
+        test_inbox = {};
+        test_inbox_push(compressed->slices + 0, server_address, 0x42);
+        sent_datagrams = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &received), ==, -1);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Hash requests carry the hash of the client content");
+    {
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        uint32 content_hash = 0xC0FFEE;
+        Net_Message message = {};
+        message.type = Net_Message_Hash_Req;
+        message.payload = cast(uint8 *)&content_hash;
+        message.payload_size = sizeof(content_hash);
+
+        sent_datagrams = {};
+        net_send_message(client, id, message);
+
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        usize header_size = serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Payload);
+        DGL_EXPECT_uint32(packet.msg_type, ==, Net_Message_Hash_Req);
+        DGL_EXPECT_usize(sent_datagrams.last.offset - header_size, ==, sizeof(content_hash));
+        DGL_EXPECT_uint32(*cast(uint32 *)(sent_datagrams.last.data + header_size), ==, content_hash);
+
+        // NOTE(dgl): requests without payload stay empty
+        message.payload = 0;
+        message.payload_size = 0;
+        net_send_message(client, id, message);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Empty);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The server sends the beacon once to the group and directly to the other connections");
+    {
+        test_time_ms = 1000.0;
+        Net_Context *ctx = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[3] = {};
+        connect_test_clients(ctx, ids, array_count(ids));
+
+        ctx->multicast.enabled = true;
+        ctx->multicast.group = parse_address("239.192.0.88", 8889);
+        ctx->multicast.salt = 0xABCD;
+        ctx->multicast.socket.handle.no_error = true;
+        ctx->conns->group_joined[ids[0]] = true;
+        ctx->conns->group_joined[ids[1]] = true;
+
+        // NOTE(dgl): a changed hash is sent right away
+        sent_datagrams = {};
+        net_update_clock(ctx);
+        net_set_beacon(ctx, 0xBEAC);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 1);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        usize header_size = serialize_packet(&reader, &packet);
+        DGL_EXPECT_usize(header_size, ==, sent_datagrams.last.offset);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Beacon);
+        DGL_EXPECT_uint32(packet.beacon.hash, ==, 0xBEAC);
+        DGL_EXPECT_uint32(packet.beacon.seq, ==, 1);
+        // NOTE(dgl): the group beacon is sent last, signed with the group salt
+        DGL_EXPECT_uint32(packet.session, ==, net_session(0xABCD));
+        DGL_EXPECT_uint32(sent_datagrams.last_address.port, ==, 8889);
+
+        // NOTE(dgl): the same hash is only announced with the next beacon
+        net_set_beacon(ctx, 0xBEAC);
+        test_time_ms += NET_BEACON_INTERVAL_MS - NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+
+        test_time_ms += NET_TIMER_TICK_MS;
+        net_process_timers(ctx);
+        DGL_EXPECT_int32(sent_datagrams.group_count, ==, 2);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 4);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.beacon.seq, ==, 2);
+
+        test_time_ms = 0.0;
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Clients return the newer beacons and drop the older ones");
+    {
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        Packet beacon = default_packet(Packet_Type_Beacon);
+        beacon.msg_type = Net_Message_Beacon;
+        beacon.beacon.hash = 0xBEAC;
+        beacon.beacon.seq = 7;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, beacon);
+        test_inbox = {};
+        test_inbox_push(&buffer, server_address, 0x42);
+
+        beacon.beacon.hash = 0xDEAD;
+        beacon.beacon.seq = 6;
+        packet_buffer_write(&buffer, beacon);
+        test_inbox_push(&buffer, server_address, 0x42);
+
+        beacon.beacon.seq = 8;
+        packet_buffer_write(&buffer, beacon);
+        test_inbox_push(&buffer, server_address, 0x42);
+
+        Net_Message message = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, id);
+        DGL_EXPECT_uint32(message.type, ==, Net_Message_Beacon);
+        DGL_EXPECT_usize(message.payload_size, ==, sizeof(uint32));
+        DGL_EXPECT_uint32(*cast(uint32 *)message.payload, ==, 0xBEAC);
+
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, id);
+        DGL_EXPECT_uint32(*cast(uint32 *)message.payload, ==, 0xDEAD);
+        DGL_EXPECT_uint32(client->beacon.seq, ==, 8);
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), <, 0);
+
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Clients drop the beacons while they receive a chunk, unless the chunk stalled");
+    {
+        test_time_ms = 1000.0;
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        uint8 payload[2500] = {};
+        Net_Message data = {};
+        data.type = Net_Message_Data_Res;
+        data.payload = payload;
+        data.payload_size = array_count(payload);
+        Net_Chunk *chunk = net_prepare_chunk(server, data, Net_Codec_None);
+
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        Packet beacon = default_packet(Packet_Type_Beacon);
+        beacon.msg_type = Net_Message_Beacon;
+        beacon.beacon.hash = 0xBEAC;
+        beacon.beacon.seq = 1;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, beacon);
+
+        // NOTE(dgl): the server queues the beacon after the content
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        test_inbox_push(chunk->slices + 0, server_address, 0x42);
+        test_inbox_push(&buffer, server_address, 0x42);
+        Net_Message message = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), <, 0);
+        DGL_EXPECT_uint32(client->received_count, ==, 1);
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), <, 0);
+        DGL_EXPECT_uint32(client->beacon.seq, ==, 1);
+
+        // NOTE(dgl): the chunk did not get a slice for one beacon interval
+        test_time_ms += NET_BEACON_INTERVAL_MS;
+        beacon.beacon.seq = 2;
+        packet_buffer_write(&buffer, beacon);
+        test_inbox = {};
+        test_inbox_push(&buffer, server_address, 0x42);
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, id);
+        DGL_EXPECT_uint32(message.type, ==, Net_Message_Beacon);
+        DGL_EXPECT_uint32(*cast(uint32 *)message.payload, ==, 0xBEAC);
+
+        test_time_ms = 0.0;
+        test_inbox = {};
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The messages of one receive batch are returned one per call");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[3] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        test_inbox = {};
+        for(int32 index = 0; index < array_count(ids); ++index)
+        {
+            Packet request = default_packet(Packet_Type_Empty);
+            request.msg_type = Net_Message_Data_Req;
+            request.message.seq = 1;
+            Packet_Buffer buffer = {};
+            packet_buffer_write(&buffer, request);
+            test_inbox_push(&buffer, server->conns->address[ids[index]], 0x1000 + cast(uint64)index);
+        }
+
+        Net_Message message = {};
+        for(int32 index = 0; index < array_count(ids); ++index)
+        {
+            DGL_EXPECT_int32(net_recv_message(&arena, server, &message), ==, ids[index]);
+            DGL_EXPECT_uint32(message.type, ==, Net_Message_Data_Req);
+        }
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &message), ==, -1);
+
+        // NOTE(dgl): a hash response after the last slice of a chunk is returned after the chunk
+        uint8 payload[3000] = {};
+        message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+        net_send_message(server, ids[0], message);
+        Net_Chunk *chunk = server->conns->chunk[ids[0]];
+
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        uint32 file_hash = 0xC0FFEE;
+        Packet response = default_packet(Packet_Type_Payload);
+        response.msg_type = Net_Message_Hash_Res;
+        response.message.seq = 1;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, response);
+        packet_buffer_append(&buffer, cast(uint8 *)&file_hash, sizeof(file_hash));
+
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        for(uint32 slice_index = 0; slice_index < chunk->info.slice_count; ++slice_index)
+        {
+            test_inbox_push(chunk->slices + slice_index, server_address, 0x42);
+        }
+        test_inbox_push(&buffer, server_address, 0x42);
+
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, id);
+        DGL_EXPECT_uint32(message.type, ==, Net_Message_Data_Res);
+        DGL_EXPECT_usize(message.payload_size, ==, array_count(payload));
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, id);
+        DGL_EXPECT_uint32(message.type, ==, Net_Message_Hash_Res);
+        DGL_EXPECT_uint32(*cast(uint32 *)message.payload, ==, file_hash);
+        DGL_EXPECT_int32(net_recv_message(&arena, client, &message), ==, -1);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Serializes group packet");
+    {
+        Packet packet1 = default_packet(Packet_Type_Group);
+        packet1.group.host = parse_address("239.192.0.88", 8889).host;
+        packet1.group.port = 8889;
+        packet1.group.salt = 0x1122334455667788;
+
+        uint8 memory[NET_MTU_SIZE] = {};
+        Bitstream writer = stream_writer_init(memory, array_count(memory));
+        serialize_packet(&writer, &packet1);
+
+        Packet packet2 = {};
+        Bitstream reader = stream_reader_init(memory, array_count(memory));
+        serialize_packet(&reader, &packet2);
+        DGL_EXPECT_uint32(packet2.type, ==, Packet_Type_Group);
+        DGL_EXPECT_uint32(packet2.group.host, ==, packet1.group.host);
+        DGL_EXPECT_uint32(packet2.group.port, ==, packet1.group.port);
+        DGL_EXPECT_uint64(packet2.group.salt, ==, packet1.group.salt);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Timers of all wheel levels expire at their tick and cancelled timers never expire");
+    {
+        DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(&arena);
+        Net_Timer_Wheel wheel = {};
+        timer_wheel_init(temp.arena, &wheel, 4, 0);
+
+        timer_schedule(&wheel, 0, 5*NET_TIMER_TICK_MS);
+        timer_schedule(&wheel, 1, 500*NET_TIMER_TICK_MS); /* level 1 */
+        timer_schedule(&wheel, 2, 100000*NET_TIMER_TICK_MS); /* level 2 */
+        timer_schedule(&wheel, 3, 300*NET_TIMER_TICK_MS);
+        timer_unlink(&wheel, 3);
+        DGL_EXPECT_bool32(timer_scheduled(&wheel, 3), ==, false);
+
+        uint64 expected_ticks[] = {5, 500, 100000};
+        for(int32 id = 0; id < array_count(expected_ticks); ++id)
+        {
+            timer_wheel_advance(&wheel, expected_ticks[id] - 1);
+            DGL_EXPECT_int32(timer_pop_expired(&wheel), ==, -1);
+            timer_wheel_advance(&wheel, expected_ticks[id]);
+            DGL_EXPECT_int32(timer_pop_expired(&wheel), ==, id);
+            DGL_EXPECT_int32(timer_pop_expired(&wheel), ==, -1);
+        }
+
+        // NOTE(dgl): rescheduling moves the timer
+        timer_schedule(&wheel, 0, 10*NET_TIMER_TICK_MS);
+        timer_schedule(&wheel, 0, 100*NET_TIMER_TICK_MS);
+        timer_wheel_advance(&wheel, wheel.tick + 50);
+        DGL_EXPECT_int32(timer_pop_expired(&wheel), ==, -1);
+        timer_wheel_advance(&wheel, wheel.tick + 50);
+        DGL_EXPECT_int32(timer_pop_expired(&wheel), ==, 0);
+
+        dgl_mem_arena_end_temp(temp);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Silent connections are disconnected when their idle timer expires");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[2] = {};
+        connect_test_clients(server, ids, array_count(ids));
+        real64 start_ms = test_time_ms;
+
+        // NOTE(dgl): the first connection sends a packet in the middle of the timeout
+        test_time_ms = start_ms + NET_CONN_TIMEOUT / 2;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, default_packet(Packet_Type_Empty));
+        test_inbox = {};
+        test_inbox_push(&buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        Net_Message received = {};
+        net_recv_message(&arena, server, &received);
+        net_process_timers(server);
+
+        test_time_ms = start_ms + NET_CONN_TIMEOUT - NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(server->conns->state[ids[1]], ==, Net_Conn_State_Connected);
+
+        test_time_ms = start_ms + NET_CONN_TIMEOUT + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(server->conns->state[ids[0]], ==, Net_Conn_State_Connected);
+        DGL_EXPECT_int32(server->conns->state[ids[1]], ==, Net_Conn_State_Disconnected);
+
+        test_time_ms = start_ms + NET_CONN_TIMEOUT*1.5 + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(server->conns->state[ids[0]], ==, Net_Conn_State_Disconnected);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The first missing slice is retransmitted if the peer does not ack the window");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        uint8 payload[5000];
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)index; }
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+        net_send_message(server, ids[0], message);
+        net_process_timers(server);
+        Net_Chunk *chunk = server->conns->chunk[ids[0]];
+
+        // NOTE(dgl): the chunk packet and the first slice are resent, because nothing was acked
+        sent_datagrams = {};
+        test_time_ms += rtt_timeout(server->conns->rtt + ids[0]) + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Slice);
+        DGL_EXPECT_uint32(packet.slice.index, ==, 0);
+
+        Packet ack = default_packet(Packet_Type_Ack);
+        ack.ack.hash = chunk->info.hash;
+        ack.ack.base = 2;
+        uint8 window[1] = {};
+        Packet_Buffer ack_buffer = {};
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        Net_Message received = {};
+        net_recv_message(&arena, server, &received);
+
+        sent_datagrams = {};
+        test_time_ms += rtt_timeout(server->conns->rtt + ids[0]) + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.slice.index, ==, 2);
+
+        // NOTE(dgl): the timer stops when the whole chunk is acked
+        ack.ack.base = chunk->info.slice_count;
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        net_recv_message(&arena, server, &received);
+
+        sent_datagrams = {};
+        test_time_ms += rtt_timeout(server->conns->rtt + ids[0]) + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Echoed timestamps are round trip samples for the retransmission timeout");
+    {
+        Net_Rtt rtt = {};
+        rtt_reset(&rtt);
+        DGL_EXPECT(rtt_timeout(&rtt), ==, NET_INITIAL_RTO_MS, real32, "%f");
+
+        rtt_add_sample(&rtt, 100.0f);
+        DGL_EXPECT(rtt.srtt, ==, 100.0f, real32, "%f");
+        DGL_EXPECT(rtt.rto, ==, 300.0f, real32, "%f");
+        rtt_add_sample(&rtt, 100.0f);
+        DGL_EXPECT(rtt.rto, ==, 250.0f, real32, "%f");
+
+        // NOTE(dgl): a fast lan has the minimum timeout
+        for(int32 index = 0; index < 64; ++index) { rtt_add_sample(&rtt, 1.0f); }
+        DGL_EXPECT(rtt.rto, ==, NET_MIN_RTO_MS, real32, "%f");
+
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        // NOTE(dgl): the peer echoes the timestamp of our packet 40 ms later
+        test_time_ms += 1000.0;
+        net_process_timers(server);
+        Net_Message message = {};
+        message.type = Net_Message_Hash_Req;
+        sent_datagrams = {};
+        net_send_message(server, ids[0], message);
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.timestamp, ==, cast(uint32)test_time_ms);
+        DGL_EXPECT_uint32(packet.echo, ==, 0);
+
+        test_time_ms += 40.0;
+        Packet reply = default_packet(Packet_Type_Empty);
+        reply.timestamp = 777;
+        reply.echo = packet.timestamp;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, reply);
+        test_inbox = {};
+        test_inbox_push(&buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        Net_Message received = {};
+        net_recv_message(&arena, server, &received);
+
+        Net_Rtt *conn_rtt = server->conns->rtt + ids[0];
+        DGL_EXPECT_uint32(conn_rtt->sample_count, ==, 1);
+        DGL_EXPECT(conn_rtt->srtt, ==, 40.0f, real32, "%f");
+
+        // NOTE(dgl): the timestamp of the peer is echoed once
+        net_send_message(server, ids[0], message);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.echo, ==, 777);
+        net_send_message(server, ids[0], message);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.echo, ==, 0);
+
+        // NOTE(dgl): each resend without reply doubles the timeout
+        real32 timeout = rtt_timeout(conn_rtt);
+        conn_timer_backoff(server->conns, ids[0], Net_Timer_Kind_Retransmit);
+        DGL_EXPECT(rtt_timeout(conn_rtt), ==, 2.0f*timeout, real32, "%f");
+        for(int32 index = 0; index < 2*NET_MAX_RTO_BACKOFF; ++index)
+        {
+            conn_timer_backoff(server->conns, ids[0], Net_Timer_Kind_Retransmit);
+        }
+        DGL_EXPECT_uint32(conn_rtt->backoff, ==, NET_MAX_RTO_BACKOFF);
+        DGL_EXPECT(rtt_timeout(conn_rtt), <=, NET_MAX_RTO_MS, real32, "%f");
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Received message sequences are tracked in the ack bits");
+    {
+        Net_Reliable reliable = {};
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 5), ==, true);
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 5), ==, false);
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 7), ==, true);
+        DGL_EXPECT_uint32(reliable.remote_seq, ==, 7);
+        DGL_EXPECT(reliable.received, ==, 0x2, uint32, "0x%X");
+
+        // NOTE(dgl): older sequences arrive out of order
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 6), ==, true);
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 6), ==, false);
+        DGL_EXPECT(reliable.received, ==, 0x3, uint32, "0x%X");
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 7 - NET_MESSAGE_ACK_BITS - 1), ==, false);
+
+        // NOTE(dgl): the sequences wrap around and skip 0
+        reliable = {};
+        reliable.next_seq = 0xFFFF;
+        DGL_EXPECT_uint32(reliable_next_seq(&reliable), ==, 1);
+        DGL_EXPECT_bool32(sequence_greater(1, 0xFFFF), ==, true);
+        DGL_EXPECT_bool32(sequence_greater(0xFFFF, 1), ==, false);
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 0xFFFF), ==, true);
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 1), ==, true);
+        DGL_EXPECT(reliable.received, ==, 0x2, uint32, "0x%X");
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 0xFFFF), ==, false);
+
+        // NOTE(dgl): a jump larger than the ack bits forgets the older sequences
+        DGL_EXPECT_bool32(reliable_receive_seq(&reliable, 1 + NET_MESSAGE_ACK_BITS + 1), ==, true);
+        DGL_EXPECT(reliable.received, ==, 0, uint32, "0x%X");
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Messages are resent until the peer acks them");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+        Connection_List *conns = server->conns;
+        Net_Packet_Ring *ring = conns->outbound + ids[0];
+
+        uint32 file_hash = 0xC0FFEE;
+        Net_Message message = {};
+        message.type = Net_Message_Hash_Res;
+        message.payload = cast(uint8 *)&file_hash;
+        message.payload_size = sizeof(file_hash);
+        sent_datagrams = {};
+        net_send_message(server, ids[0], message);
+        net_send_message(server, ids[0], message);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 2);
+
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.message.seq, ==, 2);
+        DGL_EXPECT_uint32(packet.message.ack, ==, 0);
+
+        // NOTE(dgl): both messages are resent after the timeout
+        test_time_ms += NET_INITIAL_RTO_MS + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 4);
+        DGL_EXPECT_uint64(server->stats.datagrams_resent, ==, 2);
+
+        // NOTE(dgl): the peer received the second message and piggybacks the ack on its request
+        Packet request = default_packet(Packet_Type_Empty);
+        request.msg_type = Net_Message_Data_Req;
+        request.message.seq = 1;
+        request.message.ack = 2;
+        request.message.ack_bits = 0;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, request);
+        test_inbox = {};
+        test_inbox_push(&buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+        Net_Message received = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &received), ==, ids[0]);
+        DGL_EXPECT_uint32(received.type, ==, Net_Message_Data_Req);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 1);
+        DGL_EXPECT_uint32(ring->entries[ring->read % NET_PACKET_RING_SIZE].message_seq, ==, 1);
+
+        // NOTE(dgl): only the first message is resent, with the ack of the request
+        sent_datagrams = {};
+        test_time_ms += 2.0*NET_INITIAL_RTO_MS + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.message.seq, ==, 1);
+        DGL_EXPECT_uint32(packet.message.ack, ==, 1);
+
+        // NOTE(dgl): an ack only message acks the first message
+        Packet ack = default_packet(Packet_Type_Empty);
+        ack.message.ack = 2;
+        ack.message.ack_bits = 0x1;
+        packet_buffer_write(&buffer, ack);
+        test_inbox = {};
+        test_inbox_push(&buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &received), ==, -1);
+        DGL_EXPECT_uint32(ring->write - ring->read, ==, 0);
+        DGL_EXPECT_bool32(conn_timer_scheduled(conns, ids[0], Net_Timer_Kind_Message), ==, false);
+
+        sent_datagrams = {};
+        test_time_ms += 8.0*NET_INITIAL_RTO_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 0);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Duplicate messages are dropped and acked after a delay");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+        Connection_List *conns = server->conns;
+
+        Packet request = default_packet(Packet_Type_Empty);
+        request.msg_type = Net_Message_Data_Req;
+        request.message.seq = 1;
+        Packet_Buffer buffer = {};
+        packet_buffer_write(&buffer, request);
+        test_inbox = {};
+        test_inbox_push(&buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+        test_inbox_push(&buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+
+        Net_Message received = {};
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &received), ==, ids[0]);
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &received), ==, -1);
+        DGL_EXPECT_uint64(server->stats.messages_duplicate, ==, 1);
+
+        // NOTE(dgl): we did not reply, so an ack only message is sent
+        sent_datagrams = {};
+        test_time_ms += NET_MESSAGE_ACK_DELAY_MS + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.type, ==, Packet_Type_Empty);
+        DGL_EXPECT_uint32(packet.msg_type, ==, Net_Message_Noop);
+        DGL_EXPECT_uint32(packet.message.seq, ==, 0);
+        DGL_EXPECT_uint32(packet.message.ack, ==, 1);
+
+        // NOTE(dgl): a reply piggybacks the ack, no ack only message is needed
+        test_inbox = {};
+        request.message.seq = 2;
+        packet_buffer_write(&buffer, request);
+        test_inbox_push(&buffer, conns->address[ids[0]], conns->salt[ids[0]]);
+        DGL_EXPECT_int32(net_recv_message(&arena, server, &received), ==, ids[0]);
+        Net_Message reply = {};
+        reply.type = Net_Message_Hash_Req;
+        sent_datagrams = {};
+        net_send_message(server, ids[0], reply);
+        test_time_ms += NET_MESSAGE_ACK_DELAY_MS + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+        reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+        DGL_EXPECT_uint32(packet.message.ack, ==, 2);
+        DGL_EXPECT(packet.message.ack_bits, ==, 0x1, uint32, "0x%X");
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The congestion window and the pacing limit the slices in flight");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload_size = kilobytes(256);
+        message.payload = dgl_mem_arena_push_array(&arena, uint8, message.payload_size);
+        for(usize index = 0; index < message.payload_size; ++index) { message.payload[index] = cast(uint8)(index * 13); }
+
+        // NOTE(dgl): without a round trip sample only the initial window is sent
+        sent_datagrams = {};
+        net_send_message(server, ids[0], message);
+        net_process_timers(server);
+        Net_Chunk *chunk = server->conns->chunk[ids[0]];
+        Net_Congestion *cc = server->conns->congestion + ids[0];
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1 + cast(int32)NET_INITIAL_CWND);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, cast(uint32)NET_INITIAL_CWND);
+
+        // NOTE(dgl): the acked slices grow the window in slow start. The new slices are
+        // paced with the round trip of the echoed timestamp.
+        Packet packet = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &packet);
+
+        test_time_ms += 100.0;
+        Packet ack = default_packet(Packet_Type_Ack);
+        ack.timestamp = 1;
+        ack.echo = packet.timestamp;
+        ack.ack.hash = chunk->info.hash;
+        ack.ack.base = 8;
+        uint8 window[2] = {0xFF, 0x00};
+        Packet_Buffer ack_buffer = {};
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        sent_datagrams = {};
+        Net_Message received = {};
+        net_recv_message(&arena, server, &received);
+        net_process_timers(server);
+        DGL_EXPECT_uint32(server->conns->rtt[ids[0]].sample_count, ==, 1);
+        DGL_EXPECT_uint32(cc->acked, ==, 16);
+        DGL_EXPECT_real32(cc->cwnd, ==, NET_INITIAL_CWND + 16.0f);
+
+        // NOTE(dgl): the bucket holds less than the free window. The pacing timer sends the rest.
+        uint32 paced_next = server->conns->window_next[ids[0]];
+        DGL_EXPECT_uint32(paced_next, >, 16);
+        DGL_EXPECT_uint32(paced_next, <, 16 + cast(uint32)cc->cwnd);
+        DGL_EXPECT_bool32(timer_scheduled(server->conns->timers, ids[0]*Net_Timer_Kind_Count + Net_Timer_Kind_Pacing), ==, true);
+
+        for(int32 tick = 0; tick < 20; ++tick)
+        {
+            test_time_ms += NET_TIMER_TICK_MS;
+            net_process_timers(server);
+        }
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, 16 + cast(uint32)cc->cwnd);
+
+        // NOTE(dgl): slice 16 is lost without a queue at the bottleneck. The random loss is repaired
+        // without shrinking the window.
+        ack.echo = 0;
+        ack.ack.base = 16;
+        window[0] = 0xFE;
+        window[1] = 0xFF;
+        packet_buffer_write(&ack_buffer, ack);
+        test_append_ack_window(&ack_buffer, window, array_count(window));
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        real32 cwnd_before_loss = cc->cwnd + 15.0f;
+        net_recv_message(&arena, server, &received);
+        DGL_EXPECT_real32(cc->cwnd, ==, cwnd_before_loss);
+
+        // NOTE(dgl): the round trip grew by 60 ms, the loss is caused by the queue and halves the window
+        Net_Rtt *rtt = server->conns->rtt + ids[0];
+        for(int32 index = 0; index < NET_RTT_RECENT_COUNT; ++index) { rtt_add_sample(rtt, 160.0f); }
+        test_time_ms += 200.0;
+        net_process_timers(server);
+        test_inbox = {};
+        test_inbox_push(&ack_buffer, server->conns->address[ids[0]], server->conns->salt[ids[0]]);
+        net_recv_message(&arena, server, &received);
+        DGL_EXPECT_real32(cc->cwnd, ==, cwnd_before_loss / 2.0f);
+        DGL_EXPECT_real32(cc->ssthresh, ==, cc->cwnd);
+
+        // NOTE(dgl): a retransmission timeout resets the window to the minimum
+        test_time_ms += rtt_timeout(server->conns->rtt + ids[0]) + NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_real32(cc->cwnd, ==, NET_MIN_CWND);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The send scheduler interleaves the slices of all connections within the budget");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        server->fec_group_size = 0;
+        server->congestion_control = false;
+        server->send_budget_per_tick = 2*NET_SEND_QUANTUM;
+        server->scheduler.budget = server->send_budget_per_tick;
+        Net_Conn_ID ids[3] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload_size = kilobytes(60);
+        message.payload = dgl_mem_arena_push_array(&arena, uint8, message.payload_size);
+
+        // NOTE(dgl): all clients requested the data in the same frame. Only the chunk packets
+        // are sent, before the scheduler runs.
+        sent_datagrams = {};
+        for(int32 index = 0; index < array_count(ids); ++index) { net_send_message(server, ids[index], message); }
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 3);
+        DGL_EXPECT_usize(server->scheduler.budget, ==, 2*NET_SEND_QUANTUM - sent_datagrams.bytes);
+
+        // NOTE(dgl): each connection sends one quantum per round until the budget is used up
+        server->scheduler.budget = server->send_budget_per_tick;
+        net_process_timers(server);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, 4);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[1]], ==, 4);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[2]], ==, 0);
+        DGL_EXPECT_usize(server->scheduler.budget, ==, 0);
+
+        // NOTE(dgl): control packets are sent even without budget
+        Net_Message hash = {};
+        hash.type = Net_Message_Hash_Req;
+        sent_datagrams = {};
+        net_send_message(server, ids[2], hash);
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 1);
+
+        // NOTE(dgl): the next tick continues with the connection which did not get its turn
+        test_time_ms += NET_TIMER_TICK_MS;
+        net_process_timers(server);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[0]], ==, 8);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[1]], ==, 4);
+        DGL_EXPECT_uint32(server->conns->window_next[ids[2]], ==, 4);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Connections are found by address after colliding connections are removed");
+    {
+        DGL_Mem_Temp_Arena temp = dgl_mem_arena_begin_temp(&arena);
+        Net_Context *ctx = dgl_mem_arena_push_struct(temp.arena, Net_Context);
+        Connection_List *conns = push_connection_list(temp.arena, ctx, 4);
+        DGL_EXPECT_int32(conns->lookup_count, ==, 8);
+
+        // NOTE(dgl): find three addresses with the same home slot
+        uint32 mask = cast(uint32)conns->lookup_count - 1;
+        Zhc_Net_Address addresses[3] = {};
+        int32 found = 0;
+        for(uint16 port = 9000; found < array_count(addresses); ++port)
+        {
+            Zhc_Net_Address address = parse_address("127.0.0.1", port);
+            if(found == 0 || (address_hash(address) & mask) == (address_hash(addresses[0]) & mask))
+            {
+                addresses[found++] = address;
+            }
+        }
+
+        Net_Conn_ID ids[3] = {};
+        for(int32 index = 0; index < array_count(ids); ++index)
+        {
+            ids[index] = push_connection(conns, addresses[index], 0x1000 + cast(uint64)index);
+            DGL_EXPECT_int32(ids[index], ==, index);
+            DGL_EXPECT_int32(get_connection(conns, addresses[index]), ==, index);
+        }
+
+        conn_disconnect(conns, ids[0]);
+        DGL_EXPECT_int32(get_connection(conns, addresses[0]), ==, -1);
+        DGL_EXPECT_int32(get_connection(conns, addresses[1]), ==, ids[1]);
+        DGL_EXPECT_int32(get_connection(conns, addresses[2]), ==, ids[2]);
+
+        // NOTE(dgl): disconnecting twice does not add the connection to the free list again
+        conn_disconnect(conns, ids[0]);
+        DGL_EXPECT_int32(conns->free_count, ==, 2);
+
+        // NOTE(dgl): the disconnected slot is reused first
+        Zhc_Net_Address other = parse_address("127.0.0.2", 9000);
+        DGL_EXPECT_int32(push_connection(conns, other, 0x2000), ==, ids[0]);
+        DGL_EXPECT_int32(push_connection(conns, other, 0x2001), ==, ids[0]);
+        DGL_EXPECT_int32(get_connection(conns, other), ==, ids[0]);
+
+        // NOTE(dgl): if the list is full, a connecting connection is replaced
+        Zhc_Net_Address last = parse_address("127.0.0.3", 9000);
+        Net_Conn_ID last_id = push_connection(conns, last, 0x3000);
+        DGL_EXPECT_int32(last_id, ==, 3);
+        for(int32 index = 0; index < conns->max_count; ++index) { conns->state[index] = Net_Conn_State_Connected; }
+        conns->state[ids[1]] = Net_Conn_State_Connecting;
+
+        Zhc_Net_Address late = parse_address("127.0.0.4", 9000);
+        DGL_EXPECT_int32(push_connection(conns, late, 0x4000), ==, ids[1]);
+        DGL_EXPECT_int32(get_connection(conns, addresses[1]), ==, -1);
+        DGL_EXPECT_int32(get_connection(conns, addresses[2]), ==, ids[2]);
+        DGL_EXPECT_int32(get_connection(conns, late), ==, ids[1]);
+
+        // NOTE(dgl): if all connections are established, there is no free connection (from any start index)
+        for(int32 index = 0; index < conns->max_count; ++index) { conns->state[index] = Net_Conn_State_Connected; }
+        for(int32 index = 0; index < conns->max_count; ++index)
+        {
+            conns->index = index;
+            DGL_EXPECT_int32(get_free_conn(conns), ==, -1);
+        }
+
+        dgl_mem_arena_end_temp(temp);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("Queue entries wrap around the end of the ring and the queue reports when it is full");
+    {
+        Net_Queue queue = {};
+        net_queue_init(&arena, &queue, 256);
+
+        uint8 payload[60] = {};
+        Net_Message message = {};
+        message.type = Net_Message_Hash_Req;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+
+        usize entry_size = net_queue_entry_size(array_count(payload));
+        DGL_EXPECT_usize(entry_size % NET_QUEUE_ALIGNMENT, ==, 0);
+        for(int32 index = 0; index < 2; ++index)
+        {
+            payload[0] = cast(uint8)index;
+            DGL_EXPECT_bool32(net_queue_push(&queue, Net_Queue_Entry_Send, index, message), ==, true);
+        }
+        DGL_EXPECT_bool32(net_queue_push(&queue, Net_Queue_Entry_Send, 2, message), ==, false);
+
+        Net_Queue_Entry *entry = net_queue_peek(&queue);
+        DGL_EXPECT_int32(entry->id, ==, 0);
+        net_queue_pop(&queue, entry);
+
+        // NOTE(dgl): the entry does not fit before the end. The rest of the ring is skipped.
+        payload[0] = 2;
+        DGL_EXPECT_bool32(net_queue_push(&queue, Net_Queue_Entry_Send, 2, message), ==, true);
+        DGL_EXPECT_usize(queue.write, ==, queue.capacity + entry_size);
+
+        for(int32 index = 1; index < 3; ++index)
+        {
+            entry = net_queue_peek(&queue);
+            DGL_EXPECT_int32(entry->id, ==, index);
+            DGL_EXPECT_uint32(entry->message.type, ==, Net_Message_Hash_Req);
+            DGL_EXPECT_usize(entry->message.payload_size, ==, array_count(payload));
+            DGL_EXPECT_uint32(entry->message.payload[0], ==, index);
+            DGL_EXPECT_ptr(entry->message.payload, ==, cast(uint8 *)(entry + 1));
+            net_queue_pop(&queue, entry);
+        }
+        DGL_EXPECT_ptr(net_queue_peek(&queue), ==, 0);
+
+        dgl_mem_arena_free_all(&arena);
+    }
+    DGL_END_TEST();
+
+    DGL_BEGIN_TEST("The net thread sends the queued commands and queues the received messages");
+    {
+        Net_Context *server = net_init_server(&arena, NET_DEFAULT_MAX_CLIENTS);
+        Net_Conn_ID ids[1] = {};
+        connect_test_clients(server, ids, array_count(ids));
+
+        uint8 payload[5000] = {};
+        for(usize index = 0; index < array_count(payload); ++index) { payload[index] = cast(uint8)(index*13); }
+        Net_Message message = {};
+        message.type = Net_Message_Data_Res;
+        message.payload = payload;
+        message.payload_size = array_count(payload);
+        net_send_message(server, ids[0], message);
+        Net_Chunk *chunk = server->conns->chunk[ids[0]];
+
+        Net_Context *client = net_init_client(&arena, ZHC_MAX_FILESIZE);
+        client->socket.handle.no_error = true;
+        Zhc_Net_Address server_address = parse_address("127.0.0.1", ZHC_SERVER_PORT);
+        Net_Conn_ID id = push_connection(client->conns, server_address, 0x42);
+        client->conns->state[id] = Net_Conn_State_Connected;
+
+        // NOTE(dgl): the thread is not started, the test steps it like the lib does each frame
+        Net_Thread *thread = net_thread_init(&arena, client, kilobytes(4), 2*array_count(payload));
+        DGL_EXPECT_bool32(thread->running, ==, false);
+
+        uint32 content_hash = 0xC0FFEE;
+        Net_Message request = {};
+        request.type = Net_Message_Hash_Req;
+        request.payload = cast(uint8 *)&content_hash;
+        request.payload_size = sizeof(content_hash);
+        DGL_EXPECT_bool32(net_thread_send_message(thread, id, request), ==, true);
+        content_hash = 0; /* NOTE(dgl): the payload is copied into the queue */
+
+        test_inbox = {};
+        test_inbox_push(&chunk->header, server_address, 0x42);
+        for(uint32 slice_index = 0; slice_index < chunk->info.slice_count; ++slice_index)
+        {
+            test_inbox_push(chunk->slices + slice_index, server_address, 0x42);
+        }
+
+        sent_datagrams = {};
+        net_thread_step(thread);
+        DGL_EXPECT_ptr(net_queue_peek(&thread->commands), ==, 0);
+
+        // NOTE(dgl): the request is sent first, then the ack of the received chunk
+        DGL_EXPECT_int32(sent_datagrams.count, ==, 2);
+        Packet ack = {};
+        Bitstream reader = stream_reader_init(sent_datagrams.last.data, sent_datagrams.last.offset);
+        serialize_packet(&reader, &ack);
+        DGL_EXPECT_uint32(ack.type, ==, Packet_Type_Ack);
+
+        Net_Queue_Entry *event = net_queue_peek(&thread->events);
+        DGL_EXPECT_ptr(event, !=, 0);
+        DGL_EXPECT_int32(event->id, ==, id);
+        DGL_EXPECT_uint32(event->message.type, ==, Net_Message_Data_Res);
+        DGL_EXPECT_usize(event->message.payload_size, ==, array_count(payload));
+        DGL_EXPECT_ptr(event->message.payload, !=, client->chunk_buffer);
+        DGL_EXPECT_int32(memcmp(event->message.payload, payload, array_count(payload)), ==, 0);
+        net_queue_pop(&thread->events, event);
+        DGL_EXPECT_ptr(net_queue_peek(&thread->events), ==, 0);
+
+        dgl_mem_arena_free_all(&arena);
     }
     DGL_END_TEST();
 
@@ -269,6 +269,10 @@ struct Zhc_Net_Socket
 {
     Zhc_Net_Address address;
     Zhc_File_Handle handle;
+    // NOTE(dgl): number of sockets sharing the port (0 = the port is not shared). The datagrams of
+    // a peer are delivered to the socket (peer port % reuse_port_count), counted in the order the
+    // sockets were opened. Broadcasts are delivered to all sockets.
+    int32 reuse_port_count;
 };
 
 // NOTE(dgl): Global api. Use separate api file later...
@@ -286,6 +290,9 @@ typedef ZHC_READ_ENTIRE_FILE(Zhc_Read_Entire_File);
 typedef ZHC_GET_USER_DATA_BASE_PATH(Zhc_Get_User_Data_Base_Path);
 #define ZHC_GET_DATA_BASE_PATH(name) bool32 name(DGL_String_Builder *builder)
 typedef ZHC_GET_DATA_BASE_PATH(Zhc_Get_Data_Base_Path);
+// NOTE(dgl): monotonic clock in milliseconds. The start is undefined.
+#define ZHC_GET_TIME_IN_MS(name) real64 name()
+typedef ZHC_GET_TIME_IN_MS(Zhc_Get_Time_In_Ms);
 #define ZHC_OPEN_SOCKET(name) void name(DGL_Mem_Arena *arena, Zhc_Net_Socket *socket)
 typedef ZHC_OPEN_SOCKET(Zhc_Open_Socket);
 #define ZHC_CLOSE_SOCKET(name) void name(Zhc_Net_Socket *socket)
@@ -298,6 +305,37 @@ typedef ZHC_RECEIVE_DATA(Zhc_Receive_Data);
 #define ZHC_SEND_DATA(name) void name(Zhc_Net_Socket *socket, Zhc_Net_Address *target_address, uint8 *buffer, usize buffer_size)
 typedef ZHC_SEND_DATA(Zhc_Send_Data);
 
+// NOTE(dgl): Batched variants of the functions above. They move many datagrams with one call
+// (one system call on linux). When sending, size is the size of the data. When receiving, data
+// points to a buffer of capacity bytes. The peer address and size of the received datagram are
+// written into the datagram. Returns the number of received datagrams.
+struct Zhc_Net_Datagram
+{
+    Zhc_Net_Address address;
+    uint8 *data;
+    usize size;
+    usize capacity;
+};
+
+#define ZHC_RECEIVE_DATA_BATCH(name) int32 name(Zhc_Net_Socket *socket, Zhc_Net_Datagram *datagrams, int32 count)
+typedef ZHC_RECEIVE_DATA_BATCH(Zhc_Receive_Data_Batch);
+#define ZHC_SEND_DATA_BATCH(name) void name(Zhc_Net_Socket *socket, Zhc_Net_Datagram *datagrams, int32 count)
+typedef ZHC_SEND_DATA_BATCH(Zhc_Send_Data_Batch);
+
+// NOTE(dgl): multicast sockets are native sockets. They must only be used with the multicast
+// send, receive and close functions. The socket address is the local interface (0 = default).
+#define ZHC_OPEN_MULTICAST_SOCKET(name) void name(Zhc_Net_Socket *socket, Zhc_Net_Address *group, bool32 join)
+typedef ZHC_OPEN_MULTICAST_SOCKET(Zhc_Open_Multicast_Socket);
+
+// NOTE(dgl): The net layer runs on its own thread, if the platform is able to start one. The thread
+// waits for datagrams on the sockets (the multicast socket may be 0) or until the timeout expires.
+#define ZHC_THREAD_PROC(name) void name(void *data)
+typedef ZHC_THREAD_PROC(Zhc_Thread_Proc);
+#define ZHC_START_THREAD(name) bool32 name(Zhc_Thread_Proc *proc, void *data, char *thread_name)
+typedef ZHC_START_THREAD(Zhc_Start_Thread);
+#define ZHC_WAIT_FOR_DATA(name) void name(Zhc_Net_Socket *socket, Zhc_Net_Socket *multicast_socket, real64 timeout_ms)
+typedef ZHC_WAIT_FOR_DATA(Zhc_Wait_For_Data);
+
 struct Zhc_Platform_Api
 {
     Zhc_Get_Directory_Filenames *get_directory_filenames;
@@ -306,10 +344,25 @@ struct Zhc_Platform_Api
     Zhc_Read_Entire_File *read_entire_file;
     Zhc_Get_User_Data_Base_Path *get_user_data_base_path;
     Zhc_Get_Data_Base_Path *get_data_base_path;
+    Zhc_Get_Time_In_Ms *get_time_in_ms;
     Zhc_Open_Socket *open_socket;
     Zhc_Close_Socket *close_socket;
     Zhc_Receive_Data *receive_data;
     Zhc_Send_Data *send_data;
+    // NOTE(dgl): optional. If the platform does not support multicast these are 0.
+    Zhc_Open_Multicast_Socket *open_multicast_socket;
+    Zhc_Close_Socket *close_multicast_socket;
+    Zhc_Receive_Data *receive_multicast_data;
+    Zhc_Send_Data *send_multicast_data;
+    // NOTE(dgl): optional. If the platform does not support batches these are 0 and the
+    // datagrams are sent and received one by one.
+    Zhc_Receive_Data_Batch *receive_data_batch;
+    Zhc_Send_Data_Batch *send_data_batch;
+    Zhc_Receive_Data_Batch *receive_multicast_data_batch;
+    Zhc_Send_Data_Batch *send_multicast_data_batch;
+    // NOTE(dgl): optional. If one of these is 0, the net layer is updated once per frame.
+    Zhc_Start_Thread *start_thread;
+    Zhc_Wait_For_Data *wait_for_data;
 };
 
 struct Zhc_Memory
@@ -320,6 +373,9 @@ struct Zhc_Memory
     void *permanent_storage; // NOTE(dgl): REQUIRED to be cleared to zero at startup
     usize transient_storage_size;
     void *transient_storage; // NOTE(dgl): REQUIRED to be cleared to zero at startup
+
+    int32 max_clients; // NOTE(dgl): server only, 0 uses NET_DEFAULT_MAX_CLIENTS
+    int32 shard_count; // NOTE(dgl): server only, net threads sharing the clients (0 runs one)
 };
 
 // NOTE(dgl): zhc_lib.cpp